@@ -0,0 +1,710 @@
+/**
+ * C++ Volume Rendering Application - Benchmark
+ *
+ * Runs a matrix of datasets through the CPU stages of the library and
+ *   reports, for each stage, the median/p95 latency, the throughput and
+ *   the peak resident set size of the process, as JSON:
+ * . read_*        : vis::VolumeReader (.raw copied and mapped, .pvm)
+ * . rtexture_data : voxel conversion of vis::GenerateRTexture
+ * . gradient_*    : vis::GradientEngine, Sobel-Feldman and central differences
+ * . bricks        : vis::VolumeBricks min/max
+ * . render_cpu    : vis::CPURayCaster frame
+ * . tf1d_build    : vis::TransferFunction1D::Build
+ *
+ * Datasets are synthetic volumes generated at each requested size
+ *   (written once as .raw files inside the work directory) and every
+ *   .raw/.pvm file found inside the data directory.
+ * Stages whose estimated memory exceeds -maxmem are reported as skipped.
+ * No window or OpenGL context is created.
+ *
+ * usage: cppvolrend_bench [options]
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#ifdef _WIN32
+  #define NOMINMAX
+  #include <windows.h>
+  #include <psapi.h>
+#else
+  #include <sys/resource.h>
+#endif
+
+#include <volvis_utils/reader.h>
+#include <volvis_utils/structuredgridvolume.h>
+#include <volvis_utils/transferfunction1d.h>
+#include <volvis_utils/cpuraycaster.h>
+#include <volvis_utils/gradientengine.h>
+#include <volvis_utils/volumebricks.h>
+#include <volvis_utils/threadpool.h>
+#include <volvis_utils/simd.h>
+#include <volvis_utils/utils.h>
+
+// Using suggestion on using MAKE_STR macro at C++ code from "naoyam"
+// . https://github.com/LLNL/lbann/issues/117
+#define MAKE_STR(x) _MAKE_STR(x)
+#define _MAKE_STR(x) #x
+
+#ifdef CMAKE_PATH_TO_DATA_FOLDER
+  #define CPPVOLREND_BENCH_DATA_DIR MAKE_STR(CMAKE_PATH_TO_DATA_FOLDER)
+#else
+  #define CPPVOLREND_BENCH_DATA_DIR "data/"
+#endif
+
+#define CPPVOLREND_BENCH_JSON_VERSION 1
+
+struct BenchParameters
+{
+  std::vector<int> synthetic_sizes = { 128, 256, 512, 1024 };
+  // bytes per voxel of the synthetic volumes, 1 or 2
+  int synthetic_bytes = 1;
+  bool use_data_folder = true;
+  std::string data_directory = CPPVOLREND_BENCH_DATA_DIR;
+  std::string work_directory = "bench_data";
+  // Empty uses the first .tf1d of the data directory
+  std::string transfer_function_path;
+
+  std::string output_path = "cppvolrend_bench.json";
+
+  int iterations = 5;
+  int render_width = 512;
+  int render_height = 512;
+  unsigned int n_threads = 0;
+
+  // Estimated memory budget of each stage
+  size_t max_memory_mb = 8192;
+
+  // Substring filter of the stage names, empty runs every stage
+  std::string stage_filter;
+};
+
+struct StageResult
+{
+  std::string name;
+  bool skipped = false;
+  std::string skip_reason;
+
+  std::vector<double> samples_ms;
+  double median_ms = 0.0;
+  double p95_ms = 0.0;
+  double min_ms = 0.0;
+
+  // items processed by each run and their unit
+  double items = 0.0;
+  std::string unit = "voxels";
+
+  size_t peak_rss_bytes = 0;
+};
+
+struct DatasetResult
+{
+  std::string name;
+  std::string path;
+  bool synthetic = false;
+  glm::ivec3 resolution = glm::ivec3(0);
+  int bytes_per_voxel = 0;
+  std::vector<StageResult> stages;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Process memory
+static size_t GetPeakRSSBytes ()
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+    return (size_t)pmc.PeakWorkingSetSize;
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  #ifdef __APPLE__
+  return (size_t)usage.ru_maxrss;
+  #else
+  return (size_t)usage.ru_maxrss * 1024;
+  #endif
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Timing
+static double Percentile (std::vector<double> sorted_samples, double p)
+{
+  if (sorted_samples.empty()) return 0.0;
+  // nearest rank
+  size_t rank = (size_t)std::ceil(p * (double)sorted_samples.size());
+  return sorted_samples[std::min(std::max(rank, (size_t)1), sorted_samples.size()) - 1];
+}
+
+static bool IsStageEnabled (const BenchParameters& prm, const std::string& name)
+{
+  return prm.stage_filter.empty() || name.find(prm.stage_filter) != std::string::npos;
+}
+
+// setup and teardown run outside the timed region of each iteration
+static StageResult RunStage (const BenchParameters& prm, std::string name, double items, std::string unit,
+                             size_t estimated_bytes,
+                             const std::function<bool()>& run,
+                             const std::function<void()>& setup = nullptr,
+                             const std::function<void()>& teardown = nullptr)
+{
+  StageResult res;
+  res.name = name;
+  res.items = items;
+  res.unit = unit;
+
+  if (estimated_bytes > prm.max_memory_mb * 1024 * 1024)
+  {
+    res.skipped = true;
+    res.skip_reason = "memory budget";
+    printf("  %-30s skipped (needs %.0lf MB)\n", name.c_str(), (double)estimated_bytes / (1024.0 * 1024.0));
+    return res;
+  }
+
+  for (int i = 0; i < prm.iterations; i++)
+  {
+    if (setup) setup();
+    auto t_init = std::chrono::steady_clock::now();
+    bool ok = run();
+    auto t_end = std::chrono::steady_clock::now();
+    if (teardown) teardown();
+
+    if (!ok)
+    {
+      res.skipped = true;
+      res.skip_reason = "failed";
+      res.samples_ms.clear();
+      printf("  %-30s failed\n", name.c_str());
+      return res;
+    }
+    res.samples_ms.push_back(std::chrono::duration<double, std::milli>(t_end - t_init).count());
+  }
+
+  std::vector<double> sorted = res.samples_ms;
+  std::sort(sorted.begin(), sorted.end());
+  res.median_ms = Percentile(sorted, 0.5);
+  res.p95_ms = Percentile(sorted, 0.95);
+  res.min_ms = sorted.front();
+  res.peak_rss_bytes = GetPeakRSSBytes();
+
+  printf("  %-30s median %10.2lf ms  p95 %10.2lf ms  %10.2lf M%s/s\n", name.c_str(), res.median_ms, res.p95_ms,
+    res.median_ms > 0.0 ? res.items / (res.median_ms * 1e-3) * 1e-6 : 0.0, res.unit.c_str());
+  return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Synthetic datasets
+//  . nested spherical shells, a solid core and a few blobs with value noise,
+//    ~75% of the voxels are air as the scanned datasets
+static float SyntheticDensity (glm::vec3 p, unsigned int hash_seed)
+{
+  float d = glm::length(p - glm::vec3(0.5f));
+  float v = 0.0f;
+
+  // shells
+  v = std::max(v, 0.45f * std::exp(-std::pow((d - 0.40f) / 0.015f, 2.0f)));
+  v = std::max(v, 0.65f * std::exp(-std::pow((d - 0.30f) / 0.010f, 2.0f)));
+  // core
+  if (d < 0.15f) v = std::max(v, 0.9f - d);
+
+  // blobs
+  const glm::vec3 blobs[4] = {
+    glm::vec3(0.30f, 0.45f, 0.55f), glm::vec3(0.65f, 0.35f, 0.50f),
+    glm::vec3(0.50f, 0.70f, 0.40f), glm::vec3(0.55f, 0.55f, 0.72f)
+  };
+  for (int i = 0; i < 4; i++)
+  {
+    float db = glm::length(p - blobs[i]);
+    if (db < 0.08f) v = std::max(v, 0.3f + 0.2f * (float)i * (1.0f - db / 0.08f));
+  }
+
+  // value noise inside the object
+  if (v > 0.01f)
+  {
+    unsigned int h = hash_seed;
+    h ^= (unsigned int)(p.x * 4096.0f) * 73856093u;
+    h ^= (unsigned int)(p.y * 4096.0f) * 19349663u;
+    h ^= (unsigned int)(p.z * 4096.0f) * 83492791u;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    v += 0.05f * ((float)(h & 0xFFFF) / 65535.0f - 0.5f);
+  }
+
+  return glm::clamp(v, 0.0f, 1.0f);
+}
+
+// Writes name.<bytes>.<n>x<n>x<n>.raw, the file name parsed by VolumeReader,
+//   if it does not exist yet
+static std::string GenerateSyntheticRaw (const BenchParameters& prm, int n, vis::ThreadPool* thread_pool)
+{
+  std::string path = prm.work_directory + "/synthetic." + std::to_string(prm.synthetic_bytes) + "."
+    + std::to_string(n) + "x" + std::to_string(n) + "x" + std::to_string(n) + ".raw";
+
+  size_t slice_voxels = (size_t)n * (size_t)n;
+  size_t n_bytes = slice_voxels * (size_t)n * (size_t)prm.synthetic_bytes;
+
+  std::error_code ec;
+  if (std::filesystem::exists(path, ec) && std::filesystem::file_size(path, ec) == n_bytes)
+    return path;
+
+  std::filesystem::create_directories(prm.work_directory, ec);
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open())
+  {
+    printf("Could not create %s\n", path.c_str());
+    return "";
+  }
+
+  printf("Generating %s\n", path.c_str());
+  const int slab = 16;
+  std::vector<unsigned char> buffer(slice_voxels * slab * prm.synthetic_bytes);
+  for (int z0 = 0; z0 < n; z0 += slab)
+  {
+    int n_slices = std::min(slab, n - z0);
+    thread_pool->ParallelFor(n_slices, [&](int s) {
+      int z = z0 + s;
+      for (int y = 0; y < n; y++)
+      {
+        for (int x = 0; x < n; x++)
+        {
+          glm::vec3 p = (glm::vec3(x, y, z) + 0.5f) / (float)n;
+          float v = SyntheticDensity(p, 0x9E3779B9u);
+          size_t id = (size_t)s * slice_voxels + (size_t)y * n + x;
+          if (prm.synthetic_bytes == 2)
+            reinterpret_cast<unsigned short*>(buffer.data())[id] = (unsigned short)(v * 65535.0f + 0.5f);
+          else
+            buffer[id] = (unsigned char)(v * 255.0f + 0.5f);
+        }
+      }
+    });
+    file.write((const char*)buffer.data(), (std::streamsize)(slice_voxels * n_slices * prm.synthetic_bytes));
+  }
+
+  if (!file.good())
+  {
+    printf("Could not write %s\n", path.c_str());
+    return "";
+  }
+  return path;
+}
+
+// Ramp over the densities of the synthetic volumes
+static vis::TransferFunction1D* GenerateSyntheticTransferFunction (int max_density)
+{
+  vis::TransferFunction1D* tf = new vis::TransferFunction1D(max_density);
+  tf->AddRGBControlPoint(vis::TransferControlPoint(0.0, 0.0, 0.0, 0));
+  tf->AddRGBControlPoint(vis::TransferControlPoint(0.9, 0.5, 0.2, max_density / 3));
+  tf->AddRGBControlPoint(vis::TransferControlPoint(0.9, 0.9, 0.9, max_density));
+  tf->AddAlphaControlPoint(vis::TransferControlPoint(0.0, 0));
+  tf->AddAlphaControlPoint(vis::TransferControlPoint(0.0, max_density / 10));
+  tf->AddAlphaControlPoint(vis::TransferControlPoint(0.05, max_density / 4));
+  tf->AddAlphaControlPoint(vis::TransferControlPoint(0.3, max_density / 2));
+  tf->AddAlphaControlPoint(vis::TransferControlPoint(0.9, max_density));
+  tf->SetName("synthetic_" + std::to_string(max_density + 1));
+  return tf;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Stages of each dataset
+static void RunDatasetStages (const BenchParameters& prm, DatasetResult* dres,
+                              vis::TransferFunction1D* tf, vis::ThreadPool* thread_pool)
+{
+  std::string ext = dres->path.substr(dres->path.find_last_of('.') + 1);
+  bool is_raw = (ext == "raw" || ext == "RAW");
+
+  auto read_volume = [&] (bool mapped) -> vis::StructuredGridVolume* {
+    vis::VolumeReader vr;
+    vr.SetRawMemoryMapping(mapped, MappedFile::ACCESS_PATTERN::SEQUENTIAL);
+    return vr.ReadStructuredVolume(dres->path);
+  };
+
+  // Volume used by the next stages, mapped if possible
+  vis::StructuredGridVolume* vol = read_volume(true);
+  if (vol == nullptr || vol->GetArrayData() == nullptr)
+  {
+    printf("Could not read %s\n", dres->path.c_str());
+    if (vol) delete vol;
+    return;
+  }
+
+  dres->resolution = glm::ivec3(vol->GetWidth(), vol->GetHeight(), vol->GetDepth());
+  dres->bytes_per_voxel = (int)vis::GetStorageSizeBytes(vol->GetDataStorageSize());
+
+  double n_voxels = (double)dres->resolution.x * (double)dres->resolution.y * (double)dres->resolution.z;
+  size_t vol_bytes = (size_t)n_voxels * (size_t)dres->bytes_per_voxel;
+
+  printf("%s [%d, %d, %d]\n", dres->name.c_str(), dres->resolution.x, dres->resolution.y, dres->resolution.z);
+
+  // VolumeReader
+  vis::StructuredGridVolume* read_vol = nullptr;
+  auto release_read_vol = [&] () {
+    if (read_vol) delete read_vol;
+    read_vol = nullptr;
+  };
+  std::vector<std::pair<std::string, bool>> read_stages;
+  if (is_raw)
+  {
+    read_stages.push_back({ "read_raw_copy", false });
+    read_stages.push_back({ "read_raw_mapped", true });
+  }
+  else
+  {
+    read_stages.push_back({ "read_" + ext, false });
+  }
+  for (auto& rs : read_stages)
+  {
+    if (!IsStageEnabled(prm, rs.first)) continue;
+    bool mapped = rs.second;
+    dres->stages.push_back(RunStage(prm, rs.first, n_voxels, "voxels", mapped ? 0 : vol_bytes, [&] () {
+      read_vol = read_volume(mapped);
+      return read_vol != nullptr;
+    }, nullptr, release_read_vol));
+  }
+
+  // GenerateRTexture data conversion
+  if (IsStageEnabled(prm, "rtexture_data"))
+  {
+    GLfloat* rtexture_data = nullptr;
+    dres->stages.push_back(RunStage(prm, "rtexture_data", n_voxels, "voxels", (size_t)n_voxels * sizeof(GLfloat), [&] () {
+      rtexture_data = vis::GenerateRTextureData(vol, 0, 0, 0, dres->resolution.x, dres->resolution.y, dres->resolution.z);
+      return rtexture_data != nullptr;
+    }, nullptr, [&] () {
+      if (rtexture_data) delete[] rtexture_data;
+      rtexture_data = nullptr;
+    }));
+  }
+
+  // CPU gradients
+  size_t gradient_bytes = (size_t)n_voxels * 3 * sizeof(float);
+  std::vector<float> gradient;
+  vis::GradientEngine gradient_engine(thread_pool);
+  const std::pair<std::string, vis::GradientEngine::METHOD> gradient_stages[2] = {
+    { "gradient_sobel", vis::GradientEngine::METHOD::SOBEL_FELDMAN },
+    { "gradient_central_differences", vis::GradientEngine::METHOD::CENTRAL_DIFFERENCES },
+  };
+  for (auto& gs : gradient_stages)
+  {
+    if (!IsStageEnabled(prm, gs.first)) continue;
+    gradient_engine.SetMethod(gs.second);
+    dres->stages.push_back(RunStage(prm, gs.first, n_voxels, "voxels", gradient_bytes, [&] () {
+      gradient = gradient_engine.ComputeFloat(vol);
+      return !gradient.empty();
+    }, [&] () {
+      std::vector<float>().swap(gradient);
+    }));
+  }
+
+  // Brick min/max
+  if (IsStageEnabled(prm, "bricks"))
+  {
+    vis::VolumeBricks bricks;
+    dres->stages.push_back(RunStage(prm, "bricks", n_voxels, "voxels", 0, [&] () {
+      return bricks.Build(vol, vis::VolumeBricks::DEFAULT_BRICK_SIZE, false, thread_pool);
+    }));
+  }
+
+  // CPU render, the gradient field is computed outside the timed frames
+  if (IsStageEnabled(prm, "render_cpu") && tf)
+  {
+    bool shading = gradient_bytes <= prm.max_memory_mb * 1024 * 1024;
+
+    vis::CPURayCaster ray_caster(thread_pool);
+    ray_caster.SetVolume(vol);
+    ray_caster.SetTransferFunction(tf);
+    ray_caster.SetGradientShading(shading);
+    if (shading)
+    {
+      std::vector<float>().swap(gradient);
+      gradient_engine.SetMethod(vis::GradientEngine::METHOD::SOBEL_FELDMAN);
+      ray_caster.SetGradientField(gradient_engine.ComputeFloat(vol));
+    }
+
+    glm::dvec3 sv = vol->GetScale();
+    ray_caster.SetStepSize(float((0.5f / glm::sqrt(3.0f)) * glm::sqrt(sv.x * sv.x + sv.y * sv.y + sv.z * sv.z)));
+
+    // Same first camera of cppvolrend, scaled to the volume diagonal
+    glm::vec3 eye = glm::vec3(256.0f, 256.0f, 512.0f) * (float)(vol->GetDiagonal() / (256.0 * glm::sqrt(3.0)));
+    ray_caster.SetCamera(eye, glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)),
+                         (float)tan(glm::radians(45.0) / 2.0), float(prm.render_width) / float(prm.render_height));
+    ray_caster.SetBlinnPhong(0.5f, 0.5f, 0.8f, 30.0f, glm::vec3(1.0f), eye);
+
+    std::vector<float> frame((size_t)prm.render_width * (size_t)prm.render_height * 4);
+    StageResult res = RunStage(prm, shading ? "render_cpu" : "render_cpu_noshading",
+      (double)prm.render_width * (double)prm.render_height, "rays", 0, [&] () {
+      return ray_caster.Render(prm.render_width, prm.render_height, frame.data());
+    });
+    dres->stages.push_back(res);
+    ray_caster.SetVolume(nullptr);
+  }
+
+  delete vol;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// JSON output
+static std::string JsonString (const std::string& s)
+{
+  std::string ret = "\"";
+  for (char c : s)
+  {
+    if (c == '"' || c == '\\') { ret += '\\'; ret += c; }
+    else if (c == '\n') ret += "\\n";
+    else if ((unsigned char)c < 0x20) ret += ' ';
+    else ret += c;
+  }
+  return ret + "\"";
+}
+
+static void WriteStageJson (FILE* fp, const StageResult& s, const char* indent, bool last)
+{
+  fprintf(fp, "%s{ \"stage\": %s, ", indent, JsonString(s.name).c_str());
+  if (s.skipped)
+  {
+    fprintf(fp, "\"skipped\": %s }%s\n", JsonString(s.skip_reason).c_str(), last ? "" : ",");
+    return;
+  }
+  double throughput = s.median_ms > 0.0 ? s.items / (s.median_ms * 1e-3) : 0.0;
+  fprintf(fp, "\"iterations\": %d, \"median_ms\": %.4lf, \"p95_ms\": %.4lf, \"min_ms\": %.4lf, ",
+    (int)s.samples_ms.size(), s.median_ms, s.p95_ms, s.min_ms);
+  fprintf(fp, "\"throughput\": %.1lf, \"throughput_unit\": %s, \"peak_rss_bytes\": %zu, \"samples_ms\": [",
+    throughput, JsonString(s.unit + "/s").c_str(), s.peak_rss_bytes);
+  for (size_t i = 0; i < s.samples_ms.size(); i++)
+    fprintf(fp, "%s%.4lf", i ? ", " : "", s.samples_ms[i]);
+  fprintf(fp, "] }%s\n", last ? "" : ",");
+}
+
+static bool WriteJson (const BenchParameters& prm, unsigned int n_threads,
+                       const std::vector<DatasetResult>& datasets, const std::vector<StageResult>& tf_stages)
+{
+  FILE* fp = fopen(prm.output_path.c_str(), "w");
+  if (fp == nullptr)
+  {
+    printf("Could not write %s\n", prm.output_path.c_str());
+    return false;
+  }
+
+#if defined(_MSC_VER)
+  std::string compiler = "msvc " + std::to_string(_MSC_VER);
+#elif defined(__clang__)
+  std::string compiler = "clang " __clang_version__;
+#elif defined(__GNUC__)
+  std::string compiler = "gcc " __VERSION__;
+#else
+  std::string compiler = "unknown";
+#endif
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"version\": %d,\n", CPPVOLREND_BENCH_JSON_VERSION);
+  fprintf(fp, "  \"config\": { \"threads\": %u, \"simd\": %s, \"compiler\": %s, \"iterations\": %d, "
+    "\"render_size\": [%d, %d], \"max_memory_mb\": %zu },\n",
+    n_threads, JsonString(vis::simd::GetBackendName()).c_str(), JsonString(compiler).c_str(),
+    prm.iterations, prm.render_width, prm.render_height, prm.max_memory_mb);
+  fprintf(fp, "  \"peak_rss_bytes\": %zu,\n", GetPeakRSSBytes());
+
+  fprintf(fp, "  \"transfer_functions\": [\n");
+  for (size_t i = 0; i < tf_stages.size(); i++)
+    WriteStageJson(fp, tf_stages[i], "    ", i + 1 == tf_stages.size());
+  fprintf(fp, "  ],\n");
+
+  fprintf(fp, "  \"datasets\": [\n");
+  for (size_t d = 0; d < datasets.size(); d++)
+  {
+    const DatasetResult& ds = datasets[d];
+    fprintf(fp, "    {\n");
+    fprintf(fp, "      \"name\": %s, \"path\": %s, \"synthetic\": %s,\n", JsonString(ds.name).c_str(),
+      JsonString(ds.path).c_str(), ds.synthetic ? "true" : "false");
+    fprintf(fp, "      \"resolution\": [%d, %d, %d], \"bytes_per_voxel\": %d,\n",
+      ds.resolution.x, ds.resolution.y, ds.resolution.z, ds.bytes_per_voxel);
+    fprintf(fp, "      \"stages\": [\n");
+    for (size_t i = 0; i < ds.stages.size(); i++)
+      WriteStageJson(fp, ds.stages[i], "        ", i + 1 == ds.stages.size());
+    fprintf(fp, "      ]\n");
+    fprintf(fp, "    }%s\n", d + 1 == datasets.size() ? "" : ",");
+  }
+  fprintf(fp, "  ]\n");
+  fprintf(fp, "}\n");
+
+  fclose(fp);
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+static void PrintUsage ()
+{
+  printf("usage: cppvolrend_bench [options]\n");
+  printf("  -sizes n0,n1,...   synthetic volume sizes, 0 disables (default 128,256,512,1024)\n");
+  printf("  -bytes 1|2         bytes per voxel of the synthetic volumes (default 1)\n");
+  printf("  -data dir          benchmark every .raw/.pvm inside dir (default %s)\n", CPPVOLREND_BENCH_DATA_DIR);
+  printf("  -nodata            skip the data directory\n");
+  printf("  -work dir          directory of the synthetic .raw files (default bench_data)\n");
+  printf("  -tf file.tf1d      transfer function of the render stage\n");
+  printf("  -o file.json       output file (default cppvolrend_bench.json)\n");
+  printf("  -iterations n      timed runs of each stage (default 5)\n");
+  printf("  -size w h          render resolution (default 512 512)\n");
+  printf("  -threads n         number of threads (default all)\n");
+  printf("  -maxmem mb         skip stages estimated above mb megabytes (default 8192)\n");
+  printf("  -stage name        only run the stages containing name\n");
+}
+
+static bool ReadArguments (int argc, char** argv, BenchParameters* prm)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    int n_values = argc - i - 1;
+    if (arg == "-sizes" && n_values >= 1)
+    {
+      prm->synthetic_sizes.clear();
+      std::string list = argv[++i];
+      size_t p = 0;
+      while (p < list.size())
+      {
+        size_t q = list.find(',', p);
+        if (q == std::string::npos) q = list.size();
+        int n = atoi(list.substr(p, q - p).c_str());
+        if (n > 0) prm->synthetic_sizes.push_back(n);
+        p = q + 1;
+      }
+    }
+    else if (arg == "-bytes" && n_values >= 1)
+      prm->synthetic_bytes = atoi(argv[++i]);
+    else if (arg == "-data" && n_values >= 1)
+      prm->data_directory = argv[++i];
+    else if (arg == "-nodata")
+      prm->use_data_folder = false;
+    else if (arg == "-work" && n_values >= 1)
+      prm->work_directory = argv[++i];
+    else if (arg == "-tf" && n_values >= 1)
+      prm->transfer_function_path = argv[++i];
+    else if (arg == "-o" && n_values >= 1)
+      prm->output_path = argv[++i];
+    else if (arg == "-iterations" && n_values >= 1)
+      prm->iterations = atoi(argv[++i]);
+    else if (arg == "-size" && n_values >= 2)
+    {
+      prm->render_width = atoi(argv[++i]);
+      prm->render_height = atoi(argv[++i]);
+    }
+    else if (arg == "-threads" && n_values >= 1)
+      prm->n_threads = (unsigned int)atoi(argv[++i]);
+    else if (arg == "-maxmem" && n_values >= 1)
+      prm->max_memory_mb = (size_t)atoll(argv[++i]);
+    else if (arg == "-stage" && n_values >= 1)
+      prm->stage_filter = argv[++i];
+    else
+    {
+      printf("Unknown or incomplete argument \"%s\"\n", arg.c_str());
+      return false;
+    }
+  }
+
+  if (prm->iterations <= 0 || prm->render_width <= 0 || prm->render_height <= 0 ||
+      (prm->synthetic_bytes != 1 && prm->synthetic_bytes != 2))
+  {
+    printf("Invalid benchmark parameters\n");
+    return false;
+  }
+  return true;
+}
+
+int main (int argc, char **argv)
+{
+  BenchParameters prm;
+  if (!ReadArguments(argc, argv, &prm))
+  {
+    PrintUsage();
+    return EXIT_FAILURE;
+  }
+
+  vis::ThreadPool thread_pool(prm.n_threads);
+
+  // Datasets
+  std::vector<DatasetResult> datasets;
+  for (int n : prm.synthetic_sizes)
+  {
+    DatasetResult ds;
+    ds.name = "synthetic_" + std::to_string(n);
+    ds.path = GenerateSyntheticRaw(prm, n, &thread_pool);
+    ds.synthetic = true;
+    if (!ds.path.empty()) datasets.push_back(ds);
+  }
+
+  std::string data_tf_path = prm.transfer_function_path;
+  std::error_code ec;
+  if (prm.use_data_folder && std::filesystem::is_directory(prm.data_directory, ec))
+  {
+    std::vector<std::string> files;
+    for (auto& entry : std::filesystem::recursive_directory_iterator(prm.data_directory, ec))
+    {
+      if (!entry.is_regular_file()) continue;
+      std::string ext = entry.path().extension().string();
+      if (ext == ".raw" || ext == ".pvm")
+        files.push_back(entry.path().string());
+      else if (ext == ".tf1d" && data_tf_path.empty())
+        data_tf_path = entry.path().string();
+    }
+    std::sort(files.begin(), files.end());
+    for (std::string& f : files)
+    {
+      DatasetResult ds;
+      ds.name = std::filesystem::path(f).filename().string();
+      ds.path = f;
+      datasets.push_back(ds);
+    }
+  }
+
+  // Transfer functions
+  vis::TransferFunction1D* data_tf = nullptr;
+  if (!data_tf_path.empty())
+  {
+    vis::TransferFunctionReader tfr;
+    data_tf = dynamic_cast<vis::TransferFunction1D*>(tfr.ReadTransferFunction(data_tf_path));
+    if (data_tf) data_tf->SetName(std::filesystem::path(data_tf_path).stem().string());
+  }
+  vis::TransferFunction1D* synthetic_tf = GenerateSyntheticTransferFunction(prm.synthetic_bytes == 2 ? 65535 : 255);
+
+  std::vector<StageResult> tf_stages;
+  if (IsStageEnabled(prm, "tf1d_build"))
+  {
+    std::vector<vis::TransferFunction1D*> tfs = { synthetic_tf };
+    vis::TransferFunction1D* tf_16bits = nullptr;
+    if (prm.synthetic_bytes == 1)
+      tfs.push_back(tf_16bits = GenerateSyntheticTransferFunction(65535));
+    if (data_tf) tfs.push_back(data_tf);
+
+    printf("Transfer functions\n");
+    for (vis::TransferFunction1D* tf : tfs)
+    {
+      tf_stages.push_back(RunStage(prm, "tf1d_build_" + tf->GetName(), (double)(tf->GetMaxDensity() + 1), "entries", 0, [&] () {
+        tf->Build();
+        return true;
+      }));
+    }
+    if (tf_16bits) delete tf_16bits;
+  }
+
+  for (DatasetResult& ds : datasets)
+    RunDatasetStages(prm, &ds, (ds.synthetic || data_tf == nullptr) ? synthetic_tf : data_tf, &thread_pool);
+
+  bool saved = WriteJson(prm, thread_pool.GetNumberOfThreads(), datasets, tf_stages);
+  if (saved)
+    printf("Results saved at %s\n", prm.output_path.c_str());
+
+  if (data_tf) delete data_tf;
+  delete synthetic_tf;
+  return saved ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,132 @@
+/**
+ * C++ Volume Rendering Application - Volume Converter
+ *
+ * Converts any volume read by vis::VolumeReader (.pvm, .raw, .braw,
+ *   .vvol) into a vis::VolumeContainer (.vvol) file, with compressed
+ *   bricks, coarse levels and an optional gradient channel.
+ * No window or OpenGL context is created.
+ *
+ * usage: cppvolrend_convert <input volume> <output .vvol> [options]
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+
+#include <file_utils/profiler.h>
+
+#include <volvis_utils/reader.h>
+#include <volvis_utils/structuredgridvolume.h>
+#include <volvis_utils/threadpool.h>
+#include <volvis_utils/volumecontainer.h>
+
+struct ConvertParameters
+{
+  std::string input_path;
+  std::string output_path;
+
+  vis::VolumeContainerSettings settings;
+
+  unsigned int n_threads = 0;
+  // Brick cache of .braw input volumes
+  size_t pager_memory_budget = vis::BrickPager::DEFAULT_MEMORY_BUDGET;
+  std::string profile_trace_file;
+};
+
+static void PrintUsage ()
+{
+  printf("usage: cppvolrend_convert <input volume> <output .vvol> [options]\n");
+  printf("  -brick n           brick size, power of two in [4, 256] (default 32)\n");
+  printf("  -error e           max error per voxel, 0 is lossless (default 0)\n");
+  printf("  -nolevels          do not store the coarse levels\n");
+  printf("  -lodmax            coarse levels keep the max of the voxels\n");
+  printf("  -gradient          store the gradient directions\n");
+  printf("  -threads n         number of threads (default all)\n");
+  printf("  -budget MB         brick cache budget of paged input volumes (default 1024)\n");
+  printf("  -profile file      write a chrome trace (.json) of the run\n");
+}
+
+static bool ReadArguments (int argc, char** argv, ConvertParameters* prm)
+{
+  if (argc < 3) return false;
+
+  prm->input_path = argv[1];
+  prm->output_path = argv[2];
+
+  for (int i = 3; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    int n_values = argc - i - 1;
+    if (arg == "-brick" && n_values >= 1)
+      prm->settings.brick_size = atoi(argv[++i]);
+    else if (arg == "-error" && n_values >= 1)
+      prm->settings.max_error = atoi(argv[++i]);
+    else if (arg == "-threads" && n_values >= 1)
+      prm->n_threads = (unsigned int)atoi(argv[++i]);
+    else if (arg == "-budget" && n_values >= 1)
+      prm->pager_memory_budget = (size_t)atoll(argv[++i]) << 20;
+    else if (arg == "-profile" && n_values >= 1)
+      prm->profile_trace_file = argv[++i];
+    else if (arg == "-nolevels")
+      prm->settings.write_levels = false;
+    else if (arg == "-lodmax")
+      prm->settings.reduction = vis::VolumePyramid::REDUCTION::MAXIMUM;
+    else if (arg == "-gradient")
+      prm->settings.write_gradient = true;
+    else
+    {
+      printf("Unknown or incomplete argument \"%s\"\n", arg.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+int main (int argc, char **argv)
+{
+  ConvertParameters prm;
+  if (!ReadArguments(argc, argv, &prm))
+  {
+    PrintUsage();
+    return EXIT_FAILURE;
+  }
+  Profiler::SetEnabled(!prm.profile_trace_file.empty());
+
+  auto t_init = std::chrono::steady_clock::now();
+
+  // .raw voxels are mapped, .braw volumes are streamed through their bricks
+  vis::VolumeReader vr;
+  vr.SetRawMemoryMapping(true, MappedFile::ACCESS_PATTERN::SEQUENTIAL);
+  vr.SetPagerMemoryBudget(prm.pager_memory_budget);
+  vis::StructuredGridVolume* volume = vr.ReadStructuredVolume(prm.input_path);
+  if (volume == nullptr)
+  {
+    printf("Could not read volume %s\n", prm.input_path.c_str());
+    return EXIT_FAILURE;
+  }
+  auto t_read = std::chrono::steady_clock::now();
+
+  vis::ThreadPool thread_pool(prm.n_threads);
+  bool written = vis::VolumeContainer::Write(volume, prm.output_path, prm.settings, &thread_pool);
+  auto t_end = std::chrono::steady_clock::now();
+  delete volume;
+
+  if (!written)
+  {
+    printf("Could not write %s\n", prm.output_path.c_str());
+    return EXIT_FAILURE;
+  }
+  printf("Converted %s in %.2lf ms (read %.2lf ms, write %.2lf ms) with %u threads\n", prm.input_path.c_str(),
+    std::chrono::duration<double, std::milli>(t_end - t_init).count(),
+    std::chrono::duration<double, std::milli>(t_read - t_init).count(),
+    std::chrono::duration<double, std::milli>(t_end - t_read).count(),
+    thread_pool.GetNumberOfThreads());
+
+  if (!prm.profile_trace_file.empty())
+    Profiler::WriteChromeTrace(prm.profile_trace_file);
+
+  return EXIT_SUCCESS;
+}
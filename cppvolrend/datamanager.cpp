@@ -7,7 +7,9 @@
 #include "datamanager.h"
 #include "defines.h"
 
+#include <algorithm>
 #include <fstream>
+#include <file_utils/profiler.h>
 #include <gl_utils/computeshader.h>
 #include <volvis_utils/utils.h>
 
@@ -19,28 +21,292 @@
 
 namespace vis
 {
+  static bool IsComputeShaderSupported ()
+  {
+    return GLEW_VERSION_4_3 || GLEW_ARB_compute_shader;
+  }
+
+  // Dataset read by DataManager::LoadData, with the settings of the
+  //  request. After the swap, holds the previous resources.
+  struct DataManager::LoadedData
+  {
+    LoadedData ()
+      : volume(nullptr), transfer_function(nullptr), gradient_entry(nullptr)
+      , volume_pyramid(nullptr), volume_texture(nullptr), gradient_texture(nullptr)
+    {}
+
+    ~LoadedData ()
+    {
+      // The pyramid references the volume as its level 0
+      if (volume_pyramid) delete volume_pyramid;
+      if (volume) delete volume;
+      if (transfer_function) delete transfer_function;
+      if (gradient_entry) delete gradient_entry;
+      if (volume_texture) delete volume_texture;
+      if (gradient_texture) delete gradient_texture;
+    }
+
+    std::string volume_path;
+    std::string transfer_function_path;
+
+    bool gen_gpu_resources;
+    bool compress_volume;
+    int compression_max_error;
+    STRUCTURED_GRADIENT_TYPE gradient_comp_model;
+    vis::GRADIENT_TEXTURE_FORMAT gradient_texture_format;
+    bool use_gradient_cache;
+    vis::GradientCache gradient_cache;
+    bool build_volume_pyramid;
+    VolumePyramid::REDUCTION pyramid_reduction;
+    bool persist_volume_pyramid;
+
+    vis::StructuredGridVolume* volume;
+    vis::TransferFunction* transfer_function;
+    // Uploaded by SwapLoadedData, with the voxels of the volume
+    vis::GradientCache::Entry* gradient_entry;
+    // texels of gradient_texture_format
+    std::vector<uint8_t> gradient_packed;
+    vis::VolumePyramid* volume_pyramid;
+
+    // Only set for the previous resources
+    gl::Texture3D* volume_texture;
+    gl::Texture3D* gradient_texture;
+  };
+
   DataManager::DataManager ()
     : curr_vr_volume(nullptr)
     , curr_vr_transferfunction(nullptr)
     , curr_gradient_comp_model(DataManager::STRUCTURED_GRADIENT_TYPE::COMPUTE_SHADER_SOBEL)
     , curr_gl_tex_structured_volume(nullptr)
     , curr_gl_tex_structured_gradient(nullptr)
+    , curr_gradient_texture_format(vis::GRADIENT_TEXTURE_FORMAT::FLOAT_16_GRADIENT)
+    , curr_use_gradient_cache(true)
+    , curr_pyramid_reduction(VolumePyramid::REDUCTION::AVERAGE)
+    , curr_persist_volume_pyramid(false)
+    , curr_compress_volume(false)
+    , curr_compression_max_error(0)
+    , curr_gen_gpu_resources(true)
+    , curr_volume_path(_DATA_VOLUME_PATH)
+    , curr_transfer_function_path(_DATA_TRANSFER_FUNCTION)
+    , curr_volume_pyramid(new vis::VolumePyramid())
+    , curr_load_state(LOAD_STATE::IDLE)
+    , curr_load_progress(0.0f)
+    , curr_loaded_data(nullptr)
+    , curr_swapped_data(nullptr)
+    , curr_load_thread_pool(nullptr)
   {
   }
 
   DataManager::~DataManager ()
   {
+    JoinLoadThread();
+    if (curr_loaded_data) delete curr_loaded_data;
+    ReleaseSwappedData();
+    if (curr_load_thread_pool) delete curr_load_thread_pool;
+
     DeleteVolumeData();
     DeleteTransferFunctionData();
+    delete curr_volume_pyramid;
+  }
+
+  void DataManager::SetDataPaths (std::string volume_path, std::string transfer_function_path)
+  {
+    curr_volume_path = volume_path;
+    curr_transfer_function_path = transfer_function_path;
+  }
+
+  std::string DataManager::GetCurrentVolumePath ()
+  {
+    return curr_volume_path;
+  }
+
+  std::string DataManager::GetCurrentTransferFunctionPath ()
+  {
+    return curr_transfer_function_path;
   }
 
   void DataManager::ReadData ()
   {
+    PROFILE_SCOPE("DataManager::ReadData");
     GenerateStructuredVolumeTexture();
     
     vis::TransferFunctionReader tfr;
-    curr_vr_transferfunction = tfr.ReadTransferFunction(_DATA_TRANSFER_FUNCTION);
+    curr_vr_transferfunction = tfr.ReadTransferFunction(curr_transfer_function_path);
     curr_vr_transferfunction->SetName("transfer_function");
+    PublishTransferFunction(false);
+  }
+
+  bool DataManager::ReloadTransferFunction ()
+  {
+    vis::TransferFunctionReader tfr;
+    vis::TransferFunction* tf = tfr.ReadTransferFunction(curr_transfer_function_path);
+    if (tf == nullptr)
+    {
+      printf("DataManager: could not read %s\n", curr_transfer_function_path.c_str());
+      return false;
+    }
+    tf->SetName("transfer_function");
+
+    DeleteTransferFunctionData();
+    curr_vr_transferfunction = tf;
+    PublishTransferFunction(true);
+    return true;
+  }
+
+  bool DataManager::RequestData (std::string volume_path, std::string transfer_function_path)
+  {
+    if (IsLoading()) return false;
+
+    // A loaded dataset not swapped yet is replaced by the new request
+    JoinLoadThread();
+    if (curr_loaded_data) delete curr_loaded_data;
+
+    LoadedData* data = new LoadedData();
+    data->volume_path = volume_path;
+    data->transfer_function_path = transfer_function_path;
+    data->gen_gpu_resources = curr_gen_gpu_resources;
+    data->compress_volume = curr_compress_volume;
+    data->compression_max_error = curr_compression_max_error;
+    data->gradient_comp_model = curr_gradient_comp_model;
+    data->gradient_texture_format = curr_gradient_texture_format;
+    data->use_gradient_cache = curr_use_gradient_cache;
+    data->gradient_cache = curr_gradient_cache;
+    data->build_volume_pyramid = curr_volume_pyramid->IsBuilt();
+    data->pyramid_reduction = curr_pyramid_reduction;
+    data->persist_volume_pyramid = curr_persist_volume_pyramid;
+    curr_loaded_data = data;
+
+    // One thread is left to the cpu renderer
+    if (curr_load_thread_pool == nullptr)
+    {
+      unsigned int n_threads = std::thread::hardware_concurrency();
+      curr_load_thread_pool = new vis::ThreadPool(n_threads > 1 ? n_threads - 1 : 1);
+    }
+
+    curr_load_progress = 0.0f;
+    curr_load_state = LOAD_STATE::LOADING;
+    curr_load_thread = std::thread(&DataManager::LoadData, this, data);
+    return true;
+  }
+
+  DataManager::LOAD_STATE DataManager::GetLoadState ()
+  {
+    return (LOAD_STATE)curr_load_state.load();
+  }
+
+  bool DataManager::IsLoading ()
+  {
+    return curr_load_state == LOAD_STATE::LOADING;
+  }
+
+  float DataManager::GetLoadProgress ()
+  {
+    return curr_load_progress;
+  }
+
+  bool DataManager::SwapLoadedData ()
+  {
+    unsigned int state = curr_load_state;
+    if (state != LOAD_STATE::READY && state != LOAD_STATE::FAILED)
+      return false;
+
+    JoinLoadThread();
+    LoadedData* data = curr_loaded_data;
+    curr_loaded_data = nullptr;
+    curr_load_state = LOAD_STATE::IDLE;
+
+    if (state == LOAD_STATE::FAILED)
+    {
+      printf("DataManager: could not load %s\n", data->volume_path.c_str());
+      delete data;
+      return false;
+    }
+
+    PROFILE_SCOPE("DataManager::SwapLoadedData");
+    gl::Texture3D* volume_texture = nullptr;
+    gl::Texture3D* gradient_texture = nullptr;
+    if (data->gen_gpu_resources)
+    {
+      volume_texture = vis::GenerateNativeRTexture(data->volume);
+      if (data->gradient_entry)
+        gradient_texture = vis::GenerateGradientTexture(data->gradient_entry, data->gradient_texture_format);
+      else if (!data->gradient_packed.empty())
+        gradient_texture = vis::GeneratePackedGradientTexture(data->gradient_packed.data(), data->volume->GetWidth(),
+          data->volume->GetHeight(), data->volume->GetDepth(), data->gradient_texture_format);
+    }
+    // Only needed for the upload
+    if (data->gradient_entry) delete data->gradient_entry;
+    data->gradient_entry = nullptr;
+    std::vector<uint8_t>().swap(data->gradient_packed);
+
+    // After the swap, data holds the previous resources
+    ReleaseSwappedData();
+    std::swap(curr_vr_volume, data->volume);
+    std::swap(curr_vr_transferfunction, data->transfer_function);
+    std::swap(curr_volume_pyramid, data->volume_pyramid);
+    curr_gradient_texture_format = data->gradient_texture_format;
+    data->volume_texture = curr_gl_tex_structured_volume;
+    curr_gl_tex_structured_volume = volume_texture;
+    data->gradient_texture = curr_gl_tex_structured_gradient;
+    curr_gl_tex_structured_gradient = gradient_texture;
+    std::swap(curr_volume_path, data->volume_path);
+    std::swap(curr_transfer_function_path, data->transfer_function_path);
+    curr_swapped_data = data;
+    PublishTransferFunction(false);
+
+    printf("DataManager: swapped to %s\n", curr_volume_path.c_str());
+    return true;
+  }
+
+  void DataManager::ReleaseSwappedData ()
+  {
+    if (curr_swapped_data) delete curr_swapped_data;
+    curr_swapped_data = nullptr;
+  }
+
+  void DataManager::SetGenerateGPUResources (bool gen_gpu_resources)
+  {
+    curr_gen_gpu_resources = gen_gpu_resources;
+  }
+
+  bool DataManager::GetGenerateGPUResources ()
+  {
+    return curr_gen_gpu_resources;
+  }
+
+  void DataManager::SetGradientCache (bool use_gradient_cache, std::string cache_directory)
+  {
+    curr_use_gradient_cache = use_gradient_cache;
+    curr_gradient_cache.SetCacheDirectory(cache_directory);
+  }
+
+  bool DataManager::GetUseGradientCache ()
+  {
+    return curr_use_gradient_cache;
+  }
+
+  void DataManager::SetGradientTextureFormat (vis::GRADIENT_TEXTURE_FORMAT format)
+  {
+    curr_gradient_texture_format = format;
+  }
+
+  vis::GRADIENT_TEXTURE_FORMAT DataManager::GetGradientTextureFormat ()
+  {
+    return curr_gradient_texture_format;
+  }
+
+  void DataManager::SetVolumePyramid (VolumePyramid::REDUCTION reduction, bool persist)
+  {
+    if (reduction != curr_pyramid_reduction)
+      curr_volume_pyramid->Clear();
+    curr_pyramid_reduction = reduction;
+    curr_persist_volume_pyramid = persist;
+  }
+
+  void DataManager::SetVolumeCompression (bool compress, int max_error)
+  {
+    curr_compress_volume = compress;
+    curr_compression_max_error = max_error;
   }
 
   vis::GridVolume* DataManager::GetCurrentGridVolume ()
@@ -58,6 +324,11 @@ namespace vis
     return curr_vr_transferfunction;
   }
 
+  vis::TransferFunctionPublisher* DataManager::GetTransferFunctionPublisher ()
+  {
+    return &curr_tf_publisher;
+  }
+
   gl::Texture3D* DataManager::GetCurrentVolumeTexture ()
   {
     return curr_gl_tex_structured_volume;
@@ -67,12 +338,25 @@ namespace vis
   {
     return curr_gl_tex_structured_gradient;
   }
+
+  vis::VolumePyramid* DataManager::GetCurrentVolumePyramid ()
+  {
+    if (!curr_volume_pyramid->IsBuilt() && curr_vr_volume)
+    {
+      std::string pyramid_path = curr_persist_volume_pyramid ? curr_volume_path + ".vpyr" : "";
+      curr_volume_pyramid->LoadOrBuild(pyramid_path, curr_vr_volume, curr_pyramid_reduction, vis::ThreadPool::GetDefault());
+    }
+    return curr_volume_pyramid->IsBuilt() ? curr_volume_pyramid : nullptr;
+  }
   
   ////////////////////////////////////////////////////////////////////////
   // Private Methods
   ////////////////////////////////////////////////////////////////////////
   void DataManager::DeleteVolumeData ()
   {
+    // The pyramid references the volume as its level 0
+    curr_volume_pyramid->Clear();
+
     if (curr_vr_volume) delete curr_vr_volume;
     curr_vr_volume = nullptr;
 
@@ -94,16 +378,99 @@ namespace vis
     curr_vr_transferfunction = nullptr;
   }
 
+  void DataManager::PublishTransferFunction (bool async)
+  {
+    vis::TransferFunction1D* tf = dynamic_cast<vis::TransferFunction1D*>(curr_vr_transferfunction);
+    if (tf == nullptr) return;
+
+    // The tables only cover the value range of the volume
+    double density_min = 0.0, density_max = 1.0;
+    if (curr_vr_volume)
+      curr_vr_volume->GetNormalizedRange(&density_min, &density_max);
+    curr_tf_publisher.SetDensityRange((float)density_min, (float)density_max);
+
+    if (async)
+      curr_tf_publisher.PublishAsync(*tf);
+    else
+      curr_tf_publisher.Publish(*tf);
+  }
+
+  void DataManager::LoadData (LoadedData* data)
+  {
+    PROFILE_SCOPE("DataManager::LoadData");
+    printf("DataManager: loading %s\n", data->volume_path.c_str());
+
+    vis::VolumeReader vr;
+    vr.SetRawMemoryMapping(true, data->gen_gpu_resources ? MappedFile::ACCESS_PATTERN::SEQUENTIAL
+                                                         : MappedFile::ACCESS_PATTERN::WILL_NEED);
+    vr.SetCompression(data->compress_volume && !data->gen_gpu_resources, data->compression_max_error);
+    data->volume = vr.ReadStructuredVolume(data->volume_path);
+
+    vis::TransferFunctionReader tfr;
+    data->transfer_function = tfr.ReadTransferFunction(data->transfer_function_path);
+    if (data->volume == nullptr || data->transfer_function == nullptr)
+    {
+      curr_load_state = LOAD_STATE::FAILED;
+      return;
+    }
+    data->volume->SetName("volume");
+    data->transfer_function->SetName("transfer_function");
+    curr_load_progress = 0.4f;
+
+    if (data->gen_gpu_resources)
+    {
+      // Same operators of GenerateStructuredGradientTexture, without a GL context
+      if (data->gradient_comp_model != STRUCTURED_GRADIENT_TYPE::NONE_GRADIENT)
+      {
+        vis::GradientEngine gradient_engine(curr_load_thread_pool);
+        if (data->gradient_comp_model == STRUCTURED_GRADIENT_TYPE::FINITE_DIFERENCES)
+          gradient_engine.SetMethod(vis::GradientEngine::METHOD::CENTRAL_DIFFERENCES);
+
+        if (data->use_gradient_cache)
+          data->gradient_entry = data->gradient_cache.LoadOrCompute(data->volume, &gradient_engine, data->volume_path);
+        if (data->gradient_entry == nullptr)
+          data->gradient_packed = gradient_engine.ComputePacked(data->volume,
+            vis::GetGradientOutputFormat(data->gradient_texture_format));
+      }
+      curr_load_progress = 0.8f;
+    }
+
+    // Otherwise built on demand by GetCurrentVolumePyramid
+    data->volume_pyramid = new vis::VolumePyramid();
+    if (data->build_volume_pyramid)
+    {
+      std::string pyramid_path = data->persist_volume_pyramid ? data->volume_path + ".vpyr" : "";
+      data->volume_pyramid->LoadOrBuild(pyramid_path, data->volume, data->pyramid_reduction, curr_load_thread_pool);
+    }
+
+    curr_load_progress = 1.0f;
+    curr_load_state = LOAD_STATE::READY;
+  }
+
+  void DataManager::JoinLoadThread ()
+  {
+    if (curr_load_thread.joinable())
+      curr_load_thread.join();
+  }
+
   bool DataManager::GenerateStructuredVolumeTexture ()
   {
+    PROFILE_SCOPE("DataManager::GenerateStructuredVolumeTexture");
     // Read Volume
     vis::VolumeReader vr;
-    curr_vr_volume = vr.ReadStructuredVolume(_DATA_VOLUME_PATH);
+    // .raw voxels are referenced from the mapped file, without a heap copy
+    vr.SetRawMemoryMapping(true, curr_gen_gpu_resources ? MappedFile::ACCESS_PATTERN::SEQUENTIAL
+                                                        : MappedFile::ACCESS_PATTERN::WILL_NEED);
+    vr.SetCompression(curr_compress_volume && !curr_gen_gpu_resources, curr_compression_max_error);
+    curr_vr_volume = vr.ReadStructuredVolume(curr_volume_path);
     curr_vr_volume->SetName("volume");
 
+    // The cpu renderers sample the volume directly
+    if (!curr_gen_gpu_resources)
+      return true;
+
     // Generate Volume Texture
-    curr_gl_tex_structured_volume = vis::GenerateRTexture(curr_vr_volume, 0, 0, 0, curr_vr_volume->GetWidth(),
-      curr_vr_volume->GetHeight(), curr_vr_volume->GetDepth());
+    curr_gl_tex_structured_volume = vis::GenerateNativeRTexture(curr_vr_volume);
 
     // Generate gradient, if enabled
     GenerateStructuredGradientTexture();
@@ -113,13 +480,33 @@ namespace vis
 
   bool DataManager::GenerateStructuredGradientTexture ()
   {
+    PROFILE_SCOPE("DataManager::GenerateStructuredGradientTexture");
+    // Evaluating the compute shader is faster than reading the cache
+    bool device_gradient = curr_gradient_comp_model == STRUCTURED_GRADIENT_TYPE::COMPUTE_SHADER_SOBEL
+                        && IsComputeShaderSupported();
+    if (curr_use_gradient_cache && curr_gradient_comp_model != STRUCTURED_GRADIENT_TYPE::NONE_GRADIENT && !device_gradient)
+    {
+      // The compute shader evaluates the same Sobel-Feldman operator
+      vis::GradientEngine gradient_engine;
+      if (curr_gradient_comp_model == STRUCTURED_GRADIENT_TYPE::FINITE_DIFERENCES)
+        gradient_engine.SetMethod(vis::GradientEngine::METHOD::CENTRAL_DIFFERENCES);
+
+      vis::GradientCache::Entry* entry = curr_gradient_cache.LoadOrCompute(curr_vr_volume, &gradient_engine, curr_volume_path);
+      if (entry)
+      {
+        curr_gl_tex_structured_gradient = vis::GenerateGradientTexture(entry, curr_gradient_texture_format);
+        delete entry;
+        return true;
+      }
+    }
+
     if (curr_gradient_comp_model == STRUCTURED_GRADIENT_TYPE::SOBEL_FELDMAN_FILTER)
     {
-      curr_gl_tex_structured_gradient = vis::GenerateSobelFeldmanGradientTexture(curr_vr_volume);
+      curr_gl_tex_structured_gradient = GenerateGradientWithEngine(vis::GradientEngine::METHOD::SOBEL_FELDMAN);
     }
     else if (curr_gradient_comp_model == STRUCTURED_GRADIENT_TYPE::FINITE_DIFERENCES)
     {
-      curr_gl_tex_structured_gradient = vis::GenerateGradientTexture(curr_vr_volume);
+      curr_gl_tex_structured_gradient = GenerateGradientWithEngine(vis::GradientEngine::METHOD::CENTRAL_DIFFERENCES);
     }
     else if (curr_gradient_comp_model == STRUCTURED_GRADIENT_TYPE::COMPUTE_SHADER_SOBEL)
     {
@@ -141,31 +528,63 @@ namespace vis
   
   gl::Texture3D* DataManager::GenerateGradientWithComputeShader ()
   {
+    PROFILE_SCOPE("DataManager::GenerateGradientWithComputeShader");
     // Get Current Volume
     vis::StructuredGridVolume* vol = GetCurrentStructuredVolume();
+    if (!IsComputeShaderSupported() || GetCurrentVolumeTexture() == nullptr)
+      return GenerateGradientWithEngine(vis::GradientEngine::METHOD::SOBEL_FELDMAN);
+
+    // Image unit of the output image of each format
+    GLuint image_unit = 0;
+    GLint internal_format = GL_RGBA16F;
+    GLenum format = GL_RGBA, type = GL_FLOAT;
+    if (curr_gradient_texture_format == vis::GRADIENT_TEXTURE_FORMAT::RGB10_A2_GRADIENT)
+    {
+      image_unit = 1;
+      internal_format = GL_RGB10_A2;
+      type = GL_UNSIGNED_INT_2_10_10_10_REV;
+    }
+    else if (curr_gradient_texture_format == vis::GRADIENT_TEXTURE_FORMAT::OCTAHEDRAL_16_GRADIENT)
+    {
+      image_unit = 2;
+      internal_format = GL_RG16I;
+      format = GL_RG_INTEGER;
+      type = GL_SHORT;
+    }
+    else if (curr_gradient_texture_format == vis::GRADIENT_TEXTURE_FORMAT::OCTAHEDRAL_8_GRADIENT)
+    {
+      image_unit = 3;
+      internal_format = GL_RG8I;
+      format = GL_RG_INTEGER;
+      type = GL_BYTE;
+    }
+    else if (curr_gradient_texture_format == vis::GRADIENT_TEXTURE_FORMAT::OCTAHEDRAL_8_MAGNITUDE_GRADIENT)
+    {
+      // 3 channel formats are not image formats
+      image_unit = 4;
+      internal_format = GL_RGBA8I;
+      format = GL_RGBA_INTEGER;
+      type = GL_BYTE;
+    }
+
+    // Allocate the gradient texture, written by the compute shader. Same
+    //  filtering of vis::GeneratePackedGradientTexture
+    GLint filter = image_unit >= 2 ? GL_NEAREST : GL_LINEAR;
+    gl::Texture3D* tex3d_gradient = new gl::Texture3D(vol->GetWidth(), vol->GetHeight(), vol->GetDepth());
+    tex3d_gradient->GenerateTexture(filter, filter, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+    tex3d_gradient->SetData(NULL, internal_format, format, type);
 
     // Initialize compute shader
     gl::ComputeShader* cpshader = new gl::ComputeShader();
     cpshader->SetShaderFile(CPPVOLREND_DIR"structured/_common_shaders/sobelfeldman_generator.comp");
     cpshader->LoadAndLink();
     cpshader->Bind();
-    
-    // Initialize 1-channel textures
-    gl::Texture3D* tex3d[3];
-    for (int i = 0; i < 3; i++)
-    {
-      tex3d[i] = new gl::Texture3D(vol->GetWidth(), vol->GetHeight(), vol->GetDepth());
-      tex3d[i]->GenerateTexture(GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
-      tex3d[i]->SetData(NULL, GL_R16F, GL_RED, GL_FLOAT);
-    
-      glActiveTexture(GL_TEXTURE0 + i);
-      glBindTexture(GL_TEXTURE_3D, tex3d[i]->GetTextureID());
-    }
-    
-    // Bind 1-channel textures
-    for (int i = 0; i < 3; i++)
-      glBindImageTexture(i, tex3d[i]->GetTextureID(), 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R16F);
-    
+
+    glBindImageTexture(image_unit, tex3d_gradient->GetTextureID(), 0, GL_TRUE, 0, GL_WRITE_ONLY, internal_format);
+
+    cpshader->SetUniform("GradientFormat", (int)curr_gradient_texture_format);
+    cpshader->BindUniform("GradientFormat");
+
     // Bind volume and volume dimensions
     cpshader->SetUniformTexture3D("TexVolume", GetCurrentVolumeTexture()->GetTextureID(), 3);
     cpshader->BindUniform("TexVolume");
@@ -176,62 +595,29 @@ namespace vis
     // Compute the number of groups and dispatch
     cpshader->RecomputeNumberOfGroups(vol->GetWidth(), vol->GetHeight(), vol->GetDepth());
     cpshader->Dispatch();
+    // The renderers sample the gradient as a texture
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    glBindImageTexture(image_unit, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, internal_format);
     
     // Delete compute shader
     cpshader->Unbind();
     delete cpshader;
-    
-    // Initialize Red Data
-    GLfloat* red_data = new GLfloat[vol->GetWidth() * vol->GetHeight() * vol->GetDepth()];
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_3D, tex3d[0]->GetTextureID());
-    glGetTexImage(GL_TEXTURE_3D, 0, GL_RED, GL_FLOAT, red_data);
-    glBindTexture(GL_TEXTURE_3D, 0);
-    
-    // Initialize Green Data
-    GLfloat* green_data = new GLfloat[vol->GetWidth() * vol->GetHeight() * vol->GetDepth()];
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_3D, tex3d[1]->GetTextureID());
-    glGetTexImage(GL_TEXTURE_3D, 0, GL_RED, GL_FLOAT, green_data);
-    glBindTexture(GL_TEXTURE_3D, 0);
-    
-    // Initialize Blue Data
-    GLfloat* blue_data = new GLfloat[vol->GetWidth() * vol->GetHeight() * vol->GetDepth()];
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_3D, tex3d[2]->GetTextureID());
-    glGetTexImage(GL_TEXTURE_3D, 0, GL_RED, GL_FLOAT, blue_data);
-    glBindTexture(GL_TEXTURE_3D, 0);
-    
-    // Delete 1-channel textures
-    for (int i = 0; i < 3; i++)
-      delete tex3d[i];
-    
-    // Initialize RGB Gradient Values Array
-    GLfloat* gradient_values = new GLfloat[vol->GetWidth() * vol->GetHeight() * vol->GetDepth() * 3];
-    for (int i = 0; i < vol->GetWidth() * vol->GetHeight() * vol->GetDepth(); i++)
-    {
-      gradient_values[i * 3 + 0] = red_data[i];
-      gradient_values[i * 3 + 1] = green_data[i];
-      gradient_values[i * 3 + 2] = blue_data[i];
-    }
-    
-    // Delete Red Data
-    delete[] red_data;
-    
-    // Delete Green Data
-    delete[] green_data;
-    
-    // Delete Blue Data
-    delete[] blue_data;
-    
-    // Generate a new terxture and set the gradient values [red, green, blue]
-    gl::Texture3D* tex3d_gradient = new gl::Texture3D(vol->GetWidth(), vol->GetHeight(), vol->GetDepth());
-    tex3d_gradient->GenerateTexture(GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
-    tex3d_gradient->SetData((GLvoid*)gradient_values, GL_RGB16F, GL_RGB, GL_FLOAT);
-    
-    // Delete RGB Gradient Values Array
-    delete[] gradient_values;
-  
+
+    gl::ExitOnGLError("DataManager: After GenerateGradientWithComputeShader");
     return tex3d_gradient;
   }
+
+  gl::Texture3D* DataManager::GenerateGradientWithEngine (vis::GradientEngine::METHOD method)
+  {
+    PROFILE_SCOPE("DataManager::GenerateGradientWithEngine");
+    vis::StructuredGridVolume* vol = GetCurrentStructuredVolume();
+    vis::GradientEngine gradient_engine;
+    gradient_engine.SetMethod(method);
+
+    // Encoded row by row in the texel format, without a float copy of the field
+    std::vector<uint8_t> gradient = gradient_engine.ComputePacked(vol, vis::GetGradientOutputFormat(curr_gradient_texture_format));
+    if (gradient.empty()) return nullptr;
+    return vis::GeneratePackedGradientTexture(gradient.data(), vol->GetWidth(), vol->GetHeight(), vol->GetDepth(),
+      curr_gradient_texture_format);
+  }
 }
\ No newline at end of file
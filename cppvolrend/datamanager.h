@@ -17,18 +17,36 @@
  * <path to file 5 from "path to resources"> <name of file 5 to be displayed in UI>
  * ... until eof
  *
+ * RequestData reads another dataset in a background thread, while the
+ *   current one keeps being rendered. SwapLoadedData, called by the GL
+ *   thread between two frames, uploads the loaded data and swaps it with
+ *   the current resources, which are kept until ReleaseSwappedData (after
+ *   the renderer was initialized again with the new resources).
+ *
+ * The renderers read the transfer function from the snapshots of a
+ *   vis::TransferFunctionPublisher, published when a dataset is read or
+ *   swapped and by ReloadTransferFunction, and pick up a new one at the
+ *   next frame (see BaseVolumeRenderer::PrepareRender).
+ *
  * Leonardo Quatrin Campagnolo
  * . campagnolo.lq@gmail.com
 **/
 #ifndef VOL_VIS_UTILS_DATA_MANAGER_H
 #define VOL_VIS_UTILS_DATA_MANAGER_H
 
+#include <atomic>
 #include <iostream>
+#include <thread>
 
 #include <volvis_utils/gridvolume.h>
 #include <volvis_utils/structuredgridvolume.h>
 #include <volvis_utils/transferfunction.h>
+#include <volvis_utils/transferfunctionsnapshot.h>
 #include <volvis_utils/reader.h>
+#include <volvis_utils/gradientcache.h>
+#include <volvis_utils/volumepyramid.h>
+#include <volvis_utils/threadpool.h>
+#include <volvis_utils/utils.h>
 
 #include <gl_utils/texture3d.h>
 #include <gl_utils/texture1d.h>
@@ -64,19 +82,79 @@ namespace vis
       NONE_GRADIENT        = 3
     };
 
+    enum LOAD_STATE : unsigned int {
+      IDLE    = 0,
+      LOADING = 1,
+      READY   = 2,
+      FAILED  = 3,
+    };
+
     DataManager ();
     ~DataManager ();
 
+    // Paths read by ReadData
+    void SetDataPaths (std::string volume_path, std::string transfer_function_path);
+    std::string GetCurrentVolumePath ();
+    std::string GetCurrentTransferFunctionPath ();
+
     void ReadData ();
 
+    // Read a dataset in a background thread: volume, transfer function,
+    //  gradient (if the gpu resources are generated) and mip pyramid (if
+    //  the current one is built). The gradients computed by the compute
+    //  shader are evaluated on the cpu. Returns false if a previous
+    //  request is still loading.
+    bool RequestData (std::string volume_path, std::string transfer_function_path);
+    LOAD_STATE GetLoadState ();
+    bool IsLoading ();
+    // [0, 1] progress of the current request
+    float GetLoadProgress ();
+
+    // Must be called by the GL thread, outside of the rendering of a frame.
+    //  Returns true if the loaded dataset replaced the current one: the
+    //  renderers must be initialized again, then ReleaseSwappedData
+    //  deletes the previous resources.
+    bool SwapLoadedData ();
+    void ReleaseSwappedData ();
+
+    // If false, ReadData only reads the volume and transfer function,
+    //  without generating the volume and gradient textures (cpu renderers)
+    void SetGenerateGPUResources (bool gen_gpu_resources);
+    bool GetGenerateGPUResources ();
+
+    // Gradients are stored in a vis::GradientCache, inside cache_directory
+    //  or next to the dataset if empty, and mapped by the next executions
+    void SetGradientCache (bool use_gradient_cache, std::string cache_directory = "");
+    bool GetUseGradientCache ();
+
+    // Texel format of the gradient textures, decoded by the gpu renderer
+    void SetGradientTextureFormat (vis::GRADIENT_TEXTURE_FORMAT format);
+    vis::GRADIENT_TEXTURE_FORMAT GetGradientTextureFormat ();
+
+    // Mip pyramid of the current volume, built on the first call of
+    //  GetCurrentVolumePyramid. If persisted, the levels are stored next
+    //  to the dataset (.vpyr) and loaded by the next executions
+    void SetVolumePyramid (VolumePyramid::REDUCTION reduction, bool persist);
+
+    // The cpu renderers read the volume from compressed bricks (see
+    //  vis::CompressedBricks), decoded on demand. Ignored if the gpu
+    //  resources are generated, which upload the whole volume.
+    void SetVolumeCompression (bool compress, int max_error = 0);
+
     // Read data
     vis::GridVolume* GetCurrentGridVolume ();
     vis::StructuredGridVolume* GetCurrentStructuredVolume ();
     vis::TransferFunction* GetCurrentTransferFunction ();
+    vis::TransferFunctionPublisher* GetTransferFunctionPublisher ();
+
+    // Read the transfer function file again, its snapshot is built in the
+    //  background while the current one keeps being rendered
+    bool ReloadTransferFunction ();
 
     // Processed data
     gl::Texture3D* GetCurrentVolumeTexture ();
     gl::Texture3D* GetCurrentGradientTexture ();
+    vis::VolumePyramid* GetCurrentVolumePyramid ();
 
     bool UpdateStructuredGradientTexture ();
  
@@ -88,11 +166,14 @@ namespace vis
     bool GenerateStructuredVolumeTexture ();
     bool GenerateStructuredGradientTexture ();
 
-    // Compute Shaders doesn't support rgb textures, so
-    //  we bind 3 r textures, set the data in the shader,
-    //  then we group into a single array and set into a
-    //  new rgb texture using glTexImage3D 
+    // The compute shader writes the gradient straight into a texture of
+    //  the gradient texture format, without a readback. Without compute
+    //  shaders, the same operator is evaluated by vis::GradientEngine
     gl::Texture3D* GenerateGradientWithComputeShader ();
+    gl::Texture3D* GenerateGradientWithEngine (vis::GradientEngine::METHOD method);
+
+    std::string curr_volume_path;
+    std::string curr_transfer_function_path;
     
     // structured datasets
     vis::StructuredGridVolume* curr_vr_volume;
@@ -100,10 +181,41 @@ namespace vis
 
     // transfer function
     vis::TransferFunction* curr_vr_transferfunction;
+    vis::TransferFunctionPublisher curr_tf_publisher;
 
     STRUCTURED_GRADIENT_TYPE curr_gradient_comp_model;
     gl::Texture3D* curr_gl_tex_structured_gradient;
+    vis::GRADIENT_TEXTURE_FORMAT curr_gradient_texture_format;
+
+    vis::GradientCache curr_gradient_cache;
+    bool curr_use_gradient_cache;
+
+    // Swapped with the pyramid of a loaded dataset
+    vis::VolumePyramid* curr_volume_pyramid;
+    VolumePyramid::REDUCTION curr_pyramid_reduction;
+    bool curr_persist_volume_pyramid;
+
+    bool curr_compress_volume;
+    int curr_compression_max_error;
+
+    bool curr_gen_gpu_resources;
   private:
+    struct LoadedData;
+
+    // Background thread of RequestData
+    void LoadData (LoadedData* data);
+    void JoinLoadThread ();
+    void PublishTransferFunction (bool async);
+
+    std::thread curr_load_thread;
+    std::atomic<unsigned int> curr_load_state;
+    std::atomic<float> curr_load_progress;
+    // Written by the load thread until curr_load_state leaves LOADING
+    LoadedData* curr_loaded_data;
+    // Previous resources, deleted by ReleaseSwappedData
+    LoadedData* curr_swapped_data;
+    // The cpu renderers keep using the default pool while loading
+    vis::ThreadPool* curr_load_thread_pool;
 
   };
 }
@@ -9,22 +9,68 @@
 #include <cstdio>
 #include <fstream>
 #include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <glm/glm.hpp>
 
 #include <glm/gtc/type_ptr.hpp>
 
+#include <file_utils/profiler.h>
+
 //-------------------------------------------------------
 // 1-pass - Ray Casting - GLSL
 #include "structured/rc1pass/rc1prenderer.h"
 //-------------------------------------------------------
+// 1-pass - Ray Casting - CPU
+#include "structured/rc1pcpu/rc1pcpurenderer.h"
+//-------------------------------------------------------
 
 //#define ALWAYS_OUTDATE_THE_CURRENT_VR_RENDERER
 #define RENDERING_MANAGER_TIME_PER_FPS_COUNT_MS 5000.0
 
 #define WHITE_BACKGROUND
 
-std::unique_ptr<RayCasting1Pass> curr_vol_renderer;
+std::unique_ptr<BaseVolumeRenderer> curr_vol_renderer;
+// Selected at startup with "-cpu"
+bool s_use_cpu_renderer = false;
+// Selected at startup with "-profile trace.json", written at exit
+std::string s_profile_trace_file;
+// Level of detail options: "-nolod", "-lodmax" (max-preserving levels)
+//  and "-lodcache" (levels stored next to the dataset)
+bool s_use_level_of_detail = true;
+bool s_lod_max_reduction = false;
+bool s_lod_persist = false;
+// Progressive refinement options: "-noprogressive", "-samples n" (jittered
+//  samples per pixel) and "-framebudget ms" (time per redraw)
+bool s_use_progressive_refinement = true;
+int s_progressive_samples = vis::ProgressiveRefinement::DEFAULT_NUMBER_OF_SAMPLES;
+double s_progressive_frame_budget_ms = vis::ProgressiveRefinement::DEFAULT_FRAME_BUDGET_MS;
+// "-preint k": pre-integrated transfer function with the step size
+//  multiplied by k
+bool s_use_preintegration = false;
+float s_preintegration_step_scale = 2.0f;
+// "-adaptive k": the step grows up to k times the step size in bricks
+//  with low extinction
+bool s_use_adaptive_step = false;
+float s_max_step_scale = 4.0f;
+// "-mode dvr|mip|minip|aip|mida": integrator of the renderer
+vis::RENDER_MODE s_render_mode = vis::RENDER_MODE::DIRECT_VOLUME_RENDERING;
+// "-compress e" keeps the volume of the cpu renderer as compressed bricks,
+//  e is the max error per voxel (0 is lossless)
+int s_compression_max_error = -1;
+// "-gradformat float16|rgb10a2|octahedral|octahedral8|octahedral8mag":
+//  texel format of the gradient
+vis::GRADIENT_TEXTURE_FORMAT s_gradient_texture_format = vis::GRADIENT_TEXTURE_FORMAT::FLOAT_16_GRADIENT;
+// "-dataset volume tf" (repeatable), the first one is read at startup and
+//  'n'/'p' load the next/previous one in the background, 't' reads the
+//  transfer function file again (edited while the application runs)
+std::vector<std::pair<std::string, std::string>> s_datasets;
+int s_curr_dataset = 0;
+int s_load_progress_percent = -1;
+// Last transfer function snapshot seen by the idle function
+unsigned long long s_tf_version = 0;
 vis::RenderingParameters curr_rdr_parameters;
 vis::DataManager m_data_mgr;
 
@@ -49,6 +95,17 @@ void UpdateFrameRate ()
     s_ts_last_time = s_ts_current_time;
     s_ts_n_frames = 0;
     printf("%.2lf frames per second\n", s_ts_window_fps);
+    Profiler::PrintFrameSummary();
+  }
+}
+
+void WriteProfile ()
+{
+  if (!s_profile_trace_file.empty())
+  {
+    Profiler::PrintFrameSummary();
+    Profiler::WriteChromeTrace(s_profile_trace_file);
+    s_profile_trace_file.clear();
   }
 }
 
@@ -75,6 +132,7 @@ static void s_Display (void)
   }
 
   glutSwapBuffers();
+  PROFILE_FRAME_MARK();
 }
 
 static void s_Reshape (int w, int h)
@@ -98,6 +156,7 @@ static void s_Keyboard (unsigned char key, int x, int y)
   switch (key)
   {
   case 27:
+    WriteProfile();
     exit(EXIT_FAILURE);
     return;
   default:
@@ -107,6 +166,49 @@ static void s_Keyboard (unsigned char key, int x, int y)
   PostRedisplay();
 }
 
+void RequestDataset (int dataset)
+{
+  if (s_datasets.empty()) return;
+  int n_datasets = (int)s_datasets.size();
+  dataset = ((dataset % n_datasets) + n_datasets) % n_datasets;
+  if (m_data_mgr.RequestData(s_datasets[dataset].first, s_datasets[dataset].second))
+    s_curr_dataset = dataset;
+  else
+    printf("A dataset is still loading\n");
+}
+
+// Called between frames: shows the progress of the background load and
+//  switches the renderer to the loaded dataset
+void UpdateDatasetLoading ()
+{
+  if (m_data_mgr.IsLoading())
+  {
+    int percent = (int)(m_data_mgr.GetLoadProgress() * 100.0f);
+    if (percent != s_load_progress_percent)
+    {
+      s_load_progress_percent = percent;
+      std::string title = "CppVolRend [FreeGLUT] - loading " + s_datasets[s_curr_dataset].first +
+                          " (" + std::to_string(percent) + "%)";
+      glutSetWindowTitle(title.c_str());
+    }
+    return;
+  }
+
+  if (s_load_progress_percent >= 0)
+  {
+    s_load_progress_percent = -1;
+    glutSetWindowTitle("CppVolRend [FreeGLUT]");
+  }
+
+  if (m_data_mgr.SwapLoadedData())
+  {
+    // The previous resources are released after the renderer drops them
+    curr_vol_renderer->Init(curr_rdr_parameters.GetScreenWidth(), curr_rdr_parameters.GetScreenHeight());
+    m_data_mgr.ReleaseSwappedData();
+    PostRedisplay();
+  }
+}
+
 static void s_KeyboardUp (unsigned char key, int x, int y)
 {
   curr_rdr_parameters.GetCamera()->KeyboardUp(key, x, y);
@@ -121,13 +223,26 @@ static void s_KeyboardUp (unsigned char key, int x, int y)
     );
     curr_vol_renderer->SetOutdated();
     break;
+  case 'n':
+    RequestDataset(s_curr_dataset + 1);
+    break;
+  case 'p':
+    RequestDataset(s_curr_dataset - 1);
+    break;
+  case 't':
+    m_data_mgr.ReloadTransferFunction();
+    break;
   }
   PostRedisplay();
 }
 
 static void s_OnMouse (int glut_button, int state, int x, int y)
 {
+  bool was_changing = curr_rdr_parameters.GetCamera()->Changing();
   curr_rdr_parameters.GetCamera()->MouseButton(glut_button, state, x, y);
+  // The renderer refines the level of detail once the camera stops
+  if (was_changing && !curr_rdr_parameters.GetCamera()->Changing())
+    curr_vol_renderer->SetOutdated();
   PostRedisplay();
 }
 
@@ -142,16 +257,30 @@ static void s_CloseFunc ()
 {
   gl::PipelineShader::Unbind();
   gl::ArrayObject::Unbind();
+  WriteProfile();
 }
 
 static void s_IdleFunc ()
 {
+  UpdateDatasetLoading();
+
+  // Snapshots built in the background are picked up by the next frame
+  unsigned long long tf_version = m_data_mgr.GetTransferFunctionPublisher()->GetVersion();
+  if (tf_version != s_tf_version)
+  {
+    s_tf_version = tf_version;
+    PostRedisplay();
+  }
+
   if (s_idle_rendering)
   {
 #ifdef ALWAYS_OUTDATE_THE_CURRENT_VR_RENDERER
     curr_vol_renderer->SetOutdated();
 #endif
-    PostRedisplay();
+    // Nothing changes on screen after the frame converges, input events
+    //  post their own redisplay
+    if (curr_vol_renderer->IsOutdated() || !curr_vol_renderer->IsConverged())
+      PostRedisplay();
   }
 }
 
@@ -185,6 +314,9 @@ void InitData ()
 {
   // Read Dataset and Transfer Function
   // . check datamanager.cpp for defines 
+  m_data_mgr.SetGenerateGPUResources(!s_use_cpu_renderer);
+  if (!s_datasets.empty())
+    m_data_mgr.SetDataPaths(s_datasets[0].first, s_datasets[0].second);
   m_data_mgr.ReadData();
 
   // Set first camera
@@ -195,7 +327,27 @@ void InitData ()
 
   curr_rdr_parameters.GetCamera()->SetData(&c_data);
 
-  curr_vol_renderer = std::make_unique<RayCasting1Pass>();
+  if (s_use_cpu_renderer)
+  {
+    std::unique_ptr<RayCasting1PassCPU> cpu_renderer = std::make_unique<RayCasting1PassCPU>();
+    cpu_renderer->SetLevelOfDetail(s_use_level_of_detail);
+    cpu_renderer->SetProgressiveRefinement(s_use_progressive_refinement, s_progressive_samples, s_progressive_frame_budget_ms);
+    cpu_renderer->SetPreIntegration(s_use_preintegration, s_preintegration_step_scale);
+    cpu_renderer->SetAdaptiveStep(s_use_adaptive_step, s_max_step_scale);
+    cpu_renderer->SetRenderMode(s_render_mode);
+    curr_vol_renderer = std::move(cpu_renderer);
+  }
+  else
+  {
+    std::unique_ptr<RayCasting1Pass> gpu_renderer = std::make_unique<RayCasting1Pass>();
+    gpu_renderer->SetLevelOfDetail(s_use_level_of_detail);
+    gpu_renderer->SetProgressiveRefinement(s_use_progressive_refinement, s_progressive_samples, s_progressive_frame_budget_ms);
+    gpu_renderer->SetPreIntegration(s_use_preintegration, s_preintegration_step_scale);
+    gpu_renderer->SetAdaptiveStep(s_use_adaptive_step, s_max_step_scale);
+    gpu_renderer->SetRenderMode(s_render_mode);
+    curr_vol_renderer = std::move(gpu_renderer);
+  }
+  printf("Volume Renderer: %s\n", curr_vol_renderer->GetName());
   curr_vol_renderer->SetExternalResources(&m_data_mgr, &curr_rdr_parameters);
   curr_vol_renderer->Init(curr_rdr_parameters.GetScreenWidth(), curr_rdr_parameters.GetScreenHeight());
 
@@ -206,6 +358,71 @@ void InitData ()
 int main (int argc, char **argv)
 {
   glutInit(&argc, argv);
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "-cpu")
+      s_use_cpu_renderer = true;
+    else if (arg == "-profile" && i + 1 < argc)
+      s_profile_trace_file = argv[++i];
+    else if (arg == "-nolod")
+      s_use_level_of_detail = false;
+    else if (arg == "-lodmax")
+      s_lod_max_reduction = true;
+    else if (arg == "-lodcache")
+      s_lod_persist = true;
+    else if (arg == "-noprogressive")
+      s_use_progressive_refinement = false;
+    else if (arg == "-samples" && i + 1 < argc)
+      s_progressive_samples = atoi(argv[++i]);
+    else if (arg == "-framebudget" && i + 1 < argc)
+      s_progressive_frame_budget_ms = atof(argv[++i]);
+    else if (arg == "-preint" && i + 1 < argc)
+    {
+      s_use_preintegration = true;
+      s_preintegration_step_scale = (float)atof(argv[++i]);
+    }
+    else if (arg == "-adaptive" && i + 1 < argc)
+    {
+      s_use_adaptive_step = true;
+      s_max_step_scale = (float)atof(argv[++i]);
+    }
+    else if (arg == "-mode" && i + 1 < argc)
+    {
+      std::string mode = argv[++i];
+      if (!vis::ParseRenderMode(mode, &s_render_mode))
+        printf("Unknown render mode: %s\n", mode.c_str());
+    }
+    else if (arg == "-compress" && i + 1 < argc)
+      s_compression_max_error = atoi(argv[++i]);
+    else if (arg == "-gradformat" && i + 1 < argc)
+    {
+      std::string format = argv[++i];
+      if (format == "float16")
+        s_gradient_texture_format = vis::GRADIENT_TEXTURE_FORMAT::FLOAT_16_GRADIENT;
+      else if (format == "rgb10a2")
+        s_gradient_texture_format = vis::GRADIENT_TEXTURE_FORMAT::RGB10_A2_GRADIENT;
+      else if (format == "octahedral")
+        s_gradient_texture_format = vis::GRADIENT_TEXTURE_FORMAT::OCTAHEDRAL_16_GRADIENT;
+      else if (format == "octahedral8")
+        s_gradient_texture_format = vis::GRADIENT_TEXTURE_FORMAT::OCTAHEDRAL_8_GRADIENT;
+      else if (format == "octahedral8mag")
+        s_gradient_texture_format = vis::GRADIENT_TEXTURE_FORMAT::OCTAHEDRAL_8_MAGNITUDE_GRADIENT;
+      else
+        printf("Unknown gradient format: %s (float16, rgb10a2, octahedral, octahedral8, octahedral8mag)\n", format.c_str());
+    }
+    else if (arg == "-dataset" && i + 2 < argc)
+    {
+      s_datasets.emplace_back(argv[i + 1], argv[i + 2]);
+      i += 2;
+    }
+  }
+  m_data_mgr.SetVolumeCompression(s_compression_max_error >= 0, s_compression_max_error);
+  m_data_mgr.SetGradientTextureFormat(s_gradient_texture_format);
+  m_data_mgr.SetVolumePyramid(s_lod_max_reduction ? vis::VolumePyramid::REDUCTION::MAXIMUM
+                                                  : vis::VolumePyramid::REDUCTION::AVERAGE, s_lod_persist);
+  Profiler::SetEnabled(!s_profile_trace_file.empty());
+
 #ifdef __FREEGLUT_EXT_H__
   glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_GLUTMAINLOOP_RETURNS);
 #endif
@@ -3,6 +3,8 @@
 #include <gl_utils/texture2d.h>
 #include <gl_utils/pipelineshader.h>
 
+#include <file_utils/profiler.h>
+
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <iostream>
@@ -98,11 +100,17 @@ void RenderFrameToScreen::ClearTextureImage ()
   glClearTexImage(m_screen_output->GetTextureID(), 0, GL_RGBA, GL_FLOAT, 0);
 }
 
-void RenderFrameToScreen::BindImageTexture (bool multisample)
+void RenderFrameToScreen::BindImageTexture (bool multisample, GLenum access)
 {
   glActiveTexture(GL_TEXTURE0);
   glBindTexture(GL_TEXTURE_2D, m_screen_output->GetTextureID());
-  glBindImageTexture(0, m_screen_output->GetTextureID(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+  glBindImageTexture(0, m_screen_output->GetTextureID(), 0, GL_FALSE, 0, access, GL_RGBA16F);
+}
+
+void RenderFrameToScreen::SetTextureData (float* rgba_data)
+{
+  m_screen_output->SetData((GLvoid*)rgba_data, GL_RGBA16F, GL_RGBA, GL_FLOAT);
+  gl::ExitOnGLError("RenderFrameToScreen: Error on SetTextureData.");
 }
 
 void RenderFrameToScreen::Draw ()
@@ -117,6 +125,7 @@ void RenderFrameToScreen::Draw (gl::Texture2D* screen_output)
 
 void RenderFrameToScreen::Draw (GLuint screen_output_id)
 {
+  PROFILE_SCOPE("RenderFrameToScreen::Draw");
   if (m_ps_shader == nullptr)
   {
     // Shader to blend the rendered frame to the output screen (used by compute shaders)
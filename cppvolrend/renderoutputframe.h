@@ -31,7 +31,11 @@ public:
   void ClearTextures ();
   void ClearTexture ();
   void ClearTextureImage ();
-  void BindImageTexture (bool multisample = false);
+  // GL_READ_WRITE for renderers that accumulate into the frame
+  void BindImageTexture (bool multisample = false, GLenum access = GL_WRITE_ONLY);
+  // Upload a RGBA float image with the current screen resolution
+  //  . used by the renderers that compute the frame on the cpu
+  void SetTextureData (float* rgba_data);
   void Draw ();
 
   void Draw (gl::Texture2D* screen_output);
@@ -10,19 +10,36 @@
 
 #include <volvis_utils/utils.h>
 
+#include <file_utils/profiler.h>
+
 #ifndef DEGREE_TO_RADIANS
   #define DEGREE_TO_RADIANS(s) (s * (glm::pi<double>() / 180.0))
 #endif
 
 RayCasting1Pass::RayCasting1Pass ()
   : m_glsl_transfer_function(nullptr)
+  , m_glsl_transfer_function_wrapped(nullptr)
+  , m_transfer_function_row_length(0)
+  , m_glsl_preintegrated_transfer_function(nullptr)
+  , m_apply_preintegration(false)
+  , m_preintegration_step_scale(2.0f)
+  , m_glsl_occupancy(nullptr)
+  , m_apply_empty_space_skipping(true)
+  , m_glsl_sampling_rate(nullptr)
+  , m_apply_adaptive_step(false)
+  , m_max_step_scale(4.0f)
+  , m_render_mode(vis::RENDER_MODE::DIRECT_VOLUME_RENDERING)
+  , m_glsl_brick_range(nullptr)
+  , m_lod_pyramid(nullptr)
+  , m_apply_lod(true)
+  , m_apply_progressive(true)
+  , m_progressive_ms_per_ray(0.0)
   , cp_shader_rendering(nullptr)
   , m_u_step_size(0.5f)
   , m_apply_gradient_shading(true)
-  , m_rdr_frame_to_screen(CPPVOLREND_DIR)
 {
-  SetBuilt(false);
-  SetOutdated();
+  m_progressive_queries[0] = m_progressive_queries[1] = 0;
+  m_progressive_query_rays[0] = m_progressive_query_rays[1] = 0;
 }
 
 RayCasting1Pass::~RayCasting1Pass ()
@@ -30,19 +47,30 @@ RayCasting1Pass::~RayCasting1Pass ()
   Clean();
 }
 
-void RayCasting1Pass::SetExternalResources (vis::DataManager* data_mgr, vis::RenderingParameters* rdr_prm)
-{
-  m_ext_data_manager = data_mgr;
-  m_ext_rendering_parameters = rdr_prm;
-}
-
 void RayCasting1Pass::Clean ()
 {
   if (m_glsl_transfer_function) delete m_glsl_transfer_function;
   m_glsl_transfer_function = nullptr;
+  if (m_glsl_transfer_function_wrapped) delete m_glsl_transfer_function_wrapped;
+  m_glsl_transfer_function_wrapped = nullptr;
+
+  if (m_glsl_preintegrated_transfer_function) delete m_glsl_preintegrated_transfer_function;
+  m_glsl_preintegrated_transfer_function = nullptr;
+
+  if (m_glsl_occupancy) delete m_glsl_occupancy;
+  m_glsl_occupancy = nullptr;
+  if (m_glsl_sampling_rate) delete m_glsl_sampling_rate;
+  m_glsl_sampling_rate = nullptr;
+  m_occupancy_grid.Clear();
 
+  if (m_glsl_brick_range) delete m_glsl_brick_range;
+  m_glsl_brick_range = nullptr;
+
+  DestroyPyramidLevels();
   DestroyRenderingPass();
 
+  m_tf_snapshot.reset();
+
   m_rdr_frame_to_screen.Clean();
   SetBuilt(false);
 }
@@ -55,10 +83,15 @@ void RayCasting1Pass::ReloadShaders ()
 
 bool RayCasting1Pass::Init (int swidth, int sheight)
 {
+  PROFILE_SCOPE("RayCasting1Pass::Init");
   if (IsBuilt()) Clean();
 
   if (m_ext_data_manager->GetCurrentVolumeTexture() == nullptr) return false;
-  m_glsl_transfer_function = m_ext_data_manager->GetCurrentTransferFunction()->GenerateTexture_1D_RGBt();
+  vis::TransferFunctionSnapshotPtr tf = AcquireTransferFunction();
+  if (tf == nullptr) return false;
+  GenerateTransferFunctionTexture(tf->GetTable());
+  GenerateOccupancyGrid();
+  GeneratePyramidLevels();
   // Create Rendering Buffers and Shaders
   CreateRenderingPass();
   gl::ExitOnGLError("RayCasting1Pass: Error on Preparing Models and Shaders");
@@ -76,6 +109,7 @@ bool RayCasting1Pass::Init (int swidth, int sheight)
 
 bool RayCasting1Pass::Update (vis::Camera* camera)
 {
+  PROFILE_SCOPE("RayCasting1Pass::Update");
   cp_shader_rendering->Bind();
 
   cp_shader_rendering->RecomputeNumberOfGroups(m_ext_rendering_parameters->GetScreenWidth(),
@@ -96,8 +130,32 @@ bool RayCasting1Pass::Update (vis::Camera* camera)
   cp_shader_rendering->SetUniform("u_CameraAspectRatio", camera->GetAspectRatio());
   cp_shader_rendering->BindUniform("u_CameraAspectRatio");
 
-  cp_shader_rendering->SetUniform("StepSize", m_u_step_size);
-  cp_shader_rendering->BindUniform("StepSize");
+  SetTransferFunctionUniforms();
+
+  // Before SetLevelUniforms, which scales the step size
+  if (m_apply_preintegration && m_glsl_preintegrated_transfer_function == nullptr)
+    m_glsl_preintegrated_transfer_function = m_tf_snapshot->GetTransferFunction()->GenerateTexture_2D_PreIntegratedRGBt();
+  if (m_apply_preintegration && m_glsl_preintegrated_transfer_function)
+    cp_shader_rendering->SetUniformTexture2D("TexPreIntegratedTransferFunc", m_glsl_preintegrated_transfer_function->GetTextureID(), 5);
+  cp_shader_rendering->SetUniform("ApplyPreIntegration", (m_apply_preintegration && m_glsl_preintegrated_transfer_function) ? 1 : 0);
+
+  SetRenderModeUniforms();
+
+  if (m_lod_pyramid)
+  {
+    float footprint = vis::VolumePyramid::ComputeVoxelFootprint(m_ext_data_manager->GetCurrentStructuredVolume(),
+      camera->GetEye(), (float)tan(DEGREE_TO_RADIANS(camera->GetFovY()) / 2.0), m_rdr_frame_to_screen.GetHeight());
+    m_lod_selector.Update(m_lod_pyramid, m_lod_pyramid->SelectLevel(footprint), camera->Changing());
+  }
+  SetLevelUniforms(m_lod_selector.GetLevel());
+
+  // A single pass over every pixel, overwritten by DispatchProgressive
+  cp_shader_rendering->SetUniform("ProgressiveStride", 1);
+  cp_shader_rendering->SetUniform("ProgressiveFirstRow", 0);
+  cp_shader_rendering->SetUniform("ProgressiveSkipCoarser", 0);
+  cp_shader_rendering->SetUniform("ProgressiveSamples", 0);
+  cp_shader_rendering->SetUniform("JitterSeed", 0);
+  m_progressive.Reset();
 
   cp_shader_rendering->SetUniform("ApplyOcclusion", 1);
   cp_shader_rendering->BindUniform("ApplyOcclusion");
@@ -107,6 +165,8 @@ bool RayCasting1Pass::Update (vis::Camera* camera)
 
   cp_shader_rendering->SetUniform("ApplyGradientPhongShading", (m_apply_gradient_shading && m_ext_data_manager->GetCurrentGradientTexture()) ? 1 : 0);
   cp_shader_rendering->BindUniform("ApplyGradientPhongShading");
+  cp_shader_rendering->SetUniform("GradientFormat", (int)m_ext_data_manager->GetGradientTextureFormat());
+  cp_shader_rendering->BindUniform("GradientFormat");
 
   cp_shader_rendering->SetUniform("BlinnPhongKa", m_ext_rendering_parameters->GetBlinnPhongKambient());
   cp_shader_rendering->BindUniform("BlinnPhongKa");
@@ -135,52 +195,237 @@ bool RayCasting1Pass::Update (vis::Camera* camera)
 
 void RayCasting1Pass::Redraw ()
 {
-  m_rdr_frame_to_screen.ClearTexture();
+  PROFILE_SCOPE("RayCasting1Pass::Redraw");
+  if (!m_apply_progressive)
+  {
+    m_rdr_frame_to_screen.ClearTexture();
 
-  cp_shader_rendering->Bind();
-  m_rdr_frame_to_screen.BindImageTexture();
+    cp_shader_rendering->Bind();
+    m_rdr_frame_to_screen.BindImageTexture();
 
-  cp_shader_rendering->Dispatch();
-  gl::ComputeShader::Unbind();
+    cp_shader_rendering->Dispatch();
+    gl::ComputeShader::Unbind();
+  }
+  else if (!m_progressive.IsConverged())
+  {
+    DispatchProgressive();
+  }
  
   m_rdr_frame_to_screen.Draw();
+
+  // Update binds the next finer level, once the image of this one is complete
+  if (m_lod_pyramid && (!m_apply_progressive || m_progressive.HasFullImage()) && m_lod_selector.Refine(m_lod_pyramid))
+    SetOutdated();
+}
+
+bool RayCasting1Pass::IsConverged ()
+{
+  return !m_apply_progressive || m_progressive.IsConverged();
+}
+
+void RayCasting1Pass::SetLevelOfDetail (bool apply)
+{
+  m_apply_lod = apply;
+  if (IsBuilt())
+  {
+    GeneratePyramidLevels();
+    SetOutdated();
+  }
 }
 
-void RayCasting1Pass::Reshape (int w, int h)
+void RayCasting1Pass::SetProgressiveRefinement (bool apply, int n_samples, double frame_budget_ms)
 {
-  m_rdr_frame_to_screen.UpdateScreenResolution(w, h);
-  gl::ExitOnGLError("Error on Reshape (screen_output texture).");
+  m_apply_progressive = apply;
+  m_progressive.SetNumberOfSamples(n_samples);
+  m_progressive.SetFrameBudget(frame_budget_ms);
   SetOutdated();
 }
 
+void RayCasting1Pass::SetPreIntegration (bool apply, float step_scale)
+{
+  m_apply_preintegration = apply;
+  m_preintegration_step_scale = glm::max(step_scale, 1.0f);
+  SetOutdated();
+}
 
-void RayCasting1Pass::PrepareRender (vis::Camera* camera)
+void RayCasting1Pass::SetAdaptiveStep (bool apply, float max_step_scale)
 {
-  if (IsOutdated())
+  bool rebuild = (apply != m_apply_adaptive_step) && IsBuilt();
+  m_apply_adaptive_step = apply;
+  m_max_step_scale = glm::max(max_step_scale, 1.0f);
+  // The grids only compute the sampling rate when applied
+  if (rebuild)
   {
-    Update(camera);
-    vr_outdated = false;
+    GenerateOccupancyGrid();
+    GeneratePyramidLevels();
   }
+  SetOutdated();
 }
 
-void RayCasting1Pass::SetOutdated ()
+void RayCasting1Pass::SetRenderMode (vis::RENDER_MODE mode)
 {
-  vr_outdated = true;
+  m_render_mode = mode;
+  SetOutdated();
 }
 
-bool RayCasting1Pass::IsOutdated ()
+void RayCasting1Pass::UpdateTransferFunction (vis::TransferFunctionSnapshotPtr snapshot)
 {
-  return vr_outdated;
+  PROFILE_SCOPE("RayCasting1Pass::UpdateTransferFunction");
+  int first, last;
+  if (!snapshot->GetChangedRange(m_tf_snapshot.get(), &first, &last))
+    return;
+
+  // Only the changed texels are uploaded, the texture and its lookup
+  //  uniforms are set again by Update otherwise
+  const vis::TransferFunctionTable& table = snapshot->GetTable();
+  if (m_glsl_transfer_function && (int)m_glsl_transfer_function->GetLength() == table.GetLength())
+  {
+    std::vector<float> texels((size_t)(last - first + 1) * 4);
+    for (int i = first; i <= last; i++)
+    {
+      for (int c = 0; c < 4; c++)
+        texels[(i - first) * 4 + c] = table.GetChannel((vis::TransferFunctionTable::CHANNEL)c)[i];
+    }
+    m_glsl_transfer_function->SetSubData((GLvoid*)texels.data(), first, last - first + 1, GL_RGBA, GL_FLOAT);
+  }
+  else
+  {
+    GenerateTransferFunctionTexture(table);
+  }
+
+  // Every segment crossing the changed range has another integral,
+  //  generated again by Update
+  if (m_glsl_preintegrated_transfer_function) delete m_glsl_preintegrated_transfer_function;
+  m_glsl_preintegrated_transfer_function = nullptr;
+
+  // Only the bricks fetching changed extinction entries are tested again,
+  //  the textures are uploaded if any of them changed
+  if (!snapshot->GetChangedRange(m_tf_snapshot.get(), &first, &last, true))
+    return;
+
+  vis::StructuredGridVolume* vol = m_ext_data_manager->GetCurrentStructuredVolume();
+  if (m_glsl_occupancy && m_occupancy_grid.Update(vol->GetBricks(), table, first, last) > 0)
+    GenerateOccupancyTextures(&m_occupancy_grid, &m_glsl_occupancy, &m_glsl_sampling_rate);
+  for (int l = 1; l <= (int)m_lod_levels.size(); l++)
+  {
+    PyramidLevel* level = m_lod_levels[l - 1];
+    if (level == nullptr || level->occupancy == nullptr) continue;
+    if (level->occupancy_grid.Update(m_lod_pyramid->GetLevel(l)->GetBricks(), table, first, last) > 0)
+      GenerateOccupancyTextures(&level->occupancy_grid, &level->occupancy, &level->sampling_rate);
+  }
 }
 
-bool RayCasting1Pass::IsBuilt ()
+void RayCasting1Pass::SetRenderModeUniforms ()
 {
-  return vr_built;
+  vis::StructuredGridVolume* vol = m_ext_data_manager->GetCurrentStructuredVolume();
+  bool skip_bricks = m_render_mode == vis::RENDER_MODE::MAXIMUM_INTENSITY_PROJECTION ||
+                     m_render_mode == vis::RENDER_MODE::MINIMUM_INTENSITY_PROJECTION;
+  if (skip_bricks && m_glsl_brick_range == nullptr)
+  {
+    if (vol->GetBricks() == nullptr)
+      vol->BuildBricks(vol->GetNativeBrickSize());
+    m_glsl_brick_range = vis::GenerateBrickRangeTexture(vol->GetBricks());
+  }
+  if (m_glsl_brick_range)
+  {
+    glm::vec3 vol_voxelsize = glm::vec3(vol->GetScaleX(), vol->GetScaleY(), vol->GetScaleZ());
+    cp_shader_rendering->SetUniformTexture3D("TexBrickRange", m_glsl_brick_range->GetTextureID(), 8);
+    cp_shader_rendering->SetUniform("BrickRangeSize", vol_voxelsize * (float)vol->GetBricks()->GetBrickSize());
+  }
+
+  // The MIP/MinIP rays stop at the max/min density of the volume
+  double density_min = 0.0, density_max = 1.0;
+  if (m_render_mode != vis::RENDER_MODE::DIRECT_VOLUME_RENDERING)
+    vol->GetNormalizedRange(&density_min, &density_max);
+  cp_shader_rendering->SetUniform("RenderMode", (int)m_render_mode);
+  cp_shader_rendering->SetUniform("DensityMin", (float)density_min);
+  cp_shader_rendering->SetUniform("DensityMax", (float)density_max);
 }
 
-void RayCasting1Pass::SetBuilt (bool b_built)
+void RayCasting1Pass::DispatchProgressive ()
 {
-  vr_built = b_built;
+  PROFILE_SCOPE("RayCasting1Pass::DispatchProgressive");
+  ReadProgressiveQueries();
+
+  int width = m_rdr_frame_to_screen.GetWidth();
+  int height = m_rdr_frame_to_screen.GetHeight();
+
+  cp_shader_rendering->Bind();
+  m_rdr_frame_to_screen.BindImageTexture(false, GL_READ_WRITE);
+
+  // Time this frame if a query is free
+  int query = (m_progressive_query_rays[0] == 0) ? 0 : ((m_progressive_query_rays[1] == 0) ? 1 : -1);
+  if (query >= 0)
+    glBeginQuery(GL_TIME_ELAPSED, m_progressive_queries[query]);
+
+  int n_rays = 0;
+  double estimated_ms = 0.0;
+  while (!m_progressive.IsConverged() && estimated_ms < m_progressive.GetFrameBudget())
+  {
+    int stride = m_progressive.GetStride();
+    int grid_width = (width + stride - 1) / stride;
+    int grid_height = (height + stride - 1) / stride;
+    int first_row = m_progressive.GetNextUnit();
+
+    // Rows of the stride grid that fit in the remaining budget, in whole
+    //  work groups. Without an estimate, the first pass is dispatched at once.
+    int n_rows = grid_height - first_row;
+    if (m_progressive_ms_per_ray > 0.0)
+    {
+      int budget_rows = (int)((m_progressive.GetFrameBudget() - estimated_ms) / (m_progressive_ms_per_ray * (double)grid_width));
+      n_rows = glm::min(glm::max((budget_rows / 8) * 8, 8), n_rows);
+    }
+
+    cp_shader_rendering->SetUniform("ProgressiveStride", stride);
+    cp_shader_rendering->BindUniform("ProgressiveStride");
+    cp_shader_rendering->SetUniform("ProgressiveFirstRow", first_row);
+    cp_shader_rendering->BindUniform("ProgressiveFirstRow");
+    cp_shader_rendering->SetUniform("ProgressiveSkipCoarser", m_progressive.SkipsCoarserPixels() ? 1 : 0);
+    cp_shader_rendering->BindUniform("ProgressiveSkipCoarser");
+    cp_shader_rendering->SetUniform("ProgressiveSamples", m_progressive.GetAccumulatedSamples());
+    cp_shader_rendering->BindUniform("ProgressiveSamples");
+    cp_shader_rendering->SetUniform("JitterSeed", (int)m_progressive.GetJitterSeed());
+    cp_shader_rendering->BindUniform("JitterSeed");
+
+    cp_shader_rendering->RecomputeNumberOfGroups(grid_width, n_rows, 0);
+    cp_shader_rendering->Dispatch();
+    // The next passes read the samples of this one
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    n_rays += grid_width * n_rows;
+    m_progressive.CompleteUnits(n_rows, grid_height);
+    if (m_progressive_ms_per_ray <= 0.0)
+      break;
+    estimated_ms += m_progressive_ms_per_ray * (double)(grid_width * n_rows);
+  }
+
+  if (query >= 0)
+  {
+    glEndQuery(GL_TIME_ELAPSED);
+    m_progressive_query_rays[query] = glm::max(n_rays, 1);
+  }
+  gl::ComputeShader::Unbind();
+  PROFILE_COUNTER("RayCasting1Pass::ProgressivePass", m_progressive.GetPass());
+  gl::ExitOnGLError("RayCasting1Pass: After DispatchProgressive.");
+}
+
+void RayCasting1Pass::ReadProgressiveQueries ()
+{
+  for (int i = 0; i < 2; i++)
+  {
+    if (m_progressive_query_rays[i] == 0) continue;
+
+    // Never stall waiting for the gpu
+    GLint available = 0;
+    glGetQueryObjectiv(m_progressive_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) continue;
+
+    GLuint64 elapsed_ns = 0;
+    glGetQueryObjectui64v(m_progressive_queries[i], GL_QUERY_RESULT, &elapsed_ns);
+    double ms_per_ray = (double)elapsed_ns * 1e-6 / (double)m_progressive_query_rays[i];
+    m_progressive_ms_per_ray = (m_progressive_ms_per_ray > 0.0) ? 0.5 * (m_progressive_ms_per_ray + ms_per_ray) : ms_per_ray;
+    m_progressive_query_rays[i] = 0;
+  }
 }
 
 void RayCasting1Pass::CreateRenderingPass ()
@@ -202,10 +447,23 @@ void RayCasting1Pass::CreateRenderingPass ()
 
   if (m_ext_data_manager->GetCurrentVolumeTexture())
     cp_shader_rendering->SetUniformTexture3D("TexVolume", m_ext_data_manager->GetCurrentVolumeTexture()->GetTextureID(), 1);
-  if (m_glsl_transfer_function)
-    cp_shader_rendering->SetUniformTexture1D("TexTransferFunc", m_glsl_transfer_function->GetTextureID(), 2);
+  SetTransferFunctionUniforms();
   if (m_apply_gradient_shading && m_ext_data_manager->GetCurrentGradientTexture())
-    cp_shader_rendering->SetUniformTexture3D("TexVolumeGradient", m_ext_data_manager->GetCurrentGradientTexture()->GetTextureID(), 3);
+  {
+    // octahedral codes are fetched through an integer sampler
+    GLuint gradient_id = m_ext_data_manager->GetCurrentGradientTexture()->GetTextureID();
+    vis::GRADIENT_TEXTURE_FORMAT gradient_format = m_ext_data_manager->GetGradientTextureFormat();
+    if (gradient_format == vis::GRADIENT_TEXTURE_FORMAT::FLOAT_16_GRADIENT ||
+        gradient_format == vis::GRADIENT_TEXTURE_FORMAT::RGB10_A2_GRADIENT)
+      cp_shader_rendering->SetUniformTexture3D("TexVolumeGradient", gradient_id, 3);
+    else
+      cp_shader_rendering->SetUniformTexture3D("TexVolumeGradientOctahedral", gradient_id, 9);
+  }
+  if (m_glsl_occupancy)
+  {
+    cp_shader_rendering->SetUniformTexture3D("TexOccupancy", m_glsl_occupancy->GetTextureID(), 4);
+    cp_shader_rendering->SetUniform("BrickSize", vol_voxelsize * (float)m_occupancy_grid.GetBrickSize());
+  }
 
   cp_shader_rendering->SetUniform("VolumeGridResolution", vol_resolution);
   cp_shader_rendering->SetUniform("VolumeVoxelSize", vol_voxelsize);
@@ -213,6 +471,9 @@ void RayCasting1Pass::CreateRenderingPass ()
 
   cp_shader_rendering->BindUniforms();
   cp_shader_rendering->Unbind();
+
+  glGenQueries(2, m_progressive_queries);
+  m_progressive_query_rays[0] = m_progressive_query_rays[1] = 0;
 }
 
 void RayCasting1Pass::DestroyRenderingPass ()
@@ -220,6 +481,10 @@ void RayCasting1Pass::DestroyRenderingPass ()
   if (cp_shader_rendering) delete cp_shader_rendering;
   cp_shader_rendering = nullptr;
 
+  if (m_progressive_queries[0]) glDeleteQueries(2, m_progressive_queries);
+  m_progressive_queries[0] = m_progressive_queries[1] = 0;
+  m_progressive_query_rays[0] = m_progressive_query_rays[1] = 0;
+
   gl::ExitOnGLError("Could not destroy shaders");
 }
 
@@ -229,4 +494,175 @@ void RayCasting1Pass::RecreateRenderingPass ()
   CreateRenderingPass();
 
   gl::ExitOnGLError("Could not recreate rendering pass");
+}
+
+void RayCasting1Pass::GenerateTransferFunctionTexture (const vis::TransferFunctionTable& table)
+{
+  if (m_glsl_transfer_function) delete m_glsl_transfer_function;
+  m_glsl_transfer_function = nullptr;
+  if (m_glsl_transfer_function_wrapped) delete m_glsl_transfer_function_wrapped;
+  m_glsl_transfer_function_wrapped = nullptr;
+
+  GLint max_texture_size = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+  if (table.GetLength() <= max_texture_size)
+  {
+    m_glsl_transfer_function = table.GenerateTexture_1D_RGBt();
+    m_transfer_function_row_length = 0;
+  }
+  else
+  {
+    m_glsl_transfer_function_wrapped = table.GenerateTexture_2D_WrappedRGBt(max_texture_size);
+    m_transfer_function_row_length = max_texture_size;
+    printf("RayCasting1Pass: transfer function table of %d entries stored in rows of %d texels\n",
+           table.GetLength(), max_texture_size);
+  }
+}
+
+void RayCasting1Pass::SetTransferFunctionUniforms ()
+{
+  if (m_tf_snapshot == nullptr) return;
+  const vis::TransferFunctionTable& table = m_tf_snapshot->GetTable();
+  if (m_glsl_transfer_function)
+    cp_shader_rendering->SetUniformTexture1D("TexTransferFunc", m_glsl_transfer_function->GetTextureID(), 2);
+  if (m_glsl_transfer_function_wrapped)
+    cp_shader_rendering->SetUniformTexture2D("TexTransferFuncWrapped", m_glsl_transfer_function_wrapped->GetTextureID(), 6);
+  cp_shader_rendering->SetUniform("TransferFunctionScale", table.GetScale());
+  cp_shader_rendering->SetUniform("TransferFunctionOffset", table.GetOffset());
+  cp_shader_rendering->SetUniform("TransferFunctionLength", (float)table.GetLength());
+  cp_shader_rendering->SetUniform("TransferFunctionRowLength", m_transfer_function_row_length);
+}
+
+void RayCasting1Pass::GenerateOccupancyGrid ()
+{
+  PROFILE_SCOPE("RayCasting1Pass::GenerateOccupancyGrid");
+  if (m_glsl_occupancy) delete m_glsl_occupancy;
+  m_glsl_occupancy = nullptr;
+  if (m_glsl_sampling_rate) delete m_glsl_sampling_rate;
+  m_glsl_sampling_rate = nullptr;
+  m_occupancy_grid.Clear();
+
+  vis::StructuredGridVolume* vol = m_ext_data_manager->GetCurrentStructuredVolume();
+  if ((!m_apply_empty_space_skipping && !m_apply_adaptive_step) || vol == nullptr || m_tf_snapshot == nullptr) return;
+
+  if (vol->GetBricks() == nullptr)
+    vol->BuildBricks(vol->GetNativeBrickSize());
+
+  m_occupancy_grid.SetComputeSamplingRate(m_apply_adaptive_step);
+  if (m_occupancy_grid.Build(vol->GetBricks(), m_tf_snapshot->GetTable()))
+    GenerateOccupancyTextures(&m_occupancy_grid, &m_glsl_occupancy, &m_glsl_sampling_rate);
+}
+
+void RayCasting1Pass::GenerateOccupancyTextures (const vis::OccupancyGrid* grid, gl::Texture3D** occupancy,
+                                                 gl::Texture3D** sampling_rate)
+{
+  if (*occupancy) delete *occupancy;
+  *occupancy = vis::GenerateOccupancyTexture(grid);
+  if (*sampling_rate) delete *sampling_rate;
+  *sampling_rate = vis::GenerateSamplingRateTexture(grid);
+}
+
+void RayCasting1Pass::GeneratePyramidLevels ()
+{
+  PROFILE_SCOPE("RayCasting1Pass::GeneratePyramidLevels");
+  DestroyPyramidLevels();
+
+  m_lod_pyramid = m_apply_lod ? m_ext_data_manager->GetCurrentVolumePyramid() : nullptr;
+  // The levels share the upload buffers
+  gl::TextureStreamer streamer;
+  for (int l = 1; m_lod_pyramid && l < m_lod_pyramid->GetNumberOfLevels(); l++)
+  {
+    vis::StructuredGridVolume* level_vol = m_lod_pyramid->GetLevel(l);
+    if (level_vol == nullptr)
+    {
+      m_lod_levels.push_back(nullptr);
+      continue;
+    }
+
+    PyramidLevel* level = new PyramidLevel();
+    level->volume = vis::GenerateNativeRTexture(level_vol, &streamer);
+    level->occupancy = nullptr;
+    level->sampling_rate = nullptr;
+    if ((m_apply_empty_space_skipping || m_apply_adaptive_step) && m_tf_snapshot)
+    {
+      // Coarse voxels mix a wider neighborhood, so each level has its own bricks
+      if (level_vol->GetBricks() == nullptr)
+        level_vol->BuildBricks(level_vol->GetNativeBrickSize());
+      level->occupancy_grid.SetComputeSamplingRate(m_apply_adaptive_step);
+      if (level->occupancy_grid.Build(level_vol->GetBricks(), m_tf_snapshot->GetTable()))
+        GenerateOccupancyTextures(&level->occupancy_grid, &level->occupancy, &level->sampling_rate);
+    }
+
+    glm::dvec3 sv = level_vol->GetScale();
+    level->step_size = float((0.5f / glm::sqrt(3.0f)) * glm::sqrt(sv.x * sv.x + sv.y * sv.y + sv.z * sv.z));
+    m_lod_levels.push_back(level);
+  }
+  m_lod_selector.Reset();
+}
+
+void RayCasting1Pass::DestroyPyramidLevels ()
+{
+  for (size_t i = 0; i < m_lod_levels.size(); i++)
+  {
+    if (m_lod_levels[i] == nullptr) continue;
+    if (m_lod_levels[i]->volume) delete m_lod_levels[i]->volume;
+    if (m_lod_levels[i]->occupancy) delete m_lod_levels[i]->occupancy;
+    if (m_lod_levels[i]->sampling_rate) delete m_lod_levels[i]->sampling_rate;
+    delete m_lod_levels[i];
+  }
+  m_lod_levels.clear();
+  m_lod_pyramid = nullptr;
+}
+
+void RayCasting1Pass::SetLevelUniforms (int level)
+{
+  vis::StructuredGridVolume* vol = m_ext_data_manager->GetCurrentStructuredVolume();
+  gl::Texture3D* tex_volume = m_ext_data_manager->GetCurrentVolumeTexture();
+  const vis::OccupancyGrid* occupancy_grid = &m_occupancy_grid;
+  gl::Texture3D* tex_occupancy = m_glsl_occupancy;
+  gl::Texture3D* tex_sampling_rate = m_glsl_sampling_rate;
+  float step_size = m_u_step_size;
+
+  PyramidLevel* lod_level = (level > 0 && level <= (int)m_lod_levels.size()) ? m_lod_levels[level - 1] : nullptr;
+  if (lod_level)
+  {
+    vol = m_lod_pyramid->GetLevel(level);
+    tex_volume = lod_level->volume;
+    occupancy_grid = &lod_level->occupancy_grid;
+    tex_occupancy = lod_level->occupancy;
+    tex_sampling_rate = lod_level->sampling_rate;
+    step_size = lod_level->step_size;
+  }
+
+  glm::vec3 vol_resolution = glm::vec3(vol->GetWidth(), vol->GetHeight(), vol->GetDepth());
+  glm::vec3 vol_voxelsize = glm::vec3(vol->GetScaleX(), vol->GetScaleY(), vol->GetScaleZ());
+
+  cp_shader_rendering->SetUniformTexture3D("TexVolume", tex_volume->GetTextureID(), 1);
+  if (tex_occupancy)
+  {
+    cp_shader_rendering->SetUniformTexture3D("TexOccupancy", tex_occupancy->GetTextureID(), 4);
+    cp_shader_rendering->SetUniform("BrickSize", vol_voxelsize * (float)occupancy_grid->GetBrickSize());
+  }
+  cp_shader_rendering->SetUniform("ApplyEmptySpaceSkipping", (m_apply_empty_space_skipping && tex_occupancy) ? 1 : 0);
+  if (m_apply_preintegration && m_glsl_preintegrated_transfer_function)
+    step_size *= m_preintegration_step_scale;
+  if (m_apply_adaptive_step && tex_sampling_rate)
+  {
+    glm::vec3 brick_extent = vol_voxelsize * (float)occupancy_grid->GetBrickSize();
+    // The longest step must fit inside one brick extent, the shader only
+    //  checks the bricks spanned by both of its ends
+    float min_extent = glm::min(brick_extent.x, glm::min(brick_extent.y, brick_extent.z));
+    cp_shader_rendering->SetUniformTexture3D("TexSamplingRate", tex_sampling_rate->GetTextureID(), 7);
+    cp_shader_rendering->SetUniform("BrickSize", brick_extent);
+    cp_shader_rendering->SetUniform("MaxStepScale", glm::max(glm::min(m_max_step_scale, min_extent / step_size), 1.0f));
+  }
+  cp_shader_rendering->SetUniform("ApplyAdaptiveStep", (m_apply_adaptive_step && tex_sampling_rate) ? 1 : 0);
+  // The brick ranges do not bound the coarse voxels, which mix the
+  //  neighbor bricks
+  bool skip_bricks = m_render_mode == vis::RENDER_MODE::MAXIMUM_INTENSITY_PROJECTION ||
+                     m_render_mode == vis::RENDER_MODE::MINIMUM_INTENSITY_PROJECTION;
+  cp_shader_rendering->SetUniform("ApplyBrickRangeSkipping", (skip_bricks && m_glsl_brick_range && lod_level == nullptr) ? 1 : 0);
+  cp_shader_rendering->SetUniform("VolumeGridResolution", vol_resolution);
+  cp_shader_rendering->SetUniform("VolumeVoxelSize", vol_voxelsize);
+  cp_shader_rendering->SetUniform("StepSize", step_size);
 }
\ No newline at end of file
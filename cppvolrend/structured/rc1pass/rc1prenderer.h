@@ -7,6 +7,25 @@
  *   . Francisco Sans, Rhadams Carmona
  *   . CLEI Electronic Journal, Volume 20, Number 2, Paper 7, 2017
  *   . DOI: 10.19153/cleiej.20.2.7
+ * . Level of detail: while the camera moves, the volume and occupancy
+ *   textures of a coarser vis::VolumePyramid level are bound, then the
+ *   levels are refined one per frame after it stops.
+ * . Progressive refinement: each Redraw dispatches bands of rows of the
+ *   passes of a vis::ProgressiveRefinement, sized by GL_TIME_ELAPSED
+ *   queries of the previous frames to fit the frame budget. The samples
+ *   of the jittered passes are averaged into the screen texture.
+ * . Pre-integration: the samples look up the 2D pre-integrated table of
+ *   the transfer function with the densities of the previous and current
+ *   samples, which allows larger steps at the same quality.
+ * . Adaptive step size: the step of each sample is read from the sampling
+ *   rate of its brick (see vis::OccupancyGrid), up to a maximum scale of
+ *   the step size where the extinction and its change are low.
+ * . Transfer function snapshots published while rendering are picked up
+ *   at the next frame: only the changed texels of the transfer function
+ *   and the occupancy of the bricks fetching them are updated.
+ * . Render modes (see vis::RENDER_MODE): the MIP/MinIP rays skip the bricks
+ *   whose (min, max) range cannot change the running max/min, read from
+ *   a texture of the bricks of the full resolution volume.
  *
  * Leonardo Quatrin Campagnolo
  * . campagnolo.lq@gmail.com
@@ -14,11 +33,13 @@
 #ifndef SINGLE_PASS_VOLUME_RENDERING_RAY_CASTING_H
 #define SINGLE_PASS_VOLUME_RENDERING_RAY_CASTING_H
 
-#include "../../datamanager.h"
-#include "../../renderingparameters.h"
-#include "../../renderoutputframe.h"
+#include "../../volrenderbase.h"
 #include <volvis_utils/structuredgridvolume.h>
 #include <volvis_utils/transferfunction.h>
+#include <volvis_utils/occupancygrid.h>
+#include <volvis_utils/volumepyramid.h>
+#include <volvis_utils/progressiverefinement.h>
+#include <volvis_utils/rendermode.h>
 
 #include <volvis_utils/camera.h>
 
@@ -32,7 +53,9 @@
 #include <gl_utils/pipelineshader.h>
 #include <gl_utils/computeshader.h>
 
-class RayCasting1Pass
+#include <vector>
+
+class RayCasting1Pass : public BaseVolumeRenderer
 {
 public:
   RayCasting1Pass ();
@@ -43,54 +66,120 @@ public:
   virtual const char* GetName () { return "1-Pass - Ray Casting"; }
   virtual const char* GetAbbreviationName () { return "s_1rc"; }
 
-  void SetExternalResources (vis::DataManager* data_mgr, vis::RenderingParameters* rdr_prm);
-
   virtual void Clean ();
   virtual void ReloadShaders ();
 
   virtual bool Init (int shader_width, int shader_height);
   virtual bool Update (vis::Camera* camera);
   virtual void Redraw ();
-  virtual void Reshape (int w, int h);
 
   virtual vis::GRID_VOLUME_DATA_TYPE GetDataTypeSupport ()
   {
     return vis::GRID_VOLUME_DATA_TYPE::STRUCTURED;
   }
 
-  void PrepareRender (vis::Camera* camera);
-  virtual void SetOutdated ();
-  bool IsOutdated ();
-
-  bool IsBuilt ();
+  virtual bool IsConverged ();
 
-  virtual int GetScreenTextureID() {
-    return m_rdr_frame_to_screen.GetScreenOutputTexture()->GetTextureID();
-  }
+  void SetLevelOfDetail (bool apply);
+  // n_samples jittered samples per pixel, the frame is traced in a single
+  //  dispatch if disabled
+  void SetProgressiveRefinement (bool apply, int n_samples = vis::ProgressiveRefinement::DEFAULT_NUMBER_OF_SAMPLES,
+                                 double frame_budget_ms = vis::ProgressiveRefinement::DEFAULT_FRAME_BUDGET_MS);
 
-protected:
-  void SetBuilt(bool b_built);
+  // The step size of every level is multiplied by step_scale if applied
+  void SetPreIntegration (bool apply, float step_scale = 2.0f);
 
-  //////////////////////////////////////////
-  // State Variables
-  bool vr_built;
-  bool vr_outdated;
+  // The step grows up to max_step_scale times the step size of the level
+  //  and never beyond the smallest brick extent of the level
+  void SetAdaptiveStep (bool apply, float max_step_scale = 4.0f);
 
-  //////////////////////////////////////////
-  // External Resources
-  vis::DataManager* m_ext_data_manager;
-  vis::RenderingParameters* m_ext_rendering_parameters;
+  // DIRECT_VOLUME_RENDERING by default
+  void SetRenderMode (vis::RENDER_MODE mode);
 
-  //////////////////////////////////////////
-  // Render Screen Texture
-  vis::RenderFrameToScreen m_rdr_frame_to_screen;
+protected:
+  virtual void UpdateTransferFunction (vis::TransferFunctionSnapshotPtr snapshot);
 
 private:
+  // Textures of a coarse level of the volume pyramid
+  struct PyramidLevel
+  {
+    gl::Texture3D* volume;
+    vis::OccupancyGrid occupancy_grid;
+    gl::Texture3D* occupancy;
+    gl::Texture3D* sampling_rate;
+    float step_size;
+  };
+
   void CreateRenderingPass ();
   void DestroyRenderingPass ();
   void RecreateRenderingPass ();
+
+  // 1D texture of the snapshot table, or rows of GL_MAX_TEXTURE_SIZE texels
+  //  if the table is longer (see vis::TransferFunctionTable)
+  void GenerateTransferFunctionTexture (const vis::TransferFunctionTable& table);
+  // Bind the transfer function texture and its lookup uniforms
+  void SetTransferFunctionUniforms ();
+
+  // Rebuilt with the transfer function texture
+  void GenerateOccupancyGrid ();
+  // Occupancy and sampling rate textures of a grid, after a Build or Update
+  static void GenerateOccupancyTextures (const vis::OccupancyGrid* grid, gl::Texture3D** occupancy,
+                                         gl::Texture3D** sampling_rate);
+
+  void GeneratePyramidLevels ();
+  void DestroyPyramidLevels ();
+  // Set the volume, occupancy and step size uniforms of a level
+  void SetLevelUniforms (int level);
+
+  // Render mode uniforms, the brick range texture is generated on the
+  //  first MIP/MinIP frame
+  void SetRenderModeUniforms ();
+
+  // Dispatch the rows of the progressive passes that fit in the frame budget
+  void DispatchProgressive ();
+  // Update the time per ray with the queries already finished by the gpu
+  void ReadProgressiveQueries ();
   
   gl::Texture1D* m_glsl_transfer_function;
+  // Used instead of m_glsl_transfer_function for tables longer than
+  //  GL_MAX_TEXTURE_SIZE
+  gl::Texture2D* m_glsl_transfer_function_wrapped;
+  int m_transfer_function_row_length;
+
+  // Generated on the first frame with pre-integration, and after each
+  //  transfer function update
+  gl::Texture2D* m_glsl_preintegrated_transfer_function;
+  bool m_apply_preintegration;
+  float m_preintegration_step_scale;
+
+  // Bricks mapped to zero extinction are skipped by the rays
+  vis::OccupancyGrid m_occupancy_grid;
+  gl::Texture3D* m_glsl_occupancy;
+  bool m_apply_empty_space_skipping;
+
+  // Per brick sampling rate of the same grid
+  gl::Texture3D* m_glsl_sampling_rate;
+  bool m_apply_adaptive_step;
+  float m_max_step_scale;
+
+  vis::RENDER_MODE m_render_mode;
+  // (min, max) of each brick of the volume
+  gl::Texture3D* m_glsl_brick_range;
+
+  vis::VolumePyramid* m_lod_pyramid;
+  // m_lod_levels[l - 1] holds the level l, nullptr if not kept
+  std::vector<PyramidLevel*> m_lod_levels;
+  vis::PyramidLevelSelector m_lod_selector;
+  bool m_apply_lod;
+
+  vis::ProgressiveRefinement m_progressive;
+  bool m_apply_progressive;
+  // GL_TIME_ELAPSED queries of the last frames and their number of rays,
+  //  0 if the query is not pending
+  GLuint m_progressive_queries[2];
+  int m_progressive_query_rays[2];
+  // Estimated from the queries, 0 until the first one is read
+  double m_progressive_ms_per_ray;
 
   gl::ComputeShader*  cp_shader_rendering;
 
@@ -0,0 +1,253 @@
+#include "../../defines.h"
+#include "rc1pcpurenderer.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <volvis_utils/camera.h>
+
+#include <file_utils/profiler.h>
+
+#include <chrono>
+
+#ifndef DEGREE_TO_RADIANS
+  #define DEGREE_TO_RADIANS(s) (s * (glm::pi<double>() / 180.0))
+#endif
+
+RayCasting1PassCPU::RayCasting1PassCPU ()
+  : m_cpu_ray_caster(vis::ThreadPool::GetDefault())
+  , m_lod_pyramid(nullptr)
+  , m_apply_lod(true)
+  , m_apply_progressive(true)
+  , m_frame_outdated(true)
+  , m_u_step_size(0.5f)
+  , m_apply_gradient_shading(true)
+  , m_apply_preintegration(false)
+  , m_preintegration_step_scale(2.0f)
+  , m_apply_adaptive_step(false)
+  , m_max_step_scale(vis::CPURayCaster::DEFAULT_MAX_STEP_SCALE)
+  , m_render_mode(vis::RENDER_MODE::DIRECT_VOLUME_RENDERING)
+{
+}
+
+RayCasting1PassCPU::~RayCasting1PassCPU ()
+{
+  Clean();
+}
+
+void RayCasting1PassCPU::Clean ()
+{
+  m_cpu_ray_caster.SetVolume(nullptr);
+  m_cpu_ray_caster.SetTransferFunction(nullptr);
+  m_tf_snapshot.reset();
+  m_frame_data.clear();
+
+  m_lod_ray_casters.clear();
+  m_lod_pyramid = nullptr;
+  m_lod_selector.Reset();
+  m_progressive.Reset();
+
+  m_rdr_frame_to_screen.Clean();
+  SetBuilt(false);
+}
+
+bool RayCasting1PassCPU::Init (int swidth, int sheight)
+{
+  PROFILE_SCOPE("RayCasting1PassCPU::Init");
+  if (IsBuilt()) Clean();
+
+  vis::StructuredGridVolume* vol = m_ext_data_manager->GetCurrentStructuredVolume();
+  vis::TransferFunctionSnapshotPtr tf = AcquireTransferFunction();
+  if (vol == nullptr || tf == nullptr) return false;
+
+  float step_scale = m_apply_preintegration ? m_preintegration_step_scale : 1.0f;
+  // Before SetVolume, which builds the bricks used by the mode
+  m_cpu_ray_caster.SetRenderMode(m_render_mode);
+  m_cpu_ray_caster.SetVolume(vol);
+  m_cpu_ray_caster.SetPreIntegration(m_apply_preintegration);
+  m_cpu_ray_caster.SetAdaptiveStep(m_apply_adaptive_step, m_max_step_scale);
+  m_cpu_ray_caster.SetTransferFunction(tf);
+  m_cpu_ray_caster.SetGradientShading(m_apply_gradient_shading);
+
+  // estimate initial integration step
+  glm::dvec3 sv = vol->GetScale();
+  m_u_step_size = float((0.5f / glm::sqrt(3.0f)) * glm::sqrt(sv.x * sv.x + sv.y * sv.y + sv.z * sv.z));
+  m_cpu_ray_caster.SetStepSize(m_u_step_size * step_scale);
+
+  // Coarse levels, with the step size estimated from their voxel size
+  m_lod_ray_casters.clear();
+  m_lod_pyramid = m_apply_lod ? m_ext_data_manager->GetCurrentVolumePyramid() : nullptr;
+  for (int l = 1; m_lod_pyramid && l < m_lod_pyramid->GetNumberOfLevels(); l++)
+  {
+    vis::StructuredGridVolume* level_vol = m_lod_pyramid->GetLevel(l);
+    if (level_vol == nullptr)
+    {
+      m_lod_ray_casters.emplace_back();
+      continue;
+    }
+    std::unique_ptr<vis::CPURayCaster> level_ray_caster = std::make_unique<vis::CPURayCaster>(vis::ThreadPool::GetDefault());
+    level_ray_caster->SetRenderMode(m_render_mode);
+    level_ray_caster->SetVolume(level_vol);
+    level_ray_caster->SetPreIntegration(m_apply_preintegration);
+    level_ray_caster->SetAdaptiveStep(m_apply_adaptive_step, m_max_step_scale);
+    level_ray_caster->SetTransferFunction(tf);
+    level_ray_caster->SetGradientShading(m_apply_gradient_shading);
+
+    glm::dvec3 lsv = level_vol->GetScale();
+    level_ray_caster->SetStepSize(float((0.5f / glm::sqrt(3.0f)) * glm::sqrt(lsv.x * lsv.x + lsv.y * lsv.y + lsv.z * lsv.z)) * step_scale);
+    m_lod_ray_casters.push_back(std::move(level_ray_caster));
+  }
+  m_lod_selector.Reset();
+
+  Reshape(swidth, sheight);
+
+  SetBuilt(true);
+  SetOutdated();
+  return true;
+}
+
+bool RayCasting1PassCPU::Update (vis::Camera* camera)
+{
+  PROFILE_SCOPE("RayCasting1PassCPU::Update");
+  float tan_fov_y = (float)tan(DEGREE_TO_RADIANS(camera->GetFovY()) / 2.0);
+
+  // Every level gets the same camera, the level is chosen at Redraw
+  for (int l = 0; l <= (int)m_lod_ray_casters.size(); l++)
+  {
+    vis::CPURayCaster* ray_caster = GetRayCaster(l);
+    ray_caster->SetCamera(camera->GetEye(), camera->LookAt(), tan_fov_y, camera->GetAspectRatio());
+    ray_caster->SetBlinnPhong(m_ext_rendering_parameters->GetBlinnPhongKambient(),
+                              m_ext_rendering_parameters->GetBlinnPhongKdiffuse(),
+                              m_ext_rendering_parameters->GetBlinnPhongKspecular(),
+                              m_ext_rendering_parameters->GetBlinnPhongNshininess(),
+                              m_ext_rendering_parameters->GetLightSourceSpecular(),
+                              m_ext_rendering_parameters->GetBlinnPhongLightingPosition());
+  }
+
+  if (m_lod_pyramid)
+  {
+    float footprint = vis::VolumePyramid::ComputeVoxelFootprint(m_ext_data_manager->GetCurrentStructuredVolume(),
+      camera->GetEye(), tan_fov_y, m_rdr_frame_to_screen.GetHeight());
+    m_lod_selector.Update(m_lod_pyramid, m_lod_pyramid->SelectLevel(footprint), camera->Changing());
+  }
+
+  m_progressive.Reset();
+  m_frame_outdated = true;
+  return true;
+}
+
+void RayCasting1PassCPU::Redraw ()
+{
+  PROFILE_SCOPE("RayCasting1PassCPU::Redraw");
+  // Only trace the rays again if the camera or the parameters changed,
+  //  or to refine the progressive frame
+  if (m_frame_outdated || (m_apply_progressive && !m_progressive.IsConverged()))
+  {
+    int w = m_rdr_frame_to_screen.GetWidth();
+    int h = m_rdr_frame_to_screen.GetHeight();
+    m_frame_data.resize((size_t)w * (size_t)h * 4);
+
+    vis::CPURayCaster* ray_caster = GetRayCaster(m_lod_selector.GetLevel());
+    auto t_init = std::chrono::steady_clock::now();
+    if (m_apply_progressive)
+    {
+      // The level of detail adapts to the time of the first pass, the
+      //  next ones are bounded by the frame budget
+      bool first_pass = m_progressive.GetPass() == 0 && m_progressive.GetNextUnit() == 0;
+      ray_caster->RenderProgressive(w, h, m_frame_data.data(), &m_progressive);
+      if (first_pass)
+      {
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_init).count();
+        double progress = m_progressive.GetPass() > 0 ? 1.0 : glm::max(m_progressive.GetPassProgress(), 0.01);
+        m_lod_selector.FrameRendered(ms / progress);
+      }
+    }
+    else
+    {
+      ray_caster->Render(w, h, m_frame_data.data());
+      m_lod_selector.FrameRendered(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_init).count());
+    }
+    PROFILE_COUNTER("RayCasting1PassCPU::ProgressivePass", m_progressive.GetPass());
+    m_rdr_frame_to_screen.SetTextureData(m_frame_data.data());
+
+    m_frame_outdated = false;
+
+    // Render the next finer level after the image of this one is complete
+    if (m_lod_pyramid && (!m_apply_progressive || m_progressive.HasFullImage()) && m_lod_selector.Refine(m_lod_pyramid))
+      SetOutdated();
+  }
+
+  m_rdr_frame_to_screen.Draw();
+}
+
+void RayCasting1PassCPU::Reshape (int w, int h)
+{
+  BaseVolumeRenderer::Reshape(w, h);
+  m_progressive.Reset();
+  m_frame_outdated = true;
+}
+
+bool RayCasting1PassCPU::IsConverged ()
+{
+  return !m_apply_progressive || m_progressive.IsConverged();
+}
+
+void RayCasting1PassCPU::SetLevelOfDetail (bool apply)
+{
+  m_apply_lod = apply;
+  if (IsBuilt())
+    Init(m_rdr_frame_to_screen.GetWidth(), m_rdr_frame_to_screen.GetHeight());
+}
+
+void RayCasting1PassCPU::SetProgressiveRefinement (bool apply, int n_samples, double frame_budget_ms)
+{
+  m_apply_progressive = apply;
+  m_progressive.SetNumberOfSamples(n_samples);
+  m_progressive.SetFrameBudget(frame_budget_ms);
+  m_frame_outdated = true;
+}
+
+void RayCasting1PassCPU::SetPreIntegration (bool apply, float step_scale)
+{
+  m_apply_preintegration = apply;
+  m_preintegration_step_scale = glm::max(step_scale, 1.0f);
+  // The tables are built with the transfer function of the ray casters
+  if (IsBuilt())
+    Init(m_rdr_frame_to_screen.GetWidth(), m_rdr_frame_to_screen.GetHeight());
+}
+
+void RayCasting1PassCPU::SetAdaptiveStep (bool apply, float max_step_scale)
+{
+  m_apply_adaptive_step = apply;
+  m_max_step_scale = glm::max(max_step_scale, 1.0f);
+  if (!IsBuilt()) return;
+  m_cpu_ray_caster.SetAdaptiveStep(m_apply_adaptive_step, m_max_step_scale);
+  for (size_t i = 0; i < m_lod_ray_casters.size(); i++)
+  {
+    if (m_lod_ray_casters[i])
+      m_lod_ray_casters[i]->SetAdaptiveStep(m_apply_adaptive_step, m_max_step_scale);
+  }
+  m_frame_outdated = true;
+}
+
+void RayCasting1PassCPU::SetRenderMode (vis::RENDER_MODE mode)
+{
+  m_render_mode = mode;
+  if (!IsBuilt()) return;
+  for (int l = 0; l <= (int)m_lod_ray_casters.size(); l++)
+    GetRayCaster(l)->SetRenderMode(m_render_mode);
+  m_frame_outdated = true;
+}
+
+void RayCasting1PassCPU::UpdateTransferFunction (vis::TransferFunctionSnapshotPtr snapshot)
+{
+  for (int l = 0; l <= (int)m_lod_ray_casters.size(); l++)
+    GetRayCaster(l)->SetTransferFunction(snapshot);
+}
+
+vis::CPURayCaster* RayCasting1PassCPU::GetRayCaster (int level)
+{
+  if (level <= 0 || level > (int)m_lod_ray_casters.size() || !m_lod_ray_casters[level - 1])
+    return &m_cpu_ray_caster;
+  return m_lod_ray_casters[level - 1].get();
+}
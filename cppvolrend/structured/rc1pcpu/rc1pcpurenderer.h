@@ -0,0 +1,112 @@
+/**
+ * 1-Pass - Ray Casting - CPU
+ * . Structured Datasets
+ * . Same ray integral of RayCasting1Pass, evaluated by vis::CPURayCaster
+ *   on a work-stealing thread pool with SIMD ray packets.
+ *   The final frame is uploaded to the screen texture.
+ * . Level of detail: coarse levels of the vis::VolumePyramid are rendered
+ *   while the camera moves, keeping the frame time close to the
+ *   interaction budget, and refined one level per frame after it stops.
+ *   Each level has its own ray caster (gradient and occupancy grid).
+ * . Progressive refinement: each Redraw traces the passes of a
+ *   vis::ProgressiveRefinement within the frame budget, starting from
+ *   1/16 of the pixels after each Update. Coarse levels are refined once
+ *   their image has a sample per pixel.
+ * . Transfer function snapshots published while rendering are picked up
+ *   at the next frame, every level shares the same snapshot.
+ * . Render modes: DVR, MIP, MinIP, AIP and MIDA (see vis::RENDER_MODE),
+ *   the same integrators of RayCasting1Pass.
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef SINGLE_PASS_VOLUME_RENDERING_RAY_CASTING_CPU_H
+#define SINGLE_PASS_VOLUME_RENDERING_RAY_CASTING_CPU_H
+
+#include "../../volrenderbase.h"
+
+#include <volvis_utils/structuredgridvolume.h>
+#include <volvis_utils/transferfunction1d.h>
+#include <volvis_utils/cpuraycaster.h>
+#include <volvis_utils/volumepyramid.h>
+#include <volvis_utils/progressiverefinement.h>
+
+#include <volvis_utils/camera.h>
+
+#include <memory>
+#include <vector>
+
+class RayCasting1PassCPU : public BaseVolumeRenderer
+{
+public:
+  RayCasting1PassCPU ();
+  virtual ~RayCasting1PassCPU ();
+
+  //////////////////////////////////////////
+  // Virtual base functions
+  virtual const char* GetName () { return "1-Pass - Ray Casting - CPU"; }
+  virtual const char* GetAbbreviationName () { return "s_1rc_cpu"; }
+
+  virtual void Clean ();
+
+  virtual bool Init (int shader_width, int shader_height);
+  virtual bool Update (vis::Camera* camera);
+  virtual void Redraw ();
+  virtual void Reshape (int w, int h);
+
+  virtual vis::GRID_VOLUME_DATA_TYPE GetDataTypeSupport ()
+  {
+    return vis::GRID_VOLUME_DATA_TYPE::STRUCTURED;
+  }
+
+  virtual bool IsConverged ();
+
+  void SetLevelOfDetail (bool apply);
+  // n_samples jittered samples per pixel, the frame is traced in a single
+  //  Redraw if disabled
+  void SetProgressiveRefinement (bool apply, int n_samples = vis::ProgressiveRefinement::DEFAULT_NUMBER_OF_SAMPLES,
+                                 double frame_budget_ms = vis::ProgressiveRefinement::DEFAULT_FRAME_BUDGET_MS);
+
+  // Pre-integrated transfer function, the step size of every level is
+  //  multiplied by step_scale if applied
+  void SetPreIntegration (bool apply, float step_scale = 2.0f);
+
+  // The step grows up to max_step_scale times the step size of each level
+  void SetAdaptiveStep (bool apply, float max_step_scale = vis::CPURayCaster::DEFAULT_MAX_STEP_SCALE);
+
+  // Integrator of every level, DIRECT_VOLUME_RENDERING by default
+  void SetRenderMode (vis::RENDER_MODE mode);
+
+protected:
+  virtual void UpdateTransferFunction (vis::TransferFunctionSnapshotPtr snapshot);
+
+private:
+  // m_cpu_ray_caster renders the level 0
+  vis::CPURayCaster* GetRayCaster (int level);
+
+  vis::CPURayCaster m_cpu_ray_caster;
+
+  vis::VolumePyramid* m_lod_pyramid;
+  std::vector<std::unique_ptr<vis::CPURayCaster>> m_lod_ray_casters;
+  vis::PyramidLevelSelector m_lod_selector;
+  bool m_apply_lod;
+
+  vis::ProgressiveRefinement m_progressive;
+  bool m_apply_progressive;
+
+  std::vector<float> m_frame_data;
+  bool m_frame_outdated;
+
+  float m_u_step_size;
+  bool m_apply_gradient_shading;
+
+  bool m_apply_preintegration;
+  float m_preintegration_step_scale;
+
+  bool m_apply_adaptive_step;
+  float m_max_step_scale;
+
+  vis::RENDER_MODE m_render_mode;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#include "defines.h"
+#include "volrenderbase.h"
+
+BaseVolumeRenderer::BaseVolumeRenderer ()
+  : m_ext_data_manager(nullptr)
+  , m_ext_rendering_parameters(nullptr)
+  , m_rdr_frame_to_screen(CPPVOLREND_DIR)
+{
+  SetBuilt(false);
+  SetOutdated();
+}
+
+BaseVolumeRenderer::~BaseVolumeRenderer ()
+{
+}
+
+void BaseVolumeRenderer::SetExternalResources (vis::DataManager* data_mgr, vis::RenderingParameters* rdr_prm)
+{
+  m_ext_data_manager = data_mgr;
+  m_ext_rendering_parameters = rdr_prm;
+}
+
+void BaseVolumeRenderer::Reshape (int w, int h)
+{
+  m_rdr_frame_to_screen.UpdateScreenResolution(w, h);
+  gl::ExitOnGLError("Error on Reshape (screen_output texture).");
+  SetOutdated();
+}
+
+void BaseVolumeRenderer::PrepareRender (vis::Camera* camera)
+{
+  // One atomic load per frame while the transfer function is not edited
+  vis::TransferFunctionPublisher* tf_publisher = m_ext_data_manager ? m_ext_data_manager->GetTransferFunctionPublisher() : nullptr;
+  if (IsBuilt() && m_tf_snapshot && tf_publisher && tf_publisher->GetVersion() != m_tf_snapshot->GetVersion())
+  {
+    vis::TransferFunctionSnapshotPtr snapshot = tf_publisher->Acquire();
+    UpdateTransferFunction(snapshot);
+    m_tf_snapshot = snapshot;
+    SetOutdated();
+  }
+
+  if (IsOutdated())
+  {
+    Update(camera);
+    vr_outdated = false;
+  }
+}
+
+void BaseVolumeRenderer::SetOutdated ()
+{
+  vr_outdated = true;
+}
+
+bool BaseVolumeRenderer::IsOutdated ()
+{
+  return vr_outdated;
+}
+
+bool BaseVolumeRenderer::IsBuilt ()
+{
+  return vr_built;
+}
+
+vis::TransferFunctionSnapshotPtr BaseVolumeRenderer::AcquireTransferFunction ()
+{
+  m_tf_snapshot = m_ext_data_manager->GetTransferFunctionPublisher()->Acquire();
+  return m_tf_snapshot;
+}
+
+void BaseVolumeRenderer::SetBuilt (bool b_built)
+{
+  vr_built = b_built;
+}
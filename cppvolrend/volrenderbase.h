@@ -0,0 +1,89 @@
+/**
+ * Base class of the volume renderers used by the application
+ * . Holds the external resources and the state variables
+ *   shared by the GPU and CPU rendering backends.
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef BASE_VOLUME_RENDERER_H
+#define BASE_VOLUME_RENDERER_H
+
+#include "datamanager.h"
+#include "renderingparameters.h"
+#include "renderoutputframe.h"
+
+#include <volvis_utils/gridvolume.h>
+#include <volvis_utils/camera.h>
+
+class BaseVolumeRenderer
+{
+public:
+  BaseVolumeRenderer ();
+  virtual ~BaseVolumeRenderer ();
+
+  //////////////////////////////////////////
+  // Virtual base functions
+  virtual const char* GetName () = 0;
+  virtual const char* GetAbbreviationName () = 0;
+
+  void SetExternalResources (vis::DataManager* data_mgr, vis::RenderingParameters* rdr_prm);
+
+  virtual void Clean () = 0;
+  virtual void ReloadShaders () {}
+
+  virtual bool Init (int shader_width, int shader_height) = 0;
+  virtual bool Update (vis::Camera* camera) = 0;
+  virtual void Redraw () = 0;
+  virtual void Reshape (int w, int h);
+
+  virtual vis::GRID_VOLUME_DATA_TYPE GetDataTypeSupport () = 0;
+
+  // Picks up the newest transfer function snapshot, then calls Update
+  //  if the renderer is outdated
+  void PrepareRender (vis::Camera* camera);
+  virtual void SetOutdated ();
+  bool IsOutdated ();
+
+  // Renderers that refine the frame over several Redraws return false
+  //  until it converges, the application stops redrawing after that
+  virtual bool IsConverged () { return true; }
+
+  bool IsBuilt ();
+
+  virtual int GetScreenTextureID ()
+  {
+    return m_rdr_frame_to_screen.GetScreenOutputTexture()->GetTextureID();
+  }
+
+protected:
+  void SetBuilt (bool b_built);
+
+  // Snapshot read by Init, the renderers must not keep pointers to the
+  //  transfer function of the data manager
+  vis::TransferFunctionSnapshotPtr AcquireTransferFunction ();
+  // Called at the frame boundary with a snapshot newer than m_tf_snapshot,
+  //  which still holds the previous one. The renderer is set outdated after it.
+  virtual void UpdateTransferFunction (vis::TransferFunctionSnapshotPtr snapshot) {}
+
+  vis::TransferFunctionSnapshotPtr m_tf_snapshot;
+
+  //////////////////////////////////////////
+  // State Variables
+  bool vr_built;
+  bool vr_outdated;
+
+  //////////////////////////////////////////
+  // External Resources
+  vis::DataManager* m_ext_data_manager;
+  vis::RenderingParameters* m_ext_rendering_parameters;
+
+  //////////////////////////////////////////
+  // Render Screen Texture
+  vis::RenderFrameToScreen m_rdr_frame_to_screen;
+
+private:
+
+};
+
+#endif
@@ -0,0 +1,418 @@
+/**
+ * C++ Volume Rendering Application - Headless
+ *
+ * Offline renderer: reads a structured volume and a 1D transfer
+ *   function, renders a single frame with vis::CPURayCaster and
+ *   writes it to a .png, .ppm or .exr file.
+ * No window or OpenGL context is created.
+ *
+ * usage: cppvolrend_headless <volume> <transfer function .tf1d> <output image> [options]
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <file_utils/imagewriter.h>
+#include <file_utils/profiler.h>
+
+#include <volvis_utils/brickpager.h>
+#include <volvis_utils/reader.h>
+#include <volvis_utils/structuredgridvolume.h>
+#include <volvis_utils/transferfunction1d.h>
+#include <volvis_utils/volumecontainer.h>
+#include <volvis_utils/cpuraycaster.h>
+#include <volvis_utils/gradientcache.h>
+#include <volvis_utils/progressiverefinement.h>
+#include <volvis_utils/rendermode.h>
+#include <volvis_utils/threadpool.h>
+
+struct HeadlessParameters
+{
+  std::string volume_path;
+  std::string transfer_function_path;
+  std::string output_path;
+
+  int width = 768;
+  int height = 768;
+
+  // Same first camera of cppvolrend
+  glm::vec3 eye = glm::vec3(256.0f, 256.0f, 512.0f);
+  glm::vec3 center = glm::vec3(0.0f, 0.0f, 0.0f);
+  glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
+  float fov_y = 45.0f;
+
+  bool has_light_position = false;
+  glm::vec3 light_position = glm::vec3(0.0f);
+
+  bool gradient_shading = true;
+  bool empty_space_skipping = true;
+  // <= 0 uses the same estimate of RayCasting1Pass
+  float step_size = -1.0f;
+  // > 0 uses the pre-integrated transfer function, with the step size
+  //  multiplied by this factor
+  float preintegration_step_scale = 0.0f;
+  // > 0 grows the step up to this factor in bricks with low extinction
+  float max_step_scale = 0.0f;
+  vis::RENDER_MODE render_mode = vis::RENDER_MODE::DIRECT_VOLUME_RENDERING;
+
+  // Background used to composite the frame, ignored by .exr
+  //  and by .png when writing the alpha channel
+  glm::vec3 background = glm::vec3(1.0f);
+  bool write_alpha = false;
+
+  unsigned int n_threads = 0;
+
+  // Empty writes the cache next to the volume
+  bool use_gradient_cache = false;
+  std::string gradient_cache_directory;
+  // Storage of the gradient field of the ray caster
+  vis::GradientEngine::OUTPUT_FORMAT gradient_format = vis::GradientEngine::OUTPUT_FORMAT::FLOAT_32;
+
+  // Chrome trace of the loading and rendering stages
+  std::string profile_trace_file;
+
+  // Brick cache of .braw volumes
+  size_t pager_memory_budget = vis::BrickPager::DEFAULT_MEMORY_BUDGET;
+  // Converts the volume to a .braw file before rendering
+  std::string bricked_output_path;
+  // >= 0 keeps the volume as compressed bricks with this max error per
+  //  voxel (0 is lossless), decoded into the brick cache
+  int compression_max_error = -1;
+
+  // > 0 renders with progressive refinement until the frame converges,
+  //  with this number of jittered samples per pixel
+  int progressive_samples = 0;
+  double progressive_frame_budget_ms = vis::ProgressiveRefinement::DEFAULT_FRAME_BUDGET_MS;
+};
+
+static void PrintUsage ()
+{
+  printf("usage: cppvolrend_headless <volume> <transfer function .tf1d> <output .png/.ppm/.exr> [options]\n");
+  printf("  -size w h          image resolution (default 768 768)\n");
+  printf("  -eye x y z         camera position (default 256 256 512)\n");
+  printf("  -center x y z      camera target (default 0 0 0)\n");
+  printf("  -up x y z          camera up vector (default 0 1 0)\n");
+  printf("  -fov degrees       vertical field of view (default 45)\n");
+  printf("  -light x y z       light source position (default camera eye)\n");
+  printf("  -step s            integration step size\n");
+  printf("  -preint k          pre-integrated transfer function, step size times k\n");
+  printf("  -adaptive k        adaptive step size, up to k times the step size\n");
+  printf("  -mode m            dvr (default), mip, minip, aip or mida\n");
+  printf("  -noshading         disable gradient Blinn-Phong shading\n");
+  printf("  -noskip            disable empty space skipping\n");
+  printf("  -bg r g b          background color in [0, 1] (default 1 1 1)\n");
+  printf("  -alpha             keep the alpha channel in .png output\n");
+  printf("  -threads n         number of rendering threads (default all)\n");
+  printf("  -gradcache         cache the gradient field next to the volume\n");
+  printf("  -gradcachedir dir  cache the gradient field inside dir\n");
+  printf("  -gradformat f      gradient storage: float32 (default), float16, rgb10a2,\n");
+  printf("                     oct16, oct8 or oct8mag (octahedral normals + magnitude)\n");
+  printf("  -profile file      write a chrome trace (.json) of the run\n");
+  printf("  -budget MB         brick cache budget of .braw/compressed volumes (default 1024)\n");
+  printf("  -savebricked file  also write the volume as a bricked .braw file\n");
+  printf("  -compress e        keep the volume as compressed bricks, max error e (0 lossless)\n");
+  printf("  -progressive n     progressive refinement with n samples per pixel\n");
+  printf("  -framebudget ms    time per progressive redraw (default 30)\n");
+}
+
+static bool ReadArguments (int argc, char** argv, HeadlessParameters* prm)
+{
+  if (argc < 4) return false;
+
+  prm->volume_path = argv[1];
+  prm->transfer_function_path = argv[2];
+  prm->output_path = argv[3];
+
+  for (int i = 4; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    int n_values = argc - i - 1;
+    if (arg == "-size" && n_values >= 2)
+    {
+      prm->width = atoi(argv[++i]);
+      prm->height = atoi(argv[++i]);
+    }
+    else if ((arg == "-eye" || arg == "-center" || arg == "-up" ||
+              arg == "-light" || arg == "-bg") && n_values >= 3)
+    {
+      glm::vec3 v;
+      v.x = (float)atof(argv[++i]);
+      v.y = (float)atof(argv[++i]);
+      v.z = (float)atof(argv[++i]);
+
+      if (arg == "-eye") prm->eye = v;
+      else if (arg == "-center") prm->center = v;
+      else if (arg == "-up") prm->up = v;
+      else if (arg == "-bg") prm->background = v;
+      else
+      {
+        prm->light_position = v;
+        prm->has_light_position = true;
+      }
+    }
+    else if (arg == "-fov" && n_values >= 1)
+      prm->fov_y = (float)atof(argv[++i]);
+    else if (arg == "-step" && n_values >= 1)
+      prm->step_size = (float)atof(argv[++i]);
+    else if (arg == "-preint" && n_values >= 1)
+      prm->preintegration_step_scale = (float)atof(argv[++i]);
+    else if (arg == "-adaptive" && n_values >= 1)
+      prm->max_step_scale = (float)atof(argv[++i]);
+    else if (arg == "-mode" && n_values >= 1)
+    {
+      std::string mode = argv[++i];
+      if (!vis::ParseRenderMode(mode, &prm->render_mode))
+      {
+        printf("Unknown render mode: %s\n", mode.c_str());
+        return false;
+      }
+    }
+    else if (arg == "-threads" && n_values >= 1)
+      prm->n_threads = (unsigned int)atoi(argv[++i]);
+    else if (arg == "-gradcachedir" && n_values >= 1)
+    {
+      prm->use_gradient_cache = true;
+      prm->gradient_cache_directory = argv[++i];
+    }
+    else if (arg == "-gradformat" && n_values >= 1)
+    {
+      std::string format = argv[++i];
+      if (format == "float32") prm->gradient_format = vis::GradientEngine::OUTPUT_FORMAT::FLOAT_32;
+      else if (format == "float16") prm->gradient_format = vis::GradientEngine::OUTPUT_FORMAT::FLOAT_16;
+      else if (format == "rgb10a2") prm->gradient_format = vis::GradientEngine::OUTPUT_FORMAT::RGB10_A2;
+      else if (format == "oct16") prm->gradient_format = vis::GradientEngine::OUTPUT_FORMAT::OCTAHEDRAL_16;
+      else if (format == "oct8") prm->gradient_format = vis::GradientEngine::OUTPUT_FORMAT::OCTAHEDRAL_8;
+      else if (format == "oct8mag") prm->gradient_format = vis::GradientEngine::OUTPUT_FORMAT::OCTAHEDRAL_8_MAGNITUDE;
+      else
+      {
+        printf("Unknown gradient format: %s\n", format.c_str());
+        return false;
+      }
+    }
+    else if (arg == "-profile" && n_values >= 1)
+      prm->profile_trace_file = argv[++i];
+    else if (arg == "-budget" && n_values >= 1)
+      prm->pager_memory_budget = (size_t)atoll(argv[++i]) << 20;
+    else if (arg == "-savebricked" && n_values >= 1)
+      prm->bricked_output_path = argv[++i];
+    else if (arg == "-compress" && n_values >= 1)
+      prm->compression_max_error = atoi(argv[++i]);
+    else if (arg == "-progressive" && n_values >= 1)
+      prm->progressive_samples = atoi(argv[++i]);
+    else if (arg == "-framebudget" && n_values >= 1)
+      prm->progressive_frame_budget_ms = atof(argv[++i]);
+    else if (arg == "-gradcache")
+      prm->use_gradient_cache = true;
+    else if (arg == "-noshading")
+      prm->gradient_shading = false;
+    else if (arg == "-noskip")
+      prm->empty_space_skipping = false;
+    else if (arg == "-alpha")
+      prm->write_alpha = true;
+    else
+    {
+      printf("Unknown or incomplete argument \"%s\"\n", arg.c_str());
+      return false;
+    }
+  }
+
+  if (prm->width <= 0 || prm->height <= 0)
+  {
+    printf("Invalid image size [%d, %d]\n", prm->width, prm->height);
+    return false;
+  }
+  return true;
+}
+
+int main (int argc, char **argv)
+{
+  HeadlessParameters prm;
+  if (!ReadArguments(argc, argv, &prm))
+  {
+    PrintUsage();
+    return EXIT_FAILURE;
+  }
+  Profiler::SetEnabled(!prm.profile_trace_file.empty());
+
+  // Read Dataset and Transfer Function
+  vis::VolumeReader vr;
+  // every voxel is touched by the gradient pass, prefetch the whole .raw file
+  vr.SetRawMemoryMapping(true, MappedFile::ACCESS_PATTERN::WILL_NEED);
+  vr.SetPagerMemoryBudget(prm.pager_memory_budget);
+  vis::StructuredGridVolume* volume = vr.ReadStructuredVolume(prm.volume_path);
+  if (volume == nullptr)
+  {
+    printf("Could not read volume %s\n", prm.volume_path.c_str());
+    return EXIT_FAILURE;
+  }
+
+  vis::TransferFunctionReader tfr;
+  vis::TransferFunction1D* tf = dynamic_cast<vis::TransferFunction1D*>(tfr.ReadTransferFunction(prm.transfer_function_path));
+  if (tf == nullptr)
+  {
+    printf("Could not read 1D transfer function %s\n", prm.transfer_function_path.c_str());
+    delete volume;
+    return EXIT_FAILURE;
+  }
+
+  vis::ThreadPool thread_pool(prm.n_threads);
+  if (!prm.bricked_output_path.empty())
+    vis::BrickPager::WriteFile(volume, prm.bricked_output_path, vis::BrickPager::DEFAULT_BRICK_SIZE, &thread_pool);
+  if (prm.compression_max_error >= 0 && !volume->IsPaged())
+    volume->CompressData(prm.compression_max_error, prm.pager_memory_budget, vis::CompressedBricks::DEFAULT_BRICK_SIZE, &thread_pool);
+
+  vis::CPURayCaster ray_caster(&thread_pool);
+  ray_caster.SetEmptySpaceSkipping(prm.empty_space_skipping);
+  ray_caster.SetPreIntegration(prm.preintegration_step_scale > 0.0f);
+  ray_caster.SetAdaptiveStep(prm.max_step_scale > 0.0f, prm.max_step_scale);
+  ray_caster.SetRenderMode(prm.render_mode);
+  ray_caster.SetVolume(volume);
+  ray_caster.SetTransferFunction(tf);
+  ray_caster.SetGradientShading(prm.gradient_shading);
+  ray_caster.SetGradientFormat(prm.gradient_format);
+
+  // Paged volumes evaluate the gradient at each shaded sample
+  if (prm.gradient_shading && prm.use_gradient_cache && !volume->IsPaged())
+  {
+    vis::GradientEngine gradient_engine(&thread_pool);
+    vis::GradientCache gradient_cache(prm.gradient_cache_directory);
+    vis::GradientCache::Entry* entry = gradient_cache.LoadOrCompute(volume, &gradient_engine, prm.volume_path);
+    if (entry)
+    {
+      std::vector<float> gradient((size_t)volume->GetWidth() * volume->GetHeight() * volume->GetDepth() * 3);
+      entry->DecodeFloat(gradient.data(), &thread_pool);
+      ray_caster.SetGradientField(std::move(gradient));
+      delete entry;
+    }
+  }
+  // .vvol files may store the gradient directions
+  else if (prm.gradient_shading && !volume->IsPaged() &&
+           prm.volume_path.size() > 5 && prm.volume_path.compare(prm.volume_path.size() - 5, 5, ".vvol") == 0)
+  {
+    vis::VolumeContainer container;
+    if (container.Open(prm.volume_path) && container.HasGradient())
+    {
+      std::vector<float> gradient((size_t)volume->GetWidth() * volume->GetHeight() * volume->GetDepth() * 3);
+      if (container.ReadGradient(gradient.data(), &thread_pool))
+        ray_caster.SetGradientField(std::move(gradient));
+    }
+  }
+
+  if (prm.step_size <= 0.0f)
+  {
+    glm::dvec3 sv = volume->GetScale();
+    prm.step_size = float((0.5f / glm::sqrt(3.0f)) * glm::sqrt(sv.x * sv.x + sv.y * sv.y + sv.z * sv.z));
+  }
+  if (prm.preintegration_step_scale > 0.0f)
+    prm.step_size *= prm.preintegration_step_scale;
+  ray_caster.SetStepSize(prm.step_size);
+
+  ray_caster.SetCamera(prm.eye, glm::lookAt(prm.eye, prm.center, prm.up),
+                       (float)tan(glm::radians((double)prm.fov_y) / 2.0),
+                       float(prm.width) / float(prm.height));
+
+  // Same default Blinn-Phong parameters of vis::RenderingParameters
+  ray_caster.SetBlinnPhong(0.5f, 0.5f, 0.8f, 30.0f, glm::vec3(1.0f),
+                           prm.has_light_position ? prm.light_position : prm.eye);
+
+  std::vector<float> frame((size_t)prm.width * (size_t)prm.height * 4);
+
+  auto t_init = std::chrono::steady_clock::now();
+  bool rendered = true;
+  if (prm.progressive_samples > 0)
+  {
+    // Same redraws of the interactive application, until the frame converges
+    vis::ProgressiveRefinement progressive;
+    progressive.SetNumberOfSamples(prm.progressive_samples);
+    progressive.SetFrameBudget(prm.progressive_frame_budget_ms);
+    int n_redraws = 0;
+    while (rendered && !progressive.IsConverged())
+    {
+      rendered = ray_caster.RenderProgressive(prm.width, prm.height, frame.data(), &progressive);
+      PROFILE_FRAME_MARK();
+      n_redraws++;
+    }
+    printf("Progressive refinement: %d samples per pixel in %d redraws\n", progressive.GetNumberOfSamples(), n_redraws);
+  }
+  else
+  {
+    rendered = ray_caster.Render(prm.width, prm.height, frame.data());
+    PROFILE_FRAME_MARK();
+  }
+  auto t_end = std::chrono::steady_clock::now();
+
+  if (!rendered)
+  {
+    printf("Could not render the frame\n");
+    delete tf;
+    delete volume;
+    return EXIT_FAILURE;
+  }
+  printf("Rendered [%d, %d] with %u threads in %.2lf ms\n", prm.width, prm.height,
+    thread_pool.GetNumberOfThreads(), std::chrono::duration<double, std::milli>(t_end - t_init).count());
+  if (volume->IsPaged())
+  {
+    vis::BrickPager* pager = volume->GetBrickPager();
+    printf("Brick pager: %d resident bricks, %llu misses, %llu prefetched, %llu evicted\n",
+      pager->GetNumberOfResidentBricks(), pager->GetNumberOfMisses(),
+      pager->GetNumberOfPrefetchedBricks(), pager->GetNumberOfEvictedBricks());
+  }
+
+  // The frame holds premultiplied radiance and opacity. Same extension
+  //  matching of WriteImage
+  std::string ext = prm.output_path.substr(prm.output_path.find_last_of('.') + 1);
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  bool composite = ext != "exr";
+  if (prm.write_alpha && ext != "png")
+  {
+    if (ext == "ppm")
+      printf("-alpha is ignored for .ppm output, which has no alpha channel\n");
+    prm.write_alpha = false;
+  }
+  if (composite && prm.write_alpha)
+  {
+    // png stores straight alpha
+    for (size_t i = 0; i < frame.size(); i += 4)
+    {
+      if (frame[i + 3] <= 0.0f) continue;
+      frame[i + 0] /= frame[i + 3];
+      frame[i + 1] /= frame[i + 3];
+      frame[i + 2] /= frame[i + 3];
+    }
+  }
+  else if (composite)
+  {
+    for (size_t i = 0; i < frame.size(); i += 4)
+    {
+      float transparency = 1.0f - frame[i + 3];
+      frame[i + 0] += transparency * prm.background.r;
+      frame[i + 1] += transparency * prm.background.g;
+      frame[i + 2] += transparency * prm.background.b;
+      frame[i + 3] = 1.0f;
+    }
+  }
+
+  bool saved = WriteImage(prm.output_path, prm.width, prm.height, frame.data(), prm.write_alpha);
+  if (saved)
+    printf("Image saved at %s\n", prm.output_path.c_str());
+
+  if (!prm.profile_trace_file.empty())
+  {
+    Profiler::PrintFrameSummary();
+    Profiler::WriteChromeTrace(prm.profile_trace_file);
+  }
+
+  delete tf;
+  delete volume;
+  return saved ? EXIT_SUCCESS : EXIT_FAILURE;
+}
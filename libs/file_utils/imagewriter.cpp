@@ -0,0 +1,261 @@
+#include "imagewriter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+static unsigned char QuantizeChannel (float v)
+{
+  v = std::min(std::max(v, 0.0f), 1.0f);
+  return (unsigned char)(v * 255.0f + 0.5f);
+}
+
+static void AppendU32BE (std::vector<unsigned char>& out, uint32_t v)
+{
+  out.push_back((unsigned char)(v >> 24));
+  out.push_back((unsigned char)(v >> 16));
+  out.push_back((unsigned char)(v >>  8));
+  out.push_back((unsigned char)(v      ));
+}
+
+template <typename T>
+static void AppendLE (std::vector<unsigned char>& out, T v)
+{
+  unsigned char b[sizeof(T)];
+  memcpy(b, &v, sizeof(T));
+  out.insert(out.end(), b, b + sizeof(T));
+}
+
+static void AppendString (std::vector<unsigned char>& out, const char* str)
+{
+  out.insert(out.end(), str, str + strlen(str) + 1);
+}
+
+static bool WriteBuffer (std::string filename, const std::vector<unsigned char>& buffer)
+{
+  FILE* fp = fopen(filename.c_str(), "wb");
+  if (!fp)
+  {
+    printf("imagewriter: could not open %s for writing\n", filename.c_str());
+    return false;
+  }
+  size_t written = fwrite(buffer.data(), 1, buffer.size(), fp);
+  fclose(fp);
+  return written == buffer.size();
+}
+
+bool WriteImagePPM (std::string filename, int width, int height, const float* rgba)
+{
+  if (width <= 0 || height <= 0 || !rgba) return false;
+
+  char header[64];
+  int header_size = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+
+  std::vector<unsigned char> buffer(header, header + header_size);
+  buffer.reserve(header_size + (size_t)width * height * 3);
+  for (int y = height - 1; y >= 0; y--)
+  {
+    const float* row = rgba + (size_t)y * width * 4;
+    for (int x = 0; x < width; x++)
+      for (int c = 0; c < 3; c++)
+        buffer.push_back(QuantizeChannel(row[x * 4 + c]));
+  }
+  return WriteBuffer(filename, buffer);
+}
+
+////////////////////////////////////////////////////////////////////////
+// PNG
+static uint32_t PNGCrc32 (const unsigned char* data, size_t size, uint32_t crc = 0)
+{
+  static uint32_t s_crc_table[256];
+  static bool s_crc_table_built = false;
+  if (!s_crc_table_built)
+  {
+    for (uint32_t n = 0; n < 256; n++)
+    {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++)
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      s_crc_table[n] = c;
+    }
+    s_crc_table_built = true;
+  }
+
+  crc = crc ^ 0xFFFFFFFFu;
+  for (size_t i = 0; i < size; i++)
+    crc = s_crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return crc ^ 0xFFFFFFFFu;
+}
+
+static void PNGAppendChunk (std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& data)
+{
+  AppendU32BE(out, (uint32_t)data.size());
+  size_t type_begin = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data.begin(), data.end());
+  AppendU32BE(out, PNGCrc32(out.data() + type_begin, out.size() - type_begin));
+}
+
+bool WriteImagePNG (std::string filename, int width, int height, const float* rgba, bool write_alpha)
+{
+  if (width <= 0 || height <= 0 || !rgba) return false;
+
+  int n_channels = write_alpha ? 4 : 3;
+
+  // Filter type 0 (none) for each scanline
+  std::vector<unsigned char> raw;
+  raw.reserve((size_t)height * (1 + (size_t)width * n_channels));
+  for (int y = height - 1; y >= 0; y--)
+  {
+    const float* row = rgba + (size_t)y * width * 4;
+    raw.push_back(0);
+    for (int x = 0; x < width; x++)
+      for (int c = 0; c < n_channels; c++)
+        raw.push_back(QuantizeChannel(row[x * 4 + c]));
+  }
+
+  // zlib stream made of stored deflate blocks
+  std::vector<unsigned char> zlib;
+  zlib.reserve(raw.size() + (raw.size() / 65535 + 1) * 5 + 6);
+  zlib.push_back(0x78);
+  zlib.push_back(0x01);
+  size_t offset = 0;
+  do
+  {
+    size_t block_size = std::min(raw.size() - offset, (size_t)65535);
+    bool last = offset + block_size == raw.size();
+    zlib.push_back(last ? 1 : 0);
+    zlib.push_back((unsigned char)(block_size & 0xFF));
+    zlib.push_back((unsigned char)(block_size >> 8));
+    zlib.push_back((unsigned char)(~block_size & 0xFF));
+    zlib.push_back((unsigned char)((~block_size >> 8) & 0xFF));
+    zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + block_size);
+    offset += block_size;
+  } while (offset < raw.size());
+
+  uint32_t adler_a = 1, adler_b = 0;
+  for (size_t i = 0; i < raw.size(); i++)
+  {
+    adler_a = (adler_a + raw[i]) % 65521;
+    adler_b = (adler_b + adler_a) % 65521;
+  }
+  AppendU32BE(zlib, (adler_b << 16) | adler_a);
+
+  std::vector<unsigned char> ihdr;
+  AppendU32BE(ihdr, (uint32_t)width);
+  AppendU32BE(ihdr, (uint32_t)height);
+  ihdr.push_back(8);                      // bit depth
+  ihdr.push_back(write_alpha ? 6 : 2);    // color type: rgba or rgb
+  ihdr.push_back(0);                      // compression
+  ihdr.push_back(0);                      // filter
+  ihdr.push_back(0);                      // interlace
+
+  static const unsigned char png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+  std::vector<unsigned char> buffer(png_signature, png_signature + 8);
+  PNGAppendChunk(buffer, "IHDR", ihdr);
+  PNGAppendChunk(buffer, "IDAT", zlib);
+  PNGAppendChunk(buffer, "IEND", std::vector<unsigned char>());
+
+  return WriteBuffer(filename, buffer);
+}
+
+////////////////////////////////////////////////////////////////////////
+// OpenEXR
+static void EXRAppendAttribute (std::vector<unsigned char>& out, const char* name, const char* type,
+                                const std::vector<unsigned char>& value)
+{
+  AppendString(out, name);
+  AppendString(out, type);
+  AppendLE<int32_t>(out, (int32_t)value.size());
+  out.insert(out.end(), value.begin(), value.end());
+}
+
+bool WriteImageEXR (std::string filename, int width, int height, const float* rgba)
+{
+  if (width <= 0 || height <= 0 || !rgba) return false;
+
+  // Channels must be sorted by name: A, B, G, R
+  static const char* channel_names[4] = { "A", "B", "G", "R" };
+  static const int channel_index[4] = { 3, 2, 1, 0 };
+
+  std::vector<unsigned char> buffer;
+  AppendLE<int32_t>(buffer, 20000630); // magic number
+  AppendLE<int32_t>(buffer, 2);        // version 2, single part scanline
+
+  std::vector<unsigned char> chlist;
+  for (int c = 0; c < 4; c++)
+  {
+    AppendString(chlist, channel_names[c]);
+    AppendLE<int32_t>(chlist, 2);      // FLOAT
+    AppendLE<int32_t>(chlist, 0);      // pLinear + reserved
+    AppendLE<int32_t>(chlist, 1);      // xSampling
+    AppendLE<int32_t>(chlist, 1);      // ySampling
+  }
+  chlist.push_back(0);
+  EXRAppendAttribute(buffer, "channels", "chlist", chlist);
+
+  EXRAppendAttribute(buffer, "compression", "compression", std::vector<unsigned char>(1, 0));
+
+  std::vector<unsigned char> window;
+  AppendLE<int32_t>(window, 0);
+  AppendLE<int32_t>(window, 0);
+  AppendLE<int32_t>(window, width - 1);
+  AppendLE<int32_t>(window, height - 1);
+  EXRAppendAttribute(buffer, "dataWindow", "box2i", window);
+  EXRAppendAttribute(buffer, "displayWindow", "box2i", window);
+
+  EXRAppendAttribute(buffer, "lineOrder", "lineOrder", std::vector<unsigned char>(1, 0));
+
+  std::vector<unsigned char> pixel_aspect;
+  AppendLE<float>(pixel_aspect, 1.0f);
+  EXRAppendAttribute(buffer, "pixelAspectRatio", "float", pixel_aspect);
+
+  std::vector<unsigned char> window_center;
+  AppendLE<float>(window_center, 0.0f);
+  AppendLE<float>(window_center, 0.0f);
+  EXRAppendAttribute(buffer, "screenWindowCenter", "v2f", window_center);
+
+  std::vector<unsigned char> window_width;
+  AppendLE<float>(window_width, 1.0f);
+  EXRAppendAttribute(buffer, "screenWindowWidth", "float", window_width);
+
+  buffer.push_back(0); // end of header
+
+  // Offset table, one scanline per block
+  size_t line_size = (size_t)width * 4 * sizeof(float);
+  size_t block_size = 2 * sizeof(int32_t) + line_size;
+  uint64_t first_block = (uint64_t)(buffer.size() + (size_t)height * sizeof(uint64_t));
+  for (int y = 0; y < height; y++)
+    AppendLE<uint64_t>(buffer, first_block + (uint64_t)y * block_size);
+
+  buffer.reserve(buffer.size() + (size_t)height * block_size);
+  for (int y = 0; y < height; y++)
+  {
+    const float* row = rgba + (size_t)(height - 1 - y) * width * 4;
+    AppendLE<int32_t>(buffer, y);
+    AppendLE<int32_t>(buffer, (int32_t)line_size);
+    for (int c = 0; c < 4; c++)
+      for (int x = 0; x < width; x++)
+        AppendLE<float>(buffer, row[x * 4 + channel_index[c]]);
+  }
+
+  return WriteBuffer(filename, buffer);
+}
+
+bool WriteImage (std::string filename, int width, int height, const float* rgba, bool write_alpha)
+{
+  std::string ext = filename.substr(filename.find_last_of('.') + 1);
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+  if (ext == "ppm")
+    return WriteImagePPM(filename, width, height, rgba);
+  else if (ext == "png")
+    return WriteImagePNG(filename, width, height, rgba, write_alpha);
+  else if (ext == "exr")
+    return WriteImageEXR(filename, width, height, rgba);
+
+  printf("imagewriter: unknown image extension \"%s\"\n", ext.c_str());
+  return false;
+}
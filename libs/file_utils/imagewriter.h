@@ -0,0 +1,32 @@
+/**
+ * Image writers used to save rendered frames without an OpenGL context.
+ *
+ * Input images are RGBA float buffers with the first row being the
+ * bottom row of the image (glTexImage2D layout), rows are flipped
+ * when written.
+ *
+ * . PPM: binary P6, 8 bits per channel, rgb only
+ * . PNG: 8 bits per channel, rgb or rgba, zlib stream with stored
+ *        (uncompressed) deflate blocks, no external dependency
+ * . EXR: single part scanline file, uncompressed, 32-bit float
+ *        R, G, B, A channels
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef FILE_UTILS_IMAGE_WRITER_H
+#define FILE_UTILS_IMAGE_WRITER_H
+
+#include <string>
+
+// Values are clamped to [0, 1] and quantized to 8 bits
+bool WriteImagePPM (std::string filename, int width, int height, const float* rgba);
+bool WriteImagePNG (std::string filename, int width, int height, const float* rgba, bool write_alpha = true);
+
+// Values are written as they are
+bool WriteImageEXR (std::string filename, int width, int height, const float* rgba);
+
+// Choose the writer based on the file extension (.ppm, .png or .exr)
+bool WriteImage (std::string filename, int width, int height, const float* rgba, bool write_alpha = true);
+
+#endif
@@ -0,0 +1,189 @@
+#include "mappedfile.h"
+
+#include <cstdio>
+
+#ifdef _WIN32
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+MappedFile::MappedFile ()
+  : m_data(nullptr)
+  , m_size(0)
+#ifdef _WIN32
+  , m_file_handle(nullptr)
+  , m_mapping_handle(nullptr)
+#else
+  , m_file_descriptor(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile ()
+{
+  Close();
+}
+
+bool MappedFile::Open (std::string filename, ACCESS_PATTERN access_pattern)
+{
+  Close();
+
+#ifdef _WIN32
+  DWORD flags = FILE_ATTRIBUTE_NORMAL;
+  if (access_pattern == ACCESS_PATTERN::SEQUENTIAL)
+    flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+  else if (access_pattern == ACCESS_PATTERN::RANDOM)
+    flags |= FILE_FLAG_RANDOM_ACCESS;
+
+  HANDLE file_handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+  if (file_handle == INVALID_HANDLE_VALUE)
+  {
+    printf("MappedFile: could not open %s\n", filename.c_str());
+    return false;
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0)
+  {
+    printf("MappedFile: %s is empty\n", filename.c_str());
+    CloseHandle(file_handle);
+    return false;
+  }
+
+  HANDLE mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping_handle == NULL)
+  {
+    printf("MappedFile: could not create the mapping of %s\n", filename.c_str());
+    CloseHandle(file_handle);
+    return false;
+  }
+
+  void* data = MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+  if (data == NULL)
+  {
+    printf("MappedFile: could not map %s\n", filename.c_str());
+    CloseHandle(mapping_handle);
+    CloseHandle(file_handle);
+    return false;
+  }
+
+  m_file_handle = file_handle;
+  m_mapping_handle = mapping_handle;
+  m_data = data;
+  m_size = (size_t)file_size.QuadPart;
+#else
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    printf("MappedFile: could not open %s\n", filename.c_str());
+    return false;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+  {
+    printf("MappedFile: %s is empty\n", filename.c_str());
+    close(fd);
+    return false;
+  }
+
+  void* data = mmap(nullptr, (size_t)file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED)
+  {
+    printf("MappedFile: could not map %s\n", filename.c_str());
+    close(fd);
+    return false;
+  }
+
+  m_file_descriptor = fd;
+  m_data = data;
+  m_size = (size_t)file_stat.st_size;
+#endif
+
+  m_filename = filename;
+  if (access_pattern != ACCESS_PATTERN::NORMAL)
+    Advise(access_pattern);
+  return true;
+}
+
+void MappedFile::Close ()
+{
+  if (!IsOpen()) return;
+
+#ifdef _WIN32
+  UnmapViewOfFile(m_data);
+  CloseHandle((HANDLE)m_mapping_handle);
+  CloseHandle((HANDLE)m_file_handle);
+  m_mapping_handle = nullptr;
+  m_file_handle = nullptr;
+#else
+  munmap(m_data, m_size);
+  close(m_file_descriptor);
+  m_file_descriptor = -1;
+#endif
+
+  m_data = nullptr;
+  m_size = 0;
+  m_filename = "";
+}
+
+bool MappedFile::Advise (ACCESS_PATTERN access_pattern, size_t offset, size_t size)
+{
+  if (!IsOpen() || offset >= m_size) return false;
+  if (size == 0 || offset + size > m_size)
+    size = m_size - offset;
+
+#ifdef _WIN32
+  // Sequential and random hints are given when the file is opened
+  if (access_pattern == ACCESS_PATTERN::WILL_NEED)
+  {
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = (char*)m_data + offset;
+    range.NumberOfBytes = size;
+    return PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0) != 0;
+  }
+  return true;
+#else
+  // madvise needs a page aligned address
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  size_t aligned_offset = offset - (offset % page_size);
+  size += offset - aligned_offset;
+
+  int advice = MADV_NORMAL;
+  if (access_pattern == ACCESS_PATTERN::SEQUENTIAL)
+    advice = MADV_SEQUENTIAL;
+  else if (access_pattern == ACCESS_PATTERN::RANDOM)
+    advice = MADV_RANDOM;
+  else if (access_pattern == ACCESS_PATTERN::WILL_NEED)
+    advice = MADV_WILLNEED;
+
+  return madvise((char*)m_data + aligned_offset, size, advice) == 0;
+#endif
+}
+
+bool MappedFile::IsOpen ()
+{
+  return m_data != nullptr;
+}
+
+const void* MappedFile::GetData ()
+{
+  return m_data;
+}
+
+size_t MappedFile::GetSize ()
+{
+  return m_size;
+}
+
+std::string MappedFile::GetFileName ()
+{
+  return m_filename;
+}
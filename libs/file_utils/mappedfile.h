@@ -0,0 +1,64 @@
+/**
+ * Read-only memory mapped file.
+ *
+ * The file pages are mapped into the address space of the process
+ *   and loaded by the operating system on demand, so opening a file
+ *   does not read it and the pages are shared with the file cache
+ *   instead of being copied into a heap buffer.
+ *
+ * The access pattern is forwarded as a hint to the operating system:
+ * . posix  : madvise (MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED)
+ * . windows: FILE_FLAG_SEQUENTIAL_SCAN/FILE_FLAG_RANDOM_ACCESS and
+ *            PrefetchVirtualMemory for WILL_NEED
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef FILE_UTILS_MAPPED_FILE_H
+#define FILE_UTILS_MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+class MappedFile
+{
+public:
+  enum ACCESS_PATTERN : unsigned int
+  {
+    NORMAL     = 0,
+    SEQUENTIAL = 1, // read once from the beginning to the end
+    RANDOM     = 2, // sparse accesses, disable read-ahead
+    WILL_NEED  = 3, // the whole file will be used, start reading it now
+  };
+
+  MappedFile ();
+  ~MappedFile ();
+
+  bool Open (std::string filename, ACCESS_PATTERN access_pattern = ACCESS_PATTERN::NORMAL);
+  void Close ();
+
+  // Change the access hint of [offset, offset + size), size = 0 means until the end of the file
+  bool Advise (ACCESS_PATTERN access_pattern, size_t offset = 0, size_t size = 0);
+
+  bool IsOpen ();
+  const void* GetData ();
+  size_t GetSize ();
+  std::string GetFileName ();
+
+private:
+  MappedFile (const MappedFile&) = delete;
+  MappedFile& operator= (const MappedFile&) = delete;
+
+  std::string m_filename;
+  void* m_data;
+  size_t m_size;
+
+#ifdef _WIN32
+  void* m_file_handle;
+  void* m_mapping_handle;
+#else
+  int m_file_descriptor;
+#endif
+};
+
+#endif
@@ -0,0 +1,302 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define PROFILER_DEFAULT_MAX_EVENTS_PER_THREAD (1 << 20)
+
+namespace
+{
+  enum ProfilerEventType : unsigned char
+  {
+    PROFILER_EVENT_SCOPE = 0,
+    PROFILER_EVENT_COUNTER = 1,
+  };
+
+  struct ProfilerEvent
+  {
+    const char* name;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+    double value;
+    ProfilerEventType type;
+  };
+
+  // Events recorded by one thread: the mutex is only contended while
+  //  FrameMark or WriteChromeTrace read the buffer
+  struct ProfilerThreadBuffer
+  {
+    std::mutex mutex;
+    std::vector<ProfilerEvent> events;
+    size_t n_summarized = 0;
+    size_t n_dropped = 0;
+    int thread_id = 0;
+  };
+
+  struct ProfilerScopeStats
+  {
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+  };
+
+  struct ProfilerState
+  {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ProfilerThreadBuffer>> buffers;
+    size_t max_events_per_thread = PROFILER_DEFAULT_MAX_EVENTS_PER_THREAD;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+    // Frame summary
+    uint64_t frame_begin_ns = 0;
+    uint64_t n_frames = 0;
+    uint64_t frames_total_ns = 0;
+    uint64_t frames_max_ns = 0;
+    std::map<std::string, ProfilerScopeStats> scopes;
+    std::map<std::string, double> counters;
+  };
+
+  ProfilerState& GetState ()
+  {
+    static ProfilerState state;
+    return state;
+  }
+
+  // Buffers are kept until the end of the program, so the events of finished
+  //  threads are still written to the trace
+  ProfilerThreadBuffer* GetThreadBuffer ()
+  {
+    thread_local ProfilerThreadBuffer* t_buffer = nullptr;
+    if (t_buffer == nullptr)
+    {
+      ProfilerState& state = GetState();
+      std::lock_guard<std::mutex> lock(state.mutex);
+      state.buffers.push_back(std::make_unique<ProfilerThreadBuffer>());
+      t_buffer = state.buffers.back().get();
+      t_buffer->thread_id = (int)state.buffers.size();
+    }
+    return t_buffer;
+  }
+
+  void PushEvent (const ProfilerEvent& ev)
+  {
+    ProfilerThreadBuffer* buffer = GetThreadBuffer();
+    size_t max_events = GetState().max_events_per_thread;
+
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    if (buffer->events.size() >= max_events)
+    {
+      buffer->n_dropped++;
+      return;
+    }
+    buffer->events.push_back(ev);
+  }
+
+  void WriteJSONString (FILE* fp, const char* str)
+  {
+    fputc('"', fp);
+    for (const char* c = str; *c; c++)
+    {
+      if (*c == '"' || *c == '\\')
+        fputc('\\', fp);
+      if ((unsigned char)*c < 0x20)
+        continue;
+      fputc(*c, fp);
+    }
+    fputc('"', fp);
+  }
+}
+
+std::atomic<bool> Profiler::s_enabled(false);
+
+void Profiler::SetEnabled (bool enabled)
+{
+  ProfilerState& state = GetState();
+  if (enabled && !IsEnabled())
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.frame_begin_ns = GetTimeNs();
+  }
+  s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void Profiler::SetMaxEventsPerThread (size_t max_events)
+{
+  GetState().max_events_per_thread = max_events;
+}
+
+uint64_t Profiler::GetTimeNs ()
+{
+  std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - GetState().origin;
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+void Profiler::AddScope (const char* name, uint64_t begin_ns, uint64_t end_ns)
+{
+  PushEvent({ name, begin_ns, end_ns, 0.0, PROFILER_EVENT_SCOPE });
+}
+
+void Profiler::AddCounter (const char* name, double value)
+{
+  uint64_t t = GetTimeNs();
+  PushEvent({ name, t, t, value, PROFILER_EVENT_COUNTER });
+}
+
+void Profiler::FrameMark ()
+{
+  ProfilerState& state = GetState();
+  uint64_t frame_end_ns = GetTimeNs();
+
+  std::lock_guard<std::mutex> lock(state.mutex);
+  for (std::unique_ptr<ProfilerThreadBuffer>& buffer : state.buffers)
+  {
+    std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+    for (size_t i = buffer->n_summarized; i < buffer->events.size(); i++)
+    {
+      const ProfilerEvent& ev = buffer->events[i];
+      if (ev.type == PROFILER_EVENT_COUNTER)
+      {
+        state.counters[ev.name] = ev.value;
+        continue;
+      }
+      ProfilerScopeStats& stats = state.scopes[ev.name];
+      uint64_t duration_ns = ev.end_ns - ev.begin_ns;
+      stats.count++;
+      stats.total_ns += duration_ns;
+      stats.max_ns = std::max(stats.max_ns, duration_ns);
+    }
+    buffer->n_summarized = buffer->events.size();
+  }
+
+  uint64_t frame_ns = frame_end_ns - state.frame_begin_ns;
+  state.n_frames++;
+  state.frames_total_ns += frame_ns;
+  state.frames_max_ns = std::max(state.frames_max_ns, frame_ns);
+  state.frame_begin_ns = frame_end_ns;
+}
+
+std::string Profiler::GetFrameSummary (bool reset)
+{
+  ProfilerState& state = GetState();
+  std::lock_guard<std::mutex> lock(state.mutex);
+
+  std::string summary;
+  if (state.n_frames == 0)
+    return summary;
+
+  char line[256];
+  double n_frames = (double)state.n_frames;
+  snprintf(line, sizeof(line), "Profiler: %llu frames, %.3f ms/frame (max %.3f ms)\n",
+    (unsigned long long)state.n_frames, (double)state.frames_total_ns * 1e-6 / n_frames,
+    (double)state.frames_max_ns * 1e-6);
+  summary += line;
+
+  // Most expensive scopes first
+  std::vector<std::pair<std::string, ProfilerScopeStats>> scopes(state.scopes.begin(), state.scopes.end());
+  std::sort(scopes.begin(), scopes.end(), [](const std::pair<std::string, ProfilerScopeStats>& a,
+                                             const std::pair<std::string, ProfilerScopeStats>& b) {
+    return a.second.total_ns > b.second.total_ns;
+  });
+  for (const std::pair<std::string, ProfilerScopeStats>& s : scopes)
+  {
+    snprintf(line, sizeof(line), "  %-48s %8.2f calls/frame %10.3f ms/frame %10.3f ms max\n",
+      s.first.c_str(), (double)s.second.count / n_frames,
+      (double)s.second.total_ns * 1e-6 / n_frames, (double)s.second.max_ns * 1e-6);
+    summary += line;
+  }
+  for (const std::pair<const std::string, double>& c : state.counters)
+  {
+    snprintf(line, sizeof(line), "  %-48s %g\n", c.first.c_str(), c.second);
+    summary += line;
+  }
+
+  if (reset)
+  {
+    state.n_frames = 0;
+    state.frames_total_ns = 0;
+    state.frames_max_ns = 0;
+    state.scopes.clear();
+    state.counters.clear();
+  }
+  return summary;
+}
+
+void Profiler::PrintFrameSummary (bool reset)
+{
+  std::string summary = GetFrameSummary(reset);
+  if (!summary.empty())
+    printf("%s", summary.c_str());
+}
+
+bool Profiler::WriteChromeTrace (std::string filename)
+{
+  FILE* fp = fopen(filename.c_str(), "w");
+  if (!fp)
+  {
+    printf("Profiler: could not open %s\n", filename.c_str());
+    return false;
+  }
+
+  ProfilerState& state = GetState();
+  std::lock_guard<std::mutex> lock(state.mutex);
+
+  size_t n_events = 0, n_dropped = 0;
+  bool first = true;
+  fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (std::unique_ptr<ProfilerThreadBuffer>& buffer : state.buffers)
+  {
+    std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+    fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+      first ? "" : ",\n", buffer->thread_id, buffer->thread_id == 1 ? "main" : "thread", buffer->thread_id);
+    first = false;
+
+    for (const ProfilerEvent& ev : buffer->events)
+    {
+      fprintf(fp, ",\n{\"name\":");
+      WriteJSONString(fp, ev.name);
+      if (ev.type == PROFILER_EVENT_COUNTER)
+      {
+        fprintf(fp, ",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"value\":%.17g}}",
+          (double)ev.begin_ns * 1e-3, buffer->thread_id, ev.value);
+      }
+      else
+      {
+        fprintf(fp, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+          (double)ev.begin_ns * 1e-3, (double)(ev.end_ns - ev.begin_ns) * 1e-3, buffer->thread_id);
+      }
+    }
+    n_events += buffer->events.size();
+    n_dropped += buffer->n_dropped;
+  }
+  fprintf(fp, "\n]}\n");
+  fclose(fp);
+
+  printf("Profiler: %zu events written to %s\n", n_events, filename.c_str());
+  if (n_dropped > 0)
+    printf("Profiler: %zu events were dropped, see Profiler::SetMaxEventsPerThread\n", n_dropped);
+  return true;
+}
+
+void Profiler::Clear ()
+{
+  ProfilerState& state = GetState();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  for (std::unique_ptr<ProfilerThreadBuffer>& buffer : state.buffers)
+  {
+    std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+    std::vector<ProfilerEvent>().swap(buffer->events);
+    buffer->n_summarized = 0;
+    buffer->n_dropped = 0;
+  }
+  state.n_frames = 0;
+  state.frames_total_ns = 0;
+  state.frames_max_ns = 0;
+  state.scopes.clear();
+  state.counters.clear();
+  state.frame_begin_ns = GetTimeNs();
+}
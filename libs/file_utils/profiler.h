@@ -0,0 +1,113 @@
+/**
+ * Scoped timers and counters of the loading, preprocessing and
+ *   rendering hot paths.
+ *
+ *   void VolumeReader::readpvm (...)
+ *   {
+ *     PROFILE_SCOPE("VolumeReader::readpvm");
+ *     ...
+ *     PROFILE_COUNTER("pvm_bytes", n_bytes);
+ *   }
+ *
+ * Events are appended to a buffer owned by the calling thread, so the
+ *   recording threads do not contend. While disabled, a scope costs one
+ *   relaxed atomic load and a branch. Compiling with VOLVIS_DISABLE_PROFILER
+ *   (cmake -DVOLVIS_ENABLE_PROFILER=OFF) removes the macros.
+ *
+ * Output:
+ * . WriteChromeTrace: trace-event JSON, opened by chrome://tracing or
+ *   https://ui.perfetto.dev
+ * . FrameMark closes a frame and adds its events to the frame summary:
+ *   calls and milliseconds per frame of each scope, and the last value
+ *   of each counter, printed by PrintFrameSummary
+ *
+ * Names must be string literals (only the pointer is stored).
+ * Scopes measure cpu time: OpenGL calls are asynchronous, so the scopes
+ *   around them measure the submission, not the gpu work.
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef FILE_UTILS_PROFILER_H
+#define FILE_UTILS_PROFILER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class Profiler
+{
+public:
+  static bool IsEnabled ()
+  {
+    return s_enabled.load(std::memory_order_relaxed);
+  }
+  static void SetEnabled (bool enabled);
+
+  // Events above the limit are dropped (and counted)
+  static void SetMaxEventsPerThread (size_t max_events);
+
+  // Nanoseconds since the first use of the profiler
+  static uint64_t GetTimeNs ();
+
+  static void AddScope (const char* name, uint64_t begin_ns, uint64_t end_ns);
+  static void AddCounter (const char* name, double value);
+
+  // Close the current frame, called once per displayed frame
+  static void FrameMark ();
+
+  // Per frame statistics of the frames closed since the last reset
+  static std::string GetFrameSummary (bool reset = true);
+  static void PrintFrameSummary (bool reset = true);
+
+  static bool WriteChromeTrace (std::string filename);
+
+  // Remove the recorded events and the frame summary
+  static void Clear ();
+
+private:
+  static std::atomic<bool> s_enabled;
+};
+
+class ProfilerScope
+{
+public:
+  explicit ProfilerScope (const char* name)
+    : m_name(nullptr)
+    , m_begin_ns(0)
+  {
+    if (Profiler::IsEnabled())
+    {
+      m_name = name;
+      m_begin_ns = Profiler::GetTimeNs();
+    }
+  }
+
+  ~ProfilerScope ()
+  {
+    if (m_name)
+      Profiler::AddScope(m_name, m_begin_ns, Profiler::GetTimeNs());
+  }
+
+private:
+  const char* m_name;
+  uint64_t m_begin_ns;
+};
+
+#ifndef VOLVIS_DISABLE_PROFILER
+  #define PROFILER_CONCAT_IMPL(a, b) a##b
+  #define PROFILER_CONCAT(a, b) PROFILER_CONCAT_IMPL(a, b)
+
+  #define PROFILE_SCOPE(name) ProfilerScope PROFILER_CONCAT(profiler_scope_, __LINE__)(name)
+  #define PROFILE_COUNTER(name, value) \
+    do { if (Profiler::IsEnabled()) Profiler::AddCounter(name, (double)(value)); } while (0)
+  #define PROFILE_FRAME_MARK() \
+    do { if (Profiler::IsEnabled()) Profiler::FrameMark(); } while (0)
+#else
+  #define PROFILE_SCOPE(name) do {} while (0)
+  #define PROFILE_COUNTER(name, value) do {} while (0)
+  #define PROFILE_FRAME_MARK() do {} while (0)
+#endif
+
+#endif
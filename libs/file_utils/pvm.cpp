@@ -1,4 +1,5 @@
 #include "pvm.h"
+#include "profiler.h"
 #include <fstream>
 #include <iostream>
 #include <cmath>
@@ -13,6 +14,9 @@
 #include <cstring>
 #include <cerrno>
 
+#include <algorithm>
+#include <vector>
+
 #define DDS_MAXSTR (256)
 
 #define DDS_BLOCKSIZE (1<<20)
@@ -20,29 +24,234 @@
 
 #define DDS_RL (7)
 
+namespace
+{
+  // Input read ahead of the decoder
+  const size_t DDS_PREFETCH_CHUNK = 8 << 20;
+
+  inline uint64_t LoadBigEndian64 (const unsigned char* p)
+  {
+    return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+           ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) | ((uint64_t)p[6] <<  8) | ((uint64_t)p[7]);
+  }
+
+  // Most significant bit first stream, same as DDSV3::DDS_readbits
+  //  reading past the end returns zeros
+  class DDSBitReader
+  {
+  public:
+    DDSBitReader (const unsigned char* data, size_t size)
+      : m_data(data), m_ptr(data), m_end(data + size), m_buffer(0), m_buffer_bits(0)
+    {}
+
+    // bits <= 32
+    inline unsigned int Read (unsigned int bits)
+    {
+      if (bits == 0) return 0;
+      if (m_buffer_bits < bits) Refill();
+
+      unsigned int value = (unsigned int)(m_buffer >> (64 - bits));
+      m_buffer <<= bits;
+      m_buffer_bits -= bits;
+      return value;
+    }
+
+    void Skip (size_t bits)
+    {
+      if (bits > m_buffer_bits)
+      {
+        bits -= m_buffer_bits;
+        m_ptr += std::min(bits / 8, (size_t)(m_end - m_ptr));
+        m_buffer = 0;
+        m_buffer_bits = 0;
+        bits = bits % 8;
+      }
+      while (bits > 0)
+      {
+        unsigned int n = (unsigned int)std::min(bits, (size_t)32);
+        Read(n);
+        bits -= n;
+      }
+    }
+
+    size_t GetBytePosition ()
+    {
+      return (size_t)(m_ptr - m_data) - m_buffer_bits / 8;
+    }
+
+  private:
+    // Fill the buffer with at least 57 bits. The bits below m_buffer_bits
+    //   may hold the next bytes already, which are loaded again at the
+    //   same position, so they can be or'ed.
+    inline void Refill ()
+    {
+      if (m_end - m_ptr >= 8)
+      {
+        m_buffer |= LoadBigEndian64(m_ptr) >> m_buffer_bits;
+        m_ptr += (63 - m_buffer_bits) >> 3;
+        m_buffer_bits |= 56;
+        return;
+      }
+
+      while (m_buffer_bits <= 56)
+      {
+        uint64_t byte = (m_ptr < m_end) ? *m_ptr++ : 0;
+        m_buffer |= byte << (56 - m_buffer_bits);
+        m_buffer_bits += 8;
+      }
+    }
+
+    const unsigned char* m_data;
+    const unsigned char* m_ptr;
+    const unsigned char* m_end;
+    uint64_t m_buffer;
+    unsigned int m_buffer_bits;
+  };
+
+  // Incremental version of DDSV3::DDS_decode
+  // . Decode writes the next n values of the stream at dst, dst + stride, ...
+  //   so lanes of an interleaved stream are written to their final position
+  // . the strip prediction reads a ring with the last decoded values, so
+  //   consecutive calls may write to different buffers
+  class DDSStreamDecoder
+  {
+  public:
+    DDSStreamDecoder (const unsigned char* chunk, size_t size, MappedFile* mapped_file, size_t file_offset)
+      : m_reader(chunk, size)
+      , m_run_left(0)
+      , m_run_bits(0)
+      , m_act(0)
+      , m_count(0)
+      , m_mapped_file(mapped_file)
+      , m_file_offset(file_offset)
+      , m_next_prefetch(0)
+    {
+      m_skip = m_reader.Read(2) + 1;
+      m_strip = m_reader.Read(16) + 1;
+
+      size_t history_size = 1;
+      while (history_size < (size_t)m_strip + 2)
+        history_size <<= 1;
+      m_history.assign(history_size, 0);
+      m_history_mask = history_size - 1;
+
+      Prefetch();
+    }
+
+    unsigned int GetSkip ()
+    {
+      return m_skip;
+    }
+
+    // Number of values of the stream, only reads the run headers
+    size_t ScanDecodedSize ()
+    {
+      DDSBitReader reader = m_reader;
+      size_t bytes = 0;
+      unsigned int cnt;
+      while ((cnt = reader.Read(DDS_RL)) != 0)
+      {
+        unsigned int bits = DDSV3::DDS_decode(reader.Read(3));
+        reader.Skip((size_t)cnt * bits);
+        bytes += cnt;
+      }
+      return bytes;
+    }
+
+    size_t Decode (unsigned char* dst, size_t n, size_t stride)
+    {
+      unsigned char* history = m_history.data();
+      size_t done = 0;
+      while (done < n)
+      {
+        if (m_run_left == 0)
+        {
+          Prefetch();
+          m_run_left = m_reader.Read(DDS_RL);
+          if (m_run_left == 0) break;
+          m_run_bits = DDSV3::DDS_decode(m_reader.Read(3));
+        }
+
+        size_t take = std::min((size_t)m_run_left, n - done);
+        int half = (1 << m_run_bits) / 2;
+        unsigned char* out = dst + done * stride;
+        for (size_t k = 0; k < take; k++)
+        {
+          int delta = (int)m_reader.Read(m_run_bits) - half;
+          if (m_strip == 1 || m_count <= m_strip)
+            m_act += delta;
+          else
+            m_act += (int)history[(m_count - m_strip) & m_history_mask]
+                   - (int)history[(m_count - m_strip - 1) & m_history_mask] + delta;
+          m_act &= 255;
+
+          history[m_count & m_history_mask] = (unsigned char)m_act;
+          out[k * stride] = (unsigned char)m_act;
+          m_count++;
+        }
+
+        m_run_left -= (unsigned int)take;
+        done += take;
+      }
+      return done;
+    }
+
+  private:
+    // Keep the next two chunks of the input being read by the system
+    void Prefetch ()
+    {
+      if (m_mapped_file == nullptr) return;
+
+      size_t pos = m_reader.GetBytePosition();
+      if (pos < m_next_prefetch) return;
+
+      m_mapped_file->Advise(MappedFile::ACCESS_PATTERN::WILL_NEED, m_file_offset + pos, 2 * DDS_PREFETCH_CHUNK);
+      m_next_prefetch = pos + DDS_PREFETCH_CHUNK;
+    }
+
+    DDSBitReader m_reader;
+    unsigned int m_skip, m_strip;
+
+    unsigned int m_run_left;
+    unsigned int m_run_bits;
+    int m_act;
+    size_t m_count;
+
+    std::vector<unsigned char> m_history;
+    size_t m_history_mask;
+
+    MappedFile* m_mapped_file;
+    size_t m_file_offset;
+    size_t m_next_prefetch;
+  };
+
+  bool IsLittleEndianHost ()
+  {
+    unsigned short v = 1;
+    return *((unsigned char*)&v) == 1;
+  }
+}
+
 Pvm::Pvm (const char *file_name)
+  : pvm_data(nullptr)
+  , width(0), height(0), depth(0)
+  , scalex(1.0f), scaley(1.0f), scalez(1.0f)
+  , components(0)
 {
-  std::string filename(file_name);
+  if (!ReadFile(file_name))
+  {
+    printf("Pvm: could not read %s\n", file_name);
+    return;
+  }
 
-  DDSV3 ddsloader;
-  unsigned char* raw = ddsloader.readPVMvolume(filename.c_str(),
-                                               &width, &height, &depth,
-                                               &components,
-                                               &scalex, &scaley, &scalez);
-  
   printf("Sizes: [%d %d %d]\n", width, height, depth);
   printf("Scale: [%.4f %.4f %.4f]\n", scalex, scaley, scalez);
   printf("Components: %d\n", components);
-
-  pvm_data = PostProcessData(raw);
-  
-  free(raw);
 }
 
 Pvm::~Pvm ()
 {
-  if (pvm_data)
-    delete[] pvm_data;
+  DeleteVoxelData(pvm_data, components);
   pvm_data = nullptr;
 }
 
@@ -51,6 +260,13 @@ void* Pvm::GetData ()
   return pvm_data;
 }
 
+void* Pvm::ReleaseData ()
+{
+  void* data = pvm_data;
+  pvm_data = nullptr;
+  return data;
+}
+
 void Pvm::GetDimensions (unsigned int* _width, unsigned int* _height, unsigned int* _depth)
 {
   *_width  = width;
@@ -77,36 +293,232 @@ int Pvm::GetComponents ()
   return components;
 }
 
-void* Pvm::PostProcessData (unsigned char* data)
+bool Pvm::ReadFile (const char* file_name)
 {
-  int v_array_size = width * height * depth;
-  if(components == 1)
+  PROFILE_SCOPE("Pvm::ReadFile");
+  MappedFile mapped_file;
+  if (!mapped_file.Open(file_name, MappedFile::ACCESS_PATTERN::SEQUENTIAL))
+    return false;
+
+  const unsigned char* data = static_cast<const unsigned char*>(mapped_file.GetData());
+  size_t size = mapped_file.GetSize();
+
+  const size_t id_size = 8;
+  bool ok = false;
+  if (size >= id_size && memcmp(data, "DDS v3d\n", id_size) == 0)
+    ok = ReadDDSPvm(data + id_size, size - id_size, 0, &mapped_file);
+  else if (size >= id_size && memcmp(data, "DDS v3e\n", id_size) == 0)
+    ok = ReadDDSPvm(data + id_size, size - id_size, DDS_INTERLEAVE, &mapped_file);
+  else
+    ok = ReadRawPvm(data, size);
+
+  if (!ok) return false;
+  PROFILE_COUNTER("pvm_voxel_bytes", GetVoxelDataSize());
+
+  // Voxels of 2 bytes are stored with the least significant byte first
+  if (components == 2 && !IsLittleEndianHost())
+    DDSV3::swapshort(static_cast<unsigned char*>(pvm_data), (unsigned int)(GetVoxelDataSize() / 2));
+
+  return true;
+}
+
+bool Pvm::ReadRawPvm (const unsigned char* data, size_t size)
+{
+  PROFILE_SCOPE("Pvm::ReadRawPvm");
+  int header_size = ParseHeader(data, size);
+  if (header_size <= 0 || !VoxelDataFits(size - (size_t)header_size)) return false;
+
+  size_t n_bytes = GetVoxelDataSize();
+
+  unsigned char* voxels = AllocateVoxelData(components, n_bytes);
+  if (voxels == nullptr) return false;
+
+  memcpy(voxels, data + header_size, n_bytes);
+  pvm_data = voxels;
+  return true;
+}
+
+bool Pvm::ReadDDSPvm (const unsigned char* data, size_t size, unsigned int block, MappedFile* mapped_file)
+{
+  PROFILE_SCOPE("Pvm::ReadDDSPvm");
+  DDSStreamDecoder decoder(data, size, mapped_file, (size_t)(data - static_cast<const unsigned char*>(mapped_file->GetData())));
+
+  // Not interleaved: the header is decoded first, then the voxels
+  //   straight into their buffer
+  if (decoder.GetSkip() <= 1)
   {
-    unsigned char* prc_data = new unsigned char[v_array_size];
-    for (int i = 0; i < width * height * depth; i++)
-      prc_data[i] = data[i];
-    return prc_data;
+    // Scanned at a run boundary, before the header is decoded
+    size_t stream_bytes = decoder.ScanDecodedSize();
+
+    std::vector<unsigned char> header;
+    int header_size = 0;
+    while (header_size == 0)
+    {
+      unsigned char c;
+      if (decoder.Decode(&c, 1, 1) != 1 || header.size() > 8 * DDS_MAXSTR) return false;
+      header.push_back(c);
+      if (c == '\n') header_size = ParseHeader(header.data(), header.size());
+    }
+    if (header_size < 0 || !VoxelDataFits(stream_bytes - header.size())) return false;
+
+    size_t n_bytes = GetVoxelDataSize();
+    unsigned char* voxels = AllocateVoxelData(components, n_bytes);
+    if (voxels == nullptr) return false;
+
+    if (decoder.Decode(voxels, n_bytes, 1) != n_bytes)
+    {
+      DeleteVoxelData(voxels, components);
+      return false;
+    }
+
+    pvm_data = voxels;
+    return true;
   }
-  else if(components == 2)
+
+  // Interleaved: the header bytes are spread over the lanes, so the whole
+  //   stream is decoded with each lane written to its final position, then
+  //   the voxels are moved over the header. Multi-byte voxels are written
+  //   with skip = components, so the buffer is allocated for that type.
+  unsigned int skip = decoder.GetSkip();
+  size_t bytes = decoder.ScanDecodedSize();
+  unsigned int alloc_components = (skip == 2) ? 2 : 1;
+  unsigned char* buffer = AllocateVoxelData(alloc_components, bytes);
+  if (buffer == nullptr) return false;
+
+  size_t group_size = (block == 0) ? bytes : (size_t)skip * block;
+  for (size_t g = 0; g < bytes; g += group_size)
   {
-    unsigned short* prc_data = new unsigned short[v_array_size];
-    unsigned short vl = 256;
-    for (int i = 0; i < width * height * depth; i++)
+    size_t g_bytes = std::min(group_size, bytes - g);
+    for (unsigned int i = 0; i < skip && i < g_bytes; i++)
     {
-      unsigned short v1 = data[(i * 2)];
-      unsigned short v2 = data[(i * 2) + 1];
-      
-      prc_data[i] = 
-        //((v2 << 8) | v1)
-        ((v2 * vl) + v1)
-      ;
-      assert(((v2 * vl) + v1) == ((v2 << 8) | v1));
+      size_t lane_count = (g_bytes - i + skip - 1) / skip;
+      if (decoder.Decode(buffer + g + i, lane_count, skip) != lane_count)
+      {
+        DeleteVoxelData(buffer, alloc_components);
+        return false;
+      }
     }
-    return prc_data;
   }
+
+  int header_size = ParseHeader(buffer, bytes);
+  if (header_size <= 0 || !VoxelDataFits(bytes - (size_t)header_size))
+  {
+    DeleteVoxelData(buffer, alloc_components);
+    return false;
+  }
+
+  size_t n_bytes = GetVoxelDataSize();
+  if (alloc_components == components)
+  {
+    memmove(buffer, buffer + header_size, n_bytes);
+    pvm_data = buffer;
+    return true;
+  }
+
+  unsigned char* voxels = AllocateVoxelData(components, n_bytes);
+  if (voxels) memcpy(voxels, buffer + header_size, n_bytes);
+  DeleteVoxelData(buffer, alloc_components);
+  pvm_data = voxels;
+  return voxels != nullptr;
+}
+
+int Pvm::ParseHeader (const unsigned char* text, size_t len)
+{
+  // Copy of the line starting at pos, returns the position of the next line or 0
+  char line[DDS_MAXSTR];
+  auto read_line = [&] (size_t pos) -> size_t {
+    for (size_t i = pos; i < len && i - pos < DDS_MAXSTR; i++)
+    {
+      if (text[i] != '\n') continue;
+      memcpy(line, text + pos, i - pos);
+      line[i - pos] = '\0';
+      return i + 1;
+    }
+    return 0;
+  };
+
+  int version = 0;
+  size_t pos = 0;
+  if (len >= 4 && memcmp(text, "PVM\n", 4) == 0)
+  {
+    version = 1;
+    pos = 4;
+  }
+  else if (len >= 5 && (memcmp(text, "PVM2\n", 5) == 0 || memcmp(text, "PVM3\n", 5) == 0))
+  {
+    version = text[3] - '0';
+    pos = 5;
+  }
+  else
+  {
+    return (len < 5 && memcmp(text, "PVM", std::min(len, (size_t)3)) == 0) ? 0 : -1;
+  }
+
+  // Comments are only allowed by the first version
+  while (version == 1 && pos < len && text[pos] == '#')
+    if ((pos = read_line(pos)) == 0) return 0;
+
+  int w, h, d, c;
+  float sx = 1.0f, sy = 1.0f, sz = 1.0f;
+
+  if ((pos = read_line(pos)) == 0) return 0;
+  if (sscanf_s(line, "%d %d %d", &w, &h, &d) != 3 || w < 1 || h < 1 || d < 1) return -1;
+
+  if (version > 1)
+  {
+    if ((pos = read_line(pos)) == 0) return 0;
+    if (sscanf_s(line, "%g %g %g", &sx, &sy, &sz) != 3 || sx <= 0.0f || sy <= 0.0f || sz <= 0.0f) return -1;
+  }
+
+  if ((pos = read_line(pos)) == 0) return 0;
+  if (sscanf_s(line, "%d", &c) != 1 || c < 1) return -1;
+
+  width = (unsigned int)w;
+  height = (unsigned int)h;
+  depth = (unsigned int)d;
+  scalex = sx;
+  scaley = sy;
+  scalez = sz;
+  components = (unsigned int)c;
+  return (int)pos;
+}
+
+size_t Pvm::GetVoxelDataSize ()
+{
+  return (size_t)width * (size_t)height * (size_t)depth * (size_t)components;
+}
+
+bool Pvm::VoxelDataFits (size_t max_bytes)
+{
+  size_t n_bytes = components;
+  for (unsigned int dim : { width, height, depth })
+  {
+    if (n_bytes > max_bytes / dim) return false;
+    n_bytes *= dim;
+  }
+  return n_bytes <= max_bytes;
+}
+
+unsigned char* Pvm::AllocateVoxelData (unsigned int n_components, size_t n_bytes)
+{
+  if (n_components == 1)
+    return new unsigned char[n_bytes];
+  else if (n_components == 2)
+    return reinterpret_cast<unsigned char*>(new unsigned short[(n_bytes + 1) / 2]);
+
+  printf("Pvm: %d components are not supported\n", n_components);
   return nullptr;
 }
 
+void Pvm::DeleteVoxelData (void* data, unsigned int n_components)
+{
+  if (data == nullptr) return;
+  if (n_components == 2)
+    delete[] static_cast<unsigned short*>(data);
+  else
+    delete[] static_cast<unsigned char*>(data);
+}
+
 // Reescale between 0 ~ 1 using max_density_value
 float* Pvm::GenerateNormalizeData ()
 {
@@ -197,6 +609,7 @@ unsigned char* DDSV3::readPVMvolume (const char* filename,
                                      unsigned char** parameter,
                                      unsigned char** comment)
 {
+  PROFILE_SCOPE("DDSV3::readPVMvolume");
   unsigned char* data;
   unsigned char* ptr;
   unsigned int bytes, numc;
@@ -383,6 +796,7 @@ void DDSV3::DDS_decode (unsigned char* chunk, unsigned int size,
                         unsigned char** data, unsigned int* bytes,
                         unsigned int block)
 {
+  PROFILE_SCOPE("DDSV3::DDS_decode");
   unsigned int skip, strip;
 
   unsigned char *ptr1, *ptr2;
@@ -517,6 +931,7 @@ void DDSV3::DDS_deinterleave (unsigned char* data,
 // read a Differential Data Stream
 unsigned char* DDSV3::readDDSfile (const char *filename, unsigned int *bytes)
 {
+  PROFILE_SCOPE("DDSV3::readDDSfile");
   char DDS_ID[] = "DDS v3d\n";
   char DDS_ID2[] = "DDS v3e\n";
 
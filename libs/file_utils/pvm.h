@@ -80,10 +80,17 @@ APPENDIX (B) PVM VOLUME FORMAT DESCRIPTION
 #include <iostream>
 #include <cstdint>
 
+#include "mappedfile.h"
+
 #include <cmath>
 
-// TODO: ByteOrder
-// Get the scale of the volume
+// Reader of raw and DDS (v3d/v3e) compressed .pvm files
+// . the file is memory mapped, and the next chunks are prefetched
+//   while the previous ones are decoded
+// . the DDS stream is decoded straight into the voxel buffer, the
+//   deinterleave of multi-byte voxels is done by the decoder writes
+// . the voxel buffer is allocated with new[] of unsigned char (1 component)
+//   or unsigned short (2 components), ReleaseData gives its ownership
 class Pvm
 {
 public:
@@ -102,7 +109,10 @@ public:
   Pvm (const char *file_name);
   ~Pvm ();
 
+  // nullptr if the file could not be read
   void* GetData ();
+  // The caller takes the ownership of the voxel buffer
+  void* ReleaseData ();
 
   void GetDimensions (unsigned int* width, unsigned int* height, unsigned int* depth);
   void GetScale (double* sx, double* sy, double* sz);
@@ -128,9 +138,20 @@ protected:
   unsigned int components;
 
 private:
-  // TODO: big endian and little endian. Only Big endian right now.
-  // TODO: Convertion between data size? 8 -> 16 bits and 16 -> 8 bits.
-  void* PostProcessData (unsigned char* data);
+  bool ReadFile (const char* file_name);
+  bool ReadRawPvm (const unsigned char* data, size_t size);
+  bool ReadDDSPvm (const unsigned char* data, size_t size, unsigned int block, MappedFile* mapped_file);
+
+  // Parse the pvm header from text, returns its length, 0 if text does
+  //   not hold the whole header yet, or -1 if it is not a valid header
+  int ParseHeader (const unsigned char* text, size_t len);
+
+  size_t GetVoxelDataSize ();
+  // False if the voxels of the header do not fit in max_bytes, computed
+  //   without overflowing for corrupt dimensions
+  bool VoxelDataFits (size_t max_bytes);
+  unsigned char* AllocateVoxelData (unsigned int n_components, size_t n_bytes);
+  void DeleteVoxelData (void* data, unsigned int n_components);
 };
 
 /////////////////////////////////////////////////////////////////////////////////
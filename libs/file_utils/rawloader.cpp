@@ -1,9 +1,11 @@
 #include "rawloader.h"
+#include "profiler.h"
 
 #include <cerrno>
 
 IRAWLoader::IRAWLoader (std::string filename, size_t bytes_per_pixel, size_t num_voxels, size_t type_size)
 {
+  PROFILE_SCOPE("IRAWLoader::IRAWLoader");
   m_data = NULL;
   m_filename = filename;
   m_bytesperpixel = bytes_per_pixel;
@@ -49,6 +49,20 @@ namespace gl
     return true;
   }
 
+  bool Texture1D::SetSubData (GLvoid* data, unsigned int offset, unsigned int length, GLenum format, GLenum type)
+  {
+    if (m_textureID == -1 || offset + length > m_length)
+      return false;
+
+    glBindTexture(GL_TEXTURE_1D, m_textureID);
+    glTexSubImage1D(GL_TEXTURE_1D, 0, offset, length, format, type, data);
+    glBindTexture(GL_TEXTURE_1D, 0);
+
+    assert(glGetError() == GL_NO_ERROR);
+
+    return true;
+  }
+
   GLuint Texture1D::GetTextureID ()
   {
     return m_textureID;
@@ -33,6 +33,8 @@ namespace gl
     , GLint wrap_s_param);
 
     bool SetData (GLvoid* data, GLint internalformat, GLenum format, GLenum type);
+    // Replace the texels [offset, offset + length) of the texture created by SetData
+    bool SetSubData (GLvoid* data, unsigned int offset, unsigned int length, GLenum format, GLenum type);
     
     GLuint GetTextureID ();
 
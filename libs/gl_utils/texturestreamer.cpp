@@ -0,0 +1,156 @@
+#include "texturestreamer.h"
+#include <gl_utils/utils.h>
+
+#include <algorithm>
+
+namespace gl
+{
+  TextureStreamer::TextureStreamer (size_t slab_size)
+    : m_slab_size(slab_size)
+    , m_buffer_slab_size(0)
+    , m_buffer(0)
+    , m_persistent(false)
+    , m_mapped_data(nullptr)
+  {
+    for (int i = 0; i < N_SLABS; i++)
+      m_fences[i] = nullptr;
+  }
+
+  TextureStreamer::~TextureStreamer ()
+  {
+    DestroyBuffer();
+  }
+
+  bool TextureStreamer::Upload (Texture3D* texture, GLenum format, GLenum type, size_t bytes_per_texel,
+                                const std::function<void(int z0, int z1, void* dst)>& fill)
+  {
+    if (texture == nullptr || texture->GetTextureID() == (GLuint)-1)
+      return false;
+
+    int width = (int)texture->GetWidth();
+    int height = (int)texture->GetHeight();
+    int depth = (int)texture->GetDepth();
+    size_t slice_size = (size_t)width * (size_t)height * bytes_per_texel;
+    size_t slab_size = std::max(m_slab_size, slice_size);
+    int slices_per_slab = (int)(slab_size / slice_size);
+
+    if (m_buffer == 0 || m_buffer_slab_size < slab_size)
+    {
+      DestroyBuffer();
+      if (!CreateBuffer(slab_size))
+        return false;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+    glBindTexture(GL_TEXTURE_3D, texture->GetTextureID());
+    // rows of 8 bit texels are not 4-byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    bool uploaded = true;
+    int slab = 0;
+    for (int z0 = 0; z0 < depth && uploaded; z0 += slices_per_slab)
+    {
+      int z1 = std::min(z0 + slices_per_slab, depth);
+      size_t offset = (size_t)slab * m_buffer_slab_size;
+      size_t size = (size_t)(z1 - z0) * slice_size;
+
+      WaitSlab(slab);
+      if (m_persistent)
+      {
+        fill(z0, z1, (unsigned char*)m_mapped_data + offset);
+      }
+      else
+      {
+        void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        if (dst == nullptr)
+        {
+          uploaded = false;
+          break;
+        }
+        fill(z0, z1, dst);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      }
+
+      // data is an offset into the bound unpack buffer
+      glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, z0, width, height, z1 - z0, format, type, (GLvoid*)offset);
+      m_fences[slab] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      slab = (slab + 1) % N_SLABS;
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    gl::ExitOnGLError("gl::TextureStreamer: After Upload\n");
+    return uploaded;
+  }
+
+  bool TextureStreamer::IsPersistentlyMapped ()
+  {
+    return m_persistent;
+  }
+
+  bool TextureStreamer::CreateBuffer (size_t slab_size)
+  {
+    m_buffer_slab_size = slab_size;
+    GLsizeiptr buffer_size = (GLsizeiptr)(slab_size * N_SLABS);
+
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+    m_persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+    if (m_persistent)
+    {
+      GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      glBufferStorage(GL_PIXEL_UNPACK_BUFFER, buffer_size, NULL, flags);
+      m_mapped_data = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, buffer_size, flags);
+      m_persistent = m_mapped_data != nullptr;
+    }
+    if (!m_persistent)
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, buffer_size, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (glGetError() != GL_NO_ERROR)
+    {
+      printf("gl::TextureStreamer: could not create a buffer of %zu bytes\n", (size_t)buffer_size);
+      DestroyBuffer();
+      return false;
+    }
+    return true;
+  }
+
+  void TextureStreamer::DestroyBuffer ()
+  {
+    for (int i = 0; i < N_SLABS; i++)
+    {
+      if (m_fences[i]) glDeleteSync(m_fences[i]);
+      m_fences[i] = nullptr;
+    }
+
+    if (m_buffer != 0)
+    {
+      if (m_mapped_data)
+      {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      }
+      glDeleteBuffers(1, &m_buffer);
+    }
+    m_buffer = 0;
+    m_buffer_slab_size = 0;
+    m_mapped_data = nullptr;
+    m_persistent = false;
+  }
+
+  void TextureStreamer::WaitSlab (int i)
+  {
+    if (m_fences[i] == nullptr) return;
+
+    GLenum result = glClientWaitSync(m_fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    while (result == GL_TIMEOUT_EXPIRED)
+      result = glClientWaitSync(m_fences[i], 0, 1000000);
+
+    glDeleteSync(m_fences[i]);
+    m_fences[i] = nullptr;
+  }
+}
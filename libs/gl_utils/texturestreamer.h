@@ -0,0 +1,64 @@
+/**
+ * Streams the texels of a gl::Texture3D slab by slab through a ring of
+ *   pixel unpack buffers, so the caller never builds the whole texture in
+ *   host memory.
+ *
+ * Each slab holds complete z slices. fill(z0, z1, dst) writes the slices
+ *   [z0, z1) straight into the mapped buffer, then glTexSubImage3D copies
+ *   them from the buffer. The ring keeps N_SLABS slabs in flight, with a
+ *   fence per slab: the next fill overlaps with the transfer of the
+ *   previous slabs.
+ *
+ * With GL 4.4 (or GL_ARB_buffer_storage) the ring is persistently mapped
+ *   and coherent, otherwise each slab is mapped and unmapped again.
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef GL_UTILS_TEXTURE_STREAMER_H
+#define GL_UTILS_TEXTURE_STREAMER_H
+
+#include <GL/glew.h>
+
+#include "texture3d.h"
+
+#include <functional>
+
+namespace gl
+{
+  class TextureStreamer
+  {
+  public:
+    static const int N_SLABS = 3;
+    static const size_t DEFAULT_SLAB_SIZE = (size_t)16 << 20;
+
+    // Slabs of at least one z slice, even if larger than slab_size bytes
+    TextureStreamer (size_t slab_size = DEFAULT_SLAB_SIZE);
+    ~TextureStreamer ();
+
+    // Upload every slice of texture, whose storage must be allocated
+    //  (Texture3D::SetData with null data). Rows are tightly packed,
+    //  width * bytes_per_texel bytes.
+    bool Upload (Texture3D* texture, GLenum format, GLenum type, size_t bytes_per_texel,
+                 const std::function<void(int z0, int z1, void* dst)>& fill);
+
+    bool IsPersistentlyMapped ();
+
+  protected:
+
+  private:
+    bool CreateBuffer (size_t slab_size);
+    void DestroyBuffer ();
+    // Wait until the upload of slab i is finished
+    void WaitSlab (int i);
+
+    size_t m_slab_size;
+    size_t m_buffer_slab_size;
+    GLuint m_buffer;
+    bool m_persistent;
+    void* m_mapped_data;
+    GLsync m_fences[N_SLABS];
+  };
+}
+
+#endif
@@ -0,0 +1,619 @@
+#include "brickpager.h"
+#include "structuredgridvolume.h"
+#include "volumebricks.h"
+#include "compressedbricks.h"
+#include "contenthash.h"
+#include <file_utils/profiler.h>
+
+#include <cstdio>
+#include <cstring>
+
+namespace vis
+{
+  static const char BRICK_PAGER_MAGIC[8] = { 'V', 'V', 'B', 'R', 'A', 'W', '\0', '\0' };
+  static const uint32_t BRICK_PAGER_VERSION = 1;
+
+  // The bricks start at a page boundary after the header
+  static const size_t BRICK_PAGER_DATA_OFFSET = 4096;
+
+  // Bricked rows kept in memory by WriteFile before being written
+  static const size_t BRICK_PAGER_WRITE_BUFFER_BYTES = (size_t)256 << 20;
+
+  // Fraction of the cache evicted at once when it is full
+  static const int BRICK_PAGER_EVICTION_BATCH_DIVISOR = 16;
+
+  struct BrickedFileHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t storage;
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    uint32_t brick_size;
+    double scale[3];
+    // (brick_size + 1)^3 voxels per brick, in brick id order
+    uint64_t data_offset;
+    // 2 floats per brick
+    uint64_t min_max_offset;
+  };
+
+  // Copy the bricks of row (by, bz) with their +1 apron into dst,
+  //  clamping the voxels outside the grid to the border
+  template <typename T>
+  static void WriteBrickRow (const VoxelView<T>& view, int brick_size, glm::ivec3 grid_size,
+                             int by, int bz, T* dst, float* min_max)
+  {
+    const int B = brick_size;
+    for (int bx = 0; bx < grid_size.x; bx++)
+    {
+      int brick_id = bx + (by + bz * grid_size.y) * grid_size.x;
+      ComputeBrickRange(view, B, bx, by, bz, &min_max[(size_t)brick_id * 2]);
+
+      for (int z = 0; z <= B; z++)
+      {
+        int vz = std::min(bz * B + z, view.depth - 1);
+        for (int y = 0; y <= B; y++)
+        {
+          int vy = std::min(by * B + y, view.height - 1);
+          const T* row = view.data + view.Index(0, vy, vz);
+          int vx = bx * B;
+          int n = std::min(B + 1, view.width - vx);
+          std::memcpy(dst, row + vx, sizeof(T) * n);
+          for (int x = n; x <= B; x++)
+            dst[x] = row[view.width - 1];
+          dst += B + 1;
+        }
+      }
+    }
+  }
+
+  bool BrickPager::WriteFile (StructuredGridVolume* vol, std::string filename, int brick_size, ThreadPool* thread_pool)
+  {
+    PROFILE_SCOPE("BrickPager::WriteFile");
+    if (vol == nullptr || vol->GetArrayData() == nullptr)
+    {
+      printf("BrickPager: only volumes with their voxels in memory (or mapped) can be written\n");
+      return false;
+    }
+    if (brick_size < 4 || brick_size > 256 || (brick_size & (brick_size - 1)) != 0)
+    {
+      printf("BrickPager: invalid brick size %d\n", brick_size);
+      return false;
+    }
+    if (thread_pool == nullptr)
+      thread_pool = ThreadPool::GetDefault();
+
+    glm::ivec3 resolution = glm::ivec3(vol->GetWidth(), vol->GetHeight(), vol->GetDepth());
+    glm::ivec3 grid_size = (resolution + brick_size - 1) / brick_size;
+    size_t n_bricks = (size_t)grid_size.x * grid_size.y * grid_size.z;
+    size_t brick_bytes = (size_t)(brick_size + 1) * (brick_size + 1) * (brick_size + 1)
+                       * GetStorageSizeBytes(vol->GetDataStorageSize());
+
+    BrickedFileHeader header;
+    memset(&header, 0, sizeof(BrickedFileHeader));
+    memcpy(header.magic, BRICK_PAGER_MAGIC, sizeof(BRICK_PAGER_MAGIC));
+    header.version = BRICK_PAGER_VERSION;
+    header.storage = (uint32_t)vol->GetDataStorageSize();
+    header.width = resolution.x;
+    header.height = resolution.y;
+    header.depth = resolution.z;
+    header.brick_size = brick_size;
+    header.scale[0] = vol->GetScaleX();
+    header.scale[1] = vol->GetScaleY();
+    header.scale[2] = vol->GetScaleZ();
+    header.data_offset = BRICK_PAGER_DATA_OFFSET;
+    header.min_max_offset = BRICK_PAGER_DATA_OFFSET + n_bricks * brick_bytes;
+
+    // Same temporary file approach of GradientCache::Write
+    std::string tmp_filename = filename + ".tmp";
+    FILE* fp = fopen(tmp_filename.c_str(), "wb");
+    if (fp == nullptr)
+    {
+      printf("BrickPager: could not write %s\n", filename.c_str());
+      return false;
+    }
+
+    std::vector<unsigned char> padding(BRICK_PAGER_DATA_OFFSET - sizeof(BrickedFileHeader), 0);
+    bool written = fwrite(&header, sizeof(BrickedFileHeader), 1, fp) == 1 &&
+                   fwrite(padding.data(), 1, padding.size(), fp) == padding.size();
+
+    // Rows of bricks are built in parallel and written in order
+    int n_rows = grid_size.y * grid_size.z;
+    size_t row_bytes = (size_t)grid_size.x * brick_bytes;
+    int batch_rows = (int)std::max((size_t)1, std::min((size_t)n_rows, BRICK_PAGER_WRITE_BUFFER_BYTES / row_bytes));
+
+    std::vector<unsigned char> buffer((size_t)batch_rows * row_bytes);
+    std::vector<float> min_max(n_bricks * 2);
+    for (int r0 = 0; r0 < n_rows && written; r0 += batch_rows)
+    {
+      int n = std::min(batch_rows, n_rows - r0);
+      vol->DispatchVoxelView([&](auto view) {
+        typedef typename decltype(view)::value_type T;
+        thread_pool->ParallelFor(n, [&](int i) {
+          int row_id = r0 + i;
+          WriteBrickRow(view, brick_size, grid_size, row_id % grid_size.y, row_id / grid_size.y,
+                        reinterpret_cast<T*>(buffer.data() + (size_t)i * row_bytes), min_max.data());
+        });
+      });
+      written = fwrite(buffer.data(), 1, (size_t)n * row_bytes, fp) == (size_t)n * row_bytes;
+    }
+
+    written = written && fwrite(min_max.data(), sizeof(float), min_max.size(), fp) == min_max.size();
+    written = (fclose(fp) == 0) && written;
+
+    // The previous file is only replaced once the new one is complete
+    if (written)
+    {
+      std::remove(filename.c_str());
+      written = std::rename(tmp_filename.c_str(), filename.c_str()) == 0;
+    }
+    if (!written)
+    {
+      std::remove(tmp_filename.c_str());
+      printf("BrickPager: could not write %s\n", filename.c_str());
+      return false;
+    }
+
+    printf("BrickPager: saved %s (%zu bricks of %d^3)\n", filename.c_str(), n_bricks, brick_size);
+    return true;
+  }
+
+  BrickPager::BrickPager ()
+    : m_data_offset(0)
+    , m_compressed_bricks(nullptr)
+    , m_vol_resolution(0)
+    , m_vol_scale(1.0)
+    , m_data_storage_size(DataStorageSize::UNKNOWN)
+    , m_brick_size(0)
+    , m_grid_size(0)
+    , m_brick_size_bytes(0)
+    , m_n_slots(0)
+    , m_cache(nullptr)
+    , m_clock(0)
+    , m_frame_stamp(0)
+    , m_n_misses(0)
+    , m_n_prefetched(0)
+    , m_n_evicted(0)
+    , m_full_cache_warned(false)
+    , m_prefetch_stop(false)
+  {
+  }
+
+  BrickPager::~BrickPager ()
+  {
+    Close();
+  }
+
+  bool BrickPager::Open (std::string filename, size_t memory_budget)
+  {
+    PROFILE_SCOPE("BrickPager::Open");
+    Close();
+
+    if (!m_file.Open(filename, MappedFile::ACCESS_PATTERN::RANDOM))
+    {
+      printf("BrickPager: could not open %s\n", filename.c_str());
+      return false;
+    }
+
+    BrickedFileHeader header;
+    bool valid = m_file.GetSize() >= sizeof(BrickedFileHeader);
+    if (valid)
+    {
+      memcpy(&header, m_file.GetData(), sizeof(BrickedFileHeader));
+      valid = memcmp(header.magic, BRICK_PAGER_MAGIC, sizeof(BRICK_PAGER_MAGIC)) == 0 &&
+              header.version == BRICK_PAGER_VERSION &&
+              GetStorageSizeBytes((DataStorageSize)header.storage) > 0 &&
+              header.brick_size >= 4 && header.brick_size <= 256 &&
+              (header.brick_size & (header.brick_size - 1)) == 0 &&
+              header.width > 0 && header.height > 0 && header.depth > 0;
+    }
+
+    if (valid)
+    {
+      m_vol_resolution = glm::ivec3(header.width, header.height, header.depth);
+      m_vol_scale = glm::dvec3(header.scale[0], header.scale[1], header.scale[2]);
+      m_data_storage_size = (DataStorageSize)header.storage;
+      m_brick_size = (int)header.brick_size;
+      m_grid_size = (m_vol_resolution + m_brick_size - 1) / m_brick_size;
+      m_brick_size_bytes = (size_t)(m_brick_size + 1) * (m_brick_size + 1) * (m_brick_size + 1)
+                         * GetStorageSizeBytes(m_data_storage_size);
+      m_data_offset = (size_t)header.data_offset;
+
+      size_t n_bricks = (size_t)GetNumberOfBricks();
+      valid = header.data_offset + n_bricks * m_brick_size_bytes <= header.min_max_offset &&
+              header.min_max_offset + n_bricks * 2 * sizeof(float) <= m_file.GetSize();
+    }
+
+    if (!valid)
+    {
+      printf("BrickPager: %s is not a valid bricked file\n", filename.c_str());
+      m_file.Close();
+      return false;
+    }
+
+    int n_bricks = GetNumberOfBricks();
+    m_min_max.resize((size_t)n_bricks * 2);
+    memcpy(m_min_max.data(), static_cast<const unsigned char*>(m_file.GetData()) + header.min_max_offset,
+           m_min_max.size() * sizeof(float));
+
+    CreateCache(memory_budget);
+    printf("BrickPager: %s [%d, %d, %d], %d bricks of %d^3, cache of %d bricks (%zu bytes)\n",
+      filename.c_str(), m_vol_resolution.x, m_vol_resolution.y, m_vol_resolution.z,
+      n_bricks, m_brick_size, m_n_slots, (size_t)m_n_slots * m_brick_size_bytes);
+    return true;
+  }
+
+  bool BrickPager::Open (CompressedBricks* bricks, size_t memory_budget)
+  {
+    PROFILE_SCOPE("BrickPager::Open");
+    Close();
+
+    if (bricks == nullptr || !bricks->IsBuilt())
+    {
+      printf("BrickPager: the compressed bricks are not built\n");
+      return false;
+    }
+
+    m_compressed_bricks = bricks;
+    m_vol_resolution = bricks->GetVolumeResolution();
+    m_vol_scale = bricks->GetScale();
+    m_data_storage_size = bricks->GetDataStorageSize();
+    m_brick_size = bricks->GetBrickSize();
+    m_grid_size = bricks->GetGridSize();
+    m_brick_size_bytes = bricks->GetBrickSizeBytes();
+
+    int n_bricks = GetNumberOfBricks();
+    m_min_max.assign(bricks->GetMinMaxData(), bricks->GetMinMaxData() + (size_t)n_bricks * 2);
+
+    CreateCache(memory_budget);
+    printf("BrickPager: compressed bricks [%d, %d, %d], %d bricks of %d^3, cache of %d bricks (%zu bytes)\n",
+      m_vol_resolution.x, m_vol_resolution.y, m_vol_resolution.z,
+      n_bricks, m_brick_size, m_n_slots, (size_t)m_n_slots * m_brick_size_bytes);
+    return true;
+  }
+
+  void BrickPager::Close ()
+  {
+    if (m_prefetch_thread.joinable())
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+        m_prefetch_stop = true;
+        m_prefetch_queue.clear();
+      }
+      m_prefetch_cv.notify_all();
+      m_prefetch_thread.join();
+    }
+
+    if (m_cache) delete[] m_cache;
+    m_cache = nullptr;
+    m_slots.reset();
+    m_page_table.reset();
+    m_n_slots = 0;
+    m_free_slots.clear();
+    m_loading.clear();
+    m_min_max.clear();
+    m_zero_brick.clear();
+    m_file.Close();
+    if (m_compressed_bricks) delete m_compressed_bricks;
+    m_compressed_bricks = nullptr;
+
+    m_vol_resolution = glm::ivec3(0);
+    m_data_storage_size = DataStorageSize::UNKNOWN;
+    m_brick_size = 0;
+    m_grid_size = glm::ivec3(0);
+    m_brick_size_bytes = 0;
+    m_full_cache_warned = false;
+  }
+
+  CompressedBricks* BrickPager::GetCompressedBricks ()
+  {
+    return m_compressed_bricks;
+  }
+
+  bool BrickPager::IsOpen ()
+  {
+    return m_cache != nullptr;
+  }
+
+  glm::ivec3 BrickPager::GetVolumeResolution () const
+  {
+    return m_vol_resolution;
+  }
+
+  glm::dvec3 BrickPager::GetScale () const
+  {
+    return m_vol_scale;
+  }
+
+  DataStorageSize BrickPager::GetDataStorageSize () const
+  {
+    return m_data_storage_size;
+  }
+
+  int BrickPager::GetBrickSize () const
+  {
+    return m_brick_size;
+  }
+
+  glm::ivec3 BrickPager::GetGridSize () const
+  {
+    return m_grid_size;
+  }
+
+  int BrickPager::GetNumberOfBricks () const
+  {
+    return m_grid_size.x * m_grid_size.y * m_grid_size.z;
+  }
+
+  size_t BrickPager::GetBrickSizeBytes () const
+  {
+    return m_brick_size_bytes;
+  }
+
+  const float* BrickPager::GetMinMaxData () const
+  {
+    return m_min_max.data();
+  }
+
+  uint64_t BrickPager::ComputeVoxelHash (ThreadPool* thread_pool)
+  {
+    // The encoded bricks and the max error determine the decoded voxels
+    if (m_compressed_bricks)
+    {
+      uint64_t key[2] = {
+        ComputeContentHash(m_compressed_bricks->GetBrickData(0), m_compressed_bricks->GetCompressedSizeBytes(), thread_pool),
+        (uint64_t)m_compressed_bricks->GetMaxError()
+      };
+      return HashBytes(key, sizeof(key));
+    }
+
+    if (!m_file.IsOpen()) return 0;
+    const unsigned char* bricks = static_cast<const unsigned char*>(m_file.GetData()) + m_data_offset;
+    return ComputeContentHash(bricks, (size_t)GetNumberOfBricks() * m_brick_size_bytes, thread_pool);
+  }
+
+  int BrickPager::GetCapacity () const
+  {
+    return m_n_slots;
+  }
+
+  const void* BrickPager::AcquireBrick (int brick_id)
+  {
+    if (brick_id < 0 || brick_id >= GetNumberOfBricks())
+      return m_zero_brick.data();
+
+    for (;;)
+    {
+      int slot = m_page_table[brick_id].load();
+      if (slot >= 0)
+      {
+        // Pin, then check the brick was not evicted meanwhile: the eviction
+        //  unmaps the brick before reading the pin count
+        m_slots[slot].pins.fetch_add(1);
+        if (m_page_table[brick_id].load() == slot)
+        {
+          m_slots[slot].last_use.store(m_clock.load(std::memory_order_relaxed), std::memory_order_relaxed);
+          return m_cache + (size_t)slot * m_brick_size_bytes;
+        }
+        m_slots[slot].pins.fetch_sub(1);
+        continue;
+      }
+
+      m_n_misses.fetch_add(1, std::memory_order_relaxed);
+      if (!LoadBrick(brick_id, false))
+        return m_zero_brick.data();
+    }
+  }
+
+  void BrickPager::ReleaseBrick (const void* brick)
+  {
+    const unsigned char* ptr = static_cast<const unsigned char*>(brick);
+    if (ptr < m_cache || ptr >= m_cache + (size_t)m_n_slots * m_brick_size_bytes)
+      return;
+    m_slots[(size_t)(ptr - m_cache) / m_brick_size_bytes].pins.fetch_sub(1);
+  }
+
+  void BrickPager::BeginFrame ()
+  {
+    m_frame_stamp.store(m_clock.fetch_add(1) + 1);
+  }
+
+  void BrickPager::Prefetch (std::vector<int> brick_ids)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+      m_prefetch_queue.assign(brick_ids.begin(), brick_ids.end());
+    }
+    m_prefetch_cv.notify_one();
+  }
+
+  int BrickPager::GetNumberOfResidentBricks ()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_n_slots - (int)m_free_slots.size();
+  }
+
+  unsigned long long BrickPager::GetNumberOfMisses ()
+  {
+    return m_n_misses.load();
+  }
+
+  unsigned long long BrickPager::GetNumberOfPrefetchedBricks ()
+  {
+    return m_n_prefetched.load();
+  }
+
+  unsigned long long BrickPager::GetNumberOfEvictedBricks ()
+  {
+    return m_n_evicted.load();
+  }
+
+  /////////////////////
+  // Private Methods //
+  /////////////////////
+  bool BrickPager::LoadBrick (int brick_id, bool prefetch)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // Another thread is reading the same brick
+    while (m_loading[brick_id])
+    {
+      if (prefetch) return true;
+      m_cv_loaded.wait(lock);
+    }
+    if (m_page_table[brick_id].load() >= 0)
+      return true;
+
+    int slot = PopFreeSlot(prefetch);
+    if (slot < 0)
+    {
+      if (!prefetch && !m_full_cache_warned)
+      {
+        printf("BrickPager: every cached brick is pinned, increase the memory budget\n");
+        m_full_cache_warned = true;
+      }
+      return false;
+    }
+    m_loading[brick_id] = 1;
+    lock.unlock();
+
+    if (m_compressed_bricks)
+    {
+      PROFILE_SCOPE("BrickPager::DecodeBrick");
+      if (!m_compressed_bricks->Decode(brick_id, m_cache + (size_t)slot * m_brick_size_bytes))
+      {
+        printf("BrickPager: could not decode brick %d\n", brick_id);
+        memset(m_cache + (size_t)slot * m_brick_size_bytes, 0, m_brick_size_bytes);
+      }
+    }
+    else
+    {
+      PROFILE_SCOPE("BrickPager::LoadBrick");
+      memcpy(m_cache + (size_t)slot * m_brick_size_bytes,
+             static_cast<const unsigned char*>(m_file.GetData()) + m_data_offset + (size_t)brick_id * m_brick_size_bytes,
+             m_brick_size_bytes);
+    }
+
+    lock.lock();
+    m_slots[slot].brick_id = brick_id;
+    m_slots[slot].last_use.store(m_clock.fetch_add(1) + 1);
+    m_page_table[brick_id].store(slot);
+    m_loading[brick_id] = 0;
+    m_cv_loaded.notify_all();
+
+    if (prefetch)
+      m_n_prefetched.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  void BrickPager::CreateCache (size_t memory_budget)
+  {
+    int n_bricks = GetNumberOfBricks();
+
+    // Every thread may keep PagedVoxelSampler::N_HANDLES bricks pinned
+    size_t min_slots = (size_t)PagedVoxelSampler<unsigned char>::N_HANDLES * 2
+                     * std::max(1u, std::thread::hardware_concurrency());
+    size_t n_slots = std::max(memory_budget / m_brick_size_bytes, min_slots);
+    if (n_slots * m_brick_size_bytes > memory_budget)
+      printf("BrickPager: memory budget raised to %zu bytes to hold the pinned bricks\n", n_slots * m_brick_size_bytes);
+    m_n_slots = (int)std::min(n_slots, (size_t)n_bricks);
+
+    m_page_table.reset(new std::atomic<int>[n_bricks]);
+    for (int i = 0; i < n_bricks; i++)
+      m_page_table[i].store(-1);
+    m_loading.assign(n_bricks, 0);
+
+    m_slots.reset(new Slot[m_n_slots]);
+    m_free_slots.resize(m_n_slots);
+    for (int i = 0; i < m_n_slots; i++)
+    {
+      m_slots[i].pins.store(0);
+      m_slots[i].last_use.store(0);
+      m_slots[i].brick_id = -1;
+      m_free_slots[i] = m_n_slots - 1 - i;
+    }
+    m_cache = new unsigned char[(size_t)m_n_slots * m_brick_size_bytes];
+    m_zero_brick.assign(m_brick_size_bytes, 0);
+
+    m_prefetch_stop = false;
+    m_prefetch_thread = std::thread(&BrickPager::PrefetchLoop, this);
+  }
+
+  int BrickPager::PopFreeSlot (bool prefetch)
+  {
+    if (m_free_slots.empty())
+      EvictBatch(prefetch);
+    if (m_free_slots.empty())
+      return -1;
+
+    int slot = m_free_slots.back();
+    m_free_slots.pop_back();
+    return slot;
+  }
+
+  void BrickPager::EvictBatch (bool prefetch)
+  {
+    PROFILE_SCOPE("BrickPager::EvictBatch");
+    // The prefetch thread must not evict bricks of the current frame
+    uint64_t max_stamp = prefetch ? m_frame_stamp.load() : UINT64_MAX;
+
+    std::vector<std::pair<uint64_t, int>> candidates;
+    candidates.reserve(m_n_slots);
+    for (int s = 0; s < m_n_slots; s++)
+    {
+      uint64_t last_use = m_slots[s].last_use.load(std::memory_order_relaxed);
+      if (m_slots[s].brick_id >= 0 && m_slots[s].pins.load() == 0 && last_use < max_stamp)
+        candidates.push_back(std::make_pair(last_use, s));
+    }
+
+    size_t n_evict = std::min(candidates.size(), (size_t)std::max(1, m_n_slots / BRICK_PAGER_EVICTION_BATCH_DIVISOR));
+    if (n_evict == 0) return;
+    std::nth_element(candidates.begin(), candidates.begin() + (n_evict - 1), candidates.end());
+
+    for (size_t i = 0; i < n_evict; i++)
+    {
+      int slot = candidates[i].second;
+      int brick_id = m_slots[slot].brick_id;
+
+      // Unmap first, so a concurrent AcquireBrick either sees the brick
+      //  unmapped or has its pin seen here
+      m_page_table[brick_id].store(-1);
+      if (m_slots[slot].pins.load() != 0)
+      {
+        m_page_table[brick_id].store(slot);
+        continue;
+      }
+
+      m_slots[slot].brick_id = -1;
+      m_free_slots.push_back(slot);
+      m_n_evicted.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  void BrickPager::PrefetchLoop ()
+  {
+    for (;;)
+    {
+      int brick_id;
+      {
+        std::unique_lock<std::mutex> lock(m_prefetch_mutex);
+        m_prefetch_cv.wait(lock, [this] { return m_prefetch_stop || !m_prefetch_queue.empty(); });
+        if (m_prefetch_stop) return;
+        brick_id = m_prefetch_queue.front();
+        m_prefetch_queue.pop_front();
+      }
+
+      if (brick_id < 0 || brick_id >= GetNumberOfBricks() || m_page_table[brick_id].load() >= 0)
+        continue;
+
+      // The cache holds only bricks of the current frame, stop until the next request
+      if (!LoadBrick(brick_id, true))
+      {
+        std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+        m_prefetch_queue.clear();
+      }
+    }
+  }
+}
@@ -0,0 +1,325 @@
+/**
+ * Out-of-core access to structured grid volumes larger than the memory.
+ *
+ * The volume is stored in a bricked file (.braw), written by WriteFile:
+ * . header: resolution, scale, storage type and brick size
+ * . bricks in brick id order (x fastest), each one a contiguous block
+ *   of (brick_size + 1)^3 voxels: the +1 apron repeats the first voxels
+ *   of the next bricks (clamped to the grid border), so the 8 voxels of
+ *   any trilinear cell are inside a single brick
+ * . normalized min/max of each brick, same range of vis::VolumeBricks,
+ *   so empty space skipping works without reading the voxels
+ *
+ * BrickPager keeps a cache of bricks limited by a memory budget:
+ * . AcquireBrick loads missing bricks synchronously and pins them, pinned
+ *   bricks are never evicted
+ * . when the cache is full, the least recently used unpinned bricks are
+ *   evicted in batches
+ * . Prefetch queues bricks to be loaded by a background thread, which
+ *   only evicts bricks not used since the last BeginFrame
+ *
+ * A pager can also be opened over vis::CompressedBricks kept in memory,
+ *   which it owns: missing bricks are decoded into the cache instead of
+ *   being copied from the file.
+ *
+ * Kernels read the voxels through a PagedVoxelView<T>, dispatched by
+ *   StructuredGridVolume::DispatchVoxelAccess. Each thread creates its
+ *   own PagedVoxelSampler<T>, which keeps the last used bricks pinned.
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_BRICK_PAGER_H
+#define VOL_VIS_UTILS_BRICK_PAGER_H
+
+#include <volvis_utils/voxelstorage.h>
+#include <volvis_utils/threadpool.h>
+#include <file_utils/mappedfile.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vis
+{
+  class StructuredGridVolume;
+  class CompressedBricks;
+
+  class BrickPager
+  {
+  public:
+    static const int DEFAULT_BRICK_SIZE = 32;
+    static const size_t DEFAULT_MEMORY_BUDGET = (size_t)1 << 30;
+
+    // Write the voxels of vol as a bricked file, brick_size must be a power
+    //  of two in [4, 256]. Volumes with memory mapped .raw data are converted
+    //  without being loaded into memory.
+    static bool WriteFile (StructuredGridVolume* vol, std::string filename,
+                           int brick_size = DEFAULT_BRICK_SIZE, ThreadPool* thread_pool = nullptr);
+
+    BrickPager ();
+    ~BrickPager ();
+
+    bool Open (std::string filename, size_t memory_budget = DEFAULT_MEMORY_BUDGET);
+    // Takes the ownership of bricks if it succeeds, deleted by Close
+    bool Open (CompressedBricks* bricks, size_t memory_budget = DEFAULT_MEMORY_BUDGET);
+    void Close ();
+    bool IsOpen ();
+    // nullptr if the bricks are read from a file
+    CompressedBricks* GetCompressedBricks ();
+
+    glm::ivec3 GetVolumeResolution () const;
+    glm::dvec3 GetScale () const;
+    DataStorageSize GetDataStorageSize () const;
+
+    int GetBrickSize () const;
+    glm::ivec3 GetGridSize () const;
+    int GetNumberOfBricks () const;
+    // (brick_size + 1)^3 voxels
+    size_t GetBrickSizeBytes () const;
+    // 2 floats (min, max) per brick, same content of VolumeBricks::GetMinMaxData
+    const float* GetMinMaxData () const;
+
+    // Content hash of the voxels (see vis::ComputeContentHash): the bricks
+    //  streamed from the mapped file, or the encoded compressed bricks
+    uint64_t ComputeVoxelHash (ThreadPool* thread_pool = nullptr);
+
+    int GetBrickIndex (int bx, int by, int bz) const
+    {
+      return bx + (by + bz * m_grid_size.y) * m_grid_size.x;
+    }
+
+    // Number of bricks that fit in the memory budget
+    int GetCapacity () const;
+
+    // Voxels of brick_id, pinned until ReleaseBrick. A brick of zeros is
+    //  returned if the brick can not be loaded (every cached brick pinned)
+    const void* AcquireBrick (int brick_id);
+    void ReleaseBrick (const void* brick);
+
+    // Bricks used after BeginFrame are not evicted by the prefetch thread
+    void BeginFrame ();
+
+    // Replace the prefetch queue, bricks are loaded in the given order
+    void Prefetch (std::vector<int> brick_ids);
+
+    int GetNumberOfResidentBricks ();
+    unsigned long long GetNumberOfMisses ();
+    unsigned long long GetNumberOfPrefetchedBricks ();
+    unsigned long long GetNumberOfEvictedBricks ();
+
+  protected:
+
+  private:
+    struct Slot
+    {
+      std::atomic<int> pins;
+      std::atomic<uint64_t> last_use;
+      // resident brick, -1 if free or being loaded
+      int brick_id;
+    };
+
+    // Slots, page table and prefetch thread of the opened volume
+    void CreateCache (size_t memory_budget);
+    // Returns false if the brick could not be loaded
+    bool LoadBrick (int brick_id, bool prefetch);
+    // Must be called with m_mutex locked, -1 if every slot is in use
+    int PopFreeSlot (bool prefetch);
+    void EvictBatch (bool prefetch);
+
+    void PrefetchLoop ();
+
+    MappedFile m_file;
+    size_t m_data_offset;
+    CompressedBricks* m_compressed_bricks;
+
+    glm::ivec3 m_vol_resolution;
+    glm::dvec3 m_vol_scale;
+    DataStorageSize m_data_storage_size;
+
+    int m_brick_size;
+    glm::ivec3 m_grid_size;
+    size_t m_brick_size_bytes;
+    std::vector<float> m_min_max;
+
+    // brick id -> slot, -1 if not resident
+    std::unique_ptr<std::atomic<int>[]> m_page_table;
+    std::vector<unsigned char> m_loading;
+
+    int m_n_slots;
+    std::unique_ptr<Slot[]> m_slots;
+    unsigned char* m_cache;
+    std::vector<int> m_free_slots;
+    std::vector<unsigned char> m_zero_brick;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv_loaded;
+
+    std::atomic<uint64_t> m_clock;
+    std::atomic<uint64_t> m_frame_stamp;
+
+    std::atomic<unsigned long long> m_n_misses;
+    std::atomic<unsigned long long> m_n_prefetched;
+    std::atomic<unsigned long long> m_n_evicted;
+    bool m_full_cache_warned;
+
+    std::thread m_prefetch_thread;
+    std::mutex m_prefetch_mutex;
+    std::condition_variable m_prefetch_cv;
+    std::deque<int> m_prefetch_queue;
+    bool m_prefetch_stop;
+  };
+
+  // Same interface of VoxelView<T> used by the kernels that support
+  //  paged volumes: the dimensions, the linear Index of output arrays
+  //  and the per-thread Sampler type
+  template <typename T>
+  class PagedVoxelSampler;
+
+  template <typename T>
+  class PagedVoxelView
+  {
+  public:
+    typedef T value_type;
+    typedef VoxelTypeTraits<T> traits;
+    typedef PagedVoxelSampler<T> Sampler;
+
+    PagedVoxelView (BrickPager* vpager)
+      : pager(vpager)
+      , width(vpager->GetVolumeResolution().x)
+      , height(vpager->GetVolumeResolution().y)
+      , depth(vpager->GetVolumeResolution().z)
+      , stride_y((size_t)width)
+      , stride_z((size_t)width * (size_t)height)
+      , size((size_t)width * (size_t)height * (size_t)depth)
+    {}
+
+    bool IsInside (int x, int y, int z) const
+    {
+      return x >= 0 && y >= 0 && z >= 0 && x < width && y < height && z < depth;
+    }
+
+    size_t Index (int x, int y, int z) const
+    {
+      return (size_t)x + (size_t)y * stride_y + (size_t)z * stride_z;
+    }
+
+    BrickPager* pager;
+    int width, height, depth;
+    size_t stride_y;
+    size_t stride_z;
+    size_t size;
+  };
+
+  // Per-thread access to the voxels of a brick pager, keeps the last
+  //  used bricks pinned in a small direct mapped table
+  template <typename T>
+  class PagedVoxelSampler
+  {
+  public:
+    static const int N_HANDLES = 16;
+
+    PagedVoxelSampler (const PagedVoxelView<T>& view)
+      : m_pager(view.pager)
+      , m_brick_size(view.pager->GetBrickSize())
+      , m_brick_shift(0)
+      , m_grid_size(view.pager->GetGridSize())
+      , m_resolution(view.pager->GetVolumeResolution())
+    {
+      while ((1 << m_brick_shift) < m_brick_size) m_brick_shift++;
+      m_stride_y = m_brick_size + 1;
+      m_stride_z = (m_brick_size + 1) * (m_brick_size + 1);
+      for (int i = 0; i < N_HANDLES; i++)
+      {
+        m_handle_id[i] = -1;
+        m_handle_data[i] = nullptr;
+      }
+    }
+
+    ~PagedVoxelSampler ()
+    {
+      for (int i = 0; i < N_HANDLES; i++)
+        if (m_handle_data[i]) m_pager->ReleaseBrick(m_handle_data[i]);
+    }
+
+    const T* GetBrick (int brick_id)
+    {
+      int h = brick_id & (N_HANDLES - 1);
+      if (m_handle_id[h] != brick_id)
+      {
+        if (m_handle_data[h]) m_pager->ReleaseBrick(m_handle_data[h]);
+        m_handle_data[h] = static_cast<const T*>(m_pager->AcquireBrick(brick_id));
+        m_handle_id[h] = brick_id;
+      }
+      return m_handle_data[h];
+    }
+
+    // Voxel (x, y, z) of the grid and the brick holding it
+    const T* GetVoxel (int x, int y, int z)
+    {
+      int bx = x >> m_brick_shift, by = y >> m_brick_shift, bz = z >> m_brick_shift;
+      const T* brick = GetBrick(bx + (by + bz * m_grid_size.y) * m_grid_size.x);
+      return brick + (x - (bx << m_brick_shift)) + (y - (by << m_brick_shift)) * m_stride_y
+                   + (size_t)(z - (bz << m_brick_shift)) * m_stride_z;
+    }
+
+    T Get (int x, int y, int z)
+    {
+      return *GetVoxel(x, y, z);
+    }
+
+    // Same as VoxelView<T>::GetCell, the apron holds the voxels at + 1
+    void GetCell (int x, int y, int z, float* cell, int cell_stride)
+    {
+      const T* v = GetVoxel(x, y, z);
+      const size_t sy = m_stride_y, sz = m_stride_z;
+      cell[0 * cell_stride] = (float)v[0];
+      cell[1 * cell_stride] = (float)v[1];
+      cell[2 * cell_stride] = (float)v[sy];
+      cell[3 * cell_stride] = (float)v[1 + sy];
+      cell[4 * cell_stride] = (float)v[sz];
+      cell[5 * cell_stride] = (float)v[1 + sz];
+      cell[6 * cell_stride] = (float)v[sy + sz];
+      cell[7 * cell_stride] = (float)v[1 + sy + sz];
+    }
+
+    // Normalized voxels of row (y, z), width values
+    void GetRowNormalized (int y, int z, float* dst)
+    {
+      const float norm = (float)VoxelTypeTraits<T>::NORMALIZATION;
+      for (int x0 = 0; x0 < m_resolution.x; x0 += m_brick_size)
+      {
+        const T* src = GetVoxel(x0, y, z);
+        int n = std::min(m_brick_size, m_resolution.x - x0);
+        for (int x = 0; x < n; x++)
+          dst[x0 + x] = (float)src[x] * norm;
+      }
+    }
+
+  private:
+    PagedVoxelSampler (const PagedVoxelSampler&) = delete;
+    PagedVoxelSampler& operator= (const PagedVoxelSampler&) = delete;
+
+    BrickPager* m_pager;
+    int m_brick_size;
+    int m_brick_shift;
+    glm::ivec3 m_grid_size;
+    glm::ivec3 m_resolution;
+    size_t m_stride_y;
+    size_t m_stride_z;
+
+    int m_handle_id[N_HANDLES];
+    const T* m_handle_data[N_HANDLES];
+  };
+}
+
+#endif
@@ -144,6 +144,7 @@ namespace vis
     }
     else if (st == 1 && bt == 0) {
       arcball_on = false;
+      m_changing_camera = false;
     }
     else if (st == 1 && (bt == 1 || bt == 2)) {
       changing_radius = false;
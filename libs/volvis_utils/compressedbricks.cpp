@@ -0,0 +1,595 @@
+#include "compressedbricks.h"
+#include "structuredgridvolume.h"
+#include "volumebricks.h"
+#include <file_utils/profiler.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#if defined(_MSC_VER)
+  #include <intrin.h>
+#endif
+
+namespace vis
+{
+  enum CompressedBrickMode : unsigned char
+  {
+    COMPRESSED_BRICK_CONSTANT  = 0,
+    COMPRESSED_BRICK_PREDICTED = 1,
+    COMPRESSED_BRICK_RAW       = 2,
+  };
+
+  // Quotients from RICE_ESCAPE on are written as raw values
+  static const int COMPRESSED_BRICK_RICE_ESCAPE = 20;
+  static const int COMPRESSED_BRICK_RICE_PARAMETER_BITS = 5;
+
+  static inline int CountTrailingZeros (uint64_t v)
+  {
+    if (v == 0) return 64;
+#if defined(_MSC_VER)
+    unsigned long id;
+    _BitScanForward64(&id, v);
+    return (int)id;
+#else
+    return __builtin_ctzll(v);
+#endif
+  }
+
+  // Bits are written from the least significant bit of each byte
+  class CompressedBrickBitWriter
+  {
+  public:
+    CompressedBrickBitWriter (std::vector<unsigned char>* out)
+      : m_out(out), m_acc(0), m_n_bits(0)
+    {}
+
+    // value must fit in n_bits <= 32 bits
+    void Write (uint32_t value, int n_bits)
+    {
+      m_acc |= (uint64_t)value << m_n_bits;
+      m_n_bits += n_bits;
+      while (m_n_bits >= 8)
+      {
+        m_out->push_back((unsigned char)m_acc);
+        m_acc >>= 8;
+        m_n_bits -= 8;
+      }
+    }
+
+    void Flush ()
+    {
+      if (m_n_bits > 0)
+        m_out->push_back((unsigned char)m_acc);
+      m_acc = 0;
+      m_n_bits = 0;
+    }
+
+  private:
+    std::vector<unsigned char>* m_out;
+    uint64_t m_acc;
+    int m_n_bits;
+  };
+
+  class CompressedBrickBitReader
+  {
+  public:
+    CompressedBrickBitReader (const unsigned char* data, size_t size)
+      : m_data(data), m_size(size), m_pos(0), m_acc(0), m_n_bits(0)
+    {}
+
+    uint32_t Read (int n_bits)
+    {
+      if (n_bits == 0) return 0;
+      if (m_n_bits < n_bits) Refill();
+      uint32_t v = (uint32_t)(m_acc & ((1ull << n_bits) - 1ull));
+      m_acc >>= n_bits;
+      m_n_bits -= n_bits;
+      return v;
+    }
+
+    // Number of ones before the next zero, which is consumed. Stops at
+    //  max_ones (< 56) ones, without consuming a zero.
+    int ReadUnary (int max_ones)
+    {
+      if (m_n_bits <= max_ones) Refill();
+      int n = CountTrailingZeros(~m_acc);
+      if (n >= max_ones)
+      {
+        m_acc >>= max_ones;
+        m_n_bits -= max_ones;
+        return max_ones;
+      }
+      m_acc >>= (n + 1);
+      m_n_bits -= (n + 1);
+      return n;
+    }
+
+    // False if more bits were read than the stream holds
+    bool IsValid () const
+    {
+      return m_pos * 8 - (size_t)m_n_bits <= m_size * 8;
+    }
+
+  private:
+    void Refill ()
+    {
+      if (m_pos + 8 <= m_size)
+      {
+        uint64_t word;
+        memcpy(&word, m_data + m_pos, 8);
+        m_acc |= word << m_n_bits;
+        int n_bytes = (63 - m_n_bits) >> 3;
+        m_pos += n_bytes;
+        m_n_bits += n_bytes * 8;
+        return;
+      }
+      // Zeros after the end of the stream
+      while (m_n_bits <= 56)
+      {
+        uint64_t byte = (m_pos < m_size) ? m_data[m_pos] : 0;
+        m_acc |= byte << m_n_bits;
+        m_pos++;
+        m_n_bits += 8;
+      }
+    }
+
+    const unsigned char* m_data;
+    size_t m_size;
+    size_t m_pos;
+    uint64_t m_acc;
+    int m_n_bits;
+  };
+
+  // 3D Lorenzo predictor from the decoded voxels before i, the neighbors
+  //  outside the brick are zero (lower dimensional predictor at the faces)
+  template <typename T>
+  static inline int LorenzoPrediction (const T* r, size_t i, int x, int y, int z, size_t sy, size_t sz, int max_value)
+  {
+    int a   = (x > 0) ? (int)r[i - 1] : 0;
+    int b   = (y > 0) ? (int)r[i - sy] : 0;
+    int c   = (z > 0) ? (int)r[i - sz] : 0;
+    int ab  = (x > 0 && y > 0) ? (int)r[i - 1 - sy] : 0;
+    int ac  = (x > 0 && z > 0) ? (int)r[i - 1 - sz] : 0;
+    int bc  = (y > 0 && z > 0) ? (int)r[i - sy - sz] : 0;
+    int abc = (x > 0 && y > 0 && z > 0) ? (int)r[i - 1 - sy - sz] : 0;
+    return std::min(std::max(a + b + c - ab - ac - bc + abc, 0), max_value);
+  }
+
+  template <typename T>
+  static void EncodeVoxels (const T* voxels, int side, int max_error, std::vector<unsigned char>* out)
+  {
+    const size_t n = (size_t)side * side * side;
+    const int max_value = (int)std::numeric_limits<T>::max();
+    const int escape_bits = (int)sizeof(T) * 8 + 1;
+
+    // Every voxel within max_error of a single value
+    std::pair<const T*, const T*> range = std::minmax_element(voxels, voxels + n);
+    if ((int)*range.second - (int)*range.first <= 2 * max_error)
+    {
+      T value = (T)(*range.first + (*range.second - *range.first) / 2);
+      out->push_back(COMPRESSED_BRICK_CONSTANT);
+      out->insert(out->end(), (const unsigned char*)&value, (const unsigned char*)&value + sizeof(T));
+      return;
+    }
+
+    size_t start = out->size();
+    uint32_t step = (uint32_t)(2 * max_error + 1);
+    out->push_back(COMPRESSED_BRICK_PREDICTED);
+    out->insert(out->end(), (const unsigned char*)&step, (const unsigned char*)&step + sizeof(uint32_t));
+
+    // Quantized residuals, predicted from the reconstructed voxels
+    std::vector<uint32_t> residuals(n);
+    std::vector<T> reconstructed(n);
+    const size_t sy = (size_t)side, sz = (size_t)side * side;
+    size_t i = 0;
+    for (int z = 0; z < side; z++)
+    {
+      for (int y = 0; y < side; y++)
+      {
+        for (int x = 0; x < side; x++, i++)
+        {
+          int p = LorenzoPrediction(reconstructed.data(), i, x, y, z, sy, sz, max_value);
+          int r = (int)voxels[i] - p;
+          int q = (r >= 0) ? (r + max_error) / (int)step : -((-r + max_error) / (int)step);
+          reconstructed[i] = (T)std::min(std::max(p + q * (int)step, 0), max_value);
+          residuals[i] = ((uint32_t)q << 1) ^ (uint32_t)(q >> 31);
+        }
+      }
+    }
+
+    CompressedBrickBitWriter writer(out);
+    for (size_t g = 0; g < n; g += CompressedBricks::RICE_GROUP_SIZE)
+    {
+      size_t m = std::min((size_t)CompressedBricks::RICE_GROUP_SIZE, n - g);
+      uint64_t sum = 0;
+      for (size_t j = 0; j < m; j++)
+        sum += residuals[g + j];
+
+      // k = floor(log2(mean))
+      int k = 0;
+      while (k < escape_bits && ((uint64_t)m << (k + 1)) <= sum)
+        k++;
+      writer.Write((uint32_t)k, COMPRESSED_BRICK_RICE_PARAMETER_BITS);
+
+      for (size_t j = 0; j < m; j++)
+      {
+        uint32_t u = residuals[g + j];
+        uint32_t q = u >> k;
+        if (q < (uint32_t)COMPRESSED_BRICK_RICE_ESCAPE)
+        {
+          // q ones and a zero, then the k low bits
+          writer.Write((1u << q) - 1u, (int)q + 1);
+          writer.Write(u & ((1u << k) - 1u), k);
+        }
+        else
+        {
+          writer.Write((1u << COMPRESSED_BRICK_RICE_ESCAPE) - 1u, COMPRESSED_BRICK_RICE_ESCAPE);
+          writer.Write(u, escape_bits);
+        }
+      }
+    }
+    writer.Flush();
+
+    // Noisy bricks are kept as they are
+    if (out->size() - start > 1 + n * sizeof(T))
+    {
+      out->resize(start);
+      out->push_back(COMPRESSED_BRICK_RAW);
+      out->insert(out->end(), (const unsigned char*)voxels, (const unsigned char*)(voxels + n));
+    }
+  }
+
+  template <typename T>
+  static bool DecodeVoxels (const unsigned char* data, size_t size, int side, T* voxels)
+  {
+    const size_t n = (size_t)side * side * side;
+    if (size < 1) return false;
+
+    if (data[0] == COMPRESSED_BRICK_CONSTANT)
+    {
+      if (size < 1 + sizeof(T)) return false;
+      T value;
+      memcpy(&value, data + 1, sizeof(T));
+      std::fill(voxels, voxels + n, value);
+      return true;
+    }
+
+    if (data[0] == COMPRESSED_BRICK_RAW)
+    {
+      if (size < 1 + n * sizeof(T)) return false;
+      memcpy(voxels, data + 1, n * sizeof(T));
+      return true;
+    }
+
+    if (data[0] != COMPRESSED_BRICK_PREDICTED || size < 1 + sizeof(uint32_t))
+      return false;
+
+    uint32_t ustep;
+    memcpy(&ustep, data + 1, sizeof(uint32_t));
+    const int step = (int)ustep;
+    const int max_value = (int)std::numeric_limits<T>::max();
+    const int escape_bits = (int)sizeof(T) * 8 + 1;
+
+    CompressedBrickBitReader reader(data + 1 + sizeof(uint32_t), size - 1 - sizeof(uint32_t));
+    const size_t sy = (size_t)side, sz = (size_t)side * side;
+    size_t i = 0;
+    int k = 0;
+    int group_left = 0;
+    for (int z = 0; z < side; z++)
+    {
+      for (int y = 0; y < side; y++)
+      {
+        for (int x = 0; x < side; x++, i++)
+        {
+          if (group_left == 0)
+          {
+            k = (int)reader.Read(COMPRESSED_BRICK_RICE_PARAMETER_BITS);
+            group_left = CompressedBricks::RICE_GROUP_SIZE;
+          }
+          group_left--;
+
+          uint32_t u;
+          int q = reader.ReadUnary(COMPRESSED_BRICK_RICE_ESCAPE);
+          if (q < COMPRESSED_BRICK_RICE_ESCAPE)
+            u = ((uint32_t)q << k) | reader.Read(k);
+          else
+            u = reader.Read(escape_bits);
+
+          int residual = (int)(u >> 1) ^ -(int)(u & 1u);
+          int p = LorenzoPrediction(voxels, i, x, y, z, sy, sz, max_value);
+          voxels[i] = (T)std::min(std::max(p + residual * step, 0), max_value);
+        }
+      }
+    }
+    return reader.IsValid();
+  }
+
+  // Copy brick (bx, by, bz) with its +1 apron into dst, clamping the
+  //  voxels outside the grid to the border (same bricks of BrickPager::WriteFile).
+  //  In-memory views are read directly, their sampler is not used.
+  template <typename T>
+  static void GatherBrick (const VoxelView<T>& view, VoxelView<T>&, int brick_size,
+                           int bx, int by, int bz, T* dst)
+  {
+    const int B = brick_size;
+    for (int z = 0; z <= B; z++)
+    {
+      int vz = std::min(bz * B + z, view.depth - 1);
+      for (int y = 0; y <= B; y++)
+      {
+        int vy = std::min(by * B + y, view.height - 1);
+        const T* row = view.data + view.Index(0, vy, vz);
+        int vx = bx * B;
+        int n = std::min(B + 1, view.width - vx);
+        memcpy(dst, row + vx, sizeof(T) * n);
+        for (int x = n; x <= B; x++)
+          dst[x] = row[view.width - 1];
+        dst += B + 1;
+      }
+    }
+  }
+
+  template <typename T>
+  static void GatherBrick (const PagedVoxelView<T>& view, PagedVoxelSampler<T>& sampler, int brick_size,
+                           int bx, int by, int bz, T* dst)
+  {
+    const int B = brick_size;
+    for (int z = 0; z <= B; z++)
+    {
+      int vz = std::min(bz * B + z, view.depth - 1);
+      for (int y = 0; y <= B; y++)
+      {
+        int vy = std::min(by * B + y, view.height - 1);
+        for (int x = 0; x <= B; x++)
+          dst[x] = sampler.Get(std::min(bx * B + x, view.width - 1), vy, vz);
+        dst += B + 1;
+      }
+    }
+  }
+
+  template <typename T>
+  static void GatherBrickRange (const VoxelView<T>& view, VoxelView<T>&, int brick_size,
+                                int bx, int by, int bz, float* min_max)
+  {
+    ComputeBrickRange(view, brick_size, bx, by, bz, min_max);
+  }
+
+  // Same voxels of ComputeBrickRange
+  template <typename T>
+  static void GatherBrickRange (const PagedVoxelView<T>& view, PagedVoxelSampler<T>& sampler, int brick_size,
+                                int bx, int by, int bz, float* min_max)
+  {
+    const int B = brick_size;
+    int x0 = std::max(bx * B - 1, 0), x1 = std::min((bx + 1) * B, view.width - 1);
+    int y0 = std::max(by * B - 1, 0), y1 = std::min((by + 1) * B, view.height - 1);
+    int z0 = std::max(bz * B - 1, 0), z1 = std::min((bz + 1) * B, view.depth - 1);
+
+    T vmin = sampler.Get(x0, y0, z0), vmax = vmin;
+    for (int z = z0; z <= z1; z++)
+    {
+      for (int y = y0; y <= y1; y++)
+      {
+        for (int x = x0; x <= x1; x++)
+        {
+          T v = sampler.Get(x, y, z);
+          vmin = std::min(vmin, v);
+          vmax = std::max(vmax, v);
+        }
+      }
+    }
+    min_max[0] = (float)vmin * (float)VoxelTypeTraits<T>::NORMALIZATION;
+    min_max[1] = (float)vmax * (float)VoxelTypeTraits<T>::NORMALIZATION;
+  }
+
+  bool CompressedBricks::EncodeBrick (const void* voxels, DataStorageSize dss, int side, int max_error,
+                                      std::vector<unsigned char>* out)
+  {
+    if (dss == DataStorageSize::_8_BITS)
+      EncodeVoxels(static_cast<const unsigned char*>(voxels), side, std::min(max_error, 255), out);
+    else if (dss == DataStorageSize::_16_BITS)
+      EncodeVoxels(static_cast<const unsigned short*>(voxels), side, std::min(max_error, 65535), out);
+    else
+      return false;
+    return true;
+  }
+
+  bool CompressedBricks::DecodeBrick (const unsigned char* data, size_t size, DataStorageSize dss, int side, void* voxels)
+  {
+    if (dss == DataStorageSize::_8_BITS)
+      return DecodeVoxels(data, size, side, static_cast<unsigned char*>(voxels));
+    if (dss == DataStorageSize::_16_BITS)
+      return DecodeVoxels(data, size, side, static_cast<unsigned short*>(voxels));
+    return false;
+  }
+
+  CompressedBricks::CompressedBricks ()
+    : m_vol_resolution(0)
+    , m_vol_scale(1.0)
+    , m_data_storage_size(DataStorageSize::UNKNOWN)
+    , m_max_error(0)
+    , m_brick_size(0)
+    , m_grid_size(0)
+    , m_brick_data(nullptr)
+    , m_mapped_file(nullptr)
+  {
+  }
+
+  CompressedBricks::~CompressedBricks ()
+  {
+    Clear();
+  }
+
+  bool CompressedBricks::Build (StructuredGridVolume* vol, int max_error, int brick_size, ThreadPool* thread_pool)
+  {
+    PROFILE_SCOPE("CompressedBricks::Build");
+    Clear();
+
+    if (vol == nullptr || (vol->GetArrayData() == nullptr && !vol->IsPaged()))
+    {
+      printf("CompressedBricks: the volume has no data\n");
+      return false;
+    }
+    DataStorageSize dss = vol->GetDataStorageSize();
+    if (dss != DataStorageSize::_8_BITS && dss != DataStorageSize::_16_BITS)
+    {
+      printf("CompressedBricks: only 8 and 16 bit volumes can be compressed\n");
+      return false;
+    }
+    if (brick_size < 4 || brick_size > 256 || (brick_size & (brick_size - 1)) != 0)
+    {
+      printf("CompressedBricks: invalid brick size %d\n", brick_size);
+      return false;
+    }
+    if (thread_pool == nullptr)
+      thread_pool = ThreadPool::GetDefault();
+
+    m_vol_resolution = glm::ivec3(vol->GetWidth(), vol->GetHeight(), vol->GetDepth());
+    m_vol_scale = vol->GetScale();
+    m_data_storage_size = dss;
+    m_max_error = std::max(max_error, 0);
+    m_brick_size = brick_size;
+    m_grid_size = (m_vol_resolution + brick_size - 1) / brick_size;
+
+    int n_bricks = GetNumberOfBricks();
+    m_min_max.resize((size_t)n_bricks * 2);
+    std::vector<std::vector<unsigned char>> encoded(n_bricks);
+
+    // One row of bricks per task
+    vol->DispatchVoxelAccess([&](auto view) {
+      typedef typename decltype(view)::value_type T;
+      const float norm = (float)decltype(view)::traits::NORMALIZATION;
+      thread_pool->ParallelFor(m_grid_size.y * m_grid_size.z, [&](int row_id) {
+        int by = row_id % m_grid_size.y, bz = row_id / m_grid_size.y;
+        typename decltype(view)::Sampler sampler(view);
+        std::vector<T> brick((size_t)(m_brick_size + 1) * (m_brick_size + 1) * (m_brick_size + 1));
+        for (int bx = 0; bx < m_grid_size.x; bx++)
+        {
+          int brick_id = bx + (by + bz * m_grid_size.y) * m_grid_size.x;
+          GatherBrick(view, sampler, m_brick_size, bx, by, bz, brick.data());
+          EncodeBrick(brick.data(), m_data_storage_size, m_brick_size + 1, m_max_error, &encoded[brick_id]);
+
+          float* min_max = &m_min_max[(size_t)brick_id * 2];
+          GatherBrickRange(view, sampler, m_brick_size, bx, by, bz, min_max);
+          min_max[0] = std::max(min_max[0] - (float)m_max_error * norm, 0.0f);
+          min_max[1] = std::min(min_max[1] + (float)m_max_error * norm, 1.0f);
+        }
+      });
+    });
+
+    size_t total_size = 0;
+    for (int i = 0; i < n_bricks; i++)
+      total_size += encoded[i].size();
+
+    m_offsets.resize((size_t)n_bricks + 1);
+    m_data.reserve(total_size);
+    for (int i = 0; i < n_bricks; i++)
+    {
+      m_offsets[i] = m_data.size();
+      m_data.insert(m_data.end(), encoded[i].begin(), encoded[i].end());
+      std::vector<unsigned char>().swap(encoded[i]);
+    }
+    m_offsets[n_bricks] = m_data.size();
+    m_brick_data = m_data.data();
+
+    printf("CompressedBricks: %d bricks of %d^3, %zu bytes (%.2fx, %s)\n", n_bricks, m_brick_size,
+      m_data.size(), GetCompressionRatio(), m_max_error == 0 ? "lossless" : "lossy");
+    return true;
+  }
+
+  void CompressedBricks::Clear ()
+  {
+    m_vol_resolution = glm::ivec3(0);
+    m_data_storage_size = DataStorageSize::UNKNOWN;
+    m_max_error = 0;
+    m_brick_size = 0;
+    m_grid_size = glm::ivec3(0);
+    std::vector<float>().swap(m_min_max);
+    std::vector<uint64_t>().swap(m_offsets);
+    std::vector<unsigned char>().swap(m_data);
+    m_brick_data = nullptr;
+    if (m_mapped_file) delete m_mapped_file;
+    m_mapped_file = nullptr;
+  }
+
+  bool CompressedBricks::IsBuilt () const
+  {
+    return !m_offsets.empty();
+  }
+
+  glm::ivec3 CompressedBricks::GetVolumeResolution () const
+  {
+    return m_vol_resolution;
+  }
+
+  glm::dvec3 CompressedBricks::GetScale () const
+  {
+    return m_vol_scale;
+  }
+
+  DataStorageSize CompressedBricks::GetDataStorageSize () const
+  {
+    return m_data_storage_size;
+  }
+
+  int CompressedBricks::GetMaxError () const
+  {
+    return m_max_error;
+  }
+
+  int CompressedBricks::GetBrickSize () const
+  {
+    return m_brick_size;
+  }
+
+  glm::ivec3 CompressedBricks::GetGridSize () const
+  {
+    return m_grid_size;
+  }
+
+  int CompressedBricks::GetNumberOfBricks () const
+  {
+    return m_grid_size.x * m_grid_size.y * m_grid_size.z;
+  }
+
+  size_t CompressedBricks::GetBrickSizeBytes () const
+  {
+    return (size_t)(m_brick_size + 1) * (m_brick_size + 1) * (m_brick_size + 1) * GetStorageSizeBytes(m_data_storage_size);
+  }
+
+  const float* CompressedBricks::GetMinMaxData () const
+  {
+    return m_min_max.data();
+  }
+
+  const unsigned char* CompressedBricks::GetBrickData (int brick_id) const
+  {
+    return m_brick_data + m_offsets[brick_id];
+  }
+
+  size_t CompressedBricks::GetBrickDataSize (int brick_id) const
+  {
+    return (size_t)(m_offsets[brick_id + 1] - m_offsets[brick_id]);
+  }
+
+  size_t CompressedBricks::GetCompressedSizeBytes () const
+  {
+    return m_offsets.empty() ? 0 : (size_t)m_offsets.back();
+  }
+
+  double CompressedBricks::GetCompressionRatio () const
+  {
+    if (GetCompressedSizeBytes() == 0) return 0.0;
+    double n_bytes = (double)m_vol_resolution.x * m_vol_resolution.y * m_vol_resolution.z
+                   * (double)GetStorageSizeBytes(m_data_storage_size);
+    return n_bytes / (double)GetCompressedSizeBytes();
+  }
+
+  bool CompressedBricks::Decode (int brick_id, void* dst) const
+  {
+    if (brick_id < 0 || brick_id >= GetNumberOfBricks())
+      return false;
+    return DecodeBrick(GetBrickData(brick_id), GetBrickDataSize(brick_id), m_data_storage_size, m_brick_size + 1, dst);
+  }
+}
@@ -0,0 +1,113 @@
+/**
+ * Structured grid volume kept in memory as independently decodable
+ *   compressed bricks.
+ *
+ * Each brick holds the (brick_size + 1)^3 voxels of a .braw brick (see
+ *   vis::BrickPager), apron included, so a decoded brick is a page of the
+ *   brick pager cache. A brick is stored as:
+ * . constant: a single value, for empty and saturated regions
+ * . predicted: residuals of the 3D Lorenzo predictor over the already
+ *   decoded voxels of the brick, zigzag mapped and Golomb-Rice coded
+ *   with one parameter per group of RICE_GROUP_SIZE residuals
+ * . raw: if the prediction does not pay off
+ *
+ * max_error == 0 is lossless. Otherwise the residuals are quantized with
+ *   step 2 * max_error + 1, predicting from the reconstructed voxels, so
+ *   every decoded voxel is within max_error (in voxel units) of the
+ *   source. Brick ranges are widened by max_error, keeping empty space
+ *   skipping conservative.
+ *
+ * Only 8 and 16 bit volumes are compressed, paged source volumes are read
+ *   through their bricks. The voxels are read through a vis::BrickPager
+ *   opened over the compressed bricks, whose cache holds the decoded
+ *   bricks (StructuredGridVolume::CompressData). Bricks read from a
+ *   vis::VolumeContainer stay in the mapped pages of the file.
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_COMPRESSED_BRICKS_H
+#define VOL_VIS_UTILS_COMPRESSED_BRICKS_H
+
+#include <volvis_utils/voxelstorage.h>
+#include <volvis_utils/threadpool.h>
+#include <file_utils/mappedfile.h>
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace vis
+{
+  class StructuredGridVolume;
+
+  class CompressedBricks
+  {
+  public:
+    static const int DEFAULT_BRICK_SIZE = 32;
+    static const int RICE_GROUP_SIZE = 64;
+
+    // Encode side^3 voxels of type dss (x fastest), appending the brick to out
+    static bool EncodeBrick (const void* voxels, DataStorageSize dss, int side, int max_error,
+                             std::vector<unsigned char>* out);
+    // Decode a brick of size bytes into side^3 voxels of type dss
+    static bool DecodeBrick (const unsigned char* data, size_t size, DataStorageSize dss, int side, void* voxels);
+
+    CompressedBricks ();
+    ~CompressedBricks ();
+
+    // brick_size must be a power of two in [4, 256]
+    bool Build (StructuredGridVolume* vol, int max_error = 0, int brick_size = DEFAULT_BRICK_SIZE,
+                ThreadPool* thread_pool = nullptr);
+    void Clear ();
+    bool IsBuilt () const;
+
+    glm::ivec3 GetVolumeResolution () const;
+    glm::dvec3 GetScale () const;
+    DataStorageSize GetDataStorageSize () const;
+    int GetMaxError () const;
+
+    int GetBrickSize () const;
+    glm::ivec3 GetGridSize () const;
+    int GetNumberOfBricks () const;
+    // Decoded brick, (brick_size + 1)^3 voxels
+    size_t GetBrickSizeBytes () const;
+    // 2 floats (min, max) per brick, same content of VolumeBricks::GetMinMaxData
+    const float* GetMinMaxData () const;
+
+    const unsigned char* GetBrickData (int brick_id) const;
+    size_t GetBrickDataSize (int brick_id) const;
+
+    size_t GetCompressedSizeBytes () const;
+    // Bytes of the uncompressed voxels (without aprons) per compressed byte
+    double GetCompressionRatio () const;
+
+    // Decode brick_id into dst, GetBrickSizeBytes bytes
+    bool Decode (int brick_id, void* dst) const;
+
+  protected:
+
+  private:
+    friend class VolumeContainer;
+
+    glm::ivec3 m_vol_resolution;
+    glm::dvec3 m_vol_scale;
+    DataStorageSize m_data_storage_size;
+    int m_max_error;
+
+    int m_brick_size;
+    glm::ivec3 m_grid_size;
+    std::vector<float> m_min_max;
+
+    // brick i is stored at [m_offsets[i], m_offsets[i + 1]) of m_brick_data,
+    //  which points to m_data or to the pages of a mapped file
+    std::vector<uint64_t> m_offsets;
+    std::vector<unsigned char> m_data;
+    const unsigned char* m_brick_data;
+    // not null if the bricks are read from pages owned by this object
+    MappedFile* m_mapped_file;
+  };
+}
+
+#endif
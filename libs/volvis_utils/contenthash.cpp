@@ -0,0 +1,131 @@
+#include "contenthash.h"
+#include <file_utils/profiler.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace vis
+{
+  static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+  static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+  static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+  static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+  static const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+  static inline uint64_t RotL (uint64_t x, int r)
+  {
+    return (x << r) | (x >> (64 - r));
+  }
+
+  // Little endian reads, unaligned
+  static inline uint64_t Read64 (const unsigned char* p)
+  {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  static inline uint32_t Read32 (const unsigned char* p)
+  {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  static inline uint64_t Round (uint64_t acc, uint64_t input)
+  {
+    acc += input * PRIME64_2;
+    acc = RotL(acc, 31);
+    return acc * PRIME64_1;
+  }
+
+  static inline uint64_t MergeRound (uint64_t acc, uint64_t val)
+  {
+    acc ^= Round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+  }
+
+  uint64_t HashBytes (const void* data, size_t size, uint64_t seed)
+  {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + size;
+    uint64_t h;
+
+    if (size >= 32)
+    {
+      uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+      uint64_t v2 = seed + PRIME64_2;
+      uint64_t v3 = seed;
+      uint64_t v4 = seed - PRIME64_1;
+
+      const unsigned char* limit = end - 32;
+      do
+      {
+        v1 = Round(v1, Read64(p));
+        v2 = Round(v2, Read64(p + 8));
+        v3 = Round(v3, Read64(p + 16));
+        v4 = Round(v4, Read64(p + 24));
+        p += 32;
+      } while (p <= limit);
+
+      h = RotL(v1, 1) + RotL(v2, 7) + RotL(v3, 12) + RotL(v4, 18);
+      h = MergeRound(h, v1);
+      h = MergeRound(h, v2);
+      h = MergeRound(h, v3);
+      h = MergeRound(h, v4);
+    }
+    else
+    {
+      h = seed + PRIME64_5;
+    }
+
+    h += (uint64_t)size;
+
+    for (; p + 8 <= end; p += 8)
+    {
+      h ^= Round(0, Read64(p));
+      h = RotL(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end)
+    {
+      h ^= (uint64_t)Read32(p) * PRIME64_1;
+      h = RotL(h, 23) * PRIME64_2 + PRIME64_3;
+      p += 4;
+    }
+    for (; p < end; p++)
+    {
+      h ^= (uint64_t)(*p) * PRIME64_5;
+      h = RotL(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+  }
+
+  uint64_t ComputeContentHash (const void* data, size_t size, ThreadPool* thread_pool)
+  {
+    PROFILE_SCOPE("ComputeContentHash");
+    if (size <= CONTENT_HASH_CHUNK_SIZE)
+      return HashBytes(data, size, (uint64_t)size);
+
+    if (thread_pool == nullptr)
+      thread_pool = ThreadPool::GetDefault();
+
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    int n_chunks = (int)((size + CONTENT_HASH_CHUNK_SIZE - 1) / CONTENT_HASH_CHUNK_SIZE);
+
+    std::vector<uint64_t> chunk_hashes(n_chunks);
+    thread_pool->ParallelFor(n_chunks, [&](int chunk_id) {
+      size_t offset = (size_t)chunk_id * CONTENT_HASH_CHUNK_SIZE;
+      size_t chunk_size = std::min(CONTENT_HASH_CHUNK_SIZE, size - offset);
+      chunk_hashes[chunk_id] = HashBytes(bytes + offset, chunk_size, 0);
+    });
+
+    return HashBytes(chunk_hashes.data(), chunk_hashes.size() * sizeof(uint64_t), (uint64_t)size);
+  }
+}
@@ -0,0 +1,30 @@
+/**
+ * Fast 64-bit content hash of memory buffers.
+ *
+ * HashBytes is the xxHash64 algorithm. ComputeContentHash splits large
+ * buffers in CONTENT_HASH_CHUNK_SIZE chunks hashed in parallel by a
+ * vis::ThreadPool, the result is the xxHash64 of the chunk hashes
+ * seeded with the buffer size. It only depends on the buffer contents,
+ * not on the number of threads.
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_CONTENT_HASH_H
+#define VOL_VIS_UTILS_CONTENT_HASH_H
+
+#include <volvis_utils/threadpool.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vis
+{
+  static const size_t CONTENT_HASH_CHUNK_SIZE = 4 * 1024 * 1024;
+
+  uint64_t HashBytes (const void* data, size_t size, uint64_t seed = 0);
+
+  uint64_t ComputeContentHash (const void* data, size_t size, ThreadPool* thread_pool = nullptr);
+}
+
+#endif
@@ -0,0 +1,1059 @@
+#include "cpuraycaster.h"
+#include "gradientengine.h"
+#include "simd.h"
+#include <file_utils/profiler.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace vis
+{
+  struct CPURayCaster::RayPacket
+  {
+    // texture space position at tnear [0, VolumeGridSize] and ray direction
+    float pos[3][simd::WIDTH];
+    float dir[3][simd::WIDTH];
+    // distance to be evaluated, 0 if the ray missed the volume
+    float dist[simd::WIDTH];
+    // offset of the samples inside each step, in [-0.5, 0.5)
+    float jitter[simd::WIDTH];
+    // output radiance and opacity
+    float rgba[4][simd::WIDTH];
+  };
+
+  CPURayCaster::CPURayCaster (ThreadPool* thread_pool)
+    : m_thread_pool(thread_pool)
+    , m_volume(nullptr)
+    , m_vol_resolution(0)
+    , m_vol_voxel_size(1.0f)
+    , m_vol_grid_size(0.0f)
+    , m_preint_size(TransferFunction1D::DEFAULT_PREINTEGRATION_SIZE)
+    , m_apply_preintegration(false)
+    , m_gradient_format(GradientEngine::OUTPUT_FORMAT::FLOAT_32)
+    , m_apply_gradient_shading(true)
+    , m_step_size(0.5f)
+    , m_empty_space_skipping(true)
+    , m_adaptive_step(false)
+    , m_max_step_scale(DEFAULT_MAX_STEP_SCALE)
+    , m_render_mode(RENDER_MODE::DIRECT_VOLUME_RENDERING)
+    , m_cam_eye(0.0f)
+    , m_cam_rotation(1.0f)
+    , m_cam_tan_fov_y(1.0f)
+    , m_cam_aspect_ratio(1.0f)
+    , m_blinnphong_ka(0.5f)
+    , m_blinnphong_kd(0.5f)
+    , m_blinnphong_ks(0.8f)
+    , m_blinnphong_shininess(30.0f)
+    , m_blinnphong_ispecular(1.0f)
+    , m_light_source_position(0.0f)
+  {
+    if (m_thread_pool == nullptr)
+      m_thread_pool = ThreadPool::GetDefault();
+    m_density_range[0] = 0.0;
+    m_density_range[1] = 1.0;
+  }
+
+  CPURayCaster::~CPURayCaster ()
+  {
+  }
+
+  void CPURayCaster::SetVolume (StructuredGridVolume* vol)
+  {
+    m_volume = vol;
+    m_gradient.clear();
+    m_packed_gradient.clear();
+
+    if (m_volume)
+    {
+      m_vol_resolution = glm::ivec3(vol->GetWidth(), vol->GetHeight(), vol->GetDepth());
+      m_vol_voxel_size = glm::vec3(vol->GetScaleX(), vol->GetScaleY(), vol->GetScaleZ());
+      m_vol_grid_size  = glm::vec3(m_vol_resolution) * m_vol_voxel_size;
+
+      bool skip_bricks = m_render_mode == RENDER_MODE::MAXIMUM_INTENSITY_PROJECTION ||
+                         m_render_mode == RENDER_MODE::MINIMUM_INTENSITY_PROJECTION;
+      if ((m_empty_space_skipping || m_adaptive_step || skip_bricks) && m_volume->GetBricks() == nullptr)
+        m_volume->BuildBricks(m_volume->GetNativeBrickSize(), false, m_thread_pool);
+    }
+    UpdateOccupancyGrid();
+  }
+
+  void CPURayCaster::SetTransferFunction (TransferFunction1D* tf)
+  {
+    // The table only covers the value range of the volume set
+    double density_min = 0.0, density_max = 1.0;
+    if (m_volume)
+      m_volume->GetNormalizedRange(&density_min, &density_max);
+    SetTransferFunction(tf ? std::make_shared<const TransferFunctionSnapshot>(*tf, 0, (float)density_min, (float)density_max) : nullptr);
+  }
+
+  void CPURayCaster::SetTransferFunction (TransferFunctionSnapshotPtr snapshot)
+  {
+    TransferFunctionSnapshotPtr previous = m_tf_snapshot;
+    m_tf_snapshot = snapshot;
+    if (snapshot == nullptr)
+    {
+      m_tf_preintegrated.clear();
+      UpdateOccupancyGrid();
+      return;
+    }
+
+    int first, last;
+    bool changed = snapshot->GetChangedRange(previous.get(), &first, &last);
+    if (!changed && (!m_apply_preintegration || !m_tf_preintegrated.empty()))
+      return;
+
+    // Every segment crossing the changed range has another integral
+    m_tf_preintegrated.clear();
+    if (m_apply_preintegration)
+      m_tf_preintegrated = snapshot->GetTransferFunction()->GeneratePreIntegratedRGBt(m_preint_size, m_thread_pool);
+
+    // Only the bricks fetching changed extinction entries are tested again
+    VolumeBricks* bricks = m_volume ? m_volume->GetBricks() : nullptr;
+    if (previous && bricks && m_occupancy_grid.IsBuilt())
+    {
+      if (snapshot->GetChangedRange(previous.get(), &first, &last, true))
+      {
+        const TransferFunctionTable& table = snapshot->GetTable();
+        m_occupancy_grid.Update(bricks, table, first, last);
+        PROFILE_COUNTER("occupied_bricks_ratio", m_occupancy_grid.GetOccupiedRatio());
+      }
+    }
+    else
+    {
+      UpdateOccupancyGrid();
+    }
+  }
+
+  void CPURayCaster::SetStepSize (float step_size)
+  {
+    m_step_size = step_size;
+  }
+
+  float CPURayCaster::GetStepSize ()
+  {
+    return m_step_size;
+  }
+
+  void CPURayCaster::SetPreIntegration (bool apply, int table_size)
+  {
+    m_apply_preintegration = apply;
+    m_preint_size = std::max(table_size, 2);
+  }
+
+  bool CPURayCaster::GetPreIntegration ()
+  {
+    return m_apply_preintegration;
+  }
+
+  void CPURayCaster::SetGradientShading (bool apply)
+  {
+    m_apply_gradient_shading = apply;
+  }
+
+  bool CPURayCaster::GetGradientShading ()
+  {
+    return m_apply_gradient_shading;
+  }
+
+  void CPURayCaster::SetEmptySpaceSkipping (bool skip)
+  {
+    m_empty_space_skipping = skip;
+    if (m_empty_space_skipping && m_volume && m_volume->GetBricks() == nullptr)
+      m_volume->BuildBricks(m_volume->GetNativeBrickSize(), false, m_thread_pool);
+    UpdateOccupancyGrid();
+  }
+
+  bool CPURayCaster::GetEmptySpaceSkipping ()
+  {
+    return m_empty_space_skipping;
+  }
+
+  void CPURayCaster::SetAdaptiveStep (bool apply, float max_step_scale)
+  {
+    m_adaptive_step = apply;
+    m_max_step_scale = std::max(max_step_scale, 1.0f);
+    if (m_adaptive_step && m_volume && m_volume->GetBricks() == nullptr)
+      m_volume->BuildBricks(m_volume->GetNativeBrickSize(), false, m_thread_pool);
+    UpdateOccupancyGrid();
+  }
+
+  bool CPURayCaster::GetAdaptiveStep ()
+  {
+    return m_adaptive_step;
+  }
+
+  const OccupancyGrid* CPURayCaster::GetOccupancyGrid ()
+  {
+    return m_occupancy_grid.IsBuilt() ? &m_occupancy_grid : nullptr;
+  }
+
+  void CPURayCaster::SetRenderMode (RENDER_MODE mode)
+  {
+    m_render_mode = mode;
+    // Same bricks of SetVolume
+    if (m_volume && m_volume->GetBricks() == nullptr && mode != RENDER_MODE::DIRECT_VOLUME_RENDERING)
+      m_volume->BuildBricks(m_volume->GetNativeBrickSize(), false, m_thread_pool);
+  }
+
+  RENDER_MODE CPURayCaster::GetRenderMode ()
+  {
+    return m_render_mode;
+  }
+
+  void CPURayCaster::SetGradientFormat (GradientEngine::OUTPUT_FORMAT format)
+  {
+    if (format == m_gradient_format) return;
+    m_gradient_format = format;
+    m_gradient.clear();
+    m_packed_gradient.clear();
+  }
+
+  GradientEngine::OUTPUT_FORMAT CPURayCaster::GetGradientFormat ()
+  {
+    return m_gradient_format;
+  }
+
+  void CPURayCaster::SetGradientField (std::vector<float> gradient)
+  {
+    if (m_gradient_format == GradientEngine::OUTPUT_FORMAT::FLOAT_32)
+    {
+      m_gradient = std::move(gradient);
+      return;
+    }
+
+    size_t n_voxels = gradient.size() / 3;
+    std::vector<uint8_t> packed(n_voxels * GradientEngine::GetBytesPerVoxel(m_gradient_format));
+    GradientEngine gradient_engine;
+    GradientEngine::Encode(m_gradient_format, gradient.data(), n_voxels, gradient_engine.GetMaxMagnitude(), packed.data());
+    SetGradientField(std::move(packed));
+  }
+
+  void CPURayCaster::SetGradientField (std::vector<uint8_t> gradient)
+  {
+    m_gradient.clear();
+    m_packed_gradient = std::move(gradient);
+  }
+
+  void CPURayCaster::SetCamera (glm::vec3 eye, glm::mat4 lookat, float tan_fov_y, float aspect_ratio)
+  {
+    m_cam_eye = eye;
+    m_cam_rotation = glm::mat3(lookat);
+    m_cam_tan_fov_y = tan_fov_y;
+    m_cam_aspect_ratio = aspect_ratio;
+  }
+
+  void CPURayCaster::SetBlinnPhong (float ka, float kd, float ks, float shininess,
+                                    glm::vec3 specular_color, glm::vec3 light_position)
+  {
+    m_blinnphong_ka = ka;
+    m_blinnphong_kd = kd;
+    m_blinnphong_ks = ks;
+    m_blinnphong_shininess = shininess;
+    m_blinnphong_ispecular = specular_color;
+    m_light_source_position = light_position;
+  }
+
+  bool CPURayCaster::Render (int width, int height, float* rgba_output)
+  {
+    PROFILE_SCOPE("CPURayCaster::Render");
+    if (!PrepareFrame())
+      return false;
+
+    int n_tiles = ((width + TILE_SIZE - 1) / TILE_SIZE) * ((height + TILE_SIZE - 1) / TILE_SIZE);
+
+    // Dispatch the storage type once per frame
+    return m_volume->DispatchVoxelAccess([&](auto view) {
+      m_thread_pool->ParallelFor(n_tiles, [&](int tile_id) {
+        RenderTile(view, tile_id, width, height, rgba_output);
+      });
+    });
+  }
+
+  bool CPURayCaster::RenderProgressive (int width, int height, float* rgba_output, ProgressiveRefinement* progressive)
+  {
+    PROFILE_SCOPE("CPURayCaster::RenderProgressive");
+    if (!PrepareFrame())
+      return false;
+
+    int n_tiles = ((width + TILE_SIZE - 1) / TILE_SIZE) * ((height + TILE_SIZE - 1) / TILE_SIZE);
+
+    // Tiles are traced in batches of a few tiles per thread, checking the
+    //  budget between batches
+    int batch = std::max((int)m_thread_pool->GetNumberOfThreads(), 1) * 4;
+    std::chrono::steady_clock::time_point t_init = std::chrono::steady_clock::now();
+
+    return m_volume->DispatchVoxelAccess([&](auto view) {
+      while (!progressive->IsConverged())
+      {
+        int first_tile = progressive->GetNextUnit();
+        int n = std::min(batch, n_tiles - first_tile);
+        m_thread_pool->ParallelFor(n, [&](int i) {
+          RenderProgressiveTile(view, first_tile + i, width, height, rgba_output, progressive);
+        });
+        progressive->CompleteUnits(n, n_tiles);
+
+        double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_init).count();
+        if (elapsed_ms >= progressive->GetFrameBudget())
+          break;
+      }
+    });
+  }
+
+  bool CPURayCaster::PrepareFrame ()
+  {
+    if (m_volume == nullptr || !m_tf_snapshot || (m_volume->GetArrayData() == nullptr && !m_volume->IsPaged()))
+      return false;
+
+    if (m_render_mode != RENDER_MODE::DIRECT_VOLUME_RENDERING)
+      m_volume->GetNormalizedRange(&m_density_range[0], &m_density_range[1]);
+
+    // Only DVR and MIDA are shaded
+    bool shaded = m_apply_gradient_shading && (m_render_mode == RENDER_MODE::DIRECT_VOLUME_RENDERING ||
+                                               m_render_mode == RENDER_MODE::MAXIMUM_INTENSITY_DIFFERENCE_ACCUMULATION);
+    if (m_volume->IsPaged())
+      PrefetchBricks();
+    else if (shaded && !HasGradientField())
+      GenerateGradientField();
+    return true;
+  }
+
+  void CPURayCaster::SetupRay (RayPacket& rp, int lane, float fx, float fy, int width, int height)
+  {
+    glm::vec3 aabbmin = -m_vol_grid_size * 0.5f;
+    glm::vec3 aabbmax =  m_vol_grid_size * 0.5f;
+
+    glm::vec2 ver_pos = glm::vec2(fx / (float)width, fy / (float)height) * 2.0f - 1.0f;
+    glm::vec3 dir = glm::normalize(glm::vec3(ver_pos.x * m_cam_tan_fov_y * m_cam_aspect_ratio,
+                                             ver_pos.y * m_cam_tan_fov_y, -1.0f) * m_cam_rotation);
+
+    glm::vec3 inv_dir = glm::vec3(1.0f) / dir;
+    glm::vec3 tbbmin = inv_dir * (aabbmin - m_cam_eye);
+    glm::vec3 tbbmax = inv_dir * (aabbmax - m_cam_eye);
+    glm::vec3 tmin = glm::min(tbbmin, tbbmax);
+    glm::vec3 tmax = glm::max(tbbmin, tbbmax);
+
+    float tnear = glm::max(glm::max(glm::max(tmin.x, tmin.y), tmin.z), 0.0f);
+    float tfar  = glm::min(glm::min(tmax.x, tmax.y), tmax.z);
+
+    glm::vec3 tex_pos = m_cam_eye + dir * tnear + m_vol_grid_size * 0.5f;
+    for (int c = 0; c < 3; c++)
+    {
+      rp.pos[c][lane] = tex_pos[c];
+      rp.dir[c][lane] = dir[c];
+    }
+    rp.dist[lane] = (tfar > tnear) ? tfar - tnear : 0.0f;
+    rp.jitter[lane] = 0.0f;
+  }
+
+  template <typename View>
+  void CPURayCaster::RenderTile (const View& view, int tile_id, int width, int height, float* rgba_output)
+  {
+    typename View::Sampler sampler(view);
+
+    int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    int tx0 = (tile_id % tiles_x) * TILE_SIZE;
+    int ty0 = (tile_id / tiles_x) * TILE_SIZE;
+    int tx1 = std::min(tx0 + TILE_SIZE, width);
+    int ty1 = std::min(ty0 + TILE_SIZE, height);
+
+    RayPacket rp;
+    for (int y = ty0; y < ty1; y++)
+    {
+      for (int x = tx0; x < tx1; x += simd::WIDTH)
+      {
+        int n_lanes = std::min(simd::WIDTH, tx1 - x);
+
+        // Ray setup, as in ray_marching_1p.comp
+        for (int l = 0; l < simd::WIDTH; l++)
+          SetupRay(rp, l, (float)(x + std::min(l, n_lanes - 1)) + 0.5f, (float)y + 0.5f, width, height);
+
+        if (m_render_mode == RENDER_MODE::DIRECT_VOLUME_RENDERING)
+          TracePacket<View>(sampler, rp);
+        else
+          TraceProjectionPacket<View>(sampler, rp);
+
+        for (int l = 0; l < n_lanes; l++)
+        {
+          float* px = &rgba_output[((size_t)y * width + (x + l)) * 4];
+          px[0] = rp.rgba[0][l];
+          px[1] = rp.rgba[1][l];
+          px[2] = rp.rgba[2][l];
+          px[3] = rp.rgba[3][l];
+        }
+      }
+    }
+  }
+
+  template <typename View>
+  void CPURayCaster::RenderProgressiveTile (const View& view, int tile_id, int width, int height, float* rgba_output,
+                                            const ProgressiveRefinement* progressive)
+  {
+    typename View::Sampler sampler(view);
+
+    int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    int tx0 = (tile_id % tiles_x) * TILE_SIZE;
+    int ty0 = (tile_id / tiles_x) * TILE_SIZE;
+    int tx1 = std::min(tx0 + TILE_SIZE, width);
+    int ty1 = std::min(ty0 + TILE_SIZE, height);
+
+    const int stride = progressive->GetStride();
+    const int n_accumulated = progressive->GetAccumulatedSamples();
+    const unsigned int jitter_seed = progressive->GetJitterSeed();
+
+    // Pixels of the tile traced by the pass, packed into full packets
+    int pixels[TILE_SIZE * TILE_SIZE][2];
+    int n_pixels = 0;
+    for (int y = ty0; y < ty1; y += stride)
+    {
+      for (int x = tx0; x < tx1; x += stride)
+      {
+        if (!progressive->IsTraced(x, y)) continue;
+        pixels[n_pixels][0] = x;
+        pixels[n_pixels][1] = y;
+        n_pixels++;
+      }
+    }
+
+    RayPacket rp;
+    for (int p = 0; p < n_pixels; p += simd::WIDTH)
+    {
+      int n_lanes = std::min(simd::WIDTH, n_pixels - p);
+      for (int l = 0; l < simd::WIDTH; l++)
+      {
+        const int* pixel = pixels[p + std::min(l, n_lanes - 1)];
+        SetupRay(rp, l, (float)pixel[0] + 0.5f, (float)pixel[1] + 0.5f, width, height);
+        rp.jitter[l] = ProgressiveRefinement::GetJitter(pixel[0], pixel[1], jitter_seed);
+      }
+
+      if (m_render_mode == RENDER_MODE::DIRECT_VOLUME_RENDERING)
+        TracePacket<View>(sampler, rp);
+      else
+        TraceProjectionPacket<View>(sampler, rp);
+
+      for (int l = 0; l < n_lanes; l++)
+      {
+        int x = pixels[p + l][0];
+        int y = pixels[p + l][1];
+        float rgba[4] = { rp.rgba[0][l], rp.rgba[1][l], rp.rgba[2][l], rp.rgba[3][l] };
+
+        // Running average with the previous samples
+        if (n_accumulated > 0)
+        {
+          float* px = &rgba_output[((size_t)y * width + x) * 4];
+          float w = 1.0f / (float)(n_accumulated + 1);
+          for (int c = 0; c < 4; c++)
+            px[c] = px[c] + (rgba[c] - px[c]) * w;
+          continue;
+        }
+
+        // Subsampled passes fill the stride x stride block of the pixel
+        for (int by = y; by < std::min(y + stride, height); by++)
+          for (int bx = x; bx < std::min(x + stride, width); bx++)
+            memcpy(&rgba_output[((size_t)by * width + bx) * 4], rgba, sizeof(rgba));
+      }
+    }
+  }
+
+  template <typename View>
+  void CPURayCaster::TracePacket (typename View::Sampler& sampler, RayPacket& rp)
+  {
+    using namespace simd;
+    typedef typename View::value_type T;
+
+    const int W = WIDTH;
+
+    const vfloat zero = Set1(0.0f);
+    const vfloat half = Set1(0.5f);
+    const vfloat one  = Set1(1.0f);
+
+    const bool skip_empty_space = m_empty_space_skipping && m_occupancy_grid.IsBuilt();
+    const bool adaptive_step = m_adaptive_step && m_occupancy_grid.HasSamplingRate();
+    const glm::vec3 brick_extent = (float)m_occupancy_grid.GetBrickSize() * m_vol_voxel_size;
+    const glm::ivec3 brick_grid = m_occupancy_grid.GetGridSize() - 1;
+
+    const TransferFunctionTable& tf_table = m_tf_snapshot->GetTable();
+
+    const bool preintegrated = m_apply_preintegration && !m_tf_preintegrated.empty();
+    const vfloat pi_size = Set1((float)m_preint_size);
+    const vfloat pi_max  = Set1((float)(m_preint_size - 1));
+    const float* pi_table = m_tf_preintegrated.data();
+
+    vfloat pos[3] = { Load(rp.pos[0]), Load(rp.pos[1]), Load(rp.pos[2]) };
+    vfloat dir[3] = { Load(rp.dir[0]), Load(rp.dir[1]), Load(rp.dir[2]) };
+    vfloat D = Load(rp.dist);
+    vfloat jitter = Load(rp.jitter);
+
+    vfloat E[3] = { zero, zero, zero };
+    vfloat Tr = one;
+
+    vmask active = D > zero;
+    // Density of the previous sample, < 0 at the start of a segment
+    vfloat prev_density = Set1(-1.0f);
+
+    int   itf[2][W];
+    int   idx[W];
+
+    float s = 0.0f;
+    while (Any(active))
+    {
+      float step_size = m_step_size;
+      if (adaptive_step)
+        step_size = AdaptiveStep(rp, s, MoveMask(active), brick_extent, brick_grid);
+
+      vfloat sv = Set1(s);
+      vfloat h = Min(Set1(step_size), D - sv);
+      vfloat mid = sv + h * (half + jitter);
+
+      // Texture position at tnear + (s + h/2), shifted by the jitter
+      vfloat tpos[3];
+      for (int c = 0; c < 3; c++)
+        tpos[c] = pos[c] + dir[c] * mid;
+
+      // If every active lane is inside an empty brick, go to the first
+      //  sample after the nearest brick exit
+      if (skip_empty_space)
+      {
+        float smid[W];
+        Store(smid, mid);
+        float s_next = SkipEmptySpace(rp, smid, MoveMask(active), brick_extent, brick_grid);
+        if (s_next >= 0.0f)
+        {
+          s = std::max(s_next, s + m_step_size);
+          active = active & (Set1(s) < D);
+          prev_density = Set1(-1.0f);
+          continue;
+        }
+      }
+
+      vfloat density = SamplePacketDensity<T>(sampler, tpos);
+
+      vfloat src[4];
+      if (preintegrated)
+      {
+        // Segment from the previous sample, constant at the first one,
+        //  looked up as a GL_LINEAR 2D texture (front, back)
+        vfloat front = Select(prev_density < zero, density, prev_density);
+        prev_density = density;
+
+        vfloat uf = Min(Max(front * pi_size - half, zero), pi_max);
+        vfloat ub = Min(Max(density * pi_size - half, zero), pi_max);
+        vfloat uf0 = Floor(uf), ub0 = Floor(ub);
+        vfloat wf = uf - uf0, wb = ub - ub0;
+        StoreInt(itf[0], uf0);
+        StoreInt(itf[1], ub0);
+
+        for (int c = 0; c < 4; c++)
+        {
+          vfloat t[4];
+          for (int k = 0; k < 4; k++)
+          {
+            for (int l = 0; l < W; l++)
+            {
+              int f = std::min(itf[0][l] + (k & 1), m_preint_size - 1);
+              int b = std::min(itf[1][l] + (k >> 1), m_preint_size - 1);
+              idx[l] = (b * m_preint_size + f) * 4 + c;
+            }
+            t[k] = Gather(pi_table, idx);
+          }
+          vfloat t0 = t[0] + (t[1] - t[0]) * wf;
+          vfloat t1 = t[2] + (t[3] - t[2]) * wf;
+          src[c] = t0 + (t1 - t0) * wb;
+        }
+      }
+      else
+      {
+        // Transfer function lookup, as a GL_LINEAR 1D texture
+        tf_table.Lookup(density, src);
+      }
+      src[3] = Select(active, src[3], zero);
+
+      // Apply gradient shading to non-transparent samples
+      int visible = MoveMask(src[3] > zero);
+      if (m_apply_gradient_shading && visible)
+        ShadePacket(sampler, src, tpos, visible);
+
+      // From "Local and Global Illumination in the Volume Rendering Integral"
+      vfloat F = Exp(zero - src[3] * h);
+      vfloat TmF = Tr * (one - F);
+      for (int c = 0; c < 3; c++)
+        E[c] = E[c] + TmF * src[c];
+      Tr = Tr * F;
+
+      // Go to the next interval, terminating rays with opacity > 0.99
+      s = s + step_size;
+      active = active & (Set1(s) < D) & ((one - Tr) <= Set1(0.99f));
+    }
+
+    Store(rp.rgba[0], E[0]);
+    Store(rp.rgba[1], E[1]);
+    Store(rp.rgba[2], E[2]);
+    Store(rp.rgba[3], one - Tr);
+  }
+
+  template <typename View>
+  void CPURayCaster::TraceProjectionPacket (typename View::Sampler& sampler, RayPacket& rp)
+  {
+    using namespace simd;
+    typedef typename View::value_type T;
+
+    const vfloat zero = Set1(0.0f);
+    const vfloat half = Set1(0.5f);
+    const vfloat one  = Set1(1.0f);
+    const vfloat step = Set1(m_step_size);
+
+    const bool mip   = m_render_mode == RENDER_MODE::MAXIMUM_INTENSITY_PROJECTION;
+    const bool minip = m_render_mode == RENDER_MODE::MINIMUM_INTENSITY_PROJECTION;
+    const bool aip   = m_render_mode == RENDER_MODE::AVERAGE_INTENSITY_PROJECTION;
+    const bool mida  = m_render_mode == RENDER_MODE::MAXIMUM_INTENSITY_DIFFERENCE_ACCUMULATION;
+
+    // MIP/MinIP skip the bricks that cannot change the running max/min
+    const VolumeBricks* bricks = (mip || minip) ? m_volume->GetBricks() : nullptr;
+    const float* brick_min_max = bricks ? bricks->GetMinMaxData() : nullptr;
+    vfloat brick_extent[3], brick_last[3], brick_dim[3];
+    if (bricks)
+    {
+      glm::ivec3 grid_size = bricks->GetGridSize();
+      for (int c = 0; c < 3; c++)
+      {
+        brick_extent[c] = Set1((float)bricks->GetBrickSize() * m_vol_voxel_size[c]);
+        brick_last[c] = Set1((float)(grid_size[c] - 1));
+        brick_dim[c]  = Set1((float)grid_size[c]);
+      }
+    }
+    int brick_idx[WIDTH];
+    const vfloat density_min = Set1((float)m_density_range[0]);
+    const vfloat density_max = Set1((float)m_density_range[1]);
+
+    const TransferFunctionTable& tf_table = m_tf_snapshot->GetTable();
+
+    vfloat pos[3] = { Load(rp.pos[0]), Load(rp.pos[1]), Load(rp.pos[2]) };
+    vfloat dir[3] = { Load(rp.dir[0]), Load(rp.dir[1]), Load(rp.dir[2]) };
+    vfloat D = Load(rp.dist);
+    vfloat jitter = Load(rp.jitter);
+
+    // Running max (-1 before the first sample), min (2 before the first
+    //  sample) or integral of the density
+    vfloat projection = Set1(mip ? -1.0f : (minip ? 2.0f : 0.0f));
+    // MIDA: accumulated radiance, opacity and running max
+    vfloat E[3] = { zero, zero, zero };
+    vfloat A = zero;
+    vfloat f_max = zero;
+
+    vmask active = D > zero;
+
+    float s = 0.0f;
+    while (Any(active))
+    {
+      vfloat sv = Set1(s);
+      vfloat h = Min(step, D - sv);
+      vfloat mid = sv + h * (half + jitter);
+
+      // Texture position at tnear + (s + h/2), shifted by the jitter
+      vfloat tpos[3];
+      for (int c = 0; c < 3; c++)
+        tpos[c] = pos[c] + dir[c] * mid;
+
+      // If no active lane can reach a larger max (smaller min) inside its
+      //  brick, go to the first sample after the nearest brick exit
+      if (brick_min_max)
+      {
+        vfloat b[3];
+        vfloat brick_id = zero;
+        for (int c = 2; c >= 0; c--)
+        {
+          b[c] = Min(Max(Floor(tpos[c] / brick_extent[c]), zero), brick_last[c]);
+          brick_id = brick_id * brick_dim[c] + b[c];
+        }
+        StoreInt(brick_idx, brick_id * Set1(2.0f) + Set1(mip ? 1.0f : 0.0f));
+        vfloat range = Gather(brick_min_max, brick_idx);
+
+        vmask changes = mip ? (projection < range) : (range < projection);
+        if (!MoveMask(active & changes))
+        {
+          // Distance from tnear to the brick exit
+          vfloat t_exit = Set1(FLT_MAX);
+          for (int c = 0; c < 3; c++)
+          {
+            vmask forward = dir[c] > zero;
+            vfloat face = (b[c] + Select(forward, one, zero)) * brick_extent[c];
+            t_exit = Select(forward | (dir[c] < zero), Min(t_exit, (face - tpos[c]) / dir[c]), t_exit);
+          }
+          t_exit = t_exit + mid;
+
+          // First interval s = k * StepSize with its (jittered) sample after the exit
+          vfloat k = Floor(t_exit / step - half - jitter) + one;
+          float s_lane[WIDTH];
+          Store(s_lane, Select(active, k * step, Set1(FLT_MAX)));
+
+          float s_next = s_lane[0];
+          for (int l = 1; l < WIDTH; l++)
+            s_next = std::min(s_next, s_lane[l]);
+          s = std::max(s_next, s + m_step_size);
+          active = active & (Set1(s) < D);
+          continue;
+        }
+      }
+
+      vfloat density = SamplePacketDensity<T>(sampler, tpos);
+
+      if (mip)
+      {
+        projection = Select(active, Max(projection, density), projection);
+      }
+      else if (minip)
+      {
+        projection = Select(active, Min(projection, density), projection);
+      }
+      else if (aip)
+      {
+        projection = Select(active, projection + density * h, projection);
+      }
+      else
+      {
+        vfloat src[4];
+        tf_table.Lookup(density, src);
+        src[3] = Select(active, src[3], zero);
+
+        int visible = MoveMask(src[3] > zero);
+        if (m_apply_gradient_shading && visible)
+          ShadePacket(sampler, src, tpos, visible);
+
+        // A new maximum f scales the accumulated values by 1 - (f - f_max)
+        vfloat beta = Select(active, one - Max(density - f_max, zero), one);
+        f_max = Select(active, Max(f_max, density), f_max);
+
+        vfloat alpha = one - Exp(zero - src[3] * h);
+        vfloat w = (one - beta * A) * alpha;
+        for (int c = 0; c < 3; c++)
+          E[c] = beta * E[c] + w * src[c];
+        A = beta * A + w;
+      }
+
+      // Go to the next interval, terminating rays that reached the
+      //  max/min density of the data, or opaque MIDA rays that cannot
+      //  find a larger maximum
+      s = s + m_step_size;
+      active = active & (Set1(s) < D);
+      if (mip)
+        active = active & (projection < density_max);
+      else if (minip)
+        active = active & (projection > density_min);
+      else if (mida)
+        active = active & ((A <= Set1(0.99f)) | (f_max < density_max));
+    }
+
+    if (mida)
+    {
+      Store(rp.rgba[0], E[0]);
+      Store(rp.rgba[1], E[1]);
+      Store(rp.rgba[2], E[2]);
+      Store(rp.rgba[3], A);
+      return;
+    }
+
+    // Classify the projected density, lanes without samples are transparent
+    vmask sampled = D > zero;
+    if (mip)
+      sampled = sampled & (projection >= zero);
+    else if (minip)
+      sampled = sampled & (projection <= one);
+    else
+      projection = projection / Select(sampled, D, one);
+
+    vfloat rgbt[4];
+    tf_table.Lookup(projection, rgbt);
+    vfloat alpha = Select(sampled, one - Exp(zero - rgbt[3]), zero);
+    for (int c = 0; c < 3; c++)
+      Store(rp.rgba[c], rgbt[c] * alpha);
+    Store(rp.rgba[3], alpha);
+  }
+
+  // GL_LINEAR + GL_CLAMP_TO_EDGE: texel centers at (i + 0.5) * voxel size
+  template <typename T, typename Sampler>
+  simd::vfloat CPURayCaster::SamplePacketDensity (Sampler& sampler, const simd::vfloat* tpos)
+  {
+    using namespace simd;
+    const int W = WIDTH;
+
+    const vfloat zero = Set1(0.0f);
+    const vfloat half = Set1(0.5f);
+    const vfloat vnorm = Set1((float)VoxelTypeTraits<T>::NORMALIZATION);
+    const vfloat inv_voxel[3] = { Set1(1.0f / m_vol_voxel_size.x), Set1(1.0f / m_vol_voxel_size.y), Set1(1.0f / m_vol_voxel_size.z) };
+    const vfloat max_voxel[3] = { Set1((float)(m_vol_resolution.x - 1)), Set1((float)(m_vol_resolution.y - 1)), Set1((float)(m_vol_resolution.z - 1)) };
+
+    int   ivx[3][W];
+    float corner[8][W];
+
+    vfloat wgt[3];
+    for (int c = 0; c < 3; c++)
+    {
+      vfloat v = Min(Max(tpos[c] * inv_voxel[c] - half, zero), max_voxel[c]);
+      vfloat v0 = Floor(v);
+      wgt[c] = v - v0;
+      StoreInt(ivx[c], v0);
+    }
+
+    // Fetch the 8 voxels of each lane
+    for (int l = 0; l < W; l++)
+      sampler.GetCell(ivx[0][l], ivx[1][l], ivx[2][l], &corner[0][l], W);
+
+    vfloat c00 = Load(corner[0]) + (Load(corner[1]) - Load(corner[0])) * wgt[0];
+    vfloat c10 = Load(corner[2]) + (Load(corner[3]) - Load(corner[2])) * wgt[0];
+    vfloat c01 = Load(corner[4]) + (Load(corner[5]) - Load(corner[4])) * wgt[0];
+    vfloat c11 = Load(corner[6]) + (Load(corner[7]) - Load(corner[6])) * wgt[0];
+    vfloat c0 = c00 + (c10 - c00) * wgt[1];
+    vfloat c1 = c01 + (c11 - c01) * wgt[1];
+    return (c0 + (c1 - c0) * wgt[2]) * vnorm;
+  }
+
+  template <typename Sampler>
+  void CPURayCaster::ShadePacket (Sampler& sampler, simd::vfloat* src, const simd::vfloat* tpos, int lanes)
+  {
+    using namespace simd;
+    const int W = WIDTH;
+
+    float clr[3][W], stp[3][W];
+    for (int c = 0; c < 3; c++)
+    {
+      Store(clr[c], src[c]);
+      Store(stp[c], tpos[c]);
+    }
+    for (int l = 0; l < W; l++)
+    {
+      if (!(lanes & (1 << l))) continue;
+      glm::vec3 tex_pos = glm::vec3(stp[0][l], stp[1][l], stp[2][l]);
+      glm::vec3 gradient = HasGradientField() ? SampleGradient(tex_pos) : SampleVoxelGradient(sampler, tex_pos);
+      glm::vec3 shaded = Shade(tex_pos, glm::vec3(clr[0][l], clr[1][l], clr[2][l]), gradient);
+      clr[0][l] = shaded.r;
+      clr[1][l] = shaded.g;
+      clr[2][l] = shaded.b;
+    }
+    for (int c = 0; c < 3; c++)
+      src[c] = Load(clr[c]);
+  }
+
+  float CPURayCaster::AdaptiveStep (const RayPacket& rp, float s, int active_lanes,
+                                    glm::vec3 brick_extent, glm::ivec3 brick_grid)
+  {
+    // The longest step must fit inside one brick extent, so it crosses at
+    //  most one brick face per axis
+    const float min_extent = std::min(brick_extent.x, std::min(brick_extent.y, brick_extent.z));
+    const float max_step_scale = std::max(std::min(m_max_step_scale, min_extent / m_step_size), 1.0f);
+    const float max_step = m_step_size * max_step_scale;
+    float max_rate = 1.0f / max_step_scale;
+    for (int l = 0; l < simd::WIDTH && max_rate < 1.0f; l++)
+    {
+      if (!(active_lanes & (1 << l))) continue;
+
+      glm::vec3 dir = glm::vec3(rp.dir[0][l], rp.dir[1][l], rp.dir[2][l]);
+      glm::vec3 p = glm::vec3(rp.pos[0][l], rp.pos[1][l], rp.pos[2][l]) + dir * s;
+
+      // Every brick crossed by the longest step lies in the box spanned by
+      //  the bricks at both of its ends, at most two bricks per axis
+      glm::ivec3 b0 = glm::clamp(glm::ivec3(glm::floor(p / brick_extent)), glm::ivec3(0), brick_grid);
+      glm::ivec3 b1 = glm::clamp(glm::ivec3(glm::floor((p + dir * max_step) / brick_extent)), glm::ivec3(0), brick_grid);
+      glm::ivec3 lo = glm::min(b0, b1);
+      glm::ivec3 hi = glm::max(b0, b1);
+      for (int z = lo.z; z <= hi.z; z++)
+        for (int y = lo.y; y <= hi.y; y++)
+          for (int x = lo.x; x <= hi.x; x++)
+            max_rate = std::max(max_rate, m_occupancy_grid.GetSamplingRate(x, y, z));
+    }
+    return m_step_size / std::min(max_rate, 1.0f);
+  }
+
+  float CPURayCaster::SkipEmptySpace (const RayPacket& rp, const float* mid, int active_lanes,
+                                      glm::vec3 brick_extent, glm::ivec3 brick_grid)
+  {
+    float s_next = FLT_MAX;
+    for (int l = 0; l < simd::WIDTH; l++)
+    {
+      if (!(active_lanes & (1 << l))) continue;
+
+      glm::vec3 dir = glm::vec3(rp.dir[0][l], rp.dir[1][l], rp.dir[2][l]);
+      glm::vec3 p = glm::vec3(rp.pos[0][l], rp.pos[1][l], rp.pos[2][l]) + dir * mid[l];
+
+      glm::ivec3 b = glm::clamp(glm::ivec3(glm::floor(p / brick_extent)), glm::ivec3(0), brick_grid);
+      if (m_occupancy_grid.IsOccupied(b.x, b.y, b.z))
+        return -1.0f;
+
+      // Distance from tnear to the brick exit
+      float t_exit = FLT_MAX;
+      for (int c = 0; c < 3; c++)
+      {
+        if (dir[c] > 0.0f)
+          t_exit = std::min(t_exit, ((float)(b[c] + 1) * brick_extent[c] - p[c]) / dir[c]);
+        else if (dir[c] < 0.0f)
+          t_exit = std::min(t_exit, ((float)b[c] * brick_extent[c] - p[c]) / dir[c]);
+      }
+      t_exit += mid[l];
+
+      // First interval s = k * StepSize with its (jittered) sample after the exit
+      float k = std::floor(t_exit / m_step_size - 0.5f - rp.jitter[l]) + 1.0f;
+      s_next = std::min(s_next, k * m_step_size);
+    }
+    return s_next;
+  }
+
+  glm::vec3 CPURayCaster::Shade (glm::vec3 tex_pos, glm::vec3 clr, glm::vec3 gradient)
+  {
+    glm::vec3 gradient_normal = gradient;
+
+    if (gradient_normal != glm::vec3(0.0f))
+    {
+      glm::vec3 wpos = tex_pos - (m_vol_grid_size * 0.5f);
+
+      gradient_normal = glm::normalize(gradient_normal);
+
+      glm::vec3 light_direction = glm::normalize(m_light_source_position - wpos);
+      glm::vec3 eye_direction   = glm::normalize(m_cam_eye - wpos);
+      glm::vec3 halfway_vector  = glm::normalize(eye_direction + light_direction);
+
+      float dot_diff = glm::max(0.0f, glm::dot(gradient_normal, light_direction));
+      float dot_spec = glm::max(0.0f, glm::dot(halfway_vector, gradient_normal));
+
+      clr = (clr * (m_blinnphong_ka + m_blinnphong_kd * dot_diff))
+        + m_blinnphong_ispecular * m_blinnphong_ks * glm::pow(dot_spec, m_blinnphong_shininess);
+    }
+
+    return clr;
+  }
+
+  bool CPURayCaster::HasGradientField ()
+  {
+    return !m_gradient.empty() || !m_packed_gradient.empty();
+  }
+
+  glm::vec3 CPURayCaster::SampleGradient (glm::vec3 tex_pos)
+  {
+    glm::vec3 v = glm::clamp(tex_pos / m_vol_voxel_size - 0.5f, glm::vec3(0.0f), glm::vec3(m_vol_resolution - 1));
+    glm::ivec3 i0 = glm::ivec3(glm::floor(v));
+    glm::ivec3 i1 = glm::min(i0 + 1, m_vol_resolution - 1);
+    glm::vec3 w = v - glm::vec3(i0);
+
+    size_t sw = (size_t)m_vol_resolution.x;
+    size_t swh = (size_t)m_vol_resolution.x * (size_t)m_vol_resolution.y;
+    const float* g = m_gradient.empty() ? nullptr : m_gradient.data();
+
+    glm::vec3 c[8];
+    for (int k = 0; k < 8; k++)
+    {
+      size_t id = (size_t)((k & 1) ? i1.x : i0.x)
+        + (size_t)((k & 2) ? i1.y : i0.y) * sw
+        + (size_t)((k & 4) ? i1.z : i0.z) * swh;
+      if (g != nullptr)
+        c[k] = glm::vec3(g[id * 3 + 0], g[id * 3 + 1], g[id * 3 + 2]);
+      else
+        GradientEngine::Decode(m_gradient_format, m_packed_gradient.data(), id, &c[k].x);
+    }
+
+    glm::vec3 c00 = glm::mix(c[0], c[1], w.x);
+    glm::vec3 c10 = glm::mix(c[2], c[3], w.x);
+    glm::vec3 c01 = glm::mix(c[4], c[5], w.x);
+    glm::vec3 c11 = glm::mix(c[6], c[7], w.x);
+    return glm::mix(glm::mix(c00, c10, w.y), glm::mix(c01, c11, w.y), w.z);
+  }
+
+  template <typename Sampler>
+  glm::vec3 CPURayCaster::SampleVoxelGradient (Sampler& sampler, glm::vec3 tex_pos)
+  {
+    glm::vec3 dx = glm::vec3(m_vol_voxel_size.x, 0.0f, 0.0f);
+    glm::vec3 dy = glm::vec3(0.0f, m_vol_voxel_size.y, 0.0f);
+    glm::vec3 dz = glm::vec3(0.0f, 0.0f, m_vol_voxel_size.z);
+    return glm::vec3(SampleDensity(sampler, tex_pos - dx) - SampleDensity(sampler, tex_pos + dx),
+                     SampleDensity(sampler, tex_pos - dy) - SampleDensity(sampler, tex_pos + dy),
+                     SampleDensity(sampler, tex_pos - dz) - SampleDensity(sampler, tex_pos + dz));
+  }
+
+  // Trilinear sample as a GL_LINEAR + GL_CLAMP_TO_EDGE texture, not normalized
+  template <typename Sampler>
+  float CPURayCaster::SampleDensity (Sampler& sampler, glm::vec3 tex_pos)
+  {
+    glm::vec3 v = glm::clamp(tex_pos / m_vol_voxel_size - 0.5f, glm::vec3(0.0f), glm::vec3(m_vol_resolution - 1));
+    glm::ivec3 i0 = glm::ivec3(glm::floor(v));
+    glm::vec3 w = v - glm::vec3(i0);
+
+    float c[8];
+    sampler.GetCell(i0.x, i0.y, i0.z, c, 1);
+    float c00 = glm::mix(c[0], c[1], w.x);
+    float c10 = glm::mix(c[2], c[3], w.x);
+    float c01 = glm::mix(c[4], c[5], w.x);
+    float c11 = glm::mix(c[6], c[7], w.x);
+    return glm::mix(glm::mix(c00, c10, w.y), glm::mix(c01, c11, w.y), w.z);
+  }
+
+  void CPURayCaster::PrefetchBricks ()
+  {
+    PROFILE_SCOPE("CPURayCaster::PrefetchBricks");
+    BrickPager* pager = m_volume->GetBrickPager();
+    pager->BeginFrame();
+
+    glm::vec3 forward = glm::vec3(0.0f, 0.0f, -1.0f) * m_cam_rotation;
+    glm::vec3 brick_extent = (float)pager->GetBrickSize() * m_vol_voxel_size;
+    float brick_radius = glm::length(brick_extent) * 0.5f;
+    glm::ivec3 grid = pager->GetGridSize();
+    // The projections read bricks mapped to zero extinction too
+    bool use_occupancy = m_render_mode == RENDER_MODE::DIRECT_VOLUME_RENDERING &&
+                         m_empty_space_skipping && m_occupancy_grid.IsBuilt() &&
+                         m_occupancy_grid.GetBrickSize() == pager->GetBrickSize();
+
+    // Bricks in front of the camera, sorted by their depth along the view direction
+    std::vector<std::pair<float, int>> bricks;
+    for (int bz = 0; bz < grid.z; bz++)
+    {
+      for (int by = 0; by < grid.y; by++)
+      {
+        for (int bx = 0; bx < grid.x; bx++)
+        {
+          if (use_occupancy && !m_occupancy_grid.IsOccupied(bx, by, bz)) continue;
+
+          glm::vec3 center = (glm::vec3(bx, by, bz) + 0.5f) * brick_extent - m_vol_grid_size * 0.5f;
+          float depth = glm::dot(center - m_cam_eye, forward);
+          if (depth < -brick_radius) continue;
+          bricks.push_back(std::make_pair(depth, pager->GetBrickIndex(bx, by, bz)));
+        }
+      }
+    }
+
+    size_t n_prefetch = std::min(bricks.size(), (size_t)pager->GetCapacity());
+    if (n_prefetch < bricks.size())
+      std::nth_element(bricks.begin(), bricks.begin() + n_prefetch, bricks.end());
+    std::sort(bricks.begin(), bricks.begin() + n_prefetch);
+
+    std::vector<int> brick_ids(n_prefetch);
+    for (size_t i = 0; i < n_prefetch; i++)
+      brick_ids[i] = bricks[i].second;
+    pager->Prefetch(std::move(brick_ids));
+  }
+
+  void CPURayCaster::UpdateOccupancyGrid ()
+  {
+    PROFILE_SCOPE("CPURayCaster::UpdateOccupancyGrid");
+    VolumeBricks* bricks = m_volume ? m_volume->GetBricks() : nullptr;
+    if ((!m_empty_space_skipping && !m_adaptive_step) || bricks == nullptr || !m_tf_snapshot)
+    {
+      m_occupancy_grid.Clear();
+      return;
+    }
+
+    m_occupancy_grid.SetComputeSamplingRate(m_adaptive_step);
+    m_occupancy_grid.Build(bricks, m_tf_snapshot->GetTable());
+    PROFILE_COUNTER("occupied_bricks_ratio", m_occupancy_grid.GetOccupiedRatio());
+  }
+
+  // Same operator of sobelfeldman_generator.comp
+  void CPURayCaster::GenerateGradientField ()
+  {
+    PROFILE_SCOPE("CPURayCaster::GenerateGradientField");
+    printf("CPURayCaster: Generating Sobel-Feldman gradient field...\n");
+    GradientEngine gradient_engine(m_thread_pool);
+    gradient_engine.SetMethod(GradientEngine::METHOD::SOBEL_FELDMAN);
+    if (m_gradient_format == GradientEngine::OUTPUT_FORMAT::FLOAT_32)
+      m_gradient = gradient_engine.ComputeFloat(m_volume);
+    else
+      m_packed_gradient = gradient_engine.ComputePacked(m_volume, m_gradient_format);
+  }
+}
@@ -0,0 +1,240 @@
+/**
+ * CPU ray caster for structured grid volumes.
+ *
+ * Evaluates the same integral as ray_marching_1p.comp:
+ * . ray/aabb intersection with the volume grid
+ * . midpoint sampling at StepSize, trilinear filtered as a GL_LINEAR texture
+ * . RGBt transfer function (color + extinction) looked up in the
+ *   vis::TransferFunctionTable of a snapshot, or its pre-integrated table
+ *   (TransferFunction1D::GeneratePreIntegratedRGBt) looked up with the
+ *   densities of the previous and current samples
+ * . Blinn-Phong shading using a Sobel-Feldman gradient volume, stored
+ *   as floats or in one of the packed vis::GradientEngine formats
+ *   (octahedral normals), decoded at the corners of each shaded sample
+ * . early ray termination at 0.99 opacity
+ * . empty space skipping: packets jump over the bricks of a
+ *   vis::OccupancyGrid mapped to zero extinction by the transfer function
+ * . adaptive step size: the step grows up to a maximum scale in bricks
+ *   with low extinction and low extinction change (see the sampling rate
+ *   of vis::OccupancyGrid). A packet takes the shortest step of its
+ *   lanes, and each sample is integrated over its own step length, so
+ *   exp(-t * h) is the opacity correction of the longer steps
+ *
+ * The projection render modes (see vis::RENDER_MODE) reduce the density
+ *   samples of each lane and classify the result after the last sample.
+ *   MIP/MinIP packets go front to back over the bricks of the volume and
+ *   jump over the bricks whose max/min density cannot change the running
+ *   value of any active lane, so most of the volume behind the first
+ *   bright/dark structure is never sampled.
+ *
+ * Paged volumes (vis::BrickPager) are sampled through one sampler per
+ *   tile. Before each frame, the non-empty bricks are queued for prefetch
+ *   in front-to-back order along the view direction, and the gradient is
+ *   evaluated from the voxels at each shaded sample instead of being
+ *   precomputed for the whole grid.
+ *
+ * The image is split in TILE_SIZE x TILE_SIZE tiles consumed by a
+ * work-stealing vis::ThreadPool. Inside each tile, rays are traced in
+ * packets of simd::WIDTH horizontally adjacent pixels.
+ *
+ * RenderProgressive refines the image over several calls, following the
+ *   passes of a vis::ProgressiveRefinement: the tiles of the subsampled
+ *   passes pack the traced pixels into full packets, and the samples of
+ *   the jittered passes are averaged into the output.
+ *
+ * No OpenGL context is needed. The output is a RGBA float buffer
+ * with the first row being the bottom row of the image, the same
+ * layout used by glTexImage2D.
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_CPU_RAY_CASTER_H
+#define VOL_VIS_UTILS_CPU_RAY_CASTER_H
+
+#include <volvis_utils/structuredgridvolume.h>
+#include <volvis_utils/transferfunction1d.h>
+#include <volvis_utils/transferfunctionsnapshot.h>
+#include <volvis_utils/threadpool.h>
+#include <volvis_utils/gradientengine.h>
+#include <volvis_utils/occupancygrid.h>
+#include <volvis_utils/progressiverefinement.h>
+#include <volvis_utils/rendermode.h>
+#include <volvis_utils/simd.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace vis
+{
+  class CPURayCaster
+  {
+  public:
+    static const int TILE_SIZE = 16;
+    static constexpr float DEFAULT_MAX_STEP_SCALE = 4.0f;
+
+    CPURayCaster (ThreadPool* thread_pool = nullptr);
+    ~CPURayCaster ();
+
+    void SetVolume (StructuredGridVolume* vol);
+    // Snapshot of tf for the value range of the volume, if already set
+    void SetTransferFunction (TransferFunction1D* tf);
+    // Must not be called during a frame. The occupancy grid is only
+    //  updated for the range that differs from the current snapshot.
+    void SetTransferFunction (TransferFunctionSnapshotPtr snapshot);
+
+    void SetStepSize (float step_size);
+    float GetStepSize ();
+
+    // Must be set before SetTransferFunction, which builds the table
+    void SetPreIntegration (bool apply, int table_size = TransferFunction1D::DEFAULT_PREINTEGRATION_SIZE);
+    bool GetPreIntegration ();
+
+    void SetGradientShading (bool apply);
+    bool GetGradientShading ();
+
+    // If enabled, the bricks of the volume are built by SetVolume when missing
+    //  and the occupancy grid is rebuilt when the transfer function changes
+    void SetEmptySpaceSkipping (bool skip);
+    bool GetEmptySpaceSkipping ();
+    // Steps from the step size up to max_step_scale times it, following
+    //  the sampling rate of the bricks. Builds the bricks when missing.
+    //  The longest step is clamped to the smallest brick extent, so the
+    //  bricks at its ends bound every brick it crosses.
+    void SetAdaptiveStep (bool apply, float max_step_scale = DEFAULT_MAX_STEP_SCALE);
+    bool GetAdaptiveStep ();
+    const OccupancyGrid* GetOccupancyGrid ();
+
+    // DIRECT_VOLUME_RENDERING by default. The projections build the bricks
+    //  of the volume when missing
+    void SetRenderMode (RENDER_MODE mode);
+    RENDER_MODE GetRenderMode ();
+
+    // Storage of the gradient field, FLOAT_32 by default. Changing it
+    //  discards the current field.
+    void SetGradientFormat (GradientEngine::OUTPUT_FORMAT format);
+    GradientEngine::OUTPUT_FORMAT GetGradientFormat ();
+
+    // Precomputed Sobel-Feldman gradient, 3 floats per voxel, used instead
+    //  of generating it on the first frame. Must be set after SetVolume.
+    //  Encoded if the gradient format is not FLOAT_32.
+    void SetGradientField (std::vector<float> gradient);
+    // Same, already in the gradient format (GradientEngine::ComputePacked)
+    void SetGradientField (std::vector<uint8_t> gradient);
+
+    void SetCamera (glm::vec3 eye, glm::mat4 lookat, float tan_fov_y, float aspect_ratio);
+    void SetBlinnPhong (float ka, float kd, float ks, float shininess,
+                        glm::vec3 specular_color, glm::vec3 light_position);
+
+    // Render a width x height image into rgba_output (width * height * 4 floats)
+    bool Render (int width, int height, float* rgba_output);
+
+    // Trace the tiles of the current pass of progressive, and of the next
+    //  ones, until its frame budget is spent. rgba_output must keep the
+    //  image of the previous calls, the passes restart after progressive->Reset
+    bool RenderProgressive (int width, int height, float* rgba_output, ProgressiveRefinement* progressive);
+
+  protected:
+
+  private:
+    struct RayPacket;
+
+    // Prefetch the bricks or generate the gradient, false if nothing can be rendered
+    bool PrepareFrame ();
+
+    // Primary ray of the image position (fx, fy) in lane of rp, without jitter
+    void SetupRay (RayPacket& rp, int lane, float fx, float fy, int width, int height);
+
+    template <typename View>
+    void RenderTile (const View& view, int tile_id, int width, int height, float* rgba_output);
+
+    template <typename View>
+    void RenderProgressiveTile (const View& view, int tile_id, int width, int height, float* rgba_output,
+                                const ProgressiveRefinement* progressive);
+
+    template <typename View>
+    void TracePacket (typename View::Sampler& sampler, RayPacket& rp);
+    // MIP, MinIP, AIP and MIDA
+    template <typename View>
+    void TraceProjectionPacket (typename View::Sampler& sampler, RayPacket& rp);
+
+    // Normalized trilinear filtered density of each lane at texture
+    //  position tpos, T is the voxel type of sampler
+    template <typename T, typename Sampler>
+    simd::vfloat SamplePacketDensity (Sampler& sampler, const simd::vfloat* tpos);
+
+    // Blinn-Phong shading of the src colors of lanes (bit mask)
+    template <typename Sampler>
+    void ShadePacket (Sampler& sampler, simd::vfloat* src, const simd::vfloat* tpos, int lanes);
+
+    // Interval start s after the bricks of the active lanes sampled at
+    //  distance mid[lane], or -1 if one of them is inside an occupied brick
+    float SkipEmptySpace (const RayPacket& rp, const float* mid, int active_lanes,
+                          glm::vec3 brick_extent, glm::ivec3 brick_grid);
+
+    // Shortest step allowed by the bricks of the active lanes at distance s
+    float AdaptiveStep (const RayPacket& rp, float s, int active_lanes,
+                        glm::vec3 brick_extent, glm::ivec3 brick_grid);
+
+    glm::vec3 Shade (glm::vec3 tex_pos, glm::vec3 clr, glm::vec3 gradient);
+    bool HasGradientField ();
+    glm::vec3 SampleGradient (glm::vec3 tex_pos);
+    // Central differences of the filtered density, same sign of the Sobel-Feldman field
+    template <typename Sampler>
+    glm::vec3 SampleVoxelGradient (Sampler& sampler, glm::vec3 tex_pos);
+    template <typename Sampler>
+    float SampleDensity (Sampler& sampler, glm::vec3 tex_pos);
+
+    // Queue the bricks of a paged volume in front-to-back order
+    void PrefetchBricks ();
+
+    void GenerateGradientField ();
+    void UpdateOccupancyGrid ();
+
+    ThreadPool* m_thread_pool;
+
+    StructuredGridVolume* m_volume;
+    glm::ivec3 m_vol_resolution;
+    glm::vec3 m_vol_voxel_size;
+    glm::vec3 m_vol_grid_size;
+
+    TransferFunctionSnapshotPtr m_tf_snapshot;
+
+    // Pre-integrated RGBt, m_preint_size x m_preint_size entries
+    std::vector<float> m_tf_preintegrated;
+    int m_preint_size;
+    bool m_apply_preintegration;
+
+    // Sobel-Feldman gradient, 3 floats per voxel (FLOAT_32) or packed
+    std::vector<float> m_gradient;
+    std::vector<uint8_t> m_packed_gradient;
+    GradientEngine::OUTPUT_FORMAT m_gradient_format;
+    bool m_apply_gradient_shading;
+
+    float m_step_size;
+
+    OccupancyGrid m_occupancy_grid;
+    bool m_empty_space_skipping;
+    bool m_adaptive_step;
+    float m_max_step_scale;
+
+    RENDER_MODE m_render_mode;
+    // Normalized value range of the volume, the MIP/MinIP rays stop there
+    double m_density_range[2];
+
+    glm::vec3 m_cam_eye;
+    glm::mat3 m_cam_rotation;
+    float m_cam_tan_fov_y;
+    float m_cam_aspect_ratio;
+
+    float m_blinnphong_ka;
+    float m_blinnphong_kd;
+    float m_blinnphong_ks;
+    float m_blinnphong_shininess;
+    glm::vec3 m_blinnphong_ispecular;
+    glm::vec3 m_light_source_position;
+  };
+}
+
+#endif
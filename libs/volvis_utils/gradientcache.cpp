@@ -0,0 +1,376 @@
+#include "gradientcache.h"
+#include "halffloat.h"
+#include "octahedral.h"
+#include <file_utils/profiler.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace vis
+{
+  static const char GRADIENT_CACHE_MAGIC[8] = { 'V', 'V', 'G', 'R', 'A', 'D', 'C', '\0' };
+  static const uint32_t GRADIENT_CACHE_VERSION = 1;
+
+  // Voxels encoded/decoded per task
+  static const size_t GRADIENT_CACHE_TASK_VOXELS = 64 * 1024;
+
+  // 64 bytes, the data starts right after the header
+  struct GradientCache::Header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t encoding;
+    uint32_t method;
+    int32_t cd_sample_size;
+    uint32_t cd_normalized;
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    uint32_t reserved_0;
+    uint32_t reserved_1;
+    uint64_t content_hash;
+    uint64_t data_size;
+  };
+
+  static size_t GetEncodedVoxelSize (GradientCache::ENCODING encoding)
+  {
+    return encoding == GradientCache::ENCODING::FLOAT_16 ? 3 * sizeof(uint16_t) : sizeof(uint32_t);
+  }
+
+  template <typename Func>
+  static void ParallelVoxelRanges (ThreadPool* thread_pool, size_t n_voxels, Func&& func)
+  {
+    if (thread_pool == nullptr)
+      thread_pool = ThreadPool::GetDefault();
+
+    int n_tasks = (int)((n_voxels + GRADIENT_CACHE_TASK_VOXELS - 1) / GRADIENT_CACHE_TASK_VOXELS);
+    thread_pool->ParallelFor(n_tasks, [&](int task_id) {
+      size_t v0 = (size_t)task_id * GRADIENT_CACHE_TASK_VOXELS;
+      size_t v1 = std::min(v0 + GRADIENT_CACHE_TASK_VOXELS, n_voxels);
+      func(v0, v1);
+    });
+  }
+
+  /////////////////////
+  // Entry           //
+  /////////////////////
+  GradientCache::Entry::Entry ()
+    : m_encoding(ENCODING::FLOAT_16)
+    , m_width(0)
+    , m_height(0)
+    , m_depth(0)
+    , m_max_magnitude(0.0f)
+    , m_mapped_file(nullptr)
+    , m_data(nullptr)
+    , m_data_size(0)
+  {
+  }
+
+  GradientCache::Entry::~Entry ()
+  {
+    if (m_mapped_file) delete m_mapped_file;
+    m_mapped_file = nullptr;
+  }
+
+  GradientCache::ENCODING GradientCache::Entry::GetEncoding ()
+  {
+    return m_encoding;
+  }
+
+  unsigned int GradientCache::Entry::GetWidth ()
+  {
+    return m_width;
+  }
+
+  unsigned int GradientCache::Entry::GetHeight ()
+  {
+    return m_height;
+  }
+
+  unsigned int GradientCache::Entry::GetDepth ()
+  {
+    return m_depth;
+  }
+
+  float GradientCache::Entry::GetMaxMagnitude ()
+  {
+    return m_max_magnitude;
+  }
+
+  bool GradientCache::Entry::IsMapped ()
+  {
+    return m_mapped_file != nullptr;
+  }
+
+  const void* GradientCache::Entry::GetData ()
+  {
+    return m_data;
+  }
+
+  size_t GradientCache::Entry::GetDataSize ()
+  {
+    return m_data_size;
+  }
+
+  void GradientCache::Entry::DecodeFloat (float* xyz_output, ThreadPool* thread_pool)
+  {
+    PROFILE_SCOPE("GradientCache::Entry::DecodeFloat");
+    size_t n_voxels = (size_t)m_width * (size_t)m_height * (size_t)m_depth;
+    if (m_encoding == ENCODING::FLOAT_16)
+    {
+      const uint16_t* src = static_cast<const uint16_t*>(m_data);
+      ParallelVoxelRanges(thread_pool, n_voxels, [&](size_t v0, size_t v1) {
+        HalfToFloat(src + v0 * 3, xyz_output + v0 * 3, (v1 - v0) * 3);
+      });
+    }
+    else
+    {
+      const uint32_t* src = static_cast<const uint32_t*>(m_data);
+      ParallelVoxelRanges(thread_pool, n_voxels, [&](size_t v0, size_t v1) {
+        for (size_t v = v0; v < v1; v++)
+          DecodeOctahedral16(src[v], xyz_output + v * 3);
+      });
+    }
+  }
+
+  /////////////////////
+  // Public Methods  //
+  /////////////////////
+  GradientCache::GradientCache (std::string cache_directory, ENCODING encoding)
+    : m_encoding(encoding)
+  {
+    SetCacheDirectory(cache_directory);
+  }
+
+  GradientCache::~GradientCache ()
+  {
+  }
+
+  void GradientCache::SetCacheDirectory (std::string cache_directory)
+  {
+    m_cache_directory = cache_directory;
+    if (!m_cache_directory.empty() && m_cache_directory.back() != '/' && m_cache_directory.back() != '\\')
+      m_cache_directory.push_back('/');
+  }
+
+  std::string GradientCache::GetCacheDirectory ()
+  {
+    return m_cache_directory;
+  }
+
+  void GradientCache::SetEncoding (ENCODING encoding)
+  {
+    m_encoding = encoding;
+  }
+
+  GradientCache::ENCODING GradientCache::GetEncoding ()
+  {
+    return m_encoding;
+  }
+
+  std::string GradientCache::GetEntryPath (StructuredGridVolume* vol, GradientEngine* engine, std::string dataset_path)
+  {
+    size_t sep = dataset_path.find_last_of("/\\");
+    std::string dataset_dir = sep == std::string::npos ? "" : dataset_path.substr(0, sep + 1);
+    std::string dataset_name = sep == std::string::npos ? dataset_path : dataset_path.substr(sep + 1);
+
+    char key[96];
+    if (engine->GetMethod() == GradientEngine::METHOD::SOBEL_FELDMAN)
+      snprintf(key, sizeof(key), ".%016llx.sobel", vol->GetContentHash());
+    else
+      snprintf(key, sizeof(key), ".%016llx.cd%d%s", vol->GetContentHash(),
+        engine->GetCentralDifferencesSampleSize(), engine->GetCentralDifferencesNormalized() ? "n" : "s");
+
+    return (m_cache_directory.empty() ? dataset_dir : m_cache_directory) + dataset_name + key
+      + (m_encoding == ENCODING::FLOAT_16 ? ".f16" : ".oct16") + ".vgrad";
+  }
+
+  GradientCache::Entry* GradientCache::Load (StructuredGridVolume* vol, GradientEngine* engine, std::string dataset_path)
+  {
+    PROFILE_SCOPE("GradientCache::Load");
+    std::string path = GetEntryPath(vol, engine, dataset_path);
+    if (!std::ifstream(path).good())
+      return nullptr;
+
+    MappedFile* mapped_file = new MappedFile();
+    if (!mapped_file->Open(path, MappedFile::ACCESS_PATTERN::SEQUENTIAL))
+    {
+      delete mapped_file;
+      return nullptr;
+    }
+
+    Header expected;
+    FillHeader(vol, engine, &expected);
+
+    // Every header field is part of the key, including data_size
+    if (mapped_file->GetSize() < sizeof(Header) + expected.data_size ||
+        memcmp(mapped_file->GetData(), &expected, sizeof(Header)) != 0)
+    {
+      printf("GradientCache: ignoring invalid entry %s\n", path.c_str());
+      delete mapped_file;
+      return nullptr;
+    }
+
+    Entry* entry = new Entry();
+    entry->m_encoding = m_encoding;
+    entry->m_width = expected.width;
+    entry->m_height = expected.height;
+    entry->m_depth = expected.depth;
+    entry->m_max_magnitude = engine->GetMaxMagnitude();
+    entry->m_mapped_file = mapped_file;
+    entry->m_data = static_cast<const unsigned char*>(mapped_file->GetData()) + sizeof(Header);
+    entry->m_data_size = (size_t)expected.data_size;
+
+    printf("GradientCache: loaded %s\n", path.c_str());
+    return entry;
+  }
+
+  bool GradientCache::Store (StructuredGridVolume* vol, GradientEngine* engine, std::string dataset_path,
+                             const float* xyz_gradient)
+  {
+    PROFILE_SCOPE("GradientCache::Store");
+    Entry* entry = Encode(vol, xyz_gradient);
+
+    Header header;
+    FillHeader(vol, engine, &header);
+    bool written = Write(GetEntryPath(vol, engine, dataset_path), header, entry->GetData());
+
+    delete entry;
+    return written;
+  }
+
+  GradientCache::Entry* GradientCache::LoadOrCompute (StructuredGridVolume* vol, GradientEngine* engine,
+                                                      std::string dataset_path)
+  {
+    Entry* entry = Load(vol, engine, dataset_path);
+    if (entry) return entry;
+
+    if (m_encoding == ENCODING::FLOAT_16)
+    {
+      // The engine writes half floats directly
+      entry = new Entry();
+      entry->m_encoding = ENCODING::FLOAT_16;
+      entry->m_width = vol->GetWidth();
+      entry->m_height = vol->GetHeight();
+      entry->m_depth = vol->GetDepth();
+      entry->m_buffer.resize(GradientEngine::GetOutputSize(vol, GradientEngine::OUTPUT_FORMAT::FLOAT_16));
+      if (!engine->Compute(vol, GradientEngine::OUTPUT_FORMAT::FLOAT_16, entry->m_buffer.data()))
+      {
+        delete entry;
+        return nullptr;
+      }
+      entry->m_data = entry->m_buffer.data();
+      entry->m_data_size = entry->m_buffer.size();
+    }
+    else
+    {
+      std::vector<float> gradient = engine->ComputeFloat(vol);
+      if (gradient.empty()) return nullptr;
+      entry = Encode(vol, gradient.data());
+    }
+    entry->m_max_magnitude = engine->GetMaxMagnitude();
+
+    Header header;
+    FillHeader(vol, engine, &header);
+    std::string path = GetEntryPath(vol, engine, dataset_path);
+    if (!Write(path, header, entry->GetData()))
+      return entry;
+
+    // Release the heap copy, later accesses read the file pages
+    Entry* mapped_entry = Load(vol, engine, dataset_path);
+    if (mapped_entry == nullptr) return entry;
+
+    delete entry;
+    return mapped_entry;
+  }
+
+  /////////////////////
+  // Private Methods //
+  /////////////////////
+  void GradientCache::FillHeader (StructuredGridVolume* vol, GradientEngine* engine, Header* header)
+  {
+    memset(header, 0, sizeof(Header));
+    memcpy(header->magic, GRADIENT_CACHE_MAGIC, sizeof(GRADIENT_CACHE_MAGIC));
+    header->version = GRADIENT_CACHE_VERSION;
+    header->encoding = (uint32_t)m_encoding;
+    header->method = (uint32_t)engine->GetMethod();
+    if (engine->GetMethod() == GradientEngine::METHOD::CENTRAL_DIFFERENCES)
+    {
+      header->cd_sample_size = engine->GetCentralDifferencesSampleSize();
+      header->cd_normalized = engine->GetCentralDifferencesNormalized() ? 1 : 0;
+    }
+    header->width = vol->GetWidth();
+    header->height = vol->GetHeight();
+    header->depth = vol->GetDepth();
+    header->content_hash = vol->GetContentHash();
+    header->data_size = (uint64_t)header->width * header->height * header->depth * GetEncodedVoxelSize(m_encoding);
+  }
+
+  bool GradientCache::Write (std::string path, const Header& header, const void* data)
+  {
+    // Write to a temporary file first, so an interrupted write never
+    //  leaves a truncated entry with a valid name
+    std::string tmp_path = path + ".tmp";
+    FILE* fp = fopen(tmp_path.c_str(), "wb");
+    if (fp == nullptr)
+    {
+      printf("GradientCache: could not write %s\n", path.c_str());
+      return false;
+    }
+
+    bool written = fwrite(&header, sizeof(Header), 1, fp) == 1 &&
+                   fwrite(data, 1, (size_t)header.data_size, fp) == (size_t)header.data_size;
+    written = (fclose(fp) == 0) && written;
+
+    // The previous file is only replaced once the new one is complete
+    if (written)
+    {
+      std::remove(path.c_str());
+      written = std::rename(tmp_path.c_str(), path.c_str()) == 0;
+    }
+    if (!written)
+    {
+      std::remove(tmp_path.c_str());
+      printf("GradientCache: could not write %s\n", path.c_str());
+      return false;
+    }
+
+    printf("GradientCache: saved %s\n", path.c_str());
+    return true;
+  }
+
+  GradientCache::Entry* GradientCache::Encode (StructuredGridVolume* vol, const float* xyz_gradient)
+  {
+    PROFILE_SCOPE("GradientCache::Encode");
+    Entry* entry = new Entry();
+    entry->m_encoding = m_encoding;
+    entry->m_width = vol->GetWidth();
+    entry->m_height = vol->GetHeight();
+    entry->m_depth = vol->GetDepth();
+
+    size_t n_voxels = (size_t)entry->m_width * (size_t)entry->m_height * (size_t)entry->m_depth;
+    entry->m_buffer.resize(n_voxels * GetEncodedVoxelSize(m_encoding));
+
+    if (m_encoding == ENCODING::FLOAT_16)
+    {
+      uint16_t* dst = reinterpret_cast<uint16_t*>(entry->m_buffer.data());
+      ParallelVoxelRanges(nullptr, n_voxels, [&](size_t v0, size_t v1) {
+        FloatToHalf(xyz_gradient + v0 * 3, dst + v0 * 3, (v1 - v0) * 3);
+      });
+    }
+    else
+    {
+      uint32_t* dst = reinterpret_cast<uint32_t*>(entry->m_buffer.data());
+      ParallelVoxelRanges(nullptr, n_voxels, [&](size_t v0, size_t v1) {
+        for (size_t v = v0; v < v1; v++)
+          dst[v] = EncodeOctahedral16(xyz_gradient[v * 3 + 0], xyz_gradient[v * 3 + 1], xyz_gradient[v * 3 + 2]);
+      });
+    }
+
+    entry->m_data = entry->m_buffer.data();
+    entry->m_data_size = entry->m_buffer.size();
+    return entry;
+  }
+}
@@ -0,0 +1,119 @@
+/**
+ * Persistent cache of gradient fields.
+ *
+ * Entries are written next to the dataset, or in a cache directory,
+ * with a file name built from the dataset name, the content hash of
+ * the voxels (StructuredGridVolume::GetContentHash) and the method and
+ * parameters of the vis::GradientEngine. The same values are stored
+ * in the entry header and checked when the file is loaded.
+ *
+ * Encodings:
+ * . FLOAT_16: 3 half floats per voxel, the gradient as computed
+ * . OCTAHEDRAL_16: 2 x 16 bit octahedral direction per voxel, the
+ *   magnitude is not kept
+ *
+ * Cached entries are memory mapped, so FLOAT_16 data can be uploaded
+ * as GL_HALF_FLOAT straight from the file pages.
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_GRADIENT_CACHE_H
+#define VOL_VIS_UTILS_GRADIENT_CACHE_H
+
+#include <volvis_utils/structuredgridvolume.h>
+#include <volvis_utils/gradientengine.h>
+#include <file_utils/mappedfile.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace vis
+{
+  class GradientCache
+  {
+  public:
+    enum ENCODING : unsigned int {
+      FLOAT_16      = 0,
+      OCTAHEDRAL_16 = 1,
+    };
+
+    class Entry
+    {
+    public:
+      ~Entry ();
+
+      ENCODING GetEncoding ();
+      unsigned int GetWidth ();
+      unsigned int GetHeight ();
+      unsigned int GetDepth ();
+
+      // GradientEngine::GetMaxMagnitude of the engine that computed the
+      //  gradient, the scale of the OCTAHEDRAL_8_MAGNITUDE texels
+      float GetMaxMagnitude ();
+
+      // True if the data points to the pages of a cache file
+      bool IsMapped ();
+
+      const void* GetData ();
+      size_t GetDataSize ();
+
+      // Write 3 floats per voxel, unit vectors for OCTAHEDRAL_16
+      void DecodeFloat (float* xyz_output, ThreadPool* thread_pool = nullptr);
+
+    protected:
+
+    private:
+      friend class GradientCache;
+      Entry ();
+
+      ENCODING m_encoding;
+      unsigned int m_width, m_height, m_depth;
+      float m_max_magnitude;
+
+      MappedFile* m_mapped_file;
+      std::vector<unsigned char> m_buffer;
+      const void* m_data;
+      size_t m_data_size;
+    };
+
+    // An empty directory writes the entries next to the dataset
+    GradientCache (std::string cache_directory = "", ENCODING encoding = ENCODING::FLOAT_16);
+    ~GradientCache ();
+
+    void SetCacheDirectory (std::string cache_directory);
+    std::string GetCacheDirectory ();
+
+    void SetEncoding (ENCODING encoding);
+    ENCODING GetEncoding ();
+
+    std::string GetEntryPath (StructuredGridVolume* vol, GradientEngine* engine, std::string dataset_path);
+
+    // Map the cached gradient of vol, nullptr if there is no valid entry
+    Entry* Load (StructuredGridVolume* vol, GradientEngine* engine, std::string dataset_path);
+
+    // Encode and write a gradient field with 3 floats per voxel
+    bool Store (StructuredGridVolume* vol, GradientEngine* engine, std::string dataset_path,
+                const float* xyz_gradient);
+
+    // Load the entry or compute it with engine and write it to the cache.
+    //  . if the entry can not be written, the returned entry holds the
+    //    encoded data in memory
+    Entry* LoadOrCompute (StructuredGridVolume* vol, GradientEngine* engine, std::string dataset_path);
+
+  protected:
+
+  private:
+    struct Header;
+
+    void FillHeader (StructuredGridVolume* vol, GradientEngine* engine, Header* header);
+    bool Write (std::string path, const Header& header, const void* data);
+    Entry* Encode (StructuredGridVolume* vol, const float* xyz_gradient);
+
+    std::string m_cache_directory;
+    ENCODING m_encoding;
+  };
+}
+
+#endif
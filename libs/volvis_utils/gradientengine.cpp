@@ -0,0 +1,476 @@
+#include "gradientengine.h"
+#include "halffloat.h"
+#include "octahedral.h"
+#include "simd.h"
+#include <file_utils/profiler.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace vis
+{
+  // Normalized voxels of row (y, z) at dst[pad, pad + width), zeros in the
+  //   borders and for rows outside the grid
+  template <typename View>
+  static void LoadRow (const View& view, typename View::Sampler& sampler, int y, int z, int pad, float* dst)
+  {
+    int w = view.width;
+    if (y < 0 || z < 0 || y >= view.height || z >= view.depth)
+    {
+      std::fill(dst, dst + w + 2 * pad, 0.0f);
+      return;
+    }
+
+    std::fill(dst, dst + pad, 0.0f);
+    std::fill(dst + pad + w, dst + w + 2 * pad, 0.0f);
+
+    sampler.GetRowNormalized(y, z, dst + pad);
+  }
+
+  // Interleave (gx, gy, gz) and encode them into the output voxels [voxel_id, voxel_id + n)
+  static void WriteRow (GradientEngine::OUTPUT_FORMAT format, float max_magnitude, void* output, size_t voxel_id, int n,
+                        const float* gx, const float* gy, const float* gz, float* interleaved)
+  {
+    uint8_t* row_output = static_cast<uint8_t*>(output) + voxel_id * GradientEngine::GetBytesPerVoxel(format);
+    float* dst = (format == GradientEngine::OUTPUT_FORMAT::FLOAT_32)
+      ? reinterpret_cast<float*>(row_output)
+      : interleaved;
+
+    for (int x = 0; x < n; x++)
+    {
+      dst[x * 3 + 0] = gx[x];
+      dst[x * 3 + 1] = gy[x];
+      dst[x * 3 + 2] = gz[x];
+    }
+
+    if (format != GradientEngine::OUTPUT_FORMAT::FLOAT_32)
+      GradientEngine::Encode(format, interleaved, (size_t)n, max_magnitude, row_output);
+  }
+
+  GradientEngine::GradientEngine (ThreadPool* thread_pool)
+    : m_thread_pool(thread_pool)
+    , m_method(METHOD::SOBEL_FELDMAN)
+    , m_cd_sample_size(1)
+    , m_cd_normalized(true)
+  {
+    if (m_thread_pool == nullptr)
+      m_thread_pool = ThreadPool::GetDefault();
+  }
+
+  GradientEngine::~GradientEngine ()
+  {
+  }
+
+  void GradientEngine::SetMethod (METHOD method)
+  {
+    m_method = method;
+  }
+
+  GradientEngine::METHOD GradientEngine::GetMethod ()
+  {
+    return m_method;
+  }
+
+  void GradientEngine::SetCentralDifferencesParameters (int sample_size, bool normalized)
+  {
+    m_cd_sample_size = std::max(sample_size, 1);
+    m_cd_normalized = normalized;
+  }
+
+  int GradientEngine::GetCentralDifferencesSampleSize ()
+  {
+    return m_cd_sample_size;
+  }
+
+  bool GradientEngine::GetCentralDifferencesNormalized ()
+  {
+    return m_cd_normalized;
+  }
+
+  float GradientEngine::GetMaxMagnitude ()
+  {
+    // largest component: 16 (the positive weights of Sobel-Feldman),
+    //  1 (normalized) or n / 2 (scaled central differences)
+    float max_component = 16.0f;
+    if (m_method == METHOD::CENTRAL_DIFFERENCES)
+      max_component = m_cd_normalized ? 1.0f / std::sqrt(3.0f) : (float)m_cd_sample_size / 2.0f;
+    return max_component * std::sqrt(3.0f);
+  }
+
+  size_t GradientEngine::GetBytesPerVoxel (OUTPUT_FORMAT format)
+  {
+    switch (format)
+    {
+      case OUTPUT_FORMAT::FLOAT_32:               return 3 * sizeof(float);
+      case OUTPUT_FORMAT::FLOAT_16:               return 3 * sizeof(uint16_t);
+      case OUTPUT_FORMAT::RGB10_A2:               return sizeof(uint32_t);
+      case OUTPUT_FORMAT::OCTAHEDRAL_16:          return sizeof(uint32_t);
+      case OUTPUT_FORMAT::OCTAHEDRAL_8:           return 2;
+      case OUTPUT_FORMAT::OCTAHEDRAL_8_MAGNITUDE: return 3;
+    }
+    return 0;
+  }
+
+  size_t GradientEngine::GetOutputSize (StructuredGridVolume* vol, OUTPUT_FORMAT format)
+  {
+    if (vol == nullptr) return 0;
+    size_t n_voxels = (size_t)vol->GetWidth() * (size_t)vol->GetHeight() * (size_t)vol->GetDepth();
+    return n_voxels * GetBytesPerVoxel(format);
+  }
+
+  void GradientEngine::Encode (OUTPUT_FORMAT format, const float* xyz, size_t n, float max_magnitude, void* output)
+  {
+    if (format == OUTPUT_FORMAT::FLOAT_32)
+    {
+      std::copy(xyz, xyz + n * 3, static_cast<float*>(output));
+      return;
+    }
+    if (format == OUTPUT_FORMAT::FLOAT_16)
+    {
+      FloatToHalf(xyz, static_cast<uint16_t*>(output), n * 3);
+      return;
+    }
+
+    uint32_t* texels = static_cast<uint32_t*>(output);
+    int8_t* bytes = static_cast<int8_t*>(output);
+    for (size_t v = 0; v < n; v++)
+    {
+      const float* g = xyz + v * 3;
+      if (format == OUTPUT_FORMAT::RGB10_A2)
+      {
+        // r in the low bits, alpha is 0 if the gradient vanishes
+        float len = std::sqrt(g[0] * g[0] + g[1] * g[1] + g[2] * g[2]);
+        float inv_len = len > 0.0f ? 1.0f / len : 0.0f;
+        uint32_t texel = len > 0.0f ? 3u << 30 : 0u;
+        for (int a = 0; a < 3; a++)
+          texel |= (uint32_t)std::lround((g[a] * inv_len * 0.5f + 0.5f) * 1023.0f) << (10 * a);
+        texels[v] = texel;
+      }
+      else if (format == OUTPUT_FORMAT::OCTAHEDRAL_16)
+      {
+        texels[v] = EncodeOctahedral16(g[0], g[1], g[2]);
+      }
+      else if (format == OUTPUT_FORMAT::OCTAHEDRAL_8)
+      {
+        EncodeOctahedral8(g[0], g[1], g[2], bytes + v * 2);
+      }
+      else
+      {
+        EncodeOctahedral8(g[0], g[1], g[2], bytes + v * 3);
+        bytes[v * 3 + 2] = EncodeMagnitude8(std::sqrt(g[0] * g[0] + g[1] * g[1] + g[2] * g[2]), max_magnitude);
+      }
+    }
+  }
+
+  void GradientEngine::Decode (OUTPUT_FORMAT format, const void* data, size_t voxel_id, float* xyz)
+  {
+    switch (format)
+    {
+      case OUTPUT_FORMAT::FLOAT_32:
+      {
+        const float* g = static_cast<const float*>(data) + voxel_id * 3;
+        xyz[0] = g[0]; xyz[1] = g[1]; xyz[2] = g[2];
+        break;
+      }
+      case OUTPUT_FORMAT::FLOAT_16:
+      {
+        HalfToFloat(static_cast<const uint16_t*>(data) + voxel_id * 3, xyz, 3);
+        break;
+      }
+      case OUTPUT_FORMAT::RGB10_A2:
+      {
+        uint32_t texel = static_cast<const uint32_t*>(data)[voxel_id];
+        float a = (texel >> 30) != 0 ? 1.0f : 0.0f;
+        for (int c = 0; c < 3; c++)
+          xyz[c] = ((float)((texel >> (10 * c)) & 0x3FFu) / 1023.0f * 2.0f - 1.0f) * a;
+        break;
+      }
+      case OUTPUT_FORMAT::OCTAHEDRAL_16:
+      {
+        DecodeOctahedral16(static_cast<const uint32_t*>(data)[voxel_id], xyz);
+        break;
+      }
+      case OUTPUT_FORMAT::OCTAHEDRAL_8:
+      {
+        DecodeOctahedral8(static_cast<const int8_t*>(data) + voxel_id * 2, xyz);
+        break;
+      }
+      case OUTPUT_FORMAT::OCTAHEDRAL_8_MAGNITUDE:
+      {
+        const int8_t* code = static_cast<const int8_t*>(data) + voxel_id * 3;
+        DecodeOctahedral8(code, xyz);
+        float m = DecodeMagnitude8(code[2]);
+        xyz[0] *= m; xyz[1] *= m; xyz[2] *= m;
+        break;
+      }
+    }
+  }
+
+  bool GradientEngine::Compute (StructuredGridVolume* vol, OUTPUT_FORMAT format, void* output)
+  {
+    PROFILE_SCOPE("GradientEngine::Compute");
+    if (vol == nullptr || output == nullptr) return false;
+
+    int h = (int)vol->GetHeight();
+    int d = (int)vol->GetDepth();
+    int n_slabs = (d + SLAB_DEPTH - 1) / SLAB_DEPTH;
+    int n_blocks = (h + BLOCK_ROWS - 1) / BLOCK_ROWS;
+    PROFILE_COUNTER("gradient_voxels", (size_t)vol->GetWidth() * h * d);
+
+    // Dispatch the storage type once, each task is a z-slab x y-block
+    return vol->DispatchVoxelAccess([&](auto view) {
+      m_thread_pool->ParallelFor(n_slabs * n_blocks, [&](int task_id) {
+        PROFILE_SCOPE("GradientEngine::Task");
+        typename decltype(view)::Sampler sampler(view);
+        int z0 = (task_id / n_blocks) * SLAB_DEPTH;
+        int y0 = (task_id % n_blocks) * BLOCK_ROWS;
+        int z1 = std::min(z0 + SLAB_DEPTH, d);
+        int y1 = std::min(y0 + BLOCK_ROWS, h);
+
+        if (m_method == METHOD::SOBEL_FELDMAN)
+          SobelFeldmanTask(view, sampler, z0, z1, y0, y1, format, output);
+        else
+          CentralDifferencesTask(view, sampler, z0, z1, y0, y1, format, output);
+      });
+    });
+  }
+
+  std::vector<float> GradientEngine::ComputeFloat (StructuredGridVolume* vol)
+  {
+    std::vector<float> ret(GetOutputSize(vol, OUTPUT_FORMAT::FLOAT_32) / sizeof(float));
+    if (!Compute(vol, OUTPUT_FORMAT::FLOAT_32, ret.data()))
+      ret.clear();
+    return ret;
+  }
+
+  std::vector<uint16_t> GradientEngine::ComputeHalf (StructuredGridVolume* vol)
+  {
+    std::vector<uint16_t> ret(GetOutputSize(vol, OUTPUT_FORMAT::FLOAT_16) / sizeof(uint16_t));
+    if (!Compute(vol, OUTPUT_FORMAT::FLOAT_16, ret.data()))
+      ret.clear();
+    return ret;
+  }
+
+  std::vector<uint8_t> GradientEngine::ComputePacked (StructuredGridVolume* vol, OUTPUT_FORMAT format)
+  {
+    std::vector<uint8_t> ret(GetOutputSize(vol, format));
+    if (!Compute(vol, format, ret.data()))
+      ret.clear();
+    return ret;
+  }
+
+  // 3D Sobel-Feldman as separable passes:
+  //   gx = D(x) S(y) S(z), gy = S(x) D(y) S(z), gz = S(x) S(y) D(z)
+  //   with S = [1 2 1] and D = [1 0 -1] (f(i - 1) - f(i + 1))
+  // Each slice keeps the three (x, y) partial results S(x)S(y), D(x)S(y)
+  //   and S(x)D(y), combined along z from a ring of 3 slices.
+  template <typename View>
+  void GradientEngine::SobelFeldmanTask (const View& view, typename View::Sampler& sampler, int z0, int z1, int y0, int y1,
+                                         OUTPUT_FORMAT format, void* output)
+  {
+    using namespace simd;
+
+    const int w = view.width;
+    const int d = view.depth;
+    const int n_rows = y1 - y0;
+    const size_t plane = (size_t)n_rows * w;
+
+    // [slot][sxsy, dxsy, sxdy]
+    std::vector<float> slices(plane * 9);
+    auto slice_array = [&] (int k, int a) -> float* {
+      return slices.data() + plane * (((k % 3 + 3) % 3) * 3 + a);
+    };
+
+    std::vector<float> rows((size_t)(w + 2) * 3);
+    std::vector<float> sy(w + 2), dy(w + 2);
+    std::vector<float> gx(w), gy(w), gz(w);
+    std::vector<float> interleaved((size_t)w * 3);
+    const float max_magnitude = GetMaxMagnitude();
+
+    const vfloat two = Set1(2.0f);
+
+    auto compute_slice = [&] (int k) {
+      float* sxsy = slice_array(k, 0);
+      float* dxsy = slice_array(k, 1);
+      float* sxdy = slice_array(k, 2);
+      if (k < 0 || k >= d)
+      {
+        std::fill(sxsy, sxsy + plane, 0.0f);
+        std::fill(dxsy, dxsy + plane, 0.0f);
+        std::fill(sxdy, sxdy + plane, 0.0f);
+        return;
+      }
+
+      float* rm = rows.data();
+      float* r0 = rm + (w + 2);
+      float* rp = r0 + (w + 2);
+      LoadRow(view, sampler, y0 - 1, k, 1, rm);
+      LoadRow(view, sampler, y0, k, 1, r0);
+
+      for (int y = y0; y < y1; y++)
+      {
+        LoadRow(view, sampler, y + 1, k, 1, rp);
+
+        // y pass over the padded row
+        int i = 0;
+        for (; i + WIDTH <= w + 2; i += WIDTH)
+        {
+          vfloat a = Load(rm + i), b = Load(r0 + i), c = Load(rp + i);
+          Store(sy.data() + i, a + b * two + c);
+          Store(dy.data() + i, a - c);
+        }
+        for (; i < w + 2; i++)
+        {
+          sy[i] = rm[i] + 2.0f * r0[i] + rp[i];
+          dy[i] = rm[i] - rp[i];
+        }
+
+        // x pass
+        size_t o = (size_t)(y - y0) * w;
+        int x = 0;
+        for (; x + WIDTH <= w; x += WIDTH)
+        {
+          vfloat sa = Load(sy.data() + x), sb = Load(sy.data() + x + 1), sc = Load(sy.data() + x + 2);
+          vfloat da = Load(dy.data() + x), db = Load(dy.data() + x + 1), dc = Load(dy.data() + x + 2);
+          Store(sxsy + o + x, sa + sb * two + sc);
+          Store(dxsy + o + x, sa - sc);
+          Store(sxdy + o + x, da + db * two + dc);
+        }
+        for (; x < w; x++)
+        {
+          sxsy[o + x] = sy[x] + 2.0f * sy[x + 1] + sy[x + 2];
+          dxsy[o + x] = sy[x] - sy[x + 2];
+          sxdy[o + x] = dy[x] + 2.0f * dy[x + 1] + dy[x + 2];
+        }
+
+        std::swap(rm, r0);
+        std::swap(r0, rp);
+      }
+    };
+
+    compute_slice(z0 - 1);
+    compute_slice(z0);
+    for (int z = z0; z < z1; z++)
+    {
+      compute_slice(z + 1);
+
+      const float* sxsy_m = slice_array(z - 1, 0);
+      const float* sxsy_p = slice_array(z + 1, 0);
+      const float* dxsy_m = slice_array(z - 1, 1);
+      const float* dxsy_c = slice_array(z    , 1);
+      const float* dxsy_p = slice_array(z + 1, 1);
+      const float* sxdy_m = slice_array(z - 1, 2);
+      const float* sxdy_c = slice_array(z    , 2);
+      const float* sxdy_p = slice_array(z + 1, 2);
+
+      for (int r = 0; r < n_rows; r++)
+      {
+        size_t o = (size_t)r * w;
+        int x = 0;
+        for (; x + WIDTH <= w; x += WIDTH)
+        {
+          Store(gx.data() + x, Load(dxsy_m + o + x) + Load(dxsy_c + o + x) * two + Load(dxsy_p + o + x));
+          Store(gy.data() + x, Load(sxdy_m + o + x) + Load(sxdy_c + o + x) * two + Load(sxdy_p + o + x));
+          Store(gz.data() + x, Load(sxsy_m + o + x) - Load(sxsy_p + o + x));
+        }
+        for (; x < w; x++)
+        {
+          gx[x] = dxsy_m[o + x] + 2.0f * dxsy_c[o + x] + dxsy_p[o + x];
+          gy[x] = sxdy_m[o + x] + 2.0f * sxdy_c[o + x] + sxdy_p[o + x];
+          gz[x] = sxsy_m[o + x] - sxsy_p[o + x];
+        }
+
+        WriteRow(format, max_magnitude, output, view.Index(0, y0 + r, z), w, gx.data(), gy.data(), gz.data(), interleaved.data());
+      }
+    }
+  }
+
+  template <typename View>
+  void GradientEngine::CentralDifferencesTask (const View& view, typename View::Sampler& sampler, int z0, int z1, int y0, int y1,
+                                               OUTPUT_FORMAT format, void* output)
+  {
+    using namespace simd;
+
+    const int w = view.width;
+    const int n = m_cd_sample_size;
+
+    std::vector<float> rows((size_t)(w + 2 * n) * 5);
+    float* rc  = rows.data();
+    float* rym = rc  + (w + 2 * n);
+    float* ryp = rym + (w + 2 * n);
+    float* rzm = ryp + (w + 2 * n);
+    float* rzp = rzm + (w + 2 * n);
+
+    std::vector<float> gx(w), gy(w), gz(w);
+    std::vector<float> interleaved((size_t)w * 3);
+    const float max_magnitude = GetMaxMagnitude();
+
+    const vfloat zero = Set1(0.0f);
+    const vfloat scale = Set1((float)n / 2.0f);
+
+    for (int z = z0; z < z1; z++)
+    {
+      for (int y = y0; y < y1; y++)
+      {
+        LoadRow(view, sampler, y    , z    , n, rc);
+        LoadRow(view, sampler, y - n, z    , n, rym);
+        LoadRow(view, sampler, y + n, z    , n, ryp);
+        LoadRow(view, sampler, y    , z - n, n, rzm);
+        LoadRow(view, sampler, y    , z + n, n, rzp);
+
+        int x = 0;
+        for (; x + WIDTH <= w; x += WIDTH)
+        {
+          vfloat vx = Load(rc  + x + 2 * n) - Load(rc + x);
+          vfloat vy = Load(ryp + x + n) - Load(rym + x + n);
+          vfloat vz = Load(rzp + x + n) - Load(rzm + x + n);
+          if (m_cd_normalized)
+          {
+            // zero length gradients stay 0 (the nan check of GenerateGradientTexture)
+            vfloat len = Sqrt(vx * vx + vy * vy + vz * vz);
+            vmask valid = len > zero;
+            vfloat inv_len = Set1(1.0f) / Select(valid, len, Set1(1.0f));
+            vx = Select(valid, vx * inv_len, zero);
+            vy = Select(valid, vy * inv_len, zero);
+            vz = Select(valid, vz * inv_len, zero);
+          }
+          else
+          {
+            vx = vx * scale;
+            vy = vy * scale;
+            vz = vz * scale;
+          }
+          Store(gx.data() + x, vx);
+          Store(gy.data() + x, vy);
+          Store(gz.data() + x, vz);
+        }
+        for (; x < w; x++)
+        {
+          float vx = rc[x + 2 * n] - rc[x];
+          float vy = ryp[x + n] - rym[x + n];
+          float vz = rzp[x + n] - rzm[x + n];
+          if (m_cd_normalized)
+          {
+            float len = std::sqrt(vx * vx + vy * vy + vz * vz);
+            float inv_len = len > 0.0f ? 1.0f / len : 0.0f;
+            vx *= inv_len;
+            vy *= inv_len;
+            vz *= inv_len;
+          }
+          else
+          {
+            vx *= (float)n / 2.0f;
+            vy *= (float)n / 2.0f;
+            vz *= (float)n / 2.0f;
+          }
+          gx[x] = vx;
+          gy[x] = vy;
+          gz[x] = vz;
+        }
+
+        WriteRow(format, max_magnitude, output, view.Index(0, y, z), w, gx.data(), gy.data(), gz.data(), interleaved.data());
+      }
+    }
+  }
+}
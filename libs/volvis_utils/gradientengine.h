@@ -0,0 +1,117 @@
+/**
+ * CPU gradient precomputation for structured grid volumes.
+ *
+ * Computes one gradient vector per voxel, written directly into a CPU
+ *   buffer in one of the OUTPUT_FORMAT layouts. No OpenGL context is needed.
+ * . FLOAT_32/FLOAT_16: 3 interleaved components (GL_RGB layout)
+ * . RGB10_A2: unit direction * 0.5 + 0.5, alpha 0 for zero vectors
+ * . OCTAHEDRAL_16/OCTAHEDRAL_8: octahedral unit direction (octahedral.h)
+ * . OCTAHEDRAL_8_MAGNITUDE: octahedral 8-bit direction + 8-bit magnitude,
+ *   relative to GetMaxMagnitude
+ * Each row is encoded as soon as it is filtered, the packed formats
+ *   never hold the float gradient of the whole volume.
+ *
+ * . SOBEL_FELDMAN: same operator of sobelfeldman_generator.comp and
+ *   GenerateSobelFeldmanGradientTexture (not normalized), evaluated as
+ *   separable [1 2 1] smoothing and [1 0 -1] derivative passes.
+ * . CENTRAL_DIFFERENCES: same operator of GenerateGradientTexture,
+ *   f(x + n) - f(x - n) per axis, normalized or scaled.
+ * Voxels outside the grid are 0 in both methods.
+ *
+ * The volume is split in z-slabs x y-blocks consumed in parallel by a
+ *   vis::ThreadPool. Each task keeps a ring of 3 blocked slice buffers
+ *   with the partial (x, y) filter results, so every input row is read
+ *   once per slice and the working set stays in cache.
+ * Paged volumes (vis::BrickPager) are read through one sampler per task,
+ *   the output buffer must still hold the whole gradient.
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_GRADIENT_ENGINE_H
+#define VOL_VIS_UTILS_GRADIENT_ENGINE_H
+
+#include <volvis_utils/structuredgridvolume.h>
+#include <volvis_utils/threadpool.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace vis
+{
+  class GradientEngine
+  {
+  public:
+    enum METHOD : unsigned int
+    {
+      SOBEL_FELDMAN       = 0,
+      CENTRAL_DIFFERENCES = 1,
+    };
+
+    enum OUTPUT_FORMAT : unsigned int
+    {
+      FLOAT_32               = 0, // 12 bytes per voxel
+      FLOAT_16               = 1, //  6 bytes per voxel
+      RGB10_A2               = 2, //  4 bytes per voxel
+      OCTAHEDRAL_16          = 3, //  4 bytes per voxel
+      OCTAHEDRAL_8           = 4, //  2 bytes per voxel
+      OCTAHEDRAL_8_MAGNITUDE = 5, //  3 bytes per voxel
+    };
+
+    // z slices per task and rows of each slice buffer block
+    static const int SLAB_DEPTH = 16;
+    static const int BLOCK_ROWS = 16;
+
+    GradientEngine (ThreadPool* thread_pool = nullptr);
+    ~GradientEngine ();
+
+    void SetMethod (METHOD method);
+    METHOD GetMethod ();
+
+    // CENTRAL_DIFFERENCES parameters, same defaults of GenerateGradientTexture
+    void SetCentralDifferencesParameters (int sample_size = 1, bool normalized = true);
+    int GetCentralDifferencesSampleSize ();
+    bool GetCentralDifferencesNormalized ();
+
+    // Upper bound of the gradient length for densities in [0, 1], the
+    //  scale of the OCTAHEDRAL_8_MAGNITUDE magnitudes
+    float GetMaxMagnitude ();
+
+    static size_t GetBytesPerVoxel (OUTPUT_FORMAT format);
+    // Number of bytes written by Compute
+    static size_t GetOutputSize (StructuredGridVolume* vol, OUTPUT_FORMAT format);
+
+    // Encode n gradients (3 floats each) into output
+    static void Encode (OUTPUT_FORMAT format, const float* xyz, size_t n, float max_magnitude, void* output);
+    // Decode the voxel voxel_id of data: the gradient for the float formats,
+    //  the unit direction (times the relative magnitude) for the packed ones
+    static void Decode (OUTPUT_FORMAT format, const void* data, size_t voxel_id, float* xyz);
+
+    // Write the gradient of vol into output (GetOutputSize bytes)
+    bool Compute (StructuredGridVolume* vol, OUTPUT_FORMAT format, void* output);
+
+    std::vector<float> ComputeFloat (StructuredGridVolume* vol);
+    std::vector<uint16_t> ComputeHalf (StructuredGridVolume* vol);
+    // Any format, GetBytesPerVoxel bytes per voxel
+    std::vector<uint8_t> ComputePacked (StructuredGridVolume* vol, OUTPUT_FORMAT format);
+
+  protected:
+
+  private:
+    template <typename View>
+    void SobelFeldmanTask (const View& view, typename View::Sampler& sampler, int z0, int z1, int y0, int y1,
+                           OUTPUT_FORMAT format, void* output);
+
+    template <typename View>
+    void CentralDifferencesTask (const View& view, typename View::Sampler& sampler, int z0, int z1, int y0, int y1,
+                                 OUTPUT_FORMAT format, void* output);
+
+    ThreadPool* m_thread_pool;
+
+    METHOD m_method;
+    int m_cd_sample_size;
+    bool m_cd_normalized;
+  };
+}
+
+#endif
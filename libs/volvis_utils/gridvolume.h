@@ -24,7 +24,7 @@ namespace vis
   {
   public:
     GridVolume (std::string name = "Unknown");
-    ~GridVolume ();
+    virtual ~GridVolume ();
   
     std::string GetName ();
     void SetName (std::string name);
@@ -0,0 +1,114 @@
+/**
+ * IEEE 754 half precision conversions.
+ *
+ * Used to write GL_HALF_FLOAT buffers directly from the CPU kernels.
+ * FloatToHalf rounds to nearest even, overflows to infinity and keeps
+ *   NaNs. The batch conversions use F16C when it is enabled.
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_HALF_FLOAT_H
+#define VOL_VIS_UTILS_HALF_FLOAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+  #define VOLVIS_HALF_F16C
+  #include <immintrin.h>
+#endif
+
+namespace vis
+{
+  inline uint16_t FloatToHalf (float f)
+  {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(float));
+
+    uint32_t sign = (x >> 16) & 0x8000u;
+    uint32_t abs_x = x & 0x7FFFFFFFu;
+
+    // NaN and infinity
+    if (abs_x >= 0x7F800000u)
+      return (uint16_t)(sign | 0x7C00u | (abs_x > 0x7F800000u ? 0x200u : 0u));
+    // overflow
+    if (abs_x >= 0x477FF000u)
+      return (uint16_t)(sign | 0x7C00u);
+    // normal half
+    if (abs_x >= 0x38800000u)
+    {
+      uint32_t mant_odd = (abs_x >> 13) & 1u;
+      abs_x += 0xC8000FFFu + mant_odd;
+      return (uint16_t)(sign | (abs_x >> 13));
+    }
+    // subnormal half or zero
+    if (abs_x < 0x33000000u)
+      return (uint16_t)sign;
+
+    uint32_t exponent = abs_x >> 23;
+    uint32_t mantissa = (abs_x & 0x7FFFFFu) | 0x800000u;
+    uint32_t shift = 126u - exponent;
+    uint32_t half_mant = mantissa >> shift;
+    uint32_t remainder = mantissa & ((1u << shift) - 1u);
+    uint32_t halfway = 1u << (shift - 1u);
+    if (remainder > halfway || (remainder == halfway && (half_mant & 1u)))
+      half_mant++;
+    return (uint16_t)(sign | half_mant);
+  }
+
+  inline float HalfToFloat (uint16_t h)
+  {
+    uint32_t sign = ((uint32_t)h & 0x8000u) << 16;
+    uint32_t exponent = ((uint32_t)h >> 10) & 0x1Fu;
+    uint32_t mantissa = (uint32_t)h & 0x3FFu;
+
+    uint32_t x;
+    if (exponent == 0x1Fu)
+      x = sign | 0x7F800000u | (mantissa << 13);
+    else if (exponent != 0)
+      x = sign | ((exponent + 112u) << 23) | (mantissa << 13);
+    else if (mantissa == 0)
+      x = sign;
+    else
+    {
+      // subnormal half
+      exponent = 113u;
+      while ((mantissa & 0x400u) == 0)
+      {
+        mantissa <<= 1;
+        exponent--;
+      }
+      x = sign | (exponent << 23) | ((mantissa & 0x3FFu) << 13);
+    }
+
+    float f;
+    memcpy(&f, &x, sizeof(float));
+    return f;
+  }
+
+  inline void FloatToHalf (const float* src, uint16_t* dst, size_t n)
+  {
+    size_t i = 0;
+#ifdef VOLVIS_HALF_F16C
+    for (; i + 8 <= n; i += 8)
+      _mm_storeu_si128((__m128i*)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+#endif
+    for (; i < n; i++)
+      dst[i] = FloatToHalf(src[i]);
+  }
+
+  inline void HalfToFloat (const uint16_t* src, float* dst, size_t n)
+  {
+    size_t i = 0;
+#ifdef VOLVIS_HALF_F16C
+    for (; i + 8 <= n; i += 8)
+      _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i))));
+#endif
+    for (; i < n; i++)
+      dst[i] = HalfToFloat(src[i]);
+  }
+}
+
+#endif
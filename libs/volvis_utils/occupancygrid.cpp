@@ -0,0 +1,298 @@
+#include "occupancygrid.h"
+#include <file_utils/profiler.h>
+
+#include <algorithm>
+#include <cmath>
+
+// Margin added to the density range of each brick, covering the rounding of
+//  the interpolated densities and of volumes uploaded as half float textures
+#define OCCUPANCY_GRID_DENSITY_MARGIN (1.0f / 2048.0f)
+
+namespace vis
+{
+  OccupancyGrid::OccupancyGrid ()
+    : m_brick_size(0)
+    , m_grid_size(0)
+    , m_n_occupied(0)
+    , m_tf_scale(0.0f)
+    , m_tf_offset(0.0f)
+    , m_compute_sampling_rate(false)
+  {
+  }
+
+  OccupancyGrid::~OccupancyGrid ()
+  {
+  }
+
+  void OccupancyGrid::SetComputeSamplingRate (bool compute)
+  {
+    m_compute_sampling_rate = compute;
+  }
+
+  bool OccupancyGrid::GetComputeSamplingRate () const
+  {
+    return m_compute_sampling_rate;
+  }
+
+  bool OccupancyGrid::Build (const VolumeBricks* bricks, const float* extinction, int tf_length, int stride)
+  {
+    return BuildGrid(bricks, extinction, tf_length, stride, (float)tf_length, -0.5f);
+  }
+
+  bool OccupancyGrid::Build (const VolumeBricks* bricks, const TransferFunctionTable& table)
+  {
+    return BuildGrid(bricks, table.GetExtinction(), table.GetLength(), 1, table.GetScale(), table.GetOffset());
+  }
+
+  bool OccupancyGrid::Build (const VolumeBricks* bricks, TransferFunction1D* tf)
+  {
+    if (tf == nullptr)
+    {
+      Clear();
+      return false;
+    }
+
+    int tf_length = tf->GetMaxDensity() + 1;
+    std::vector<float> extinction(tf_length);
+    for (int i = 0; i < tf_length; i++)
+      extinction[i] = tf->GetExt((double)i);
+
+    return Build(bricks, extinction.data(), tf_length);
+  }
+
+  int OccupancyGrid::Update (const VolumeBricks* bricks, const float* extinction, int tf_length, int first, int last, int stride)
+  {
+    return UpdateGrid(bricks, extinction, tf_length, first, last, stride, (float)tf_length, -0.5f);
+  }
+
+  int OccupancyGrid::Update (const VolumeBricks* bricks, const TransferFunctionTable& table, int first, int last)
+  {
+    return UpdateGrid(bricks, table.GetExtinction(), table.GetLength(), first, last, 1, table.GetScale(), table.GetOffset());
+  }
+
+  void OccupancyGrid::Clear ()
+  {
+    m_brick_size = 0;
+    m_grid_size = glm::ivec3(0);
+    m_occupancy.clear();
+    m_n_occupied = 0;
+    m_tf_nonzero_prefix.clear();
+    m_tf_scale = 0.0f;
+    m_tf_offset = 0.0f;
+    m_brick_step_error.clear();
+    m_sampling_rate.clear();
+    m_tf_max_extinction.clear();
+    m_tf_min_extinction.clear();
+  }
+
+  bool OccupancyGrid::IsBuilt () const
+  {
+    return !m_occupancy.empty();
+  }
+
+  int OccupancyGrid::GetBrickSize () const
+  {
+    return m_brick_size;
+  }
+
+  glm::ivec3 OccupancyGrid::GetGridSize () const
+  {
+    return m_grid_size;
+  }
+
+  const unsigned char* OccupancyGrid::GetData () const
+  {
+    return m_occupancy.data();
+  }
+
+  bool OccupancyGrid::HasSamplingRate () const
+  {
+    return !m_sampling_rate.empty();
+  }
+
+  const float* OccupancyGrid::GetSamplingRateData () const
+  {
+    return m_sampling_rate.data();
+  }
+
+  float OccupancyGrid::GetOccupiedRatio () const
+  {
+    if (m_occupancy.empty()) return 0.0f;
+    return (float)m_n_occupied / (float)m_occupancy.size();
+  }
+
+  bool OccupancyGrid::BuildGrid (const VolumeBricks* bricks, const float* extinction, int tf_length, int stride,
+                                 float tf_scale, float tf_offset)
+  {
+    PROFILE_SCOPE("OccupancyGrid::Build");
+    Clear();
+    if (bricks == nullptr || !bricks->IsBuilt() || extinction == nullptr || tf_length <= 0)
+      return false;
+
+    BuildNonZeroPrefix(extinction, tf_length, stride);
+    m_tf_scale = tf_scale;
+    m_tf_offset = tf_offset;
+
+    m_brick_size = bricks->GetBrickSize();
+    m_grid_size = bricks->GetGridSize();
+
+    int n_bricks = bricks->GetNumberOfBricks();
+    m_occupancy.resize(n_bricks);
+
+    for (int b = 0; b < n_bricks; b++)
+    {
+      int i0, i1;
+      GetLookupRange(bricks, b, tf_length, &i0, &i1);
+
+      bool occupied = m_tf_nonzero_prefix[i1 + 1] - m_tf_nonzero_prefix[i0] > 0;
+      m_occupancy[b] = occupied ? 255 : 0;
+      m_n_occupied += occupied ? 1 : 0;
+    }
+
+    if (m_compute_sampling_rate)
+    {
+      BuildExtinctionRanges(extinction, tf_length, stride);
+      m_brick_step_error.resize(n_bricks);
+      for (int b = 0; b < n_bricks; b++)
+        m_brick_step_error[b] = ComputeBrickStepError(bricks, b, tf_length);
+      NormalizeSamplingRate();
+    }
+
+    return true;
+  }
+
+  int OccupancyGrid::UpdateGrid (const VolumeBricks* bricks, const float* extinction, int tf_length, int first, int last,
+                                 int stride, float tf_scale, float tf_offset)
+  {
+    PROFILE_SCOPE("OccupancyGrid::Update");
+    if (bricks == nullptr || !bricks->IsBuilt() || extinction == nullptr || tf_length <= 0)
+    {
+      Clear();
+      return 0;
+    }
+
+    int n_bricks = bricks->GetNumberOfBricks();
+    if (!IsBuilt() || (int)m_occupancy.size() != n_bricks || m_grid_size != bricks->GetGridSize() ||
+        (int)m_tf_nonzero_prefix.size() != tf_length + 1 || m_tf_scale != tf_scale || m_tf_offset != tf_offset ||
+        m_compute_sampling_rate != HasSamplingRate())
+    {
+      BuildGrid(bricks, extinction, tf_length, stride, tf_scale, tf_offset);
+      return n_bricks;
+    }
+
+    BuildNonZeroPrefix(extinction, tf_length, stride);
+    if (m_compute_sampling_rate)
+      BuildExtinctionRanges(extinction, tf_length, stride);
+
+    int n_changed = 0;
+    bool rate_changed = false;
+    for (int b = 0; b < n_bricks; b++)
+    {
+      int i0, i1;
+      GetLookupRange(bricks, b, tf_length, &i0, &i1);
+      if (i1 < first || i0 > last)
+        continue;
+
+      bool changed = false;
+      bool occupied = m_tf_nonzero_prefix[i1 + 1] - m_tf_nonzero_prefix[i0] > 0;
+      if (occupied != (m_occupancy[b] != 0))
+      {
+        m_occupancy[b] = occupied ? 255 : 0;
+        m_n_occupied += occupied ? 1 : -1;
+        changed = true;
+      }
+
+      if (m_compute_sampling_rate)
+      {
+        float error = ComputeBrickStepError(bricks, b, tf_length);
+        if (error != m_brick_step_error[b])
+        {
+          m_brick_step_error[b] = error;
+          rate_changed = changed = true;
+        }
+      }
+      n_changed += changed ? 1 : 0;
+    }
+
+    // The rates are relative to the largest error, which may have changed
+    if (rate_changed)
+      NormalizeSamplingRate();
+
+    return n_changed;
+  }
+
+  void OccupancyGrid::GetLookupRange (const VolumeBricks* bricks, int b, int tf_length, int* i0, int* i1) const
+  {
+    // Entries fetched by a GL_LINEAR lookup at u = density * m_tf_scale + m_tf_offset
+    const float* min_max = bricks->GetMinMaxData();
+    float u0 = (min_max[b * 2 + 0] - OCCUPANCY_GRID_DENSITY_MARGIN) * m_tf_scale + m_tf_offset;
+    float u1 = (min_max[b * 2 + 1] + OCCUPANCY_GRID_DENSITY_MARGIN) * m_tf_scale + m_tf_offset;
+    *i0 = glm::clamp((int)std::floor(u0), 0, tf_length - 1);
+    *i1 = glm::clamp((int)std::floor(u1) + 1, 0, tf_length - 1);
+  }
+
+  void OccupancyGrid::BuildNonZeroPrefix (const float* extinction, int tf_length, int stride)
+  {
+    m_tf_nonzero_prefix.resize(tf_length + 1);
+    m_tf_nonzero_prefix[0] = 0;
+    for (int i = 0; i < tf_length; i++)
+      m_tf_nonzero_prefix[i + 1] = m_tf_nonzero_prefix[i] + (extinction[(size_t)i * stride] > 0.0f ? 1 : 0);
+  }
+
+  void OccupancyGrid::BuildExtinctionRanges (const float* extinction, int tf_length, int stride)
+  {
+    int n_levels = 1;
+    while ((1 << n_levels) <= tf_length)
+      n_levels++;
+
+    m_tf_max_extinction.resize(n_levels);
+    m_tf_min_extinction.resize(n_levels);
+    m_tf_max_extinction[0].resize(tf_length);
+    m_tf_min_extinction[0].resize(tf_length);
+    for (int i = 0; i < tf_length; i++)
+      m_tf_max_extinction[0][i] = m_tf_min_extinction[0][i] = extinction[(size_t)i * stride];
+
+    for (int k = 1; k < n_levels; k++)
+    {
+      int half = 1 << (k - 1);
+      int n = tf_length - (1 << k) + 1;
+      m_tf_max_extinction[k].resize(n);
+      m_tf_min_extinction[k].resize(n);
+      for (int i = 0; i < n; i++)
+      {
+        m_tf_max_extinction[k][i] = std::max(m_tf_max_extinction[k - 1][i], m_tf_max_extinction[k - 1][i + half]);
+        m_tf_min_extinction[k][i] = std::min(m_tf_min_extinction[k - 1][i], m_tf_min_extinction[k - 1][i + half]);
+      }
+    }
+  }
+
+  float OccupancyGrid::ComputeBrickStepError (const VolumeBricks* bricks, int b, int tf_length) const
+  {
+    if (m_occupancy[b] == 0)
+      return 0.0f;
+
+    int i0, i1;
+    GetLookupRange(bricks, b, tf_length, &i0, &i1);
+
+    // Two overlapping ranges of 2^k entries cover [i0, i1]
+    int k = 0;
+    while ((2 << k) <= i1 - i0 + 1)
+      k++;
+    int j = i1 - (1 << k) + 1;
+    float ext_max = std::max(m_tf_max_extinction[k][i0], m_tf_max_extinction[k][j]);
+    float ext_min = std::min(m_tf_min_extinction[k][i0], m_tf_min_extinction[k][j]);
+
+    return (ext_max - ext_min) + STEP_ERROR_EXTINCTION_WEIGHT * ext_max;
+  }
+
+  void OccupancyGrid::NormalizeSamplingRate ()
+  {
+    float max_error = 0.0f;
+    for (size_t b = 0; b < m_brick_step_error.size(); b++)
+      max_error = std::max(max_error, m_brick_step_error[b]);
+
+    m_sampling_rate.resize(m_brick_step_error.size());
+    for (size_t b = 0; b < m_brick_step_error.size(); b++)
+      m_sampling_rate[b] = max_error > 0.0f ? m_brick_step_error[b] / max_error : 0.0f;
+  }
+}
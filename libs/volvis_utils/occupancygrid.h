@@ -0,0 +1,137 @@
+/**
+ * Transfer function dependent occupancy of the bricks of a volume.
+ *
+ * A brick is empty if every density of its [min, max] range (see
+ *   vis::VolumeBricks) is mapped to zero extinction, considering the
+ *   linear filtering of the transfer function lookup, so rays can skip
+ *   it without changing the image.
+ *
+ * The transfer function is reduced to a prefix count of its non-zero
+ *   entries, making each brick an O(1) test: rebuilding the grid after
+ *   a transfer function change takes a fraction of a millisecond for
+ *   volumes with ~10^5 bricks.
+ *
+ * The occupancy is stored as one byte per brick (255 occupied, 0 empty),
+ *   same layout of a GL_R8 3D texture.
+ *
+ * Adaptive step size (SetComputeSamplingRate): each brick also gets a
+ *   sampling rate relative to the brick that needs the most samples. The
+ *   error of a step of length h inside a brick is bounded by h times the
+ *   change of extinction over the lookup range of the brick, plus a
+ *   fraction (STEP_ERROR_EXTINCTION_WEIGHT) of its max extinction for the
+ *   colors. A brick with rate r keeps the same bound with a step r times
+ *   longer: transparent or homogeneous bricks are crossed with long
+ *   steps, bricks with a transfer function edge keep the step size. The
+ *   max and min extinction of each lookup range are O(1) queries of a
+ *   sparse table built from the transfer function.
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_OCCUPANCY_GRID_H
+#define VOL_VIS_UTILS_OCCUPANCY_GRID_H
+
+#include <volvis_utils/volumebricks.h>
+#include <volvis_utils/transferfunction1d.h>
+#include <volvis_utils/transferfunctiontable.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace vis
+{
+  class OccupancyGrid
+  {
+  public:
+    // Weight of the max extinction of a brick in its step error, see
+    //  GetSamplingRate
+    static constexpr float STEP_ERROR_EXTINCTION_WEIGHT = 0.25f;
+
+    OccupancyGrid ();
+    ~OccupancyGrid ();
+
+    // Also compute the sampling rate of the bricks in the next Build
+    void SetComputeSamplingRate (bool compute);
+    bool GetComputeSamplingRate () const;
+
+    // extinction holds tf_length entries, each stride floats apart,
+    //  indexed as a GL_LINEAR + GL_CLAMP_TO_EDGE texture by the normalized density
+    bool Build (const VolumeBricks* bricks, const float* extinction, int tf_length, int stride = 1);
+    // Same entries of TransferFunction1D::GenerateTexture_1D_RGBt
+    bool Build (const VolumeBricks* bricks, TransferFunction1D* tf);
+    // Extinction of table, read at u = density * GetScale() + GetOffset()
+    bool Build (const VolumeBricks* bricks, const TransferFunctionTable& table);
+    // Only the bricks whose lookup range overlaps the changed entries
+    //  [first, last] are tested again, the grid is built from scratch if it
+    //  was built for other bricks or another lookup.
+    //  Returns the number of bricks that changed occupancy or sampling rate.
+    int Update (const VolumeBricks* bricks, const float* extinction, int tf_length, int first, int last, int stride = 1);
+    int Update (const VolumeBricks* bricks, const TransferFunctionTable& table, int first, int last);
+    void Clear ();
+
+    bool IsBuilt () const;
+
+    int GetBrickSize () const;
+    glm::ivec3 GetGridSize () const;
+
+    bool IsOccupied (int bx, int by, int bz) const
+    {
+      return m_occupancy[bx + (by + bz * m_grid_size.y) * m_grid_size.x] != 0;
+    }
+
+    const unsigned char* GetData () const;
+
+    bool HasSamplingRate () const;
+    // Sampling rate of brick (bx, by, bz) in [0, 1]: 1 for the bricks
+    //  sampled with the step size, the step can be 1 / rate times longer.
+    //  0 if the brick is empty
+    float GetSamplingRate (int bx, int by, int bz) const
+    {
+      return m_sampling_rate[bx + (by + bz * m_grid_size.y) * m_grid_size.x];
+    }
+    // One float per brick, same layout of GetData
+    const float* GetSamplingRateData () const;
+
+    // Fraction of the bricks that are occupied, in [0, 1]
+    float GetOccupiedRatio () const;
+
+  protected:
+
+  private:
+    // Entries read at u = density * tf_scale + tf_offset
+    bool BuildGrid (const VolumeBricks* bricks, const float* extinction, int tf_length, int stride,
+                    float tf_scale, float tf_offset);
+    int UpdateGrid (const VolumeBricks* bricks, const float* extinction, int tf_length, int first, int last,
+                    int stride, float tf_scale, float tf_offset);
+    // Range [i0, i1] of the entries fetched by the densities of brick b
+    void GetLookupRange (const VolumeBricks* bricks, int b, int tf_length, int* i0, int* i1) const;
+    void BuildNonZeroPrefix (const float* extinction, int tf_length, int stride);
+
+    // Sparse tables of the max and min extinction of 2^k entries
+    void BuildExtinctionRanges (const float* extinction, int tf_length, int stride);
+    // Step error of brick b per unit length, 0 if empty
+    float ComputeBrickStepError (const VolumeBricks* bricks, int b, int tf_length) const;
+    // m_sampling_rate = m_brick_step_error / largest step error
+    void NormalizeSamplingRate ();
+
+    int m_brick_size;
+    glm::ivec3 m_grid_size;
+    std::vector<unsigned char> m_occupancy;
+    int m_n_occupied;
+
+    // m_tf_nonzero_prefix[i] = number of non-zero entries in [0, i)
+    std::vector<int> m_tf_nonzero_prefix;
+    float m_tf_scale;
+    float m_tf_offset;
+
+    bool m_compute_sampling_rate;
+    std::vector<float> m_brick_step_error;
+    std::vector<float> m_sampling_rate;
+    // level k holds the max/min of the entries [i, i + 2^k)
+    std::vector<std::vector<float>> m_tf_max_extinction;
+    std::vector<std::vector<float>> m_tf_min_extinction;
+  };
+}
+
+#endif
@@ -0,0 +1,142 @@
+/**
+ * Octahedral encoding of unit vectors.
+ *
+ * The direction is projected onto the octahedron |x| + |y| + |z| = 1,
+ * the lower hemisphere is folded over the diagonals and the (u, v)
+ * coordinates are stored as two snorm values, u first:
+ * . 16-bit: packed in 32 bits (u in the low half)
+ * . 8-bit: two bytes, GL_RG8I layout, less than 1 degree of error
+ * Valid directions are quantized to [-32767, 32767] / [-127, 127], so the
+ * code (-32768, -32768) / (-128, -128) is reserved for zero vectors. The
+ * ray casters fetch the codes as integers to test for it exactly.
+ *
+ * The 8-bit magnitude of EncodeMagnitude8 is sqrt(|g| / max_magnitude)
+ * as a positive snorm byte, so small gradients keep more precision.
+ * It is decoded as the relative magnitude (q / 127)^2, gradients below
+ * (0.5 / 127)^2 of max_magnitude decode as zero.
+ *
+ * Reference:
+ * . Cigolle et al., A Survey of Efficient Representations for
+ *   Independent Unit Vectors, JCGT 2014
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_OCTAHEDRAL_H
+#define VOL_VIS_UTILS_OCTAHEDRAL_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace vis
+{
+  static const uint32_t OCTAHEDRAL_16_ZERO = 0x80008000u;
+  static const uint16_t OCTAHEDRAL_8_ZERO = 0x8080u;
+
+  inline float OctahedralSign (float v)
+  {
+    return v >= 0.0f ? 1.0f : -1.0f;
+  }
+
+  // (u, v) in [-1, 1] of a non-zero vector
+  inline bool OctahedralProject (float x, float y, float z, float* uv)
+  {
+    float l1 = std::fabs(x) + std::fabs(y) + std::fabs(z);
+    if (!(l1 > 0.0f)) return false;
+
+    float u = x / l1;
+    float v = y / l1;
+    if (z < 0.0f)
+    {
+      float fu = (1.0f - std::fabs(v)) * OctahedralSign(u);
+      float fv = (1.0f - std::fabs(u)) * OctahedralSign(v);
+      u = fu;
+      v = fv;
+    }
+    uv[0] = std::fmin(std::fmax(u, -1.0f), 1.0f);
+    uv[1] = std::fmin(std::fmax(v, -1.0f), 1.0f);
+    return true;
+  }
+
+  // Unit vector of the (u, v) coordinates
+  inline void OctahedralUnfold (float u, float v, float* xyz)
+  {
+    float z = 1.0f - std::fabs(u) - std::fabs(v);
+    if (z < 0.0f)
+    {
+      float fu = (1.0f - std::fabs(v)) * OctahedralSign(u);
+      float fv = (1.0f - std::fabs(u)) * OctahedralSign(v);
+      u = fu;
+      v = fv;
+    }
+
+    float inv_len = 1.0f / std::sqrt(u * u + v * v + z * z);
+    xyz[0] = u * inv_len;
+    xyz[1] = v * inv_len;
+    xyz[2] = z * inv_len;
+  }
+
+  inline uint32_t EncodeOctahedral16 (float x, float y, float z)
+  {
+    float uv[2];
+    if (!OctahedralProject(x, y, z, uv)) return OCTAHEDRAL_16_ZERO;
+
+    int16_t qu = (int16_t)std::lround(uv[0] * 32767.0f);
+    int16_t qv = (int16_t)std::lround(uv[1] * 32767.0f);
+    return (uint32_t)(uint16_t)qu | ((uint32_t)(uint16_t)qv << 16);
+  }
+
+  // Writes a unit vector, or (0, 0, 0) for the zero code
+  inline void DecodeOctahedral16 (uint32_t code, float* xyz)
+  {
+    if (code == OCTAHEDRAL_16_ZERO)
+    {
+      xyz[0] = xyz[1] = xyz[2] = 0.0f;
+      return;
+    }
+
+    OctahedralUnfold((float)(int16_t)(code & 0xFFFFu) / 32767.0f,
+                     (float)(int16_t)(code >> 16) / 32767.0f, xyz);
+  }
+
+  // Writes the two snorm bytes (u, v) into dst
+  inline void EncodeOctahedral8 (float x, float y, float z, int8_t* dst)
+  {
+    float uv[2];
+    if (!OctahedralProject(x, y, z, uv))
+    {
+      dst[0] = dst[1] = -128;
+      return;
+    }
+
+    dst[0] = (int8_t)std::lround(uv[0] * 127.0f);
+    dst[1] = (int8_t)std::lround(uv[1] * 127.0f);
+  }
+
+  inline void DecodeOctahedral8 (const int8_t* src, float* xyz)
+  {
+    if (src[0] == -128 && src[1] == -128)
+    {
+      xyz[0] = xyz[1] = xyz[2] = 0.0f;
+      return;
+    }
+
+    OctahedralUnfold((float)src[0] / 127.0f, (float)src[1] / 127.0f, xyz);
+  }
+
+  inline int8_t EncodeMagnitude8 (float magnitude, float max_magnitude)
+  {
+    if (!(magnitude > 0.0f) || !(max_magnitude > 0.0f)) return 0;
+    return (int8_t)std::lround(std::sqrt(std::fmin(magnitude / max_magnitude, 1.0f)) * 127.0f);
+  }
+
+  // Relative magnitude in [0, 1]
+  inline float DecodeMagnitude8 (int8_t code)
+  {
+    float m = (float)std::max<int>(code, 0) / 127.0f;
+    return m * m;
+  }
+}
+
+#endif
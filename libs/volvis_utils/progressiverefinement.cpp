@@ -0,0 +1,130 @@
+#include "progressiverefinement.h"
+
+#include <algorithm>
+
+namespace vis
+{
+  ProgressiveRefinement::ProgressiveRefinement ()
+    : m_n_samples(DEFAULT_NUMBER_OF_SAMPLES)
+    , m_frame_budget_ms((double)DEFAULT_FRAME_BUDGET_MS)
+    , m_pass(0)
+    , m_next_unit(0)
+    , m_n_units(0)
+  {
+  }
+
+  ProgressiveRefinement::~ProgressiveRefinement ()
+  {
+  }
+
+  void ProgressiveRefinement::SetNumberOfSamples (int n_samples)
+  {
+    m_n_samples = std::max(n_samples, 1);
+    Reset();
+  }
+
+  int ProgressiveRefinement::GetNumberOfSamples () const
+  {
+    return m_n_samples;
+  }
+
+  void ProgressiveRefinement::SetFrameBudget (double budget_ms)
+  {
+    m_frame_budget_ms = budget_ms;
+  }
+
+  double ProgressiveRefinement::GetFrameBudget () const
+  {
+    return m_frame_budget_ms;
+  }
+
+  void ProgressiveRefinement::Reset ()
+  {
+    m_pass = 0;
+    m_next_unit = 0;
+    m_n_units = 0;
+  }
+
+  int ProgressiveRefinement::GetPass () const
+  {
+    return m_pass;
+  }
+
+  bool ProgressiveRefinement::HasFullImage () const
+  {
+    return m_pass >= N_SUBSAMPLED_PASSES;
+  }
+
+  bool ProgressiveRefinement::IsConverged () const
+  {
+    return m_pass >= N_SUBSAMPLED_PASSES - 1 + m_n_samples;
+  }
+
+  int ProgressiveRefinement::GetStride () const
+  {
+    if (m_pass == 0) return 4;
+    if (m_pass == 1) return 2;
+    return 1;
+  }
+
+  bool ProgressiveRefinement::SkipsCoarserPixels () const
+  {
+    return m_pass > 0 && m_pass < N_SUBSAMPLED_PASSES;
+  }
+
+  int ProgressiveRefinement::GetAccumulatedSamples () const
+  {
+    return std::max(m_pass - (N_SUBSAMPLED_PASSES - 1), 0);
+  }
+
+  unsigned int ProgressiveRefinement::GetJitterSeed () const
+  {
+    return m_n_samples > 1 ? (unsigned int)m_pass + 1u : 0u;
+  }
+
+  bool ProgressiveRefinement::IsTraced (int x, int y) const
+  {
+    int stride = GetStride();
+    if (x % stride != 0 || y % stride != 0)
+      return false;
+    if (SkipsCoarserPixels() && x % (stride * 2) == 0 && y % (stride * 2) == 0)
+      return false;
+    return true;
+  }
+
+  int ProgressiveRefinement::GetNextUnit () const
+  {
+    return m_next_unit;
+  }
+
+  double ProgressiveRefinement::GetPassProgress () const
+  {
+    return m_n_units > 0 ? (double)m_next_unit / (double)m_n_units : 0.0;
+  }
+
+  void ProgressiveRefinement::CompleteUnits (int n, int n_units)
+  {
+    m_n_units = n_units;
+    m_next_unit += n;
+    if (m_next_unit >= n_units)
+    {
+      m_pass++;
+      m_next_unit = 0;
+      m_n_units = 0;
+    }
+  }
+
+  float ProgressiveRefinement::GetJitter (int x, int y, unsigned int seed)
+  {
+    if (seed == 0) return 0.0f;
+
+    // Wang hash
+    unsigned int h = (unsigned int)x * 1973u + (unsigned int)y * 9277u + seed * 26699u;
+    h = (h ^ 61u) ^ (h >> 16);
+    h *= 9u;
+    h = h ^ (h >> 4);
+    h *= 0x27d4eb2du;
+    h = h ^ (h >> 15);
+    return (float)(h >> 8) / 16777216.0f - 0.5f;
+  }
+}
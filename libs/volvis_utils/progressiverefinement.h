@@ -0,0 +1,90 @@
+/**
+ * Pass schedule of progressive refinement rendering.
+ *
+ * After Reset, a frame is refined in passes spread over several redraws:
+ * . pass 0: one ray per 4x4 pixels (1/16 of the image), filling the block
+ * . pass 1: one ray per 2x2 pixels not traced by pass 0, filling the block
+ * . pass 2: the remaining pixels, completing the first sample per pixel
+ * . pass 3..: one more sample per pixel, averaged into the image
+ * The frame converges after GetNumberOfSamples samples per pixel. With
+ *   more than one sample, each pass jitters the sample offsets inside the
+ *   integration steps, so the average removes the wood-grain artifacts of
+ *   the fixed step size. A single sample is the image of a full render.
+ *
+ * Renderers split each pass in units of work (tiles, rows) traced in
+ *   order, and stop when the frame budget is spent: the next redraw
+ *   continues from GetNextUnit. Blocks of the subsampled passes never
+ *   cross TILE_ALIGNMENT pixels, so tiles aligned to it are independent.
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_PROGRESSIVE_REFINEMENT_H
+#define VOL_VIS_UTILS_PROGRESSIVE_REFINEMENT_H
+
+namespace vis
+{
+  class ProgressiveRefinement
+  {
+  public:
+    static const int N_SUBSAMPLED_PASSES = 3;
+    static const int TILE_ALIGNMENT = 4;
+    static const int DEFAULT_NUMBER_OF_SAMPLES = 8;
+    static const int DEFAULT_FRAME_BUDGET_MS = 30;
+
+    ProgressiveRefinement ();
+    ~ProgressiveRefinement ();
+
+    // Samples per pixel of the converged frame, at least 1
+    void SetNumberOfSamples (int n_samples);
+    int GetNumberOfSamples () const;
+
+    // Time each redraw may spend tracing rays
+    void SetFrameBudget (double budget_ms);
+    double GetFrameBudget () const;
+
+    // Restart from pass 0, the frame is outdated
+    void Reset ();
+
+    int GetPass () const;
+    // Every pixel has at least one sample
+    bool HasFullImage () const;
+    bool IsConverged () const;
+
+    // One ray per stride x stride pixels: 4, 2, then 1
+    int GetStride () const;
+    // Pixels of the stride grid traced by a previous pass are skipped
+    bool SkipsCoarserPixels () const;
+    // Samples already averaged in the image, 0 if the pass overwrites it
+    int GetAccumulatedSamples () const;
+    // 0 if the samples are taken at the middle of each step
+    unsigned int GetJitterSeed () const;
+
+    // Pixel (x, y) is traced by the current pass
+    bool IsTraced (int x, int y) const;
+
+    // Units of work of the current pass, traced in order
+    int GetNextUnit () const;
+    // Fraction of the units of the current pass already traced
+    double GetPassProgress () const;
+    // Mark the next n units as traced, moves to the next pass after the
+    //  last one of n_units
+    void CompleteUnits (int n, int n_units);
+
+    // Offset in [-0.5, 0.5) of the samples of pixel (x, y) inside each
+    //  step, same hash of ray_marching_1p.comp
+    static float GetJitter (int x, int y, unsigned int seed);
+
+  protected:
+
+  private:
+    int m_n_samples;
+    double m_frame_budget_ms;
+
+    int m_pass;
+    int m_next_unit;
+    int m_n_units;
+  };
+}
+
+#endif
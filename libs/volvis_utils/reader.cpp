@@ -6,14 +6,21 @@
 
 #include <file_utils/pvm.h>
 #include <file_utils/rawloader.h>
+#include <file_utils/profiler.h>
 
 #include <fstream>
 
 #include <volvis_utils/transferfunction1d.h>
+#include <volvis_utils/volumecontainer.h>
 
 namespace vis
 {
   VolumeReader::VolumeReader ()
+    : m_raw_memory_mapping(false)
+    , m_raw_access_pattern(MappedFile::ACCESS_PATTERN::SEQUENTIAL)
+    , m_pager_memory_budget(BrickPager::DEFAULT_MEMORY_BUDGET)
+    , m_compression(false)
+    , m_compression_max_error(0)
   {
 
   }
@@ -25,6 +32,7 @@ namespace vis
 
   StructuredGridVolume* VolumeReader::ReadStructuredVolume (std::string filepath)
   {
+    PROFILE_SCOPE("VolumeReader::ReadStructuredVolume");
     StructuredGridVolume* ret = nullptr;
 
     int found = filepath.find_last_of('.');
@@ -37,13 +45,41 @@ namespace vis
     else if (extension.compare("raw") == 0) {
       ret = readraw(filepath);
     }
+    else if (extension.compare("braw") == 0) {
+      ret = readbraw(filepath);
+    }
+    else if (extension.compare("vvol") == 0) {
+      ret = readvvol(filepath);
+    }
+
+    // Volumes that can not be compressed are kept as they were read
+    if (ret != nullptr && m_compression && !ret->IsPaged())
+      ret->CompressData(m_compression_max_error, m_pager_memory_budget);
     printf("DONE\n");
 
     return ret;
   }
 
+  void VolumeReader::SetRawMemoryMapping (bool use_mapping, MappedFile::ACCESS_PATTERN access_pattern)
+  {
+    m_raw_memory_mapping = use_mapping;
+    m_raw_access_pattern = access_pattern;
+  }
+
+  void VolumeReader::SetPagerMemoryBudget (size_t memory_budget)
+  {
+    m_pager_memory_budget = memory_budget;
+  }
+
+  void VolumeReader::SetCompression (bool compress, int max_error)
+  {
+    m_compression = compress;
+    m_compression_max_error = max_error;
+  }
+
   StructuredGridVolume* VolumeReader::readpvm (std::string filename)
   {
+    PROFILE_SCOPE("VolumeReader::readpvm");
     StructuredGridVolume* ret = nullptr;
 
     printf("Started  -> Read Volume From .pvm File\n");
@@ -53,41 +89,32 @@ namespace vis
     double scalex, scaley, scalez;
 
     Pvm fpvm(filename.c_str());
+    if (fpvm.GetData() == nullptr)
+    {
+      printf("Finished -> Could not read .pvm file\n");
+      return nullptr;
+    }
 
     fpvm.GetDimensions(&width, &height, &depth);
     components = fpvm.GetComponents();
     fpvm.GetScale(&scalex, &scaley, &scalez);
 
-    assert(components > 0);
-
     vis::DataStorageSize data_tp;
-    void* scalar_values = nullptr;
-
     // GLubyte - 8 bits
     if (components == 1)
-    {
       data_tp = vis::DataStorageSize::_8_BITS;
-    
-      scalar_values = new unsigned char[width * height * depth];
-      unsigned char* u_sv = static_cast<unsigned char*>(scalar_values);
-
-      unsigned char* vol_data = static_cast<unsigned char*>(fpvm.GetData());
-      for (int i = 0; i < width * height * depth; i++)
-        u_sv[i] = (unsigned char)vol_data[i];
-    }
     // GLushort - 16 bits
     else if (components == 2)
-    {
       data_tp = vis::DataStorageSize::_16_BITS;
-      
-      scalar_values = new unsigned short[width * height * depth];
-      unsigned short* u_sv = static_cast<unsigned short*>(scalar_values);
-
-      unsigned short* vol_data = static_cast<unsigned short*>(fpvm.GetData());
-      for (int i = 0; i < width * height * depth; i++)
-        u_sv[i] = (unsigned short)vol_data[i];
+    else
+    {
+      printf("Finished -> .pvm files with %d components are not supported\n", components);
+      return nullptr;
     }
 
+    // The voxels were decoded into the buffer of the volume, no copy needed
+    void* scalar_values = fpvm.ReleaseData();
+
     ret = new StructuredGridVolume(filename, width, height, depth);
     ret->SetScale(scalex, scaley, scalez);
     ret->SetName(filename);
@@ -106,6 +133,7 @@ namespace vis
 
   StructuredGridVolume* VolumeReader::readraw (std::string filepath)
   {
+    PROFILE_SCOPE("VolumeReader::readraw");
     StructuredGridVolume* sg_ret = nullptr;
 
     printf("Started  -> Read Volume From .raw File\n");
@@ -149,44 +177,62 @@ namespace vis
       // Byte Size
       bytes_per_value = atoi(t_filebytesize.c_str());
 
-      IRAWLoader rawLoader = IRAWLoader(filepath, bytes_per_value, fw * fh * fd, bytes_per_value);
+      sg_ret = new StructuredGridVolume(filename, fw, fh, fd);
+      sg_ret->SetScale(1.0, 1.0, 1.0);
+      sg_ret->SetName(filepath);
 
-      vis::DataStorageSize data_tp;
+      vis::DataStorageSize data_tp = vis::GetStorageSizeType((size_t)bytes_per_value);
 
-      void* scalar_values = nullptr;
-      // GLushort - 16 bits - converting to float
-      if (bytes_per_value == sizeof(unsigned short))
+      bool mapped = false;
+      if (m_raw_memory_mapping)
       {
-        data_tp = vis::DataStorageSize::_16_BITS;
-        scalar_values = new unsigned short[fw * fh * fd];
-  
-        unsigned short* us_scalar_values = static_cast<unsigned short*>(scalar_values);
-        unsigned short* b = static_cast<unsigned short*>(rawLoader.GetData());
-
-        for (int i = 0; i < fw * fh * fd; i++)
-          us_scalar_values[i] = b[i];
+        MappedFile* mapped_file = new MappedFile();
+        // The volume keeps the mapped file, which is closed at DestroyData
+        if (mapped_file->Open(filepath, m_raw_access_pattern) && sg_ret->SetMappedArrayData(mapped_file, 0, data_tp))
+        {
+          mapped = true;
+          printf("  - Memory Mapped   : %zu bytes\n", mapped_file->GetSize());
+        }
+        else
+        {
+          delete mapped_file;
+          printf("  - Could not map the .raw file, reading it instead\n");
+        }
       }
-      // GLubyte - 8 bits - converting to float
-      else if (bytes_per_value == sizeof(unsigned char))
-      {
-        data_tp = vis::DataStorageSize::_8_BITS;
-        scalar_values = new unsigned char[fw * fh * fd];
 
-        unsigned char* uc_scalar_values = static_cast<unsigned char*>(scalar_values);
-        unsigned char* b = static_cast<unsigned char*>(rawLoader.GetData());
+      if (!mapped)
+      {
+        IRAWLoader rawLoader = IRAWLoader(filepath, bytes_per_value, fw * fh * fd, bytes_per_value);
 
-        for (int i = 0; i < fw * fh * fd; i++)
-          uc_scalar_values[i] = b[i];
+        void* scalar_values = nullptr;
+        // GLushort - 16 bits - converting to float
+        if (bytes_per_value == sizeof(unsigned short))
+        {
+          scalar_values = new unsigned short[fw * fh * fd];
+  
+          unsigned short* us_scalar_values = static_cast<unsigned short*>(scalar_values);
+          unsigned short* b = static_cast<unsigned short*>(rawLoader.GetData());
+
+          for (int i = 0; i < fw * fh * fd; i++)
+            us_scalar_values[i] = b[i];
+        }
+        // GLubyte - 8 bits - converting to float
+        else if (bytes_per_value == sizeof(unsigned char))
+        {
+          scalar_values = new unsigned char[fw * fh * fd];
+
+          unsigned char* uc_scalar_values = static_cast<unsigned char*>(scalar_values);
+          unsigned char* b = static_cast<unsigned char*>(rawLoader.GetData());
+
+          for (int i = 0; i < fw * fh * fd; i++)
+            uc_scalar_values[i] = b[i];
+        }
+
+        // We won't delete the scalar_values, because it will be stored at 
+        //   structured grid volume...
+        sg_ret->SetArrayData(scalar_values, data_tp);
       }
 
-      sg_ret = new StructuredGridVolume(filename, fw, fh, fd);
-      sg_ret->SetScale(1.0, 1.0, 1.0);
-      sg_ret->SetName(filepath);
-
-      // We won't delete the scalar_values, because it will be stored at 
-      //   structured grid volume...
-      sg_ret->SetArrayData(scalar_values, data_tp);
-
       printf("  - Volume Name     : %s\n", filepath.c_str());
       printf("  - Volume Size     : [%d, %d, %d]\n", fw, fh, fd);
       printf("  - Volume Byte Size: %d\n", bytes_per_value);
@@ -201,6 +247,68 @@ namespace vis
     return sg_ret;
   }
 
+  StructuredGridVolume* VolumeReader::readbraw (std::string filepath)
+  {
+    PROFILE_SCOPE("VolumeReader::readbraw");
+    printf("Started  -> Read Volume From .braw File\n");
+    printf("  - File .braw Path: %s\n", filepath.c_str());
+
+    BrickPager* pager = new BrickPager();
+    if (!pager->Open(filepath, m_pager_memory_budget))
+    {
+      delete pager;
+      printf("Finished -> Error on opening .braw file\n");
+      return nullptr;
+    }
+
+    glm::ivec3 res = pager->GetVolumeResolution();
+    glm::dvec3 scale = pager->GetScale();
+
+    StructuredGridVolume* sg_ret = new StructuredGridVolume(filepath, res.x, res.y, res.z);
+    sg_ret->SetScale(scale.x, scale.y, scale.z);
+    sg_ret->SetName(filepath);
+    // The volume keeps the pager, which is deleted at DestroyData
+    sg_ret->SetBrickPager(pager);
+
+    printf("  - Volume Size     : [%d, %d, %d]\n", res.x, res.y, res.z);
+    printf("  - Bricks          : %d of %d^3 voxels, %d in cache\n",
+      pager->GetNumberOfBricks(), pager->GetBrickSize(), pager->GetCapacity());
+    printf("Finished -> Read Volume From .braw File\n");
+
+    return sg_ret;
+  }
+
+  StructuredGridVolume* VolumeReader::readvvol (std::string filepath)
+  {
+    PROFILE_SCOPE("VolumeReader::readvvol");
+    printf("Started  -> Read Volume From .vvol File\n");
+    printf("  - File .vvol Path: %s\n", filepath.c_str());
+
+    VolumeContainer container;
+    if (!container.Open(filepath))
+    {
+      printf("Finished -> Error on opening .vvol file\n");
+      return nullptr;
+    }
+
+    // Compressed volumes are read on demand, the others are decoded at once
+    StructuredGridVolume* sg_ret = m_compression ? container.ReadLevelPaged(0, m_pager_memory_budget)
+                                                 : container.ReadLevel(0);
+    if (sg_ret == nullptr)
+    {
+      printf("Finished -> Error on reading .vvol file\n");
+      return nullptr;
+    }
+    sg_ret->SetName(filepath);
+
+    glm::ivec3 res = container.GetResolution();
+    printf("  - Volume Size     : [%d, %d, %d]\n", res.x, res.y, res.z);
+    printf("  - Levels          : %d%s\n", container.GetNumberOfLevels(), container.HasGradient() ? ", gradient" : "");
+    printf("Finished -> Read Volume From .vvol File\n");
+
+    return sg_ret;
+  }
+
   TransferFunctionReader::TransferFunctionReader ()
   {
 
@@ -213,6 +321,7 @@ namespace vis
   
   vis::TransferFunction* TransferFunctionReader::ReadTransferFunction (std::string file)
   {
+    PROFILE_SCOPE("TransferFunctionReader::ReadTransferFunction");
     TransferFunction* tf_ret = NULL;
 
     int found = file.find_last_of('.');
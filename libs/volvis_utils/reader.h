@@ -3,6 +3,8 @@
  * - VolumeReader:
  *  .pvm
  *  .raw
+ *  .braw (bricked, paged by vis::BrickPager)
+ *  .vvol (vis::VolumeContainer, level 0)
  *
  * - TransferFunctionReader:
  *  .tf1d
@@ -27,12 +29,34 @@ namespace vis
     ~VolumeReader ();
 
     StructuredGridVolume* ReadStructuredVolume (std::string filepath);
+
+    // .raw files are memory mapped instead of copied into a new array
+    //  . the volume references the read-only mapped pages (zero-copy)
+    //  . access_pattern is forwarded to madvise/PrefetchVirtualMemory
+    void SetRawMemoryMapping (bool use_mapping,
+      MappedFile::ACCESS_PATTERN access_pattern = MappedFile::ACCESS_PATTERN::SEQUENTIAL);
+
+    // Memory budget of the brick cache of .braw volumes
+    void SetPagerMemoryBudget (size_t memory_budget);
+
+    // .pvm and .raw volumes are kept as compressed bricks (see
+    //  StructuredGridVolume::CompressData), decoded on demand into a cache
+    //  of the pager memory budget. max_error == 0 is lossless.
+    //  . .vvol volumes keep their own bricks, decoded from the mapped file
+    void SetCompression (bool compress, int max_error = 0);
   
   protected:
     StructuredGridVolume* readpvm (std::string filename);
     StructuredGridVolume* readraw (std::string filepath);
+    StructuredGridVolume* readbraw (std::string filepath);
+    StructuredGridVolume* readvvol (std::string filepath);
 
   private:
+    bool m_raw_memory_mapping;
+    MappedFile::ACCESS_PATTERN m_raw_access_pattern;
+    size_t m_pager_memory_budget;
+    bool m_compression;
+    int m_compression_max_error;
 
   };
 
@@ -0,0 +1,70 @@
+/**
+ * Integrators of the ray casters.
+ *
+ * DIRECT_VOLUME_RENDERING is the emission-absorption model. The
+ *   projections reduce the normalized densities along the ray to a single
+ *   value, classified by the transfer function afterwards: the color is
+ *   premultiplied by the opacity of that value.
+ * . MAXIMUM/MINIMUM_INTENSITY_PROJECTION: largest/smallest density. The
+ *   bricks whose density range cannot change the running value are
+ *   skipped, and the ray stops at the largest/smallest density of the data.
+ * . AVERAGE_INTENSITY_PROJECTION: mean density over the ray segment
+ *   inside the volume.
+ * . MAXIMUM_INTENSITY_DIFFERENCE_ACCUMULATION: emission-absorption
+ *   compositing where the accumulated color and opacity are scaled by
+ *   1 - (f - f_max) each time a sample f exceeds the running maximum
+ *   f_max, so structures with higher densities show through, as in MIP,
+ *   but keep the occlusion and shading of DVR.
+ *
+ * Reference:
+ * . Bruckner and Groller, Instant Volume Visualization using Maximum
+ *   Intensity Difference Accumulation, EuroVis 2009
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_RENDER_MODE_H
+#define VOL_VIS_UTILS_RENDER_MODE_H
+
+#include <string>
+
+namespace vis
+{
+  // Same values of the RenderMode uniform of the compute shaders
+  enum RENDER_MODE : unsigned int {
+    DIRECT_VOLUME_RENDERING                   = 0,
+    MAXIMUM_INTENSITY_PROJECTION              = 1,
+    MINIMUM_INTENSITY_PROJECTION              = 2,
+    AVERAGE_INTENSITY_PROJECTION              = 3,
+    MAXIMUM_INTENSITY_DIFFERENCE_ACCUMULATION = 4,
+  };
+
+  // Short names used by the command line options: dvr, mip, minip, aip, mida
+  inline const char* GetRenderModeName (RENDER_MODE mode)
+  {
+    switch (mode)
+    {
+      case RENDER_MODE::MAXIMUM_INTENSITY_PROJECTION:              return "mip";
+      case RENDER_MODE::MINIMUM_INTENSITY_PROJECTION:              return "minip";
+      case RENDER_MODE::AVERAGE_INTENSITY_PROJECTION:              return "aip";
+      case RENDER_MODE::MAXIMUM_INTENSITY_DIFFERENCE_ACCUMULATION: return "mida";
+      default:                                                     return "dvr";
+    }
+  }
+
+  // False if name is not one of the short names
+  inline bool ParseRenderMode (const std::string& name, RENDER_MODE* mode)
+  {
+    for (unsigned int m = 0; m <= RENDER_MODE::MAXIMUM_INTENSITY_DIFFERENCE_ACCUMULATION; m++)
+    {
+      if (name == GetRenderModeName((RENDER_MODE)m))
+      {
+        *mode = (RENDER_MODE)m;
+        return true;
+      }
+    }
+    return false;
+  }
+}
+
+#endif
@@ -0,0 +1,223 @@
+/**
+ * Minimal SIMD wrapper used by the CPU kernels (ray packets, batch
+ * classification...).
+ *
+ * vfloat holds simd::WIDTH floats and vmask the result of a lane-wise
+ * comparison. The backend is chosen at compile time:
+ * . AVX2 (8 lanes) when __AVX2__ is defined (/arch:AVX2, see VOLVIS_USE_AVX2)
+ * . NEON (4 lanes) when __ARM_NEON is defined
+ * . Plain C++ (4 lanes) otherwise
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_SIMD_H
+#define VOL_VIS_UTILS_SIMD_H
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX2__)
+  #include <immintrin.h>
+  #define VOLVIS_SIMD_AVX2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+  #include <arm_neon.h>
+  #define VOLVIS_SIMD_NEON
+#else
+  #define VOLVIS_SIMD_SCALAR
+#endif
+
+namespace vis
+{
+  namespace simd
+  {
+#if defined(VOLVIS_SIMD_AVX2)
+    static const int WIDTH = 8;
+    inline const char* GetBackendName () { return "AVX2"; }
+
+    struct vfloat { __m256 v; };
+    struct vmask  { __m256 v; };
+
+    inline vfloat Set1 (float a) { return { _mm256_set1_ps(a) }; }
+    inline vfloat Load (const float* p) { return { _mm256_loadu_ps(p) }; }
+    inline void Store (float* p, vfloat a) { _mm256_storeu_ps(p, a.v); }
+    // Store the lanes truncated to integer
+    inline void StoreInt (int* p, vfloat a) { _mm256_storeu_si256((__m256i*)p, _mm256_cvttps_epi32(a.v)); }
+
+    inline vfloat operator+ (vfloat a, vfloat b) { return { _mm256_add_ps(a.v, b.v) }; }
+    inline vfloat operator- (vfloat a, vfloat b) { return { _mm256_sub_ps(a.v, b.v) }; }
+    inline vfloat operator* (vfloat a, vfloat b) { return { _mm256_mul_ps(a.v, b.v) }; }
+    inline vfloat operator/ (vfloat a, vfloat b) { return { _mm256_div_ps(a.v, b.v) }; }
+
+    inline vfloat Min (vfloat a, vfloat b) { return { _mm256_min_ps(a.v, b.v) }; }
+    inline vfloat Max (vfloat a, vfloat b) { return { _mm256_max_ps(a.v, b.v) }; }
+    inline vfloat Floor (vfloat a) { return { _mm256_floor_ps(a.v) }; }
+    inline vfloat Sqrt (vfloat a) { return { _mm256_sqrt_ps(a.v) }; }
+
+    inline vmask operator< (vfloat a, vfloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+    inline vmask operator> (vfloat a, vfloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+    inline vmask operator<= (vfloat a, vfloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+    inline vmask operator>= (vfloat a, vfloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+
+    inline vmask operator& (vmask a, vmask b) { return { _mm256_and_ps(a.v, b.v) }; }
+    inline vmask operator| (vmask a, vmask b) { return { _mm256_or_ps(a.v, b.v) }; }
+    // a & ~b
+    inline vmask AndNot (vmask a, vmask b) { return { _mm256_andnot_ps(b.v, a.v) }; }
+    inline vmask MaskFromBits (int bits)
+    {
+      const __m256i lane_bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+      __m256i b = _mm256_and_si256(_mm256_set1_epi32(bits), lane_bit);
+      return { _mm256_castsi256_ps(_mm256_cmpeq_epi32(b, lane_bit)) };
+    }
+
+    inline int MoveMask (vmask a) { return _mm256_movemask_ps(a.v); }
+    inline vfloat Select (vmask m, vfloat a, vfloat b) { return { _mm256_blendv_ps(b.v, a.v, m.v) }; }
+
+    // Cephes based exp approximation (relative error ~1e-7)
+    inline vfloat Exp (vfloat x)
+    {
+      __m256 a = _mm256_min_ps(_mm256_max_ps(x.v, _mm256_set1_ps(-87.3f)), _mm256_set1_ps(88.3f));
+      __m256 fx = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(a, _mm256_set1_ps(1.44269504088896341f)), _mm256_set1_ps(0.5f)));
+      a = _mm256_sub_ps(a, _mm256_mul_ps(fx, _mm256_set1_ps(0.693359375f)));
+      a = _mm256_sub_ps(a, _mm256_mul_ps(fx, _mm256_set1_ps(-2.12194440e-4f)));
+
+      __m256 y = _mm256_set1_ps(1.9875691500e-4f);
+      y = _mm256_add_ps(_mm256_mul_ps(y, a), _mm256_set1_ps(1.3981999507e-3f));
+      y = _mm256_add_ps(_mm256_mul_ps(y, a), _mm256_set1_ps(8.3334519073e-3f));
+      y = _mm256_add_ps(_mm256_mul_ps(y, a), _mm256_set1_ps(4.1665795894e-2f));
+      y = _mm256_add_ps(_mm256_mul_ps(y, a), _mm256_set1_ps(1.6666665459e-1f));
+      y = _mm256_add_ps(_mm256_mul_ps(y, a), _mm256_set1_ps(5.0000001201e-1f));
+      y = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(y, a), a), _mm256_add_ps(a, _mm256_set1_ps(1.0f)));
+
+      __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+      return { _mm256_mul_ps(y, _mm256_castsi256_ps(e)) };
+    }
+
+    // Gather base[idx[i]] for each lane
+    inline vfloat Gather (const float* base, const int* idx)
+    {
+      return { _mm256_i32gather_ps(base, _mm256_loadu_si256((const __m256i*)idx), 4) };
+    }
+
+#elif defined(VOLVIS_SIMD_NEON)
+    static const int WIDTH = 4;
+    inline const char* GetBackendName () { return "NEON"; }
+
+    struct vfloat { float32x4_t v; };
+    struct vmask  { uint32x4_t v; };
+
+    inline vfloat Set1 (float a) { return { vdupq_n_f32(a) }; }
+    inline vfloat Load (const float* p) { return { vld1q_f32(p) }; }
+    inline void Store (float* p, vfloat a) { vst1q_f32(p, a.v); }
+    inline void StoreInt (int* p, vfloat a) { vst1q_s32(p, vcvtq_s32_f32(a.v)); }
+
+    inline vfloat operator+ (vfloat a, vfloat b) { return { vaddq_f32(a.v, b.v) }; }
+    inline vfloat operator- (vfloat a, vfloat b) { return { vsubq_f32(a.v, b.v) }; }
+    inline vfloat operator* (vfloat a, vfloat b) { return { vmulq_f32(a.v, b.v) }; }
+    inline vfloat operator/ (vfloat a, vfloat b) { return { vdivq_f32(a.v, b.v) }; }
+
+    inline vfloat Min (vfloat a, vfloat b) { return { vminq_f32(a.v, b.v) }; }
+    inline vfloat Max (vfloat a, vfloat b) { return { vmaxq_f32(a.v, b.v) }; }
+    inline vfloat Floor (vfloat a) { return { vrndmq_f32(a.v) }; }
+    inline vfloat Sqrt (vfloat a) { return { vsqrtq_f32(a.v) }; }
+
+    inline vmask operator< (vfloat a, vfloat b) { return { vcltq_f32(a.v, b.v) }; }
+    inline vmask operator> (vfloat a, vfloat b) { return { vcgtq_f32(a.v, b.v) }; }
+    inline vmask operator<= (vfloat a, vfloat b) { return { vcleq_f32(a.v, b.v) }; }
+    inline vmask operator>= (vfloat a, vfloat b) { return { vcgeq_f32(a.v, b.v) }; }
+
+    inline vmask operator& (vmask a, vmask b) { return { vandq_u32(a.v, b.v) }; }
+    inline vmask operator| (vmask a, vmask b) { return { vorrq_u32(a.v, b.v) }; }
+    inline vmask AndNot (vmask a, vmask b) { return { vbicq_u32(a.v, b.v) }; }
+    inline vmask MaskFromBits (int bits)
+    {
+      const uint32_t lane_bit_values[4] = { 1, 2, 4, 8 };
+      uint32x4_t lane_bit = vld1q_u32(lane_bit_values);
+      return { vceqq_u32(vandq_u32(vdupq_n_u32((uint32_t)bits), lane_bit), lane_bit) };
+    }
+
+    inline int MoveMask (vmask a)
+    {
+      const int32_t shift_values[4] = { 0, 1, 2, 3 };
+      uint32x4_t bits = vshlq_u32(vshrq_n_u32(a.v, 31), vld1q_s32(shift_values));
+      return (int)vaddvq_u32(bits);
+    }
+    inline vfloat Select (vmask m, vfloat a, vfloat b) { return { vbslq_f32(m.v, a.v, b.v) }; }
+
+    inline vfloat Exp (vfloat x)
+    {
+      float32x4_t a = vminq_f32(vmaxq_f32(x.v, vdupq_n_f32(-87.3f)), vdupq_n_f32(88.3f));
+      float32x4_t fx = vrndmq_f32(vaddq_f32(vmulq_f32(a, vdupq_n_f32(1.44269504088896341f)), vdupq_n_f32(0.5f)));
+      a = vsubq_f32(a, vmulq_f32(fx, vdupq_n_f32(0.693359375f)));
+      a = vsubq_f32(a, vmulq_f32(fx, vdupq_n_f32(-2.12194440e-4f)));
+
+      float32x4_t y = vdupq_n_f32(1.9875691500e-4f);
+      y = vaddq_f32(vmulq_f32(y, a), vdupq_n_f32(1.3981999507e-3f));
+      y = vaddq_f32(vmulq_f32(y, a), vdupq_n_f32(8.3334519073e-3f));
+      y = vaddq_f32(vmulq_f32(y, a), vdupq_n_f32(4.1665795894e-2f));
+      y = vaddq_f32(vmulq_f32(y, a), vdupq_n_f32(1.6666665459e-1f));
+      y = vaddq_f32(vmulq_f32(y, a), vdupq_n_f32(5.0000001201e-1f));
+      y = vaddq_f32(vmulq_f32(vmulq_f32(y, a), a), vaddq_f32(a, vdupq_n_f32(1.0f)));
+
+      int32x4_t e = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(fx), vdupq_n_s32(127)), 23);
+      return { vmulq_f32(y, vreinterpretq_f32_s32(e)) };
+    }
+
+    inline vfloat Gather (const float* base, const int* idx)
+    {
+      float r[4] = { base[idx[0]], base[idx[1]], base[idx[2]], base[idx[3]] };
+      return { vld1q_f32(r) };
+    }
+
+#else
+    static const int WIDTH = 4;
+    inline const char* GetBackendName () { return "Scalar"; }
+
+    struct vfloat { float v[WIDTH]; };
+    struct vmask  { bool v[WIDTH]; };
+
+#define VOLVIS_SIMD_LANES(expr) for (int l = 0; l < WIDTH; l++) { expr; }
+
+    inline vfloat Set1 (float a) { vfloat r; VOLVIS_SIMD_LANES(r.v[l] = a) return r; }
+    inline vfloat Load (const float* p) { vfloat r; VOLVIS_SIMD_LANES(r.v[l] = p[l]) return r; }
+    inline void Store (float* p, vfloat a) { VOLVIS_SIMD_LANES(p[l] = a.v[l]) }
+    inline void StoreInt (int* p, vfloat a) { VOLVIS_SIMD_LANES(p[l] = (int)a.v[l]) }
+
+    inline vfloat operator+ (vfloat a, vfloat b) { vfloat r; VOLVIS_SIMD_LANES(r.v[l] = a.v[l] + b.v[l]) return r; }
+    inline vfloat operator- (vfloat a, vfloat b) { vfloat r; VOLVIS_SIMD_LANES(r.v[l] = a.v[l] - b.v[l]) return r; }
+    inline vfloat operator* (vfloat a, vfloat b) { vfloat r; VOLVIS_SIMD_LANES(r.v[l] = a.v[l] * b.v[l]) return r; }
+    inline vfloat operator/ (vfloat a, vfloat b) { vfloat r; VOLVIS_SIMD_LANES(r.v[l] = a.v[l] / b.v[l]) return r; }
+
+    inline vfloat Min (vfloat a, vfloat b) { vfloat r; VOLVIS_SIMD_LANES(r.v[l] = a.v[l] < b.v[l] ? a.v[l] : b.v[l]) return r; }
+    inline vfloat Max (vfloat a, vfloat b) { vfloat r; VOLVIS_SIMD_LANES(r.v[l] = a.v[l] > b.v[l] ? a.v[l] : b.v[l]) return r; }
+    inline vfloat Floor (vfloat a) { vfloat r; VOLVIS_SIMD_LANES(r.v[l] = std::floor(a.v[l])) return r; }
+    inline vfloat Sqrt (vfloat a) { vfloat r; VOLVIS_SIMD_LANES(r.v[l] = std::sqrt(a.v[l])) return r; }
+
+    inline vmask operator< (vfloat a, vfloat b) { vmask r; VOLVIS_SIMD_LANES(r.v[l] = a.v[l] < b.v[l]) return r; }
+    inline vmask operator> (vfloat a, vfloat b) { vmask r; VOLVIS_SIMD_LANES(r.v[l] = a.v[l] > b.v[l]) return r; }
+    inline vmask operator<= (vfloat a, vfloat b) { vmask r; VOLVIS_SIMD_LANES(r.v[l] = a.v[l] <= b.v[l]) return r; }
+    inline vmask operator>= (vfloat a, vfloat b) { vmask r; VOLVIS_SIMD_LANES(r.v[l] = a.v[l] >= b.v[l]) return r; }
+
+    inline vmask operator& (vmask a, vmask b) { vmask r; VOLVIS_SIMD_LANES(r.v[l] = a.v[l] && b.v[l]) return r; }
+    inline vmask operator| (vmask a, vmask b) { vmask r; VOLVIS_SIMD_LANES(r.v[l] = a.v[l] || b.v[l]) return r; }
+    inline vmask AndNot (vmask a, vmask b) { vmask r; VOLVIS_SIMD_LANES(r.v[l] = a.v[l] && !b.v[l]) return r; }
+    inline vmask MaskFromBits (int bits) { vmask r; VOLVIS_SIMD_LANES(r.v[l] = ((bits >> l) & 1) != 0) return r; }
+
+    inline int MoveMask (vmask a) { int r = 0; VOLVIS_SIMD_LANES(r |= (a.v[l] ? 1 : 0) << l) return r; }
+    inline vfloat Select (vmask m, vfloat a, vfloat b) { vfloat r; VOLVIS_SIMD_LANES(r.v[l] = m.v[l] ? a.v[l] : b.v[l]) return r; }
+
+    inline vfloat Exp (vfloat x) { vfloat r; VOLVIS_SIMD_LANES(r.v[l] = std::exp(x.v[l])) return r; }
+
+    inline vfloat Gather (const float* base, const int* idx) { vfloat r; VOLVIS_SIMD_LANES(r.v[l] = base[idx[l]]) return r; }
+
+#undef VOLVIS_SIMD_LANES
+#endif
+
+    static const int ALL_LANES = (1 << WIDTH) - 1;
+
+    inline bool Any (vmask a) { return MoveMask(a) != 0; }
+    inline bool None (vmask a) { return MoveMask(a) == 0; }
+  }
+}
+
+#endif
@@ -1,12 +1,64 @@
 #include "structuredgridvolume.h"
+#include "contenthash.h"
 
 #include <iostream>
 #include <string>
 #include <cstdlib>
 #include <fstream>
+#include <memory>
+#include <mutex>
 
 namespace vis
 {
+  template <typename T>
+  static double NormalizedSampleFunc (const void* data, size_t id)
+  {
+    return (double)static_cast<const T*>(data)[id] * VoxelTypeTraits<T>::NORMALIZATION;
+  }
+
+  static double NullSampleFunc (const void* data, size_t id)
+  {
+    return 0.0;
+  }
+
+  static double (*GetNormalizedSampleFunc (DataStorageSize dss)) (const void*, size_t)
+  {
+    if (dss == DataStorageSize::_8_BITS)
+      return &NormalizedSampleFunc<unsigned char>;
+    else if (dss == DataStorageSize::_16_BITS)
+      return &NormalizedSampleFunc<unsigned short>;
+    else if (dss == DataStorageSize::_NORMALIZED_F)
+      return &NormalizedSampleFunc<float>;
+    else if (dss == DataStorageSize::_NORMALIZED_D)
+      return &NormalizedSampleFunc<double>;
+    return &NullSampleFunc;
+  }
+
+  struct StructuredGridVolume::PagedSampleCache
+  {
+    virtual ~PagedSampleCache () {}
+    virtual double GetNormalized (int x, int y, int z) = 0;
+
+    // the sampler pins bricks and is not thread safe
+    std::mutex mutex;
+  };
+
+  template <typename T>
+  struct StructuredGridVolume::TypedPagedSampleCache : public StructuredGridVolume::PagedSampleCache
+  {
+    TypedPagedSampleCache (BrickPager* pager)
+      : sampler(PagedVoxelView<T>(pager))
+    {}
+
+    double GetNormalized (int x, int y, int z)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return (double)sampler.Get(x, y, z) * VoxelTypeTraits<T>::NORMALIZATION;
+    }
+
+    PagedVoxelSampler<T> sampler;
+  };
+
   /////////////////////
   // Public Methods  //
   /////////////////////
@@ -21,6 +73,14 @@ namespace vis
     , m_grid_center(glm::dvec3(0.0))
     , m_data_storage_size(DataStorageSize::UNKNOWN)
     , m_voxel_values(nullptr)
+    , m_mapped_file(nullptr)
+    , m_normalized_sample_func(&NullSampleFunc)
+    , m_content_hash(0)
+    , m_content_hash_valid(false)
+    , m_normalized_range_valid(false)
+    , m_bricks(nullptr)
+    , m_brick_pager(nullptr)
+    , m_paged_sample_cache(nullptr)
   {}
   
   StructuredGridVolume::~StructuredGridVolume ()
@@ -109,8 +169,36 @@ namespace vis
 
   void StructuredGridVolume::SetArrayData (void* input_vol_data, DataStorageSize dss)
   {
+    if (input_vol_data != m_voxel_values)
+      DestroyData();
     m_data_storage_size = dss;
     m_voxel_values = input_vol_data;
+    m_normalized_sample_func = GetNormalizedSampleFunc(m_voxel_values ? dss : DataStorageSize::UNKNOWN);
+    m_content_hash_valid = false;
+    m_normalized_range_valid = false;
+    DestroyBricks();
+  }
+
+  bool StructuredGridVolume::SetMappedArrayData (MappedFile* mapped_file, size_t data_offset, DataStorageSize dss)
+  {
+    size_t type_size = GetStorageSizeBytes(dss);
+
+    size_t n_bytes = (size_t)m_width * (size_t)m_height * (size_t)m_depth * type_size;
+    if (mapped_file == nullptr || !mapped_file->IsOpen() || type_size == 0 ||
+        data_offset % type_size != 0 || data_offset + n_bytes > mapped_file->GetSize())
+    {
+      printf("StructuredGridVolume: mapped file does not hold the volume data\n");
+      return false;
+    }
+
+    DestroyData();
+    m_mapped_file = mapped_file;
+    m_data_storage_size = dss;
+    m_voxel_values = (void*)((const char*)mapped_file->GetData() + data_offset);
+    m_normalized_sample_func = GetNormalizedSampleFunc(dss);
+    m_content_hash_valid = false;
+    m_normalized_range_valid = false;
+    return true;
   }
 
   void* StructuredGridVolume::GetArrayData ()
@@ -118,31 +206,74 @@ namespace vis
     return m_voxel_values;
   }
 
-  double StructuredGridVolume::GetNormalizedSample (unsigned int x, unsigned int y, unsigned int z)
+  DataStorageSize StructuredGridVolume::GetDataStorageSize ()
   {
-    if(m_voxel_values == nullptr || m_data_storage_size == DataStorageSize::UNKNOWN) return 0.0;
-    
-    if(m_data_storage_size == DataStorageSize::_8_BITS)
-    {
-      unsigned char* array_vls = static_cast<unsigned char*>(m_voxel_values);
-      return (double)array_vls[x + (y * GetWidth()) + (z * GetWidth() * GetHeight())] / (256.0 - 1.0);
-    }
-    else if(m_data_storage_size == DataStorageSize::_16_BITS)
-    {
-      unsigned short* array_vls = static_cast<unsigned short*>(m_voxel_values);
-      return (double)array_vls[x + (y * GetWidth()) + (z * GetWidth() * GetHeight())] / (65536.0 - 1.0);
-    }
-    else if (m_data_storage_size == DataStorageSize::_NORMALIZED_F)
-    {
-      float* array_vls = static_cast<float*>(m_voxel_values);
-      return (double)array_vls[x + (y * GetWidth()) + (z * GetWidth() * GetHeight())] / (1.0);
-    }
-    else if (m_data_storage_size == DataStorageSize::_NORMALIZED_D)
+    return m_data_storage_size;
+  }
+
+  bool StructuredGridVolume::IsArrayDataOwned ()
+  {
+    return m_mapped_file == nullptr;
+  }
+
+  bool StructuredGridVolume::SetBrickPager (BrickPager* pager)
+  {
+    if (pager == nullptr || !pager->IsOpen())
     {
-      double* array_vls = static_cast<double*>(m_voxel_values);
-      return (double)array_vls[x + (y * GetWidth()) + (z * GetWidth() * GetHeight())] / (1.0);
+      printf("StructuredGridVolume: the brick pager is not opened\n");
+      return false;
     }
-    return 0.0;
+
+    DestroyData();
+    glm::ivec3 resolution = pager->GetVolumeResolution();
+    m_width = resolution.x;
+    m_height = resolution.y;
+    m_depth = resolution.z;
+    m_brick_pager = pager;
+    m_data_storage_size = pager->GetDataStorageSize();
+    m_content_hash_valid = false;
+    m_normalized_range_valid = false;
+
+    DispatchVoxelAccess([&](auto view) {
+      m_paged_sample_cache = new TypedPagedSampleCache<typename decltype(view)::value_type>(m_brick_pager);
+    });
+    return true;
+  }
+
+  BrickPager* StructuredGridVolume::GetBrickPager ()
+  {
+    return m_brick_pager;
+  }
+
+  bool StructuredGridVolume::IsPaged ()
+  {
+    return m_brick_pager != nullptr;
+  }
+
+  bool StructuredGridVolume::CompressData (int max_error, size_t cache_memory_budget, int brick_size, ThreadPool* thread_pool)
+  {
+    // Released once the pager, and then this volume, take the ownership
+    std::unique_ptr<CompressedBricks> bricks(new CompressedBricks());
+    if (!bricks->Build(this, max_error, brick_size, thread_pool))
+      return false;
+
+    std::unique_ptr<BrickPager> pager(new BrickPager());
+    if (!pager->Open(bricks.get(), cache_memory_budget))
+      return false;
+    bricks.release();
+
+    if (!SetBrickPager(pager.get()))
+      return false;
+    pager.release();
+    return true;
+  }
+
+  double StructuredGridVolume::GetNormalizedSample (unsigned int x, unsigned int y, unsigned int z)
+  {
+    if (IsOutOfBoundary(x, y, z)) return 0.0;
+    if (m_paged_sample_cache)
+      return m_paged_sample_cache->GetNormalized((int)x, (int)y, (int)z);
+    return m_normalized_sample_func(m_voxel_values, (size_t)x + (size_t)y * m_width + (size_t)z * m_width * m_height);
   }
 
   double StructuredGridVolume::GetNormalizedInterpolatedSample (double i_x, double i_y, double i_z)
@@ -179,19 +310,30 @@ namespace vis
     double xd = (x - (double)x0) / ((double)x1 - (double)x0);
     double yd = (y - (double)y0) / ((double)y1 - (double)y0);
     double zd = (z - (double)z0) / ((double)z1 - (double)z0);
+
+    double c = 0.0;
+    DispatchVoxelAccess([&](auto view) {
+      typename decltype(view)::Sampler sampler(view);
+      auto sample = [this, &view, &sampler] (int sx, int sy, int sz) -> double {
+        if (!view.IsInside(sx, sy, sz)) return 0.0;
+        // the sampler of a paged view would acquire its bricks again
+        if (m_paged_sample_cache) return m_paged_sample_cache->GetNormalized(sx, sy, sz);
+        return (double)sampler.Get(sx, sy, sz) * decltype(view)::traits::NORMALIZATION;
+      };
+
+      // X interpolation
+      double c00 = sample(x0, y0, z0) * (1.0 - xd) + sample(x1, y0, z0) * xd;
+      double c10 = sample(x0, y1, z0) * (1.0 - xd) + sample(x1, y1, z0) * xd;
+      double c01 = sample(x0, y0, z1) * (1.0 - xd) + sample(x1, y0, z1) * xd;
+      double c11 = sample(x0, y1, z1) * (1.0 - xd) + sample(x1, y1, z1) * xd;
     
-    // X interpolation
-    double c00 = GetNormalizedSample(x0, y0, z0) * (1.0 - xd) + GetNormalizedSample(x1, y0, z0) * xd;
-    double c10 = GetNormalizedSample(x0, y1, z0) * (1.0 - xd) + GetNormalizedSample(x1, y1, z0) * xd;
-    double c01 = GetNormalizedSample(x0, y0, z1) * (1.0 - xd) + GetNormalizedSample(x1, y0, z1) * xd;
-    double c11 = GetNormalizedSample(x0, y1, z1) * (1.0 - xd) + GetNormalizedSample(x1, y1, z1) * xd;
-    
-    // Y interpolation
-    double c0 = c00 * (1.0 - yd) + c10 * yd;
-    double c1 = c01 * (1.0 - yd) + c11 * yd;
+      // Y interpolation
+      double c0 = c00 * (1.0 - yd) + c10 * yd;
+      double c1 = c01 * (1.0 - yd) + c11 * yd;
     
-    // Z interpolation
-    double c = c0 * (1.0 - zd) + c1 * zd;
+      // Z interpolation
+      c = c0 * (1.0 - zd) + c1 * zd;
+    });
     
     return c;
   }
@@ -199,30 +341,84 @@ namespace vis
   unsigned long long StructuredGridVolume::CheckSum ()
   {
     unsigned long long csum = 0;
-    for (int i = 0; i < m_width * m_height * m_depth; i++)
+    DispatchVoxelView([&](auto view) {
+      for (size_t i = 0; i < view.size; i++)
+        csum += (unsigned long long)view.data[i];
+    });
+    return csum;
+  }
+
+  unsigned long long StructuredGridVolume::GetContentHash ()
+  {
+    if (m_content_hash_valid)
+      return m_content_hash;
+
+    size_t n_bytes = (size_t)m_width * (size_t)m_height * (size_t)m_depth * GetStorageSizeBytes(m_data_storage_size);
+    uint64_t key[5] = {
+      m_width, m_height, m_depth, (uint64_t)m_data_storage_size,
+      m_voxel_values ? ComputeContentHash(m_voxel_values, n_bytes) : 0
+    };
+
+    // Paged volumes stream the voxels of their bricks through the hash
+    if (m_brick_pager)
+      key[4] = m_brick_pager->ComputeVoxelHash();
+
+    m_content_hash = HashBytes(key, sizeof(key));
+    m_content_hash_valid = true;
+    return m_content_hash;
+  }
+
+  void StructuredGridVolume::GetNormalizedRange (double* min, double* max)
+  {
+    if (!m_normalized_range_valid)
     {
-      if (m_data_storage_size == DataStorageSize::_8_BITS)
+      m_normalized_range[0] = 0.0;
+      m_normalized_range[1] = 0.0;
+
+      const float* brick_min_max = nullptr;
+      int n_bricks = 0;
+      if (m_brick_pager)
       {
-        unsigned char* array_vls = static_cast<unsigned char*>(m_voxel_values);
-        csum += (unsigned long long)array_vls[i];
+        brick_min_max = m_brick_pager->GetMinMaxData();
+        n_bricks = m_brick_pager->GetNumberOfBricks();
       }
-      else if (m_data_storage_size == DataStorageSize::_16_BITS)
+      else if (m_bricks)
       {
-        unsigned short* array_vls = static_cast<unsigned short*>(m_voxel_values);
-        csum += (unsigned long long)array_vls[i];
+        brick_min_max = m_bricks->GetMinMaxData();
+        n_bricks = m_bricks->GetNumberOfBricks();
       }
-      else if (m_data_storage_size == DataStorageSize::_NORMALIZED_F)
+
+      if (n_bricks > 0)
       {
-        float* array_vls = static_cast<float*>(m_voxel_values);
-        csum += (unsigned long long)array_vls[i];
+        float vmin = brick_min_max[0], vmax = brick_min_max[1];
+        for (int i = 1; i < n_bricks; i++)
+        {
+          vmin = std::min(vmin, brick_min_max[i * 2 + 0]);
+          vmax = std::max(vmax, brick_min_max[i * 2 + 1]);
+        }
+        m_normalized_range[0] = vmin;
+        m_normalized_range[1] = vmax;
       }
-      else if (m_data_storage_size == DataStorageSize::_NORMALIZED_D)
+      else
       {
-        double* array_vls = static_cast<double*>(m_voxel_values);
-        csum += (unsigned long long)array_vls[i];
+        DispatchVoxelView([&](auto view) {
+          if (view.size == 0)
+            return;
+          auto vmin = view.data[0], vmax = view.data[0];
+          for (size_t i = 1; i < view.size; i++)
+          {
+            vmin = std::min(vmin, view.data[i]);
+            vmax = std::max(vmax, view.data[i]);
+          }
+          m_normalized_range[0] = (double)vmin * decltype(view)::traits::NORMALIZATION;
+          m_normalized_range[1] = (double)vmax * decltype(view)::traits::NORMALIZATION;
+        });
       }
+      m_normalized_range_valid = true;
     }
-    return csum;
+
+    *min = m_normalized_range[0];
+    *max = m_normalized_range[1];
   }
 
   double StructuredGridVolume::GetMaxDensity ()
@@ -245,12 +441,67 @@ namespace vis
     }
     return 0.0;
   }
+
+  int StructuredGridVolume::GetNativeBrickSize ()
+  {
+    return IsPaged() ? m_brick_pager->GetBrickSize() : VolumeBricks::DEFAULT_BRICK_SIZE;
+  }
+
+  bool StructuredGridVolume::BuildBricks (int brick_size, bool store_bricked_voxels, ThreadPool* thread_pool)
+  {
+    DestroyBricks();
+    m_bricks = new VolumeBricks();
+    if (!m_bricks->Build(this, brick_size, store_bricked_voxels, thread_pool))
+    {
+      DestroyBricks();
+      return false;
+    }
+    return true;
+  }
+
+  VolumeBricks* StructuredGridVolume::GetBricks ()
+  {
+    return m_bricks;
+  }
+
+  void StructuredGridVolume::DestroyBricks ()
+  {
+    if (m_bricks) delete m_bricks;
+    m_bricks = nullptr;
+  }
   
   /////////////////////
   // Private Methods //
   /////////////////////
   void StructuredGridVolume::DestroyData ()
   {
+    m_normalized_sample_func = &NullSampleFunc;
+    m_content_hash_valid = false;
+    m_normalized_range_valid = false;
+    DestroyBricks();
+
+    // The cached sampler releases its bricks before the pager closes
+    if (m_paged_sample_cache)
+    {
+      delete m_paged_sample_cache;
+      m_paged_sample_cache = nullptr;
+    }
+    if (m_brick_pager)
+    {
+      delete m_brick_pager;
+      m_brick_pager = nullptr;
+      return;
+    }
+
+    // Mapped pages are released by unmapping the file
+    if (m_mapped_file)
+    {
+      delete m_mapped_file;
+      m_mapped_file = nullptr;
+      m_voxel_values = nullptr;
+      return;
+    }
+
     if (m_data_storage_size == DataStorageSize::_8_BITS)
     {
       unsigned char* array_vls = static_cast<unsigned char*>(m_voxel_values);
@@ -8,6 +8,11 @@
 #define VOL_VIS_UTILS_STRUCTURED_GRID_VOLUME_H
 
 #include <volvis_utils/gridvolume.h>
+#include <volvis_utils/voxelstorage.h>
+#include <volvis_utils/volumebricks.h>
+#include <volvis_utils/brickpager.h>
+#include <volvis_utils/compressedbricks.h>
+#include <file_utils/mappedfile.h>
 #include <iostream>
 #include <string>
 
@@ -15,28 +20,6 @@
 
 namespace vis
 {
-  enum DataStorageSize : unsigned int
-  {
-    UNKNOWN       = 0, // null data
-    _8_BITS       = 1, // unsigned char  [0 -   255]
-    _16_BITS      = 2, // unsigned short [0 - 65535]
-    _NORMALIZED_F = 3, // float [0.0f - 1.0f]
-    _NORMALIZED_D = 4, // double [0.0 - 1.0]
-  };
-
-  static DataStorageSize GetStorageSizeType (size_t bytesize)
-  {
-    if (bytesize == sizeof(unsigned char))
-      return DataStorageSize::_8_BITS;
-    else if (bytesize == sizeof(unsigned short))
-      return DataStorageSize::_16_BITS;
-    else if (bytesize == sizeof(float))
-      return DataStorageSize::_NORMALIZED_F;
-    else if (bytesize == sizeof(double))
-      return DataStorageSize::_NORMALIZED_D;
-    return DataStorageSize::UNKNOWN;
-  }
-  
   class StructuredGridVolume : public GridVolume
   {
   public:
@@ -63,16 +46,124 @@ namespace vis
 
     bool IsOutOfBoundary (unsigned int x, unsigned int y, unsigned int z);
   
+    // The volume takes the ownership of input_vol_data (allocated with new[])
     void SetArrayData (void* input_vol_data, DataStorageSize dss);
+    // The voxels are read directly from the mapped pages, starting at data_offset.
+    //  . the volume takes the ownership of mapped_file, which is closed by DestroyData
+    //  . the array data is read-only and must not be deleted
+    bool SetMappedArrayData (MappedFile* mapped_file, size_t data_offset, DataStorageSize dss);
     void* GetArrayData ();
+    DataStorageSize GetDataStorageSize ();
+
+    // False if the voxels are stored in mapped (read-only, non-owned) pages
+    bool IsArrayDataOwned ();
+
+    // The voxels are read on demand by an opened brick pager, which is
+    //  owned by the volume. The array data of paged volumes is null.
+    bool SetBrickPager (BrickPager* pager);
+    BrickPager* GetBrickPager ();
+    bool IsPaged ();
+
+    // Replace the array data by compressed bricks (see vis::CompressedBricks),
+    //  read through a brick pager that caches cache_memory_budget bytes of
+    //  decoded bricks. max_error == 0 is lossless.
+    bool CompressData (int max_error = 0, size_t cache_memory_budget = BrickPager::DEFAULT_MEMORY_BUDGET,
+                       int brick_size = CompressedBricks::DEFAULT_BRICK_SIZE, ThreadPool* thread_pool = nullptr);
+
+    // Typed view of the voxels, invalid if T is not the storage type
+    template <typename T>
+    VoxelView<T> GetVoxelView ()
+    {
+      if (m_voxel_values == nullptr || m_data_storage_size != VoxelTypeTraits<T>::STORAGE)
+        return VoxelView<T>();
+      return VoxelView<T>(static_cast<const T*>(m_voxel_values), (int)m_width, (int)m_height, (int)m_depth);
+    }
+
+    // Call func(VoxelView<T>) with T being the storage type of the volume
+    //  . returns false if the volume has no data
+    template <typename Func>
+    bool DispatchVoxelView (Func&& func)
+    {
+      if (m_voxel_values == nullptr) return false;
+      switch (m_data_storage_size)
+      {
+      case DataStorageSize::_8_BITS:
+        func(GetVoxelView<unsigned char>());
+        return true;
+      case DataStorageSize::_16_BITS:
+        func(GetVoxelView<unsigned short>());
+        return true;
+      case DataStorageSize::_NORMALIZED_F:
+        func(GetVoxelView<float>());
+        return true;
+      case DataStorageSize::_NORMALIZED_D:
+        func(GetVoxelView<double>());
+        return true;
+      default:
+        break;
+      }
+      return false;
+    }
+
+    // Same as DispatchVoxelView, but paged volumes call func(PagedVoxelView<T>)
+    //  . func must create one View::Sampler per thread to read the voxels
+    template <typename Func>
+    bool DispatchVoxelAccess (Func&& func)
+    {
+      if (m_brick_pager == nullptr)
+        return DispatchVoxelView(func);
 
+      switch (m_data_storage_size)
+      {
+      case DataStorageSize::_8_BITS:
+        func(PagedVoxelView<unsigned char>(m_brick_pager));
+        return true;
+      case DataStorageSize::_16_BITS:
+        func(PagedVoxelView<unsigned short>(m_brick_pager));
+        return true;
+      case DataStorageSize::_NORMALIZED_F:
+        func(PagedVoxelView<float>(m_brick_pager));
+        return true;
+      case DataStorageSize::_NORMALIZED_D:
+        func(PagedVoxelView<double>(m_brick_pager));
+        return true;
+      default:
+        break;
+      }
+      return false;
+    }
+
+    // Single voxel access, 0 outside the grid
+    //  . loops over the volume should use DispatchVoxelView instead
+    //  . paged volumes read through one sampler kept with the pager, so
+    //    neighbor lookups stay in its pinned bricks
     double GetNormalizedSample (unsigned int x, unsigned int y, unsigned int z);
     double GetNormalizedInterpolatedSample (double x, double y, double z);
 
     unsigned long long CheckSum ();
 
+    // xxHash64 based hash of the voxel values, dimensions and storage type
+    //  . computed in parallel on the first call after the data is set
+    //  . paged volumes hash the voxels of their bricks (BrickPager::ComputeVoxelHash)
+    unsigned long long GetContentHash ();
+
+    // Normalized [min, max] of the voxel values, taken from the brick ranges
+    //  of bricked and paged volumes. Cached until the data changes
+    void GetNormalizedRange (double* min, double* max);
+
     double GetMaxDensity ();
 
+    // Optional bricked representation with per-brick min/max, released
+    //  when the data changes
+    //  . paged volumes only keep the ranges of their own bricks, so callers
+    //    pass GetNativeBrickSize instead of a fixed size
+    int GetNativeBrickSize ();
+    bool BuildBricks (int brick_size = VolumeBricks::DEFAULT_BRICK_SIZE, bool store_bricked_voxels = false,
+                      ThreadPool* thread_pool = nullptr);
+    // nullptr if BuildBricks was not called for the current data
+    VolumeBricks* GetBricks ();
+    void DestroyBricks ();
+
   protected:
     virtual void DestroyData ();
   
@@ -85,6 +176,27 @@ namespace vis
   
     DataStorageSize m_data_storage_size;
     void* m_voxel_values;
+
+    // not null if m_voxel_values points to mapped pages
+    MappedFile* m_mapped_file;
+
+    // typed fetch of GetNormalizedSample, chosen when the data is set
+    double (*m_normalized_sample_func) (const void* data, size_t id);
+
+    unsigned long long m_content_hash;
+    bool m_content_hash_valid;
+
+    double m_normalized_range[2];
+    bool m_normalized_range_valid;
+
+    VolumeBricks* m_bricks;
+
+    BrickPager* m_brick_pager;
+
+    // PagedVoxelSampler of GetNormalizedSample, created with the pager
+    struct PagedSampleCache;
+    template <typename T> struct TypedPagedSampleCache;
+    PagedSampleCache* m_paged_sample_cache;
   };
 }
 
@@ -0,0 +1,149 @@
+#include "threadpool.h"
+
+namespace vis
+{
+  // true while the current thread is executing a pool task
+  static thread_local bool s_inside_pool_task = false;
+
+  ThreadPool::ThreadPool (unsigned int n_threads)
+    : m_job(nullptr)
+    , m_job_generation(0)
+    , m_active_workers(0)
+    , m_stop(false)
+  {
+    if (n_threads == 0)
+      n_threads = std::thread::hardware_concurrency();
+    if (n_threads == 0)
+      n_threads = 1;
+
+    // one queue per spawned worker + one for the calling thread
+    for (unsigned int i = 0; i < n_threads; i++)
+      m_queues.push_back(std::make_unique<WorkerQueue>());
+
+    for (unsigned int i = 0; i < n_threads - 1; i++)
+      m_workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+  }
+
+  ThreadPool::~ThreadPool ()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_state_mutex);
+      m_stop = true;
+    }
+    m_cv_start.notify_all();
+
+    for (size_t i = 0; i < m_workers.size(); i++)
+      m_workers[i].join();
+  }
+
+  unsigned int ThreadPool::GetNumberOfThreads ()
+  {
+    return (unsigned int)m_queues.size();
+  }
+
+  void ThreadPool::ParallelFor (int n_tasks, const std::function<void(int task_id)>& func)
+  {
+    if (n_tasks <= 0) return;
+
+    if (m_workers.empty() || n_tasks == 1 || s_inside_pool_task)
+    {
+      for (int i = 0; i < n_tasks; i++)
+        func(i);
+      return;
+    }
+
+    std::lock_guard<std::mutex> submit_lock(m_submit_mutex);
+
+    // Split the tasks in contiguous ranges, one per queue
+    unsigned int n_queues = (unsigned int)m_queues.size();
+    for (unsigned int q = 0; q < n_queues; q++)
+    {
+      int t_init = (int)(((long long)n_tasks * q) / n_queues);
+      int t_last = (int)(((long long)n_tasks * (q + 1)) / n_queues);
+
+      std::lock_guard<std::mutex> lock(m_queues[q]->mtx);
+      for (int t = t_init; t < t_last; t++)
+        m_queues[q]->tasks.push_back(t);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_state_mutex);
+      m_job = &func;
+      m_active_workers = (unsigned int)m_workers.size();
+      m_job_generation++;
+    }
+    m_cv_start.notify_all();
+
+    // The calling thread works on the last queue
+    RunTasks(n_queues - 1);
+
+    std::unique_lock<std::mutex> lock(m_state_mutex);
+    m_cv_done.wait(lock, [this] { return m_active_workers == 0; });
+    m_job = nullptr;
+  }
+
+  ThreadPool* ThreadPool::GetDefault ()
+  {
+    static ThreadPool s_default_pool;
+    return &s_default_pool;
+  }
+
+  void ThreadPool::WorkerLoop (unsigned int worker_id)
+  {
+    unsigned long long seen_generation = 0;
+    while (true)
+    {
+      {
+        std::unique_lock<std::mutex> lock(m_state_mutex);
+        m_cv_start.wait(lock, [&] { return m_stop || m_job_generation != seen_generation; });
+        if (m_stop) return;
+        seen_generation = m_job_generation;
+      }
+
+      RunTasks(worker_id);
+
+      {
+        std::lock_guard<std::mutex> lock(m_state_mutex);
+        m_active_workers--;
+        if (m_active_workers == 0)
+          m_cv_done.notify_all();
+      }
+    }
+  }
+
+  void ThreadPool::RunTasks (unsigned int worker_id)
+  {
+    s_inside_pool_task = true;
+    int task_id;
+    while (PopTask(worker_id, &task_id) || StealTask(worker_id, &task_id))
+      (*m_job)(task_id);
+    s_inside_pool_task = false;
+  }
+
+  bool ThreadPool::PopTask (unsigned int worker_id, int* task_id)
+  {
+    WorkerQueue* q = m_queues[worker_id].get();
+    std::lock_guard<std::mutex> lock(q->mtx);
+    if (q->tasks.empty()) return false;
+    *task_id = q->tasks.front();
+    q->tasks.pop_front();
+    return true;
+  }
+
+  bool ThreadPool::StealTask (unsigned int worker_id, int* task_id)
+  {
+    unsigned int n_queues = (unsigned int)m_queues.size();
+    for (unsigned int i = 1; i < n_queues; i++)
+    {
+      WorkerQueue* q = m_queues[(worker_id + i) % n_queues].get();
+      std::lock_guard<std::mutex> lock(q->mtx);
+      if (!q->tasks.empty())
+      {
+        *task_id = q->tasks.back();
+        q->tasks.pop_back();
+        return true;
+      }
+    }
+    return false;
+  }
+}
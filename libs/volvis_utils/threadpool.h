@@ -0,0 +1,77 @@
+/**
+ * Work-stealing thread pool used by the CPU kernels.
+ *
+ * Each worker owns a task queue. ParallelFor splits the task indices
+ * into one contiguous range per queue, workers consume their own queue
+ * from the front and steal from the back of the other queues when
+ * they run out of work. The calling thread also takes part as the
+ * last worker, so a pool of N threads spawns N - 1 std::threads.
+ *
+ * Nested calls to ParallelFor issued from inside a task are executed
+ * serially by the calling worker.
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_THREAD_POOL_H
+#define VOL_VIS_UTILS_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vis
+{
+  class ThreadPool
+  {
+  public:
+    // n_threads = 0 uses std::thread::hardware_concurrency
+    ThreadPool (unsigned int n_threads = 0);
+    ~ThreadPool ();
+
+    unsigned int GetNumberOfThreads ();
+
+    // Execute func(task_id) for every task_id in [0, n_tasks) and
+    //   return after all tasks are finished.
+    void ParallelFor (int n_tasks, const std::function<void(int task_id)>& func);
+
+    // Shared pool used by the library when no pool is given
+    static ThreadPool* GetDefault ();
+
+  protected:
+
+  private:
+    struct WorkerQueue
+    {
+      std::mutex mtx;
+      std::deque<int> tasks;
+    };
+
+    void WorkerLoop (unsigned int worker_id);
+    void RunTasks (unsigned int worker_id);
+
+    bool PopTask (unsigned int worker_id, int* task_id);
+    bool StealTask (unsigned int worker_id, int* task_id);
+
+    std::vector<std::thread> m_workers;
+    std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+
+    std::mutex m_submit_mutex;
+
+    std::mutex m_state_mutex;
+    std::condition_variable m_cv_start;
+    std::condition_variable m_cv_done;
+
+    const std::function<void(int)>* m_job;
+    unsigned long long m_job_generation;
+    unsigned int m_active_workers;
+    bool m_stop;
+  };
+}
+
+#endif
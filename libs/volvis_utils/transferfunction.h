@@ -5,7 +5,12 @@
 #ifndef VOL_VIS_UTILS_TRANSFER_FUNCTION_H
 #define VOL_VIS_UTILS_TRANSFER_FUNCTION_H
 
+// VOLVIS_UTILS_NO_GL builds the library without the texture generation,
+//  for tools that never create an OpenGL context
+#ifndef VOLVIS_UTILS_NO_GL
 #include <gl_utils/texture1d.h>
+#include <gl_utils/texture2d.h>
+#endif
 
 #include <glm/glm.hpp>
 
@@ -48,7 +53,7 @@ namespace vis
   {
   public:
     TransferFunction () {}
-    ~TransferFunction () {}
+    virtual ~TransferFunction () {}
 
     virtual const char* GetNameClass () = 0;
 
@@ -59,8 +64,11 @@ namespace vis
     virtual float GetExt (double value, double max_input_value = -1.0) { return -1.0; }
     virtual float GetExtN (double normalized_value) { return -1.0; }
 
+#ifndef VOLVIS_UTILS_NO_GL
     virtual gl::Texture1D* GenerateTexture_1D_RGBA () { return NULL; }
     virtual gl::Texture1D* GenerateTexture_1D_RGBt () { return NULL; }
+    virtual gl::Texture2D* GenerateTexture_2D_PreIntegratedRGBt (int size = 256) { return NULL; }
+#endif
     
     std::string GetName () { return m_name; }
     void SetName (std::string name) { m_name = name; }
@@ -1,10 +1,16 @@
 #include "transferfunction1d.h"
+#ifndef VOLVIS_UTILS_NO_GL
 #include <gl_utils/texture1d.h>
 #include <GL/glew.h>
+#endif
 
+#include <algorithm>
 #include <fstream>
 #include <cstdlib>
 
+// Largest value of the GL_RGBA16F lookup textures
+#define TRANSFER_FUNCTION_1D_MAX_EXTINCTION 65504.0
+
 namespace vis
 {
   TransferFunction1D::TransferFunction1D (int max_value)
@@ -15,10 +21,32 @@ namespace vis
     m_cpt_rgb.clear ();
     m_cpt_alpha.clear ();
     m_transferfunction = NULL;
+    m_gradients = NULL;
 
     extinction_coef_type = false;
   }
 
+  TransferFunction1D::TransferFunction1D (const TransferFunction1D& tf)
+    : TransferFunction (tf)
+    , m_built (tf.m_built)
+    , m_cpt_rgb (tf.m_cpt_rgb)
+    , m_cpt_alpha (tf.m_cpt_alpha)
+    , m_transferfunction (NULL)
+    , m_gradients (NULL)
+    , max_density (tf.max_density)
+    , extinction_coef_type (tf.extinction_coef_type)
+  {
+    if (tf.m_transferfunction)
+    {
+      m_transferfunction = new glm::dvec4[max_density + 1];
+      std::copy(tf.m_transferfunction, tf.m_transferfunction + max_density + 1, m_transferfunction);
+    }
+    else
+    {
+      m_built = false;
+    }
+  }
+
   TransferFunction1D::~TransferFunction1D ()
   {
     m_cpt_rgb.clear ();
@@ -39,22 +67,41 @@ namespace vis
     extinction_coef_type = s;
   }
 
+  int TransferFunction1D::GetMaxDensity ()
+  {
+    return max_density;
+  }
+
   void TransferFunction1D::AddRGBControlPoint (TransferControlPoint rgb)
   {
     m_cpt_rgb.push_back (rgb);
+    m_built = false;
   }
 
   void TransferFunction1D::AddAlphaControlPoint (TransferControlPoint alpha)
   {
     m_cpt_alpha.push_back (alpha);
+    m_built = false;
   }
 
   void TransferFunction1D::ClearControlPoints ()
   {
     m_cpt_rgb.clear ();
     m_cpt_alpha.clear ();
+    m_built = false;
+  }
+
+  const std::vector<TransferControlPoint>& TransferFunction1D::GetRGBControlPoints () const
+  {
+    return m_cpt_rgb;
   }
 
+  const std::vector<TransferControlPoint>& TransferFunction1D::GetAlphaControlPoints () const
+  {
+    return m_cpt_alpha;
+  }
+
+#ifndef VOLVIS_UTILS_NO_GL
   gl::Texture1D* TransferFunction1D::GenerateTexture_1D_RGBA ()
   {
     if (!m_built)
@@ -116,6 +163,107 @@ namespace vis
     }
     return NULL;
   }
+#endif
+
+  std::vector<float> TransferFunction1D::GeneratePreIntegratedRGBt (int size, ThreadPool* thread_pool)
+  {
+    if (!m_built)
+      Build();
+    if (thread_pool == nullptr)
+      thread_pool = ThreadPool::GetDefault();
+
+    // RGBt lookup, same content of GenerateTexture_1D_RGBt
+    int n = max_density + 1;
+    std::vector<glm::dvec4> rgbt(n);
+    for (int i = 0; i < n; i++)
+    {
+      double ext = m_transferfunction[i].a;
+      if (!extinction_coef_type)
+        ext = MaterialOpacityToExtinction((float)ext);
+      rgbt[i] = glm::dvec4(glm::dvec3(m_transferfunction[i]), glm::min(ext, TRANSFER_FUNCTION_1D_MAX_EXTINCTION));
+    }
+
+    // Prefix integrals over the texel coordinate u = d * n - 0.5, from
+    //  u = -0.5, of the extinction (w) and of extinction * color (rgb).
+    //  The lookup is clamped outside of the texel centers [0, n - 1].
+    std::vector<glm::dvec4> prefix(n);
+    prefix[0] = glm::dvec4(glm::dvec3(rgbt[0]) * rgbt[0].a, rgbt[0].a) * 0.5;
+    for (int i = 0; i + 1 < n; i++)
+    {
+      const glm::dvec4& a = rgbt[i];
+      const glm::dvec4& b = rgbt[i + 1];
+      glm::dvec3 kc = (2.0 * a.a * glm::dvec3(a) + a.a * glm::dvec3(b) + b.a * glm::dvec3(a) + 2.0 * b.a * glm::dvec3(b)) / 6.0;
+      prefix[i + 1] = prefix[i] + glm::dvec4(kc, (a.a + b.a) * 0.5);
+    }
+
+    // Lookup and prefix integral at the density of each table texel
+    std::vector<glm::dvec4> node_rgbt(size), node_integral(size);
+    for (int j = 0; j < size; j++)
+    {
+      double u = ((double)j + 0.5) * (double)n / (double)size - 0.5;
+      if (u <= 0.0)
+      {
+        node_rgbt[j] = rgbt[0];
+        node_integral[j] = glm::dvec4(glm::dvec3(rgbt[0]) * rgbt[0].a, rgbt[0].a) * (u + 0.5);
+        continue;
+      }
+      if (u >= (double)(n - 1))
+      {
+        node_rgbt[j] = rgbt[n - 1];
+        node_integral[j] = prefix[n - 1] + glm::dvec4(glm::dvec3(rgbt[n - 1]) * rgbt[n - 1].a, rgbt[n - 1].a) * (u - (double)(n - 1));
+        continue;
+      }
+
+      int i = (int)u;
+      double t = u - (double)i;
+      const glm::dvec4& a = rgbt[i];
+      const glm::dvec4& b = rgbt[i + 1];
+      glm::dvec3 ca = glm::dvec3(a), dc = glm::dvec3(b) - ca;
+      double dt = b.a - a.a;
+      node_rgbt[j] = a + (b - a) * t;
+      // integral of (a.a + dt x) (ca + dc x) from 0 to t
+      glm::dvec3 kc = a.a * ca * t + (a.a * dc + dt * ca) * (t * t * 0.5) + dt * dc * (t * t * t / 3.0);
+      node_integral[j] = prefix[i] + glm::dvec4(kc, a.a * t + dt * t * t * 0.5);
+    }
+
+    // Each row (back density) is independent
+    std::vector<float> table((size_t)size * size * 4);
+    thread_pool->ParallelFor(size, [&](int back) {
+      for (int front = 0; front < size; front++)
+      {
+        glm::dvec4 entry = node_rgbt[back];
+        if (front != back)
+        {
+          glm::dvec4 integral = node_integral[back] - node_integral[front];
+          double du = ((double)(back - front)) * (double)n / (double)size;
+          entry.a = integral.a / du;
+          if (entry.a > 0.0)
+            entry = glm::dvec4(glm::dvec3(integral) / integral.a, entry.a);
+          else
+            entry = glm::dvec4((glm::dvec3(node_rgbt[front]) + glm::dvec3(node_rgbt[back])) * 0.5, 0.0);
+        }
+
+        float* dst = table.data() + ((size_t)back * size + front) * 4;
+        dst[0] = (float)entry.r;
+        dst[1] = (float)entry.g;
+        dst[2] = (float)entry.b;
+        dst[3] = (float)glm::min(entry.a, TRANSFER_FUNCTION_1D_MAX_EXTINCTION);
+      }
+    });
+    return table;
+  }
+
+#ifndef VOLVIS_UTILS_NO_GL
+  gl::Texture2D* TransferFunction1D::GenerateTexture_2D_PreIntegratedRGBt (int size)
+  {
+    std::vector<float> table = GeneratePreIntegratedRGBt(size);
+
+    gl::Texture2D* ret = new gl::Texture2D(size, size);
+    ret->GenerateTexture(GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+    ret->SetData((void*)table.data(), GL_RGBA16F, GL_RGBA, GL_FLOAT);
+    return ret;
+  }
+#endif
 
   void TransferFunction1D::Build ()
   {
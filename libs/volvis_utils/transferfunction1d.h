@@ -16,12 +16,23 @@
  * |a/t isovalue
  * |a/t isovalue
  * |...
+ *
+ * Pre-integration:
+ * . Engel, Kraus and Ertl, High-Quality Pre-Integrated Volume Rendering
+ *   Using Hardware-Accelerated Pixel Shading, 2001
+ * The table entry (front, back) keeps the average extinction and the
+ *   extinction weighted average color of a ray segment where the density
+ *   goes linearly from front to back. Both come from prefix integrals of
+ *   the RGBt lookup (as a GL_LINEAR texture), so each entry is O(1) and
+ *   the table does not depend on the step size:
+ *   F = exp(-t * h), E += T * rgb * (1 - F), same as the 1D lookup.
 **/
 
 #ifndef VOL_VIS_UTILS_TRANSFER_FUNCTION_1D_H
 #define VOL_VIS_UTILS_TRANSFER_FUNCTION_1D_H
 
 #include <volvis_utils/transferfunction.h>
+#include <volvis_utils/threadpool.h>
 
 #include <vector>
 #include <iostream>
@@ -34,8 +45,12 @@ namespace vis
   {
   public:
     TransferFunction1D (int max_value = 255);
+    // Copy of the control points and of the built table, if any
+    TransferFunction1D (const TransferFunction1D& tf);
     ~TransferFunction1D ();
 
+    TransferFunction1D& operator= (const TransferFunction1D&) = delete;
+
     virtual const char* GetNameClass ();
     virtual glm::vec4 Get (double value, double max_data_value = -1.0);
     
@@ -44,14 +59,30 @@ namespace vis
     virtual float GetExt (double value, double max_input_value = -1.0);
     virtual float GetExtN (double normalized_value);
 
+#ifndef VOLVIS_UTILS_NO_GL
     virtual gl::Texture1D* GenerateTexture_1D_RGBA ();
     virtual gl::Texture1D* GenerateTexture_1D_RGBt ();
+#endif
+
+    static const int DEFAULT_PREINTEGRATION_SIZE = 256;
+
+    // size x size RGBt entries, front density along x and back density along
+    //  y, both normalized and sampled at texel centers (i + 0.5) / size
+    std::vector<float> GeneratePreIntegratedRGBt (int size = DEFAULT_PREINTEGRATION_SIZE, ThreadPool* thread_pool = nullptr);
+#ifndef VOLVIS_UTILS_NO_GL
+    virtual gl::Texture2D* GenerateTexture_2D_PreIntegratedRGBt (int size = DEFAULT_PREINTEGRATION_SIZE);
+#endif
 
     void SetExtinctionCoefficientInput (bool s);
 
+    int GetMaxDensity ();
+
+    // Edits are applied by the next Build
     void AddRGBControlPoint (TransferControlPoint rgb);
     void AddAlphaControlPoint (TransferControlPoint alpha);
     void ClearControlPoints ();
+    const std::vector<TransferControlPoint>& GetRGBControlPoints () const;
+    const std::vector<TransferControlPoint>& GetAlphaControlPoints () const;
 
     //If we don't have a file with the values of the TF, we need to compute the TF
     void Build ();
@@ -0,0 +1,178 @@
+#include "transferfunctionsnapshot.h"
+#include <file_utils/profiler.h>
+
+#include <algorithm>
+
+namespace vis
+{
+  TransferFunctionSnapshot::TransferFunctionSnapshot (const TransferFunction1D& tf, unsigned long long version,
+                                                      float density_min, float density_max)
+    : m_transfer_function(new TransferFunction1D(tf))
+    , m_version(version)
+  {
+    PROFILE_SCOPE("TransferFunctionSnapshot::Build");
+    if (!m_transfer_function->m_built)
+      m_transfer_function->Build();
+    m_table.BuildAdaptive(m_transfer_function.get(), density_min, density_max);
+  }
+
+  TransferFunctionSnapshot::~TransferFunctionSnapshot ()
+  {
+  }
+
+  unsigned long long TransferFunctionSnapshot::GetVersion () const
+  {
+    return m_version;
+  }
+
+  TransferFunction1D* TransferFunctionSnapshot::GetTransferFunction () const
+  {
+    return m_transfer_function.get();
+  }
+
+  const TransferFunctionTable& TransferFunctionSnapshot::GetTable () const
+  {
+    return m_table;
+  }
+
+  bool TransferFunctionSnapshot::GetChangedRange (const TransferFunctionSnapshot* previous, int* first, int* last,
+                                                  bool extinction_only) const
+  {
+    int length = m_table.GetLength();
+    if (previous == nullptr || previous->m_table.GetLength() != length ||
+        previous->m_table.GetScale() != m_table.GetScale() || previous->m_table.GetOffset() != m_table.GetOffset())
+    {
+      *first = 0;
+      *last = length - 1;
+      return length > 0;
+    }
+
+    *first = length;
+    *last = -1;
+    for (int c = 0; c < TransferFunctionTable::NUMBER_OF_CHANNELS; c++)
+    {
+      if (extinction_only && c != TransferFunctionTable::EXTINCTION)
+        continue;
+      const float* curr = m_table.GetChannel((TransferFunctionTable::CHANNEL)c);
+      const float* prev = previous->m_table.GetChannel((TransferFunctionTable::CHANNEL)c);
+
+      int i0 = 0;
+      while (i0 < length && curr[i0] == prev[i0]) i0++;
+      if (i0 == length) continue;
+      int i1 = length - 1;
+      while (curr[i1] == prev[i1]) i1--;
+
+      *first = std::min(*first, i0);
+      *last = std::max(*last, i1);
+    }
+    return *first <= *last;
+  }
+
+  TransferFunctionPublisher::TransferFunctionPublisher ()
+    : m_version(0)
+    , m_next_version(1)
+    , m_pending_version(0)
+    , m_building(false)
+    , m_stop(false)
+  {
+    m_pending_range[0] = m_density_range[0] = 0.0f;
+    m_pending_range[1] = m_density_range[1] = 1.0f;
+  }
+
+  TransferFunctionPublisher::~TransferFunctionPublisher ()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_build_mutex);
+      m_stop = true;
+    }
+    m_cv_build.notify_all();
+    if (m_build_thread.joinable())
+      m_build_thread.join();
+  }
+
+  void TransferFunctionPublisher::Publish (const TransferFunction1D& tf)
+  {
+    float range[2];
+    {
+      std::lock_guard<std::mutex> lock(m_build_mutex);
+      range[0] = m_density_range[0];
+      range[1] = m_density_range[1];
+    }
+    Store(std::make_shared<const TransferFunctionSnapshot>(tf, m_next_version++, range[0], range[1]));
+  }
+
+  void TransferFunctionPublisher::PublishAsync (const TransferFunction1D& tf)
+  {
+    // Copied here, the caller can keep editing tf
+    std::unique_ptr<TransferFunction1D> pending(new TransferFunction1D(tf));
+    {
+      std::lock_guard<std::mutex> lock(m_build_mutex);
+      m_pending = std::move(pending);
+      m_pending_version = m_next_version++;
+      m_pending_range[0] = m_density_range[0];
+      m_pending_range[1] = m_density_range[1];
+      if (!m_build_thread.joinable())
+        m_build_thread = std::thread(&TransferFunctionPublisher::BuildLoop, this);
+    }
+    m_cv_build.notify_one();
+  }
+
+  void TransferFunctionPublisher::Wait ()
+  {
+    std::unique_lock<std::mutex> lock(m_build_mutex);
+    m_cv_idle.wait(lock, [this] { return m_pending == nullptr && !m_building; });
+  }
+
+  void TransferFunctionPublisher::SetDensityRange (float density_min, float density_max)
+  {
+    std::lock_guard<std::mutex> lock(m_build_mutex);
+    m_density_range[0] = density_min;
+    m_density_range[1] = density_max;
+  }
+
+  TransferFunctionSnapshotPtr TransferFunctionPublisher::Acquire () const
+  {
+    return std::atomic_load(&m_snapshot);
+  }
+
+  unsigned long long TransferFunctionPublisher::GetVersion () const
+  {
+    return m_version.load(std::memory_order_acquire);
+  }
+
+  void TransferFunctionPublisher::Store (TransferFunctionSnapshotPtr snapshot)
+  {
+    // A snapshot built after a newer one was published is dropped
+    std::lock_guard<std::mutex> lock(m_store_mutex);
+    if (snapshot->GetVersion() <= m_version.load(std::memory_order_relaxed))
+      return;
+    std::atomic_store(&m_snapshot, snapshot);
+    m_version.store(snapshot->GetVersion(), std::memory_order_release);
+  }
+
+  void TransferFunctionPublisher::BuildLoop ()
+  {
+    std::unique_lock<std::mutex> lock(m_build_mutex);
+    while (true)
+    {
+      m_cv_build.wait(lock, [this] { return m_stop || m_pending != nullptr; });
+      if (m_stop)
+        break;
+
+      std::unique_ptr<TransferFunction1D> tf = std::move(m_pending);
+      unsigned long long version = m_pending_version;
+      float range[2] = { m_pending_range[0], m_pending_range[1] };
+      m_building = true;
+      lock.unlock();
+
+      Store(std::make_shared<const TransferFunctionSnapshot>(*tf, version, range[0], range[1]));
+
+      lock.lock();
+      m_building = false;
+      if (m_pending == nullptr)
+        m_cv_idle.notify_all();
+    }
+    m_building = false;
+    m_cv_idle.notify_all();
+  }
+}
@@ -0,0 +1,120 @@
+/**
+ * Immutable snapshots of a 1D transfer function, for editing it while
+ *   renderers and background jobs are reading it.
+ *
+ * A TransferFunctionSnapshot owns a built copy of the transfer function
+ *   and its vis::TransferFunctionTable, built with BuildAdaptive for the
+ *   value range of the data set by SetDensityRange. Nothing changes after it is
+ *   constructed, so it can be read from any thread, and it is shared
+ *   through a reference counted TransferFunctionSnapshotPtr: a snapshot
+ *   lives until the last frame or job using it is finished.
+ *
+ * The TransferFunctionPublisher holds the newest snapshot:
+ * . Publish/PublishAsync copy the edited transfer function, then build
+ *   the snapshot in the calling thread or in a background thread. Edits
+ *   published while a build is running are merged, only the newest one
+ *   is built next.
+ * . GetVersion is a single atomic load, renderers check it at each frame
+ *   boundary and only call Acquire when a newer snapshot was published.
+ * . GetChangedRange gives the entries that differ between the snapshot in
+ *   use and the new one, so derived data (GL textures, occupancy grids)
+ *   is only updated for the changed density range.
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_TRANSFER_FUNCTION_SNAPSHOT_H
+#define VOL_VIS_UTILS_TRANSFER_FUNCTION_SNAPSHOT_H
+
+#include <volvis_utils/transferfunction1d.h>
+#include <volvis_utils/transferfunctiontable.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace vis
+{
+  class TransferFunctionSnapshot
+  {
+  public:
+    // Copy and build tf, the table covers [density_min, density_max]
+    TransferFunctionSnapshot (const TransferFunction1D& tf, unsigned long long version = 0,
+                              float density_min = 0.0f, float density_max = 1.0f);
+    ~TransferFunctionSnapshot ();
+
+    unsigned long long GetVersion () const;
+
+    // Built copy of the transfer function, must not be edited
+    TransferFunction1D* GetTransferFunction () const;
+    const TransferFunctionTable& GetTable () const;
+
+    // Range [first, last] of the table entries that differ from previous,
+    //  the whole table if previous is nullptr or its table has another
+    //  length, scale or offset.
+    //  Returns false if no entry changed. With extinction_only, the color
+    //  channels are ignored.
+    bool GetChangedRange (const TransferFunctionSnapshot* previous, int* first, int* last,
+                          bool extinction_only = false) const;
+
+  protected:
+
+  private:
+    std::unique_ptr<TransferFunction1D> m_transfer_function;
+    TransferFunctionTable m_table;
+    unsigned long long m_version;
+  };
+
+  typedef std::shared_ptr<const TransferFunctionSnapshot> TransferFunctionSnapshotPtr;
+
+  class TransferFunctionPublisher
+  {
+  public:
+    TransferFunctionPublisher ();
+    // Waits for the snapshot being built
+    ~TransferFunctionPublisher ();
+
+    // Build the snapshot of tf in the calling thread and publish it
+    void Publish (const TransferFunction1D& tf);
+    // Copy tf and build its snapshot in the background thread
+    void PublishAsync (const TransferFunction1D& tf);
+    // Wait until every PublishAsync call is published
+    void Wait ();
+
+    // Normalized value range of the data, used by the next publish
+    void SetDensityRange (float density_min, float density_max);
+
+    // Newest snapshot, nullptr before the first publish
+    TransferFunctionSnapshotPtr Acquire () const;
+    // Version of the newest snapshot, 0 before the first publish
+    unsigned long long GetVersion () const;
+
+  protected:
+
+  private:
+    void Store (TransferFunctionSnapshotPtr snapshot);
+    void BuildLoop ();
+
+    // Read with std::atomic_load, written under m_store_mutex
+    TransferFunctionSnapshotPtr m_snapshot;
+    std::atomic<unsigned long long> m_version;
+    std::atomic<unsigned long long> m_next_version;
+    std::mutex m_store_mutex;
+
+    // Background builds, m_pending holds the newest edit not built yet
+    std::thread m_build_thread;
+    std::mutex m_build_mutex;
+    std::condition_variable m_cv_build;
+    std::condition_variable m_cv_idle;
+    std::unique_ptr<TransferFunction1D> m_pending;
+    unsigned long long m_pending_version;
+    float m_pending_range[2];
+    float m_density_range[2];
+    bool m_building;
+    bool m_stop;
+  };
+}
+
+#endif
@@ -0,0 +1,469 @@
+#include "transferfunctiontable.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#if defined(__AVX512F__)
+  #include <immintrin.h>
+#endif
+
+namespace vis
+{
+  TransferFunctionTable::TransferFunctionTable ()
+    : m_length(0)
+    , m_scale(0.0f)
+    , m_offset(0.0f)
+    , m_max_error(0.0f)
+  {
+  }
+
+  TransferFunctionTable::TransferFunctionTable (TransferFunction1D* tf)
+    : m_length(0)
+    , m_scale(0.0f)
+    , m_offset(0.0f)
+    , m_max_error(0.0f)
+  {
+    Build(tf);
+  }
+
+  TransferFunctionTable::~TransferFunctionTable ()
+  {
+    Clear();
+  }
+
+  void TransferFunctionTable::Build (TransferFunction1D* tf)
+  {
+    Clear();
+    if (tf == nullptr)
+      return;
+
+    Allocate(tf->GetMaxDensity() + 1);
+    for (int i = 0; i < m_length; i++)
+      for (int c = 0; c < NUMBER_OF_CHANNELS; c++)
+        m_data[c * (m_length + 1) + i] = GetExactEntry(tf, i, (CHANNEL)c);
+    RepeatLastEntry();
+
+    m_scale = (float)m_length;
+    m_offset = -0.5f;
+  }
+
+  void TransferFunctionTable::BuildAdaptive (TransferFunction1D* tf, float density_min, float density_max,
+                                             float max_error, int min_length, int max_length)
+  {
+    Clear();
+    if (tf == nullptr)
+      return;
+
+    // Densities read by the samples in [density_min, density_max]
+    int n = tf->GetMaxDensity() + 1;
+    float d0 = glm::clamp(glm::min(density_min, density_max), 0.0f, 1.0f);
+    float d1 = glm::clamp(glm::max(density_min, density_max), 0.0f, 1.0f);
+    int x0 = glm::clamp((int)floor(d0 * (float)n - 0.5f), 0, n - 1);
+    int x1 = glm::clamp((int)ceil(d1 * (float)n - 0.5f), 0, n - 1);
+
+    // Control points inside the range are the kinks of the exact table:
+    //  entries spaced by their gcd (or a fraction of it), starting at one
+    //  of them, keep every kink. The range is extended to the closest
+    //  aligned densities, the ends of the table [0, n - 1] are kinks too.
+    std::vector<int> kinks;
+    const std::vector<TransferControlPoint>* cpts[2] = { &tf->GetRGBControlPoints(), &tf->GetAlphaControlPoints() };
+    for (int k = 0; k < 2; k++)
+      for (size_t i = 0; i < cpts[k]->size(); i++)
+        if ((*cpts[k])[i].m_isoValue > x0 && (*cpts[k])[i].m_isoValue < x1)
+          kinks.push_back((*cpts[k])[i].m_isoValue);
+
+    int gcd = 0;
+    if (!kinks.empty())
+    {
+      int ref = kinks[0];
+      for (size_t i = 0; i < kinks.size(); i++)
+        gcd = Gcd(gcd, abs(kinks[i] - ref));
+      if (gcd == 0)
+        gcd = x1 - x0;
+
+      x0 = ref - ((ref - x0 + gcd - 1) / gcd) * gcd;
+      x1 = ref + ((x1 - ref + gcd - 1) / gcd) * gcd;
+      if (x0 < 0)
+        gcd = Gcd(gcd, ref - (x0 = 0));
+      if (x1 > n - 1)
+        gcd = Gcd(gcd, (x1 = n - 1) - ref);
+    }
+    int span = x1 - x0;
+
+    std::vector<float> exact((size_t)NUMBER_OF_CHANNELS * (span + 1));
+    for (int i = 0; i <= span; i++)
+      for (int c = 0; c < NUMBER_OF_CHANNELS; c++)
+        exact[c * (span + 1) + i] = GetExactEntry(tf, x0 + i, (CHANNEL)c);
+
+    if (span + 1 > min_length)
+    {
+      // Entries at the kinks, then m entries between consecutive ones
+      for (int m = 1; gcd > 0 && (long long)(span / gcd) * m < span && (long long)(span / gcd) * m + 1 <= max_length; m *= 2)
+      {
+        if (Resample(exact, span, (span / gcd) * m) <= max_error)
+          break;
+        Clear();
+      }
+
+      // Kinks not aligned: uniform entries, two of them between the
+      //  closest control points, doubled until the error is small enough
+      if (m_length == 0)
+      {
+        int spacing = span;
+        for (size_t i = 1; i < kinks.size(); i++)
+          if (kinks[i] != kinks[i - 1])
+            spacing = glm::min(spacing, abs(kinks[i] - kinks[i - 1]));
+
+        int cells = min_length - 1;
+        while (cells < span && (long long)cells * spacing < 2LL * span)
+          cells *= 2;
+        for (; cells < span && cells + 1 <= max_length; cells *= 2)
+        {
+          if (Resample(exact, span, cells) <= max_error)
+            break;
+          Clear();
+        }
+      }
+    }
+
+    if (m_length > 0)
+    {
+      int cells = m_length - 1;
+      m_scale = (float)((double)n * (double)cells / (double)span);
+      m_offset = (float)((-0.5 - (double)x0) * (double)cells / (double)span);
+      printf("TransferFunctionTable: %d entries for densities [%d, %d], max error %.2e\n",
+             m_length, x0, x1, m_max_error);
+      return;
+    }
+
+    // Exact entries of the range
+    Allocate(span + 1);
+    for (int c = 0; c < NUMBER_OF_CHANNELS; c++)
+      std::copy(exact.begin() + c * (span + 1), exact.begin() + (c + 1) * (span + 1), m_data.begin() + c * (m_length + 1));
+    RepeatLastEntry();
+
+    m_scale = (float)n;
+    m_offset = -0.5f - (float)x0;
+    m_max_error = 0.0f;
+    printf("TransferFunctionTable: %d exact entries for densities [%d, %d]\n", m_length, x0, x1);
+  }
+
+  void TransferFunctionTable::Clear ()
+  {
+    m_data.clear();
+    m_length = 0;
+    m_scale = 0.0f;
+    m_offset = 0.0f;
+    m_max_error = 0.0f;
+  }
+
+  bool TransferFunctionTable::IsBuilt () const
+  {
+    return m_length > 0;
+  }
+
+  int TransferFunctionTable::GetLength () const
+  {
+    return m_length;
+  }
+
+  float TransferFunctionTable::GetScale () const
+  {
+    return m_scale;
+  }
+
+  float TransferFunctionTable::GetOffset () const
+  {
+    return m_offset;
+  }
+
+  float TransferFunctionTable::GetMaxError () const
+  {
+    return m_max_error;
+  }
+
+  size_t TransferFunctionTable::GetMemorySize () const
+  {
+    return m_data.size() * sizeof(float);
+  }
+
+  const float* TransferFunctionTable::GetChannel (CHANNEL c) const
+  {
+    return m_data.data() + (size_t)c * (m_length + 1);
+  }
+
+  const float* TransferFunctionTable::GetExtinction () const
+  {
+    return GetChannel(EXTINCTION);
+  }
+
+  const float* TransferFunctionTable::GetOpacity () const
+  {
+    return GetChannel(OPACITY);
+  }
+
+#ifndef VOLVIS_UTILS_NO_GL
+  gl::Texture1D* TransferFunctionTable::GenerateTexture_1D_RGBt () const
+  {
+    if (m_length == 0)
+      return NULL;
+
+    std::vector<float> data((size_t)m_length * 4);
+    for (int i = 0; i < m_length; i++)
+      for (int c = 0; c < 4; c++)
+        data[i * 4 + c] = GetChannel((CHANNEL)c)[i];
+
+    gl::Texture1D* ret = new gl::Texture1D(m_length);
+    ret->GenerateTexture(GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE);
+    ret->SetData((void*)data.data(), GL_RGBA16F, GL_RGBA, GL_FLOAT);
+    return ret;
+  }
+
+  gl::Texture2D* TransferFunctionTable::GenerateTexture_2D_WrappedRGBt (int row_length) const
+  {
+    if (m_length == 0 || row_length < 2)
+      return NULL;
+
+    int rows = glm::max((m_length - 2) / (row_length - 1) + 1, 1);
+    std::vector<float> data((size_t)row_length * rows * 4);
+    for (int r = 0; r < rows; r++)
+    {
+      for (int x = 0; x < row_length; x++)
+      {
+        int i = glm::min(r * (row_length - 1) + x, m_length - 1);
+        for (int c = 0; c < 4; c++)
+          data[((size_t)r * row_length + x) * 4 + c] = GetChannel((CHANNEL)c)[i];
+      }
+    }
+
+    // Rows are read at their centers, the filter only blends along x
+    gl::Texture2D* ret = new gl::Texture2D(row_length, rows);
+    ret->GenerateTexture(GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+    ret->SetData((void*)data.data(), GL_RGBA16F, GL_RGBA, GL_FLOAT);
+    return ret;
+  }
+#endif
+
+  void TransferFunctionTable::ClassifyRGBt (const float* samples, size_t count, float* rgbt) const
+  {
+    const CHANNEL channels[4] = { RED, GREEN, BLUE, EXTINCTION };
+    float* const dst[4] = { rgbt, rgbt + 1, rgbt + 2, rgbt + 3 };
+    Classify(samples, count, channels, 4, dst, 4);
+  }
+
+  void TransferFunctionTable::ClassifyRGBA (const float* samples, size_t count, float* rgba) const
+  {
+    const CHANNEL channels[4] = { RED, GREEN, BLUE, OPACITY };
+    float* const dst[4] = { rgba, rgba + 1, rgba + 2, rgba + 3 };
+    Classify(samples, count, channels, 4, dst, 4);
+  }
+
+  void TransferFunctionTable::ClassifyRGBt (const float* samples, size_t count, float* r, float* g, float* b, float* t) const
+  {
+    const CHANNEL channels[4] = { RED, GREEN, BLUE, EXTINCTION };
+    float* const dst[4] = { r, g, b, t };
+    Classify(samples, count, channels, 4, dst, 1);
+  }
+
+  void TransferFunctionTable::ClassifyRGBA (const float* samples, size_t count, float* r, float* g, float* b, float* a) const
+  {
+    const CHANNEL channels[4] = { RED, GREEN, BLUE, OPACITY };
+    float* const dst[4] = { r, g, b, a };
+    Classify(samples, count, channels, 4, dst, 1);
+  }
+
+  void TransferFunctionTable::ClassifyExtinction (const float* samples, size_t count, float* extinction) const
+  {
+    const CHANNEL channels[1] = { EXTINCTION };
+    float* const dst[1] = { extinction };
+    Classify(samples, count, channels, 1, dst, 1);
+  }
+
+  void TransferFunctionTable::ClassifyOpacity (const float* samples, size_t count, float* opacity) const
+  {
+    const CHANNEL channels[1] = { OPACITY };
+    float* const dst[1] = { opacity };
+    Classify(samples, count, channels, 1, dst, 1);
+  }
+
+  void TransferFunctionTable::Classify (const float* samples, size_t count, const CHANNEL* channels, int n_channels,
+                                        float* const* dst, int stride) const
+  {
+    if (m_length == 0)
+    {
+      for (size_t i = 0; i < count; i++)
+        for (int k = 0; k < n_channels; k++)
+          dst[k][i * stride] = 0.0f;
+      return;
+    }
+
+    const float* src[NUMBER_OF_CHANNELS];
+    for (int k = 0; k < n_channels; k++)
+      src[k] = GetChannel(channels[k]);
+
+    size_t i = 0;
+
+#if defined(__AVX512F__)
+    {
+      const __m512 scale = _mm512_set1_ps(m_scale);
+      const __m512 offset = _mm512_set1_ps(m_offset);
+      const __m512 umax = _mm512_set1_ps((float)(m_length - 1));
+      const __m512 zero = _mm512_setzero_ps();
+      const __m512i one = _mm512_set1_epi32(1);
+
+      alignas(64) float out[16];
+      for (; i + 16 <= count; i += 16)
+      {
+        __m512 u = _mm512_add_ps(_mm512_mul_ps(_mm512_loadu_ps(samples + i), scale), offset);
+        u = _mm512_min_ps(_mm512_max_ps(u, zero), umax);
+        __m512 u0 = _mm512_roundscale_ps(u, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        __m512 ut = _mm512_sub_ps(u, u0);
+        __m512i i0 = _mm512_cvttps_epi32(u0);
+        __m512i i1 = _mm512_add_epi32(i0, one);
+
+        for (int k = 0; k < n_channels; k++)
+        {
+          __m512 s0 = _mm512_i32gather_ps(i0, src[k], 4);
+          __m512 s1 = _mm512_i32gather_ps(i1, src[k], 4);
+          __m512 v = _mm512_add_ps(s0, _mm512_mul_ps(_mm512_sub_ps(s1, s0), ut));
+          if (stride == 1)
+          {
+            _mm512_storeu_ps(dst[k] + i, v);
+          }
+          else
+          {
+            _mm512_store_ps(out, v);
+            for (int l = 0; l < 16; l++)
+              dst[k][(i + l) * stride] = out[l];
+          }
+        }
+      }
+    }
+#endif
+
+    using namespace simd;
+    const vfloat scale = Set1(m_scale);
+    const vfloat offset = Set1(m_offset);
+    const vfloat umax = Set1((float)(m_length - 1));
+    const vfloat zero = Set1(0.0f);
+
+    float in[WIDTH], out[WIDTH];
+    int i0[WIDTH], i1[WIDTH];
+    while (i < count)
+    {
+      // The last batch is padded with zeros
+      int n_lanes = (int)std::min((size_t)WIDTH, count - i);
+      vfloat d;
+      if (n_lanes == WIDTH)
+      {
+        d = Load(samples + i);
+      }
+      else
+      {
+        for (int l = 0; l < WIDTH; l++)
+          in[l] = l < n_lanes ? samples[i + l] : 0.0f;
+        d = Load(in);
+      }
+
+      vfloat u = Min(Max(d * scale + offset, zero), umax);
+      vfloat u0 = Floor(u);
+      vfloat ut = u - u0;
+      StoreInt(i0, u0);
+      for (int l = 0; l < WIDTH; l++)
+        i1[l] = i0[l] + 1;
+
+      for (int k = 0; k < n_channels; k++)
+      {
+        vfloat s0 = Gather(src[k], i0);
+        vfloat s1 = Gather(src[k], i1);
+        vfloat v = s0 + (s1 - s0) * ut;
+        if (stride == 1 && n_lanes == WIDTH)
+        {
+          Store(dst[k] + i, v);
+        }
+        else
+        {
+          Store(out, v);
+          for (int l = 0; l < n_lanes; l++)
+            dst[k][(i + l) * stride] = out[l];
+        }
+      }
+      i += n_lanes;
+    }
+  }
+
+  float TransferFunctionTable::Resample (const std::vector<float>& exact, int span, int cells)
+  {
+    // Entry i at density x0 + i * span / cells, lerp of the exact entries
+    Allocate(cells + 1);
+    for (int i = 0; i <= cells; i++)
+    {
+      double x = (double)i * (double)span / (double)cells;
+      int e0 = glm::min((int)x, span - 1);
+      float t = (float)(x - (double)e0);
+      for (int c = 0; c < NUMBER_OF_CHANNELS; c++)
+      {
+        const float* e = &exact[c * (span + 1)];
+        m_data[c * (m_length + 1) + i] = e[e0] + (e[e0 + 1] - e[e0]) * t;
+      }
+    }
+    RepeatLastEntry();
+
+    // Both tables are piecewise linear and equal at the entries above,
+    //  the largest difference is at one of the exact entries
+    m_max_error = 0.0f;
+    for (int j = 0; j <= span; j++)
+    {
+      double u = (double)j * (double)cells / (double)span;
+      int u0 = glm::min((int)u, cells - 1);
+      float ut = (float)(u - (double)u0);
+      for (int c = 0; c < NUMBER_OF_CHANNELS; c++)
+      {
+        const float* a = GetChannel((CHANNEL)c);
+        float v = a[u0] + (a[u0 + 1] - a[u0]) * ut;
+        float e = exact[c * (span + 1) + j];
+        float err = c == EXTINCTION ? fabs(exp(-v) - exp(-e)) : fabs(v - e);
+        m_max_error = glm::max(m_max_error, err);
+      }
+    }
+    return m_max_error;
+  }
+
+  int TransferFunctionTable::Gcd (int a, int b)
+  {
+    while (b != 0)
+    {
+      int t = a % b;
+      a = b;
+      b = t;
+    }
+    return a;
+  }
+
+  float TransferFunctionTable::GetExactEntry (TransferFunction1D* tf, int density, CHANNEL c)
+  {
+    switch (c)
+    {
+    case RED:        return tf->Get((double)density).r;
+    case GREEN:      return tf->Get((double)density).g;
+    case BLUE:       return tf->Get((double)density).b;
+    case EXTINCTION: return glm::min(tf->GetExt((double)density), MAX_EXTINCTION);
+    case OPACITY:    return tf->GetOpc((double)density);
+    default:         return 0.0f;
+    }
+  }
+
+  void TransferFunctionTable::Allocate (int length)
+  {
+    m_length = length;
+    m_data.assign((size_t)NUMBER_OF_CHANNELS * (m_length + 1), 0.0f);
+  }
+
+  void TransferFunctionTable::RepeatLastEntry ()
+  {
+    // Lerp weight is 0 there
+    for (int c = 0; c < NUMBER_OF_CHANNELS; c++)
+      m_data[c * (m_length + 1) + m_length] = m_data[c * (m_length + 1) + m_length - 1];
+  }
+}
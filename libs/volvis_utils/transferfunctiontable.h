@@ -0,0 +1,178 @@
+/**
+ * Float lookup table of a 1D transfer function used for batch
+ *   classification of normalized samples on the CPU, and for the
+ *   transfer function texture of the GPU ray caster.
+ *
+ * TransferFunction1D::Get works in double, is virtual and converts the
+ *   alpha channel on each call (GetOpcN/GetExtN). The table keeps one
+ *   float array per channel: r, g, b, extinction and opacity, with the
+ *   conversion already applied, so a sample costs two gathers and a
+ *   lerp per channel.
+ *
+ * Lookups follow a GL_LINEAR + GL_CLAMP_TO_EDGE 1D texture of GetLength()
+ *   texels, same as GenerateTexture_1D_RGBt and the GPU renderers. Each
+ *   channel has an extra copy of its last entry, so the second texel of
+ *   the lerp never needs to be clamped. A sample d is read at texel
+ *   coordinate u = clamp(d * GetScale() + GetOffset(), 0, GetLength() - 1).
+ *
+ * Build keeps one entry per density of the transfer function (scale =
+ *   length, offset = -0.5). For 16-bit data that is 65536 entries, 1.3 MB
+ *   of floats that do not fit in L2, and more than GL_MAX_TEXTURE_SIZE on
+ *   some drivers. BuildAdaptive only covers the densities in the value
+ *   range of the data and places entries uniformly along it:
+ * . The exact table (lerp between densities) is piecewise linear, with
+ *   kinks at the control points. Entries spaced by the gcd of the control
+ *   points, or by a fraction of it, keep the kinks: that spacing is tried
+ *   first, halved until the table is within max_error of the exact one.
+ * . Otherwise the first length tried puts two entries between the closest
+ *   control points, doubled until the table is within max_error.
+ * . Both tables are piecewise linear and agree at the adaptive entries,
+ *   so the error is the largest difference at the integer densities,
+ *   checked for each one. The error of color and opacity is absolute,
+ *   the extinction error is the error of the transmittance exp(-t) of a
+ *   unit length segment.
+ * . If max_length entries are not enough, the exact entries of the value
+ *   range are kept. GenerateTexture_2D_WrappedRGBt stores them in rows
+ *   when the table is longer than GL_MAX_TEXTURE_SIZE.
+ *
+ * The table is immutable after Build: const member functions can be
+ *   called from any number of threads.
+ *
+ * The batch functions use the simd.h backend (AVX2 / NEON / scalar) and
+ *   16 lanes if the library is compiled with AVX-512 (VOLVIS_USE_AVX512).
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_TRANSFER_FUNCTION_TABLE_H
+#define VOL_VIS_UTILS_TRANSFER_FUNCTION_TABLE_H
+
+#include <volvis_utils/transferfunction1d.h>
+#include <volvis_utils/simd.h>
+#ifndef VOLVIS_UTILS_NO_GL
+#include <gl_utils/texture1d.h>
+#include <gl_utils/texture2d.h>
+#endif
+
+#include <cstddef>
+#include <vector>
+
+namespace vis
+{
+  class TransferFunctionTable
+  {
+  public:
+    enum CHANNEL : unsigned int
+    {
+      RED        = 0,
+      GREEN      = 1,
+      BLUE       = 2,
+      EXTINCTION = 3,
+      OPACITY    = 4,
+    };
+    static const int NUMBER_OF_CHANNELS = 5;
+
+    // Extinction is clamped to the largest value of a GL_RGBA16F texel
+    static constexpr float MAX_EXTINCTION = 65504.0f;
+
+    static const int DEFAULT_MIN_ADAPTIVE_LENGTH = 256;
+    static const int DEFAULT_MAX_ADAPTIVE_LENGTH = 4096;
+    static constexpr float DEFAULT_MAX_ERROR = 1.0f / 1024.0f;
+
+    TransferFunctionTable ();
+    TransferFunctionTable (TransferFunction1D* tf);
+    ~TransferFunctionTable ();
+
+    // One entry for each density of tf, [0, tf->GetMaxDensity()]
+    void Build (TransferFunction1D* tf);
+    // Entries along the normalized value range [density_min, density_max]
+    //  of the data, exact if tf has at most min_length densities there
+    void BuildAdaptive (TransferFunction1D* tf, float density_min = 0.0f, float density_max = 1.0f,
+                        float max_error = DEFAULT_MAX_ERROR,
+                        int min_length = DEFAULT_MIN_ADAPTIVE_LENGTH,
+                        int max_length = DEFAULT_MAX_ADAPTIVE_LENGTH);
+    void Clear ();
+
+    bool IsBuilt () const;
+    int GetLength () const;
+    // Texel coordinate of a normalized sample before clamping
+    float GetScale () const;
+    float GetOffset () const;
+    // Largest difference with the exact table, 0 after Build
+    float GetMaxError () const;
+    size_t GetMemorySize () const;
+
+#ifndef VOLVIS_UTILS_NO_GL
+    // RGBt texture with the lookup of a GL_LINEAR 1D texture at texture
+    //  coordinate (u + 0.5) / GetLength()
+    gl::Texture1D* GenerateTexture_1D_RGBt () const;
+    // Same lookup from rows of row_length texels, row r holds the texels
+    //  [r * (row_length - 1), (r + 1) * (row_length - 1)]: the last texel
+    //  of a row is repeated at the start of the next one, so u is read
+    //  with a GL_LINEAR fetch in row min(floor(u / (row_length - 1)), rows - 1)
+    gl::Texture2D* GenerateTexture_2D_WrappedRGBt (int row_length) const;
+#endif
+
+    // GetLength() + 1 floats
+    const float* GetChannel (CHANNEL c) const;
+    const float* GetExtinction () const;
+    const float* GetOpacity () const;
+
+    // Classify count normalized samples into interleaved RGBt/RGBA
+    //  (4 floats per sample) or into one array per channel
+    void ClassifyRGBt (const float* samples, size_t count, float* rgbt) const;
+    void ClassifyRGBA (const float* samples, size_t count, float* rgba) const;
+    void ClassifyRGBt (const float* samples, size_t count, float* r, float* g, float* b, float* t) const;
+    void ClassifyRGBA (const float* samples, size_t count, float* r, float* g, float* b, float* a) const;
+    void ClassifyExtinction (const float* samples, size_t count, float* extinction) const;
+    void ClassifyOpacity (const float* samples, size_t count, float* opacity) const;
+
+    // Single vector lookup of the RGBt channels, for kernels built on simd.h
+    void Lookup (simd::vfloat density, simd::vfloat* rgbt) const
+    {
+      using namespace simd;
+      vfloat u = Min(Max(density * Set1(m_scale) + Set1(m_offset), Set1(0.0f)), Set1((float)(m_length - 1)));
+      vfloat u0 = Floor(u);
+      vfloat ut = u - u0;
+
+      int i0[WIDTH], i1[WIDTH];
+      StoreInt(i0, u0);
+      for (int l = 0; l < WIDTH; l++)
+        i1[l] = i0[l] + 1;
+
+      for (int c = 0; c < 4; c++)
+      {
+        const float* channel = GetChannel((CHANNEL)c);
+        vfloat s0 = Gather(channel, i0);
+        vfloat s1 = Gather(channel, i1);
+        rgbt[c] = s0 + (s1 - s0) * ut;
+      }
+    }
+
+  protected:
+
+  private:
+    // Write the channels[k] lookup of sample i at dst[k][i * stride]
+    void Classify (const float* samples, size_t count, const CHANNEL* channels, int n_channels,
+                   float* const* dst, int stride) const;
+
+    // Entry of Build for density, tf lerp between densities
+    static float GetExactEntry (TransferFunction1D* tf, int density, CHANNEL c);
+    // Entries uniformly spaced along the span + 1 exact entries of
+    //  BuildAdaptive, returns their max error
+    float Resample (const std::vector<float>& exact, int span, int cells);
+    static int Gcd (int a, int b);
+    // Channels of length + 1 entries, the last one copied by RepeatLastEntry
+    void Allocate (int length);
+    void RepeatLastEntry ();
+
+    // NUMBER_OF_CHANNELS arrays of m_length + 1 floats
+    std::vector<float> m_data;
+    int m_length;
+    float m_scale;
+    float m_offset;
+    float m_max_error;
+  };
+}
+
+#endif
@@ -1,5 +1,12 @@
 #include "utils.h"
-
+#include "gradientengine.h"
+#include "threadpool.h"
+#include "octahedral.h"
+#include <file_utils/profiler.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 #include <random>
 #include <fstream>
@@ -16,41 +23,125 @@ namespace vis
     GLfloat a;
   };
 
+  GLfloat* GenerateRTextureData (StructuredGridVolume* vol, int init_x, int init_y, int init_z,
+    int last_x, int last_y, int last_z)
+  {
+    PROFILE_SCOPE("GenerateRTextureData");
+    if (!vol) return NULL;
+
+    int size_x = abs(last_x - init_x);
+    int size_y = abs(last_y - init_y);
+    int size_z = abs(last_z - init_z);
+
+    GLfloat* scalar_values = new GLfloat[(size_t)size_x * size_y * size_z];
+
+    vol->DispatchVoxelView([&](auto view) {
+      for (int k = 0; k < size_z; k++)
+      {
+        for (int j = 0; j < size_y; j++)
+        {
+          GLfloat* dst = &scalar_values[(size_t)j * size_x + (size_t)k * size_x * size_y];
+          for (int i = 0; i < size_x; i++)
+            dst[i] = view.GetNormalizedOrZero(i + init_x, j + init_y, k + init_z);
+        }
+      }
+    });
+
+    return scalar_values;
+  }
+
   gl::Texture3D* GenerateRTexture(StructuredGridVolume* vol, int init_x, int init_y, int init_z,
     int last_x, int last_y, int last_z)
   {
+    PROFILE_SCOPE("GenerateRTexture");
     if (!vol) return NULL;
 
     int size_x = abs(last_x - init_x);
     int size_y = abs(last_y - init_y);
     int size_z = abs(last_z - init_z);
 
-    GLfloat* scalar_values = new GLfloat[size_x*size_y*size_z];
+    GLfloat* scalar_values = GenerateRTextureData(vol, init_x, init_y, init_z, last_x, last_y, last_z);
+    gl::Texture3D* tex3d_r = GenerateRTexture(scalar_values, size_x, size_y, size_z);
+    delete[] scalar_values;
 
-    for (int k = 0; k < size_z; k++)
-    {
-      for (int j = 0; j < size_y; j++)
+    return tex3d_r;
+  }
+
+  // Voxels of the slices [z0, z1), tightly packed
+  template <typename T>
+  static void CopySlices (const VoxelView<T>& view, int z0, int z1, T* dst)
+  {
+    memcpy(dst, view.data + view.Index(0, 0, z0), sizeof(T) * view.stride_z * (size_t)(z1 - z0));
+  }
+
+  // Each brick is acquired once per slice
+  template <typename T>
+  static void CopySlices (const PagedVoxelView<T>& view, int z0, int z1, T* dst)
+  {
+    const int B = view.pager->GetBrickSize();
+    ThreadPool::GetDefault()->ParallelFor(z1 - z0, [&](int k) {
+      PagedVoxelSampler<T> sampler(view);
+      T* slice = dst + (size_t)k * view.stride_z;
+      for (int y0 = 0; y0 < view.height; y0 += B)
       {
-        for (int i = 0; i < size_x; i++)
+        int y1 = std::min(y0 + B, view.height);
+        for (int x0 = 0; x0 < view.width; x0 += B)
         {
-          scalar_values[i + (j * size_x) + (k * size_x * size_y)] = (GLfloat)vol->GetNormalizedSample((i + init_x), (j + init_y), (k + init_z));
+          size_t n = (size_t)std::min(B, view.width - x0);
+          for (int y = y0; y < y1; y++)
+            memcpy(slice + view.Index(x0, y, 0), sampler.GetVoxel(x0, y, z0 + k), sizeof(T) * n);
         }
       }
+    });
+  }
+
+  gl::Texture3D* GenerateNativeRTexture (StructuredGridVolume* vol, gl::TextureStreamer* streamer)
+  {
+    PROFILE_SCOPE("GenerateNativeRTexture");
+    if (!vol) return NULL;
+
+    DataStorageSize dss = vol->GetDataStorageSize();
+    if (dss != DataStorageSize::_8_BITS && dss != DataStorageSize::_16_BITS)
+      return GenerateRTexture(vol, 0, 0, 0, vol->GetWidth(), vol->GetHeight(), vol->GetDepth());
+
+    GLint internal_format = (dss == DataStorageSize::_8_BITS) ? GL_R8 : GL_R16;
+    GLenum type = (dss == DataStorageSize::_8_BITS) ? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT;
+
+    gl::Texture3D* tex3d_r = new gl::Texture3D(vol->GetWidth(), vol->GetHeight(), vol->GetDepth());
+    tex3d_r->GenerateTexture(TEXTURE_FILTER, TEXTURE_FILTER, TEXTURE_WRAP, TEXTURE_WRAP, TEXTURE_WRAP);
+    tex3d_r->SetData(NULL, internal_format, GL_RED, type);
+
+    gl::TextureStreamer local_streamer;
+    if (streamer == nullptr) streamer = &local_streamer;
+
+    bool uploaded = false;
+    vol->DispatchVoxelAccess([&](auto view) {
+      typedef typename decltype(view)::value_type T;
+      uploaded = streamer->Upload(tex3d_r, GL_RED, type, sizeof(T), [&](int z0, int z1, void* dst) {
+        CopySlices(view, z0, z1, (T*)dst);
+      });
+    });
+
+    if (!uploaded)
+    {
+      delete tex3d_r;
+      return GenerateRTexture(vol, 0, 0, 0, vol->GetWidth(), vol->GetHeight(), vol->GetDepth());
     }
+    return tex3d_r;
+  }
+
+  gl::Texture3D* GenerateRTexture (const GLfloat* scalar_values, int size_x, int size_y, int size_z)
+  {
+    PROFILE_SCOPE("GenerateRTexture(data)");
+    if (!scalar_values) return NULL;
 
     gl::Texture3D* tex3d_r = new gl::Texture3D(size_x, size_y, size_z);
 
     tex3d_r->GenerateTexture(TEXTURE_FILTER, TEXTURE_FILTER, TEXTURE_WRAP, TEXTURE_WRAP, TEXTURE_WRAP);
 
-#ifdef USE_16F_INTERNAL_FORMAT
-    tex3d_r->SetData(scalar_values, GL_R16F, GL_RED, GL_FLOAT);
-#else
-    tex3d_r->SetData(scalar_values, GL_R32F, GL_RED, GL_FLOAT);
-#endif
+    tex3d_r->SetData((GLvoid*)scalar_values, GL_R16F, GL_RED, GL_FLOAT);
     gl::ExitOnGLError("ERROR: After SetData");
 
-    delete[] scalar_values;
-
     return tex3d_r;
   }
 
@@ -68,16 +159,10 @@ namespace vis
     {
       GLubyte* scalar_values = new GLubyte[size_x*size_y*size_z];
       
-      for (int k = 0; k < size_z; k++)
-      {
-        for (int j = 0; j < size_y; j++)
-        {
-          for (int i = 0; i < size_x; i++)
-          {
-            scalar_values[i + (j * size_x) + (k * size_x * size_y)] = (GLubyte)((vol->GetNormalizedSample(i, j, k)) * 255.0);
-          }
-        }
-      }
+      vol->DispatchVoxelView([&](auto view) {
+        for (size_t id = 0; id < view.size; id++)
+          scalar_values[id] = (GLubyte)((double)view.data[id] * decltype(view)::traits::NORMALIZATION * 255.0);
+      });
       tex3d_r->GenerateTexture(GL_NEAREST, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
       tex3d_r->SetData(scalar_values, GL_R8UI, GL_RED_INTEGER, GL_UNSIGNED_BYTE);
       delete[] scalar_values;
@@ -86,16 +171,10 @@ namespace vis
     {
       GLushort* scalar_values = new GLushort[size_x*size_y*size_z];
 
-      for (int k = 0; k < size_z; k++)
-      {
-        for (int j = 0; j < size_y; j++)
-        {
-          for (int i = 0; i < size_x; i++)
-          {
-            scalar_values[i + (j * size_x) + (k * size_x * size_y)] = (GLushort)((vol->GetNormalizedSample(i, j, k)) * 65535.0);
-          }
-        }
-      }
+      vol->DispatchVoxelView([&](auto view) {
+        for (size_t id = 0; id < view.size; id++)
+          scalar_values[id] = (GLushort)((double)view.data[id] * decltype(view)::traits::NORMALIZATION * 65535.0);
+      });
       tex3d_r->GenerateTexture(GL_NEAREST, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
       tex3d_r->SetData(scalar_values, GL_R16UI, GL_RED_INTEGER, GL_UNSIGNED_SHORT);
       delete[] scalar_values;
@@ -104,16 +183,10 @@ namespace vis
     {
       GLfloat* scalar_values = new GLfloat[size_x*size_y*size_z];
 
-      for (int k = 0; k < size_z; k++)
-      {
-        for (int j = 0; j < size_y; j++)
-        {
-          for (int i = 0; i < size_x; i++)
-          {
-            scalar_values[i + (j * size_x) + (k * size_x * size_y)] = (GLfloat)(vol->GetNormalizedSample(i, j, k));
-          }
-        }
-      }
+      vol->DispatchVoxelView([&](auto view) {
+        for (size_t id = 0; id < view.size; id++)
+          scalar_values[id] = (GLfloat)((double)view.data[id] * decltype(view)::traits::NORMALIZATION);
+      });
       tex3d_r->GenerateTexture(GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
       tex3d_r->SetData(scalar_values, GL_R16F, GL_RED, GL_FLOAT);
       delete[] scalar_values;
@@ -122,16 +195,10 @@ namespace vis
     {
       GLfloat* scalar_values = new GLfloat[size_x*size_y*size_z];
 
-      for (int k = 0; k < size_z; k++)
-      {
-        for (int j = 0; j < size_y; j++)
-        {
-          for (int i = 0; i < size_x; i++)
-          {
-            scalar_values[i + (j * size_x) + (k * size_x * size_y)] = (GLfloat)(vol->GetNormalizedSample(i, j, k));
-          }
-        }
-      }
+      vol->DispatchVoxelView([&](auto view) {
+        for (size_t id = 0; id < view.size; id++)
+          scalar_values[id] = (GLfloat)((double)view.data[id] * decltype(view)::traits::NORMALIZATION);
+      });
       tex3d_r->GenerateTexture(GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
       tex3d_r->SetData(scalar_values, GL_R32F, GL_RED, GL_FLOAT);
       delete[] scalar_values;
@@ -147,56 +214,24 @@ namespace vis
     int init_x, int init_y, int init_z,
     int last_x, int last_y, int last_z)
   {
+    PROFILE_SCOPE("GenerateGradientTexture");
     int width = vol->GetWidth();
     int height = vol->GetHeight();
     int depth = vol->GetDepth();
 
     //1
     //Generation of gradients
-    int n = gradient_sample_size;
-    glm::dvec3* gradients = new glm::dvec3[width * height * depth];
-    glm::dvec3 s1, s2;
-    int index = 0;
-    for (int z = 0; z < depth; z++)
-    {
-      for (int y = 0; y < height; y++)
-      {
-        for (int x = 0; x < width; x++)
-        {
-          s1.x = vol->GetNormalizedSample(x - n, y, z);
-          s2.x = vol->GetNormalizedSample(x + n, y, z);
-          s1.y = vol->GetNormalizedSample(x, y - n, z);
-          s2.y = vol->GetNormalizedSample(x, y + n, z);
-          s1.z = vol->GetNormalizedSample(x, y, z - n);
-          s2.z = vol->GetNormalizedSample(x, y, z + n);
-
-          glm::dvec3 s2s1 = (s2 - s1);
-
-          if (normalized_gradient)
-          {
-            s2s1 = glm::normalize<double>(s2s1);
-          }
-          else
-          {
-            s2s1.x = s2s1.x / 2.0f * (float)gradient_sample_size;
-            s2s1.y = s2s1.y / 2.0f * (float)gradient_sample_size;
-            s2s1.z = s2s1.z / 2.0f * (float)gradient_sample_size;
-          }
-
-          gradients[index] = s2s1;
-
-          if (gradients[index].x != gradients[index].x) //lm.IsNaN
-            gradients[index] = glm::dvec3(0);
-
-          index++;
-        }
-      }
-    }
+    GradientEngine gradient_engine;
+    gradient_engine.SetMethod(GradientEngine::METHOD::CENTRAL_DIFFERENCES);
+    gradient_engine.SetCentralDifferencesParameters(gradient_sample_size, normalized_gradient);
+    std::vector<float> gradient_field = gradient_engine.ComputeFloat(vol);
+    if (gradient_field.empty()) return nullptr;
+    glm::vec3* gradients = reinterpret_cast<glm::vec3*>(gradient_field.data());
 
     //2
     //Filtering
-    n = filter_nxnxn;
-    index = 0;
+    int n = filter_nxnxn;
+    int index = 0;
     if (n > 0)
     {
       for (int z = 0; z < depth; z++)
@@ -207,7 +242,7 @@ namespace vis
           {
             int fn = (n - 1) / 2;
 
-            glm::dvec3 average = glm::dvec3(0);
+            glm::vec3 average = glm::vec3(0);
             int num = 0;
             for (int k = z - fn; k <= z + fn; k++)
             {
@@ -224,9 +259,9 @@ namespace vis
               }
             }
 
-            average = average / (double)num;
+            average = average / (float)num;
             if (average.x != 0.0f && average.y != 0.0f && average.z != 0.0f)
-              average = glm::normalize<double>(average);
+              average = glm::normalize(average);
 
             gradients[index++] = average;
           }
@@ -252,17 +287,15 @@ namespace vis
     int size_x = abs(last_x - init_x);
     int size_y = abs(last_y - init_y);
     int size_z = abs(last_z - init_z);
-    glm::vec3* gradients_values = new glm::vec3[size_x*size_y*size_z];
 
-    for (int k = 0; k < size_z; k++)
+    // Crop the sub-volume in place, rows move to lower addresses
+    if (size_x != width || size_y != height || size_z != depth)
     {
-      for (int j = 0; j < size_y; j++)
-      {
-        for (int i = 0; i < size_x; i++)
-        {
-          gradients_values[i + (j * size_x) + (k * size_x * size_y)] = gradients[(i + init_x) + ((j + init_y) * width) + ((k + init_z) * width * height)];
-        }
-      }
+      for (int k = 0; k < size_z; k++)
+        for (int j = 0; j < size_y; j++)
+          std::memmove(gradient_field.data() + 3 * ((j * size_x) + (k * size_x * size_y)),
+            gradient_field.data() + 3 * (init_x + ((j + init_y) * width) + ((k + init_z) * width * height)),
+            sizeof(float) * 3 * size_x);
     }
 
     //4
@@ -270,82 +303,186 @@ namespace vis
     gl::Texture3D* tex3d_gradient = new gl::Texture3D(size_x, size_y, size_z);
     tex3d_gradient->GenerateTexture(TEXTURE_FILTER, TEXTURE_FILTER, TEXTURE_WRAP, TEXTURE_WRAP, TEXTURE_WRAP);
 
-#ifdef USE_16F_INTERNAL_FORMAT
-    tex3d_gradient->SetData((GLvoid*)gradients_values, GL_RGB16F, GL_RGB, GL_FLOAT);
-#else
-    tex3d_gradient->SetData((GLvoid*)gradients_values, GL_RGB32F, GL_RGB, GL_FLOAT);
-#endif
-
-    delete[] gradients_values;
-    delete[] gradients;
+    tex3d_gradient->SetData((GLvoid*)gradients, GL_RGB16F, GL_RGB, GL_FLOAT);
 
     return tex3d_gradient;
   }
 
+  GradientEngine::OUTPUT_FORMAT GetGradientOutputFormat (GRADIENT_TEXTURE_FORMAT format)
+  {
+    switch (format)
+    {
+      case GRADIENT_TEXTURE_FORMAT::RGB10_A2_GRADIENT:               return GradientEngine::OUTPUT_FORMAT::RGB10_A2;
+      case GRADIENT_TEXTURE_FORMAT::OCTAHEDRAL_16_GRADIENT:          return GradientEngine::OUTPUT_FORMAT::OCTAHEDRAL_16;
+      case GRADIENT_TEXTURE_FORMAT::OCTAHEDRAL_8_GRADIENT:           return GradientEngine::OUTPUT_FORMAT::OCTAHEDRAL_8;
+      case GRADIENT_TEXTURE_FORMAT::OCTAHEDRAL_8_MAGNITUDE_GRADIENT: return GradientEngine::OUTPUT_FORMAT::OCTAHEDRAL_8_MAGNITUDE;
+      default:                                                       return GradientEngine::OUTPUT_FORMAT::FLOAT_16;
+    }
+  }
+
   // https://en.wikipedia.org/wiki/Sobel_operator  
-  gl::Texture3D* GenerateSobelFeldmanGradientTexture(StructuredGridVolume* vol)
+  gl::Texture3D* GenerateSobelFeldmanGradientTexture(StructuredGridVolume* vol, GRADIENT_TEXTURE_FORMAT format)
   {
+    PROFILE_SCOPE("GenerateSobelFeldmanGradientTexture");
     int width = vol->GetWidth();
     int height = vol->GetHeight();
     int depth = vol->GetDepth();
 
-    int n = 1;
-    glm::dvec3* gradients = new glm::dvec3[width * height * depth];
-    for (int z = 0; z < depth; z++)
-    {
-      for (int y = 0; y < height; y++)
-      {
-        for (int x = 0; x < width; x++)
-        {
-          glm::dvec3 sg(0.0);
-          for (int v1 = -1; v1 <= 1; v1++)
-          {
-            for (int v2 = -1; v2 <= 1; v2++)
-            {
-              sg.z += ((double)vol->GetNormalizedSample(x + v1, y + v2, z - 1)) * (4.0 / pow(2.0, glm::abs(v1) + glm::abs(v2)))
-                + ((double)vol->GetNormalizedSample(x + v1, y + v2, z + 1)) * (-4.0 / pow(2.0, glm::abs(v1) + glm::abs(v2)));
+    // not normalized (for tests...), encoded by the engine row by row
+    GradientEngine gradient_engine;
+    gradient_engine.SetMethod(GradientEngine::METHOD::SOBEL_FELDMAN);
+    std::vector<uint8_t> texels = gradient_engine.ComputePacked(vol, GetGradientOutputFormat(format));
+    if (texels.empty()) return nullptr;
 
-              sg.y += ((double)vol->GetNormalizedSample(x + v1, y - 1, z + v2)) * (4.0 / pow(2.0, glm::abs(v1) + glm::abs(v2)))
-                + ((double)vol->GetNormalizedSample(x + v1, y + 1, z + v2)) * (-4.0 / pow(2.0, glm::abs(v1) + glm::abs(v2)));
+    return GeneratePackedGradientTexture(texels.data(), width, height, depth, format);
+  }
 
-              sg.x += ((double)vol->GetNormalizedSample(x - 1, y + v2, z + v1)) * (4.0 / pow(2.0, glm::abs(v1) + glm::abs(v2)))
-                + ((double)vol->GetNormalizedSample(x + 1, y + v2, z + v1)) * (-4.0 / pow(2.0, glm::abs(v1) + glm::abs(v2)));
-            }
-          }
+  gl::Texture3D* GenerateGradientTexture (GradientCache::Entry* entry, GRADIENT_TEXTURE_FORMAT format)
+  {
+    PROFILE_SCOPE("GenerateGradientTexture(GradientCache::Entry)");
+    if (entry == nullptr) return nullptr;
+
+    int size_x = (int)entry->GetWidth(), size_y = (int)entry->GetHeight(), size_z = (int)entry->GetDepth();
+    if (format == GRADIENT_TEXTURE_FORMAT::FLOAT_16_GRADIENT && entry->GetEncoding() == GradientCache::ENCODING::FLOAT_16)
+      return GeneratePackedGradientTexture(entry->GetData(), size_x, size_y, size_z, format);
+    if (format == GRADIENT_TEXTURE_FORMAT::OCTAHEDRAL_16_GRADIENT && entry->GetEncoding() == GradientCache::ENCODING::OCTAHEDRAL_16)
+      return GeneratePackedGradientTexture(entry->GetData(), size_x, size_y, size_z, format);
+
+    std::vector<float> gradients((size_t)size_x * size_y * size_z * 3);
+    entry->DecodeFloat(gradients.data());
+    return GenerateGradientTexture(gradients.data(), size_x, size_y, size_z, format, entry->GetMaxMagnitude());
+  }
 
-          // not normalized (for tests...)
-          gradients[x + (y * width) + (z * width * height)] = sg;
-        }
-      }
-    }
+  gl::Texture3D* GenerateHalfGradientTexture (const uint16_t* xyz_gradient, int size_x, int size_y, int size_z)
+  {
+    PROFILE_SCOPE("GenerateHalfGradientTexture");
+    if (xyz_gradient == nullptr) return nullptr;
+
+    gl::Texture3D* tex3d_gradient = new gl::Texture3D(size_x, size_y, size_z);
+    tex3d_gradient->GenerateTexture(TEXTURE_FILTER, TEXTURE_FILTER, TEXTURE_WRAP, TEXTURE_WRAP, TEXTURE_WRAP);
+    tex3d_gradient->SetData((GLvoid*)xyz_gradient, GL_RGB16F, GL_RGB, GL_HALF_FLOAT);
 
-    glm::vec3* gradients_values = new glm::vec3[width * height * depth];
-    for (int k = 0; k < depth; k++)
+    return tex3d_gradient;
+  }
+
+  gl::Texture3D* GenerateGradientTexture (const float* xyz_gradient, int size_x, int size_y, int size_z,
+    GRADIENT_TEXTURE_FORMAT format, float max_magnitude, ThreadPool* thread_pool)
+  {
+    PROFILE_SCOPE("GenerateGradientTexture(float)");
+    if (xyz_gradient == nullptr) return nullptr;
+
+    if (format != GRADIENT_TEXTURE_FORMAT::FLOAT_16_GRADIENT)
     {
-      for (int j = 0; j < height; j++)
-      {
-        for (int i = 0; i < width; i++)
-        {
-          gradients_values[i + (j * width) + (k * width * height)] = gradients[i + (j * width) + (k * width * height)];
-        }
-      }
+      std::vector<uint8_t> texels = PackGradientTexels(xyz_gradient, (size_t)size_x * size_y * size_z, format,
+        max_magnitude, thread_pool);
+      return GeneratePackedGradientTexture(texels.data(), size_x, size_y, size_z, format);
     }
 
-    //4
-    //Creating Texture
-    gl::Texture3D* tex3d_gradient = new gl::Texture3D(width, height, depth);
+    gl::Texture3D* tex3d_gradient = new gl::Texture3D(size_x, size_y, size_z);
     tex3d_gradient->GenerateTexture(TEXTURE_FILTER, TEXTURE_FILTER, TEXTURE_WRAP, TEXTURE_WRAP, TEXTURE_WRAP);
+    tex3d_gradient->SetData((GLvoid*)xyz_gradient, GL_RGB16F, GL_RGB, GL_FLOAT);
+    return tex3d_gradient;
+  }
 
-#ifdef USE_16F_INTERNAL_FORMAT
-    tex3d_gradient->SetData((GLvoid*)gradients_values, GL_RGB16F, GL_RGB, GL_FLOAT);
-#else
-    tex3d_gradient->SetData((GLvoid*)gradients_values, GL_RGB32F, GL_RGB, GL_FLOAT);
-#endif
-
-    delete[] gradients_values;
-    delete[] gradients;
+  std::vector<uint8_t> PackGradientTexels (const float* xyz_gradient, size_t n_voxels,
+    GRADIENT_TEXTURE_FORMAT format, float max_magnitude, ThreadPool* thread_pool)
+  {
+    PROFILE_SCOPE("PackGradientTexels");
+    GradientEngine::OUTPUT_FORMAT texel_format = GetGradientOutputFormat(format);
+    size_t texel_size = GradientEngine::GetBytesPerVoxel(texel_format);
+    std::vector<uint8_t> texels(n_voxels * texel_size);
+    if (thread_pool == nullptr) thread_pool = ThreadPool::GetDefault();
+
+    const size_t chunk_size = (size_t)1 << 16;
+    int n_chunks = (int)((n_voxels + chunk_size - 1) / chunk_size);
+    thread_pool->ParallelFor(n_chunks, [&](int c) {
+      size_t v0 = (size_t)c * chunk_size;
+      size_t v1 = std::min(n_voxels, v0 + chunk_size);
+      GradientEngine::Encode(texel_format, xyz_gradient + v0 * 3, v1 - v0, max_magnitude,
+        texels.data() + v0 * texel_size);
+    });
+    return texels;
+  }
 
+  gl::Texture3D* GeneratePackedGradientTexture (const void* texels, int size_x, int size_y, int size_z,
+    GRADIENT_TEXTURE_FORMAT format)
+  {
+    PROFILE_SCOPE("GeneratePackedGradientTexture");
+    if (texels == nullptr) return nullptr;
+    if (format == GRADIENT_TEXTURE_FORMAT::FLOAT_16_GRADIENT)
+      return GenerateHalfGradientTexture((const uint16_t*)texels, size_x, size_y, size_z);
+
+    // Octahedral codes are decoded before the interpolation, so they are
+    //  fetched as integers without filtering
+    bool octahedral = format != GRADIENT_TEXTURE_FORMAT::RGB10_A2_GRADIENT;
+    GLint filter = octahedral ? GL_NEAREST : TEXTURE_FILTER;
+    gl::Texture3D* tex3d_gradient = new gl::Texture3D(size_x, size_y, size_z);
+    tex3d_gradient->GenerateTexture(filter, filter, TEXTURE_WRAP, TEXTURE_WRAP, TEXTURE_WRAP);
+    if (format == GRADIENT_TEXTURE_FORMAT::OCTAHEDRAL_16_GRADIENT)
+    {
+      tex3d_gradient->SetData((GLvoid*)texels, GL_RG16I, GL_RG_INTEGER, GL_SHORT);
+    }
+    else if (format == GRADIENT_TEXTURE_FORMAT::OCTAHEDRAL_8_GRADIENT
+          || format == GRADIENT_TEXTURE_FORMAT::OCTAHEDRAL_8_MAGNITUDE_GRADIENT)
+    {
+      // rows of 2 and 3 byte texels are not 4-byte aligned
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      if (format == GRADIENT_TEXTURE_FORMAT::OCTAHEDRAL_8_GRADIENT)
+        tex3d_gradient->SetData((GLvoid*)texels, GL_RG8I, GL_RG_INTEGER, GL_BYTE);
+      else
+        tex3d_gradient->SetData((GLvoid*)texels, GL_RGB8I, GL_RGB_INTEGER, GL_BYTE);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    else
+    {
+      tex3d_gradient->SetData((GLvoid*)texels, GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV);
+    }
     return tex3d_gradient;
   }
 
-}
\ No newline at end of file
+  gl::Texture3D* GenerateOccupancyTexture (const OccupancyGrid* occupancy_grid)
+  {
+    PROFILE_SCOPE("GenerateOccupancyTexture");
+    if (occupancy_grid == nullptr || !occupancy_grid->IsBuilt()) return NULL;
+
+    glm::ivec3 grid_size = occupancy_grid->GetGridSize();
+    gl::Texture3D* tex3d_occupancy = new gl::Texture3D(grid_size.x, grid_size.y, grid_size.z);
+    tex3d_occupancy->GenerateTexture(GL_NEAREST, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+
+    // rows of bricks are not 4-byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    tex3d_occupancy->SetData((GLvoid*)occupancy_grid->GetData(), GL_R8, GL_RED, GL_UNSIGNED_BYTE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    gl::ExitOnGLError("ERROR: After SetData");
+
+    return tex3d_occupancy;
+  }
+
+  gl::Texture3D* GenerateSamplingRateTexture (const OccupancyGrid* occupancy_grid)
+  {
+    PROFILE_SCOPE("GenerateSamplingRateTexture");
+    if (occupancy_grid == nullptr || !occupancy_grid->HasSamplingRate()) return NULL;
+
+    glm::ivec3 grid_size = occupancy_grid->GetGridSize();
+    gl::Texture3D* tex3d_rate = new gl::Texture3D(grid_size.x, grid_size.y, grid_size.z);
+    tex3d_rate->GenerateTexture(GL_NEAREST, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+    tex3d_rate->SetData((GLvoid*)occupancy_grid->GetSamplingRateData(), GL_R32F, GL_RED, GL_FLOAT);
+    gl::ExitOnGLError("ERROR: After SetData");
+
+    return tex3d_rate;
+  }
+
+  gl::Texture3D* GenerateBrickRangeTexture (const VolumeBricks* bricks)
+  {
+    PROFILE_SCOPE("GenerateBrickRangeTexture");
+    if (bricks == nullptr || !bricks->IsBuilt()) return NULL;
+
+    glm::ivec3 grid_size = bricks->GetGridSize();
+    gl::Texture3D* tex3d_range = new gl::Texture3D(grid_size.x, grid_size.y, grid_size.z);
+    tex3d_range->GenerateTexture(GL_NEAREST, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+    tex3d_range->SetData((GLvoid*)bricks->GetMinMaxData(), GL_RG32F, GL_RG, GL_FLOAT);
+    gl::ExitOnGLError("ERROR: After SetData");
+
+    return tex3d_range;
+  }
+}
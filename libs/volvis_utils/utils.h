@@ -6,12 +6,18 @@
 
 #include <gl_utils/texture3d.h>
 #include <gl_utils/texture2d.h>
+#include <gl_utils/texturestreamer.h>
 #include <volvis_utils/transferfunction.h>
 #include <volvis_utils/structuredgridvolume.h>
+#include <volvis_utils/gradientcache.h>
+#include <volvis_utils/gradientengine.h>
+#include <volvis_utils/occupancygrid.h>
+#include <volvis_utils/threadpool.h>
 
 #include <glm/glm.hpp>
 
-#define USE_16F_INTERNAL_FORMAT
+#include <cstdint>
+#include <vector>
 
 namespace vis
 {
@@ -29,6 +35,16 @@ namespace vis
     float Color[3];
   } Vertex2p;
 
+  // Normalized GLfloat copy of the voxels in [init, last), the data uploaded
+  //  by GenerateRTexture (new[] array, 0 outside the grid)
+  GLfloat* GenerateRTextureData (StructuredGridVolume* vol,
+    int init_x,
+    int init_y,
+    int init_z,
+    int last_x,
+    int last_y,
+    int last_z);
+
   gl::Texture3D* GenerateRTexture (StructuredGridVolume* vol,
     int init_x = 0,
     int init_y = 0,
@@ -37,6 +53,16 @@ namespace vis
     int last_y = 0,
     int last_z = 0);
 
+  // Upload size_x * size_y * size_z normalized values, the data of
+  //  GenerateRTextureData (prepared outside of the GL thread)
+  gl::Texture3D* GenerateRTexture (const GLfloat* scalar_values, int size_x, int size_y, int size_z);
+
+  // 8 and 16 bit volumes are uploaded as GL_R8/GL_R16 (same normalized
+  //  values of GenerateRTexture), streamed slab by slab from the voxels
+  //  in memory, in the mapped file or in the bricks of a paged volume,
+  //  without a float copy. Other volumes use GenerateRTexture.
+  gl::Texture3D* GenerateNativeRTexture (StructuredGridVolume* vol, gl::TextureStreamer* streamer = nullptr);
+
   enum VIS_UTILS_DATA_TYPE : unsigned int {
     UNSIGNED_BYTE  = 0,
     UNSIGNED_SHORT = 1,
@@ -57,8 +83,56 @@ namespace vis
     int last_y = -1,
     int last_z = -1);
 
+  // Texel formats of the gradient textures, decoded by the ray casters
+  enum GRADIENT_TEXTURE_FORMAT : unsigned int {
+    // gradient vector, GL_RGB16F (GL_RGBA16F from the compute shader)
+    FLOAT_16_GRADIENT = 0,
+    // unit direction * 0.5 + 0.5, GL_RGB10_A2, alpha is 0 for zero vectors
+    RGB10_A2_GRADIENT = 1,
+    // octahedral direction codes (octahedral.h), GL_RG16I + GL_NEAREST,
+    //  zero vectors are OCTAHEDRAL_16_ZERO
+    OCTAHEDRAL_16_GRADIENT = 2,
+    // octahedral direction codes, GL_RG8I + GL_NEAREST, zero vectors are
+    //  OCTAHEDRAL_8_ZERO
+    OCTAHEDRAL_8_GRADIENT = 3,
+    // octahedral direction + sqrt of the relative magnitude, GL_RGB8I
+    //  (GL_RGBA8I from the compute shader) + GL_NEAREST
+    OCTAHEDRAL_8_MAGNITUDE_GRADIENT = 4,
+  };
+
+  // Layout of the texels of format written by vis::GradientEngine
+  GradientEngine::OUTPUT_FORMAT GetGradientOutputFormat (GRADIENT_TEXTURE_FORMAT format);
+
   // https://en.wikipedia.org/wiki/Sobel_operator  
-  gl::Texture3D* GenerateSobelFeldmanGradientTexture (StructuredGridVolume* vol);
+  gl::Texture3D* GenerateSobelFeldmanGradientTexture (StructuredGridVolume* vol,
+    GRADIENT_TEXTURE_FORMAT format = GRADIENT_TEXTURE_FORMAT::FLOAT_16_GRADIENT);
+
+  // FLOAT_16 entries are uploaded as GL_HALF_FLOAT and OCTAHEDRAL_16
+  //  entries as GL_RG16I straight from the entry data
+  gl::Texture3D* GenerateGradientTexture (GradientCache::Entry* entry,
+    GRADIENT_TEXTURE_FORMAT format = GRADIENT_TEXTURE_FORMAT::FLOAT_16_GRADIENT);
+  // 3 half floats per voxel (GradientEngine::ComputeHalf)
+  gl::Texture3D* GenerateHalfGradientTexture (const uint16_t* xyz_gradient, int size_x, int size_y, int size_z);
+  // 3 floats per voxel (GradientEngine::ComputeFloat)
+  gl::Texture3D* GenerateGradientTexture (const float* xyz_gradient, int size_x, int size_y, int size_z,
+    GRADIENT_TEXTURE_FORMAT format, float max_magnitude, ThreadPool* thread_pool = nullptr);
+
+  // Texels of format, in the layout of GradientEngine::ComputePacked. The
+  //  magnitudes of OCTAHEDRAL_8_MAGNITUDE are relative to max_magnitude,
+  //  the GradientEngine::GetMaxMagnitude of the engine of the field
+  std::vector<uint8_t> PackGradientTexels (const float* xyz_gradient, size_t n_voxels,
+    GRADIENT_TEXTURE_FORMAT format, float max_magnitude, ThreadPool* thread_pool = nullptr);
+  gl::Texture3D* GeneratePackedGradientTexture (const void* texels, int size_x, int size_y, int size_z,
+    GRADIENT_TEXTURE_FORMAT format);
+
+  // One GL_R8 texel per brick, GL_NEAREST: 1.0 occupied, 0.0 empty
+  gl::Texture3D* GenerateOccupancyTexture (const OccupancyGrid* occupancy_grid);
+  // One GL_R32F texel per brick, GL_NEAREST: relative sampling rate
+  //  (see OccupancyGrid::GetSamplingRate)
+  gl::Texture3D* GenerateSamplingRateTexture (const OccupancyGrid* occupancy_grid);
+  // One GL_RG32F texel per brick, GL_NEAREST: normalized (min, max) of the
+  //  voxels read by the samples inside the brick (see VolumeBricks)
+  gl::Texture3D* GenerateBrickRangeTexture (const VolumeBricks* bricks);
 }
 
 #endif
@@ -0,0 +1,173 @@
+#include "volumebricks.h"
+#include "structuredgridvolume.h"
+#include <file_utils/profiler.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace vis
+{
+  namespace
+  {
+    template <typename T>
+    void BuildBrickRow (const VoxelView<T>& view, int brick_size, glm::ivec3 grid_size,
+                        int by, int bz, float* min_max, unsigned char* bricked_voxels)
+    {
+      const int B = brick_size;
+
+      for (int bx = 0; bx < grid_size.x; bx++)
+      {
+        int brick_id = bx + (by + bz * grid_size.y) * grid_size.x;
+        ComputeBrickRange(view, B, bx, by, bz, &min_max[brick_id * 2]);
+
+        if (bricked_voxels == nullptr) continue;
+
+        // Copy the brick, clamping partial bricks to the border
+        T* dst = reinterpret_cast<T*>(bricked_voxels) + (size_t)brick_id * B * B * B;
+        for (int z = 0; z < B; z++)
+        {
+          int vz = std::min(bz * B + z, view.depth - 1);
+          for (int y = 0; y < B; y++)
+          {
+            int vy = std::min(by * B + y, view.height - 1);
+            const T* row = view.data + view.Index(0, vy, vz);
+            int vx = bx * B;
+            int n = std::min(B, view.width - vx);
+            std::memcpy(dst, row + vx, sizeof(T) * n);
+            for (int x = n; x < B; x++)
+              dst[x] = row[view.width - 1];
+            dst += B;
+          }
+        }
+      }
+    }
+  }
+
+  VolumeBricks::VolumeBricks ()
+    : m_brick_size(0)
+    , m_grid_size(0)
+    , m_vol_resolution(0)
+    , m_data_storage_size(DataStorageSize::UNKNOWN)
+  {
+  }
+
+  VolumeBricks::~VolumeBricks ()
+  {
+    Clear();
+  }
+
+  bool VolumeBricks::Build (StructuredGridVolume* vol, int brick_size, bool store_bricked_voxels, ThreadPool* thread_pool)
+  {
+    PROFILE_SCOPE("VolumeBricks::Build");
+    Clear();
+    if (vol == nullptr) return false;
+
+    if (brick_size < 4 || brick_size > 256 || (brick_size & (brick_size - 1)) != 0)
+    {
+      printf("VolumeBricks: invalid brick size %d\n", brick_size);
+      return false;
+    }
+
+    if (vol->IsPaged())
+      return BuildFromPager(vol->GetBrickPager(), brick_size, store_bricked_voxels);
+    if (vol->GetArrayData() == nullptr) return false;
+
+    if (thread_pool == nullptr)
+      thread_pool = ThreadPool::GetDefault();
+
+    m_brick_size = brick_size;
+    m_vol_resolution = glm::ivec3(vol->GetWidth(), vol->GetHeight(), vol->GetDepth());
+    m_grid_size = (m_vol_resolution + brick_size - 1) / brick_size;
+    m_data_storage_size = vol->GetDataStorageSize();
+
+    m_min_max.resize((size_t)GetNumberOfBricks() * 2);
+    if (store_bricked_voxels)
+      m_bricked_voxels.resize((size_t)GetNumberOfBricks() * GetBrickSizeBytes());
+
+    unsigned char* bricked_voxels = store_bricked_voxels ? m_bricked_voxels.data() : nullptr;
+    return vol->DispatchVoxelView([&](auto view) {
+      thread_pool->ParallelFor(m_grid_size.y * m_grid_size.z, [&](int row_id) {
+        BuildBrickRow(view, m_brick_size, m_grid_size, row_id % m_grid_size.y, row_id / m_grid_size.y,
+                      m_min_max.data(), bricked_voxels);
+      });
+    });
+  }
+
+  bool VolumeBricks::BuildFromPager (BrickPager* pager, int brick_size, bool store_bricked_voxels)
+  {
+    if (pager->GetBrickSize() != brick_size || store_bricked_voxels)
+    {
+      printf("VolumeBricks: paged volumes only have the ranges of their %d^3 bricks\n", pager->GetBrickSize());
+      return false;
+    }
+
+    m_brick_size = brick_size;
+    m_vol_resolution = pager->GetVolumeResolution();
+    m_grid_size = pager->GetGridSize();
+    m_data_storage_size = pager->GetDataStorageSize();
+    m_min_max.assign(pager->GetMinMaxData(), pager->GetMinMaxData() + (size_t)GetNumberOfBricks() * 2);
+    return true;
+  }
+
+  void VolumeBricks::Clear ()
+  {
+    m_brick_size = 0;
+    m_grid_size = glm::ivec3(0);
+    m_vol_resolution = glm::ivec3(0);
+    m_data_storage_size = DataStorageSize::UNKNOWN;
+    std::vector<float>().swap(m_min_max);
+    std::vector<unsigned char>().swap(m_bricked_voxels);
+  }
+
+  bool VolumeBricks::IsBuilt () const
+  {
+    return !m_min_max.empty();
+  }
+
+  int VolumeBricks::GetBrickSize () const
+  {
+    return m_brick_size;
+  }
+
+  glm::ivec3 VolumeBricks::GetGridSize () const
+  {
+    return m_grid_size;
+  }
+
+  int VolumeBricks::GetNumberOfBricks () const
+  {
+    return m_grid_size.x * m_grid_size.y * m_grid_size.z;
+  }
+
+  glm::ivec3 VolumeBricks::GetVolumeResolution () const
+  {
+    return m_vol_resolution;
+  }
+
+  const float* VolumeBricks::GetMinMaxData () const
+  {
+    return m_min_max.data();
+  }
+
+  bool VolumeBricks::HasBrickedVoxels () const
+  {
+    return !m_bricked_voxels.empty();
+  }
+
+  DataStorageSize VolumeBricks::GetDataStorageSize () const
+  {
+    return m_data_storage_size;
+  }
+
+  const void* VolumeBricks::GetBrickVoxels (int brick_id) const
+  {
+    if (m_bricked_voxels.empty()) return nullptr;
+    return m_bricked_voxels.data() + (size_t)brick_id * GetBrickSizeBytes();
+  }
+
+  size_t VolumeBricks::GetBrickSizeBytes () const
+  {
+    return (size_t)m_brick_size * m_brick_size * m_brick_size * GetStorageSizeBytes(m_data_storage_size);
+  }
+}
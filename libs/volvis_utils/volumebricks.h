@@ -0,0 +1,122 @@
+/**
+ * Bricked representation of a structured grid volume.
+ *
+ * The grid is split in brick_size^3 bricks (the bricks of the last
+ *   row/column/slice may be partial). Each brick keeps the normalized
+ *   min/max of the voxels read by a trilinear sample taken inside it,
+ *   so the range includes a 1 voxel apron around the brick.
+ *
+ * Optionally, the voxels are also copied in brick order: each brick is
+ *   a contiguous brick_size^3 block (x fastest), with the voxels of
+ *   partial bricks clamped to the grid border.
+ *
+ * Built in parallel, one task per (y, z) row of bricks.
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_VOLUME_BRICKS_H
+#define VOL_VIS_UTILS_VOLUME_BRICKS_H
+
+#include <volvis_utils/voxelstorage.h>
+#include <volvis_utils/threadpool.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace vis
+{
+  class StructuredGridVolume;
+  class BrickPager;
+
+  // Normalized [min, max] of the voxels read by a trilinear sample inside
+  //  brick (bx, by, bz): [b * B - 1, (b + 1) * B] in each axis
+  template <typename T>
+  void ComputeBrickRange (const VoxelView<T>& view, int brick_size, int bx, int by, int bz, float* min_max)
+  {
+    const int B = brick_size;
+    int x0 = std::max(bx * B - 1, 0), x1 = std::min((bx + 1) * B, view.width - 1);
+    int y0 = std::max(by * B - 1, 0), y1 = std::min((by + 1) * B, view.height - 1);
+    int z0 = std::max(bz * B - 1, 0), z1 = std::min((bz + 1) * B, view.depth - 1);
+
+    T vmin = view.Get(x0, y0, z0);
+    T vmax = vmin;
+    for (int z = z0; z <= z1; z++)
+    {
+      for (int y = y0; y <= y1; y++)
+      {
+        const T* row = view.data + view.Index(0, y, z);
+        for (int x = x0; x <= x1; x++)
+        {
+          vmin = std::min(vmin, row[x]);
+          vmax = std::max(vmax, row[x]);
+        }
+      }
+    }
+
+    const float norm = (float)VoxelTypeTraits<T>::NORMALIZATION;
+    min_max[0] = (float)vmin * norm;
+    min_max[1] = (float)vmax * norm;
+  }
+
+  class VolumeBricks
+  {
+  public:
+    static const int DEFAULT_BRICK_SIZE = 16;
+
+    VolumeBricks ();
+    ~VolumeBricks ();
+
+    // brick_size must be a power of two in [4, 256]
+    //  . paged volumes take the ranges stored in the bricked file, so
+    //    brick_size must be the brick size of the file and the voxels
+    //    are not stored
+    bool Build (StructuredGridVolume* vol, int brick_size = DEFAULT_BRICK_SIZE,
+                bool store_bricked_voxels = false, ThreadPool* thread_pool = nullptr);
+    void Clear ();
+
+    bool IsBuilt () const;
+
+    int GetBrickSize () const;
+    // number of bricks in each axis
+    glm::ivec3 GetGridSize () const;
+    int GetNumberOfBricks () const;
+    // resolution of the bricked volume
+    glm::ivec3 GetVolumeResolution () const;
+
+    int GetBrickIndex (int bx, int by, int bz) const
+    {
+      return bx + (by + bz * m_grid_size.y) * m_grid_size.x;
+    }
+
+    // Normalized density range of each brick, including the apron
+    float GetMin (int brick_id) const { return m_min_max[brick_id * 2 + 0]; }
+    float GetMax (int brick_id) const { return m_min_max[brick_id * 2 + 1]; }
+    // 2 floats (min, max) per brick
+    const float* GetMinMaxData () const;
+
+    bool HasBrickedVoxels () const;
+    DataStorageSize GetDataStorageSize () const;
+    // brick_size^3 voxels of GetDataStorageSize type
+    const void* GetBrickVoxels (int brick_id) const;
+    size_t GetBrickSizeBytes () const;
+
+  protected:
+
+  private:
+    bool BuildFromPager (BrickPager* pager, int brick_size, bool store_bricked_voxels);
+
+    int m_brick_size;
+    glm::ivec3 m_grid_size;
+    glm::ivec3 m_vol_resolution;
+
+    std::vector<float> m_min_max;
+
+    DataStorageSize m_data_storage_size;
+    std::vector<unsigned char> m_bricked_voxels;
+  };
+}
+
+#endif
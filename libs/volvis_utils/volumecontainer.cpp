@@ -0,0 +1,629 @@
+#include "volumecontainer.h"
+#include "gradientengine.h"
+#include "octahedral.h"
+#include <file_utils/profiler.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+namespace vis
+{
+  static const char VOLUME_CONTAINER_MAGIC[8] = { 'V', 'V', 'V', 'O', 'L', '\0', '\0', '\0' };
+  static const uint32_t VOLUME_CONTAINER_VERSION = 1;
+
+  // The octahedral snorm components are stored biased by 0x8000, so
+  //  directions around zero are neighbor values for the predictor
+  static const uint16_t VOLUME_CONTAINER_GRADIENT_BIAS = 0x8000;
+
+  struct VolumeContainer::Header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t storage;
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    uint32_t brick_size;
+    uint32_t max_error;
+    uint32_t reduction;
+    uint32_t n_chunks;
+    uint32_t reserved;
+    double scale[3];
+    float value_range[2];
+    uint64_t histogram[HISTOGRAM_BINS];
+    uint64_t chunk_table_offset;
+  };
+
+  struct VolumeContainer::Chunk
+  {
+    uint32_t type;
+    uint32_t level;
+    uint32_t storage;
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    uint32_t brick_size;
+    uint32_t max_error;
+    double scale[3];
+    // n_bricks + 1 brick offsets, relative to data_offset
+    uint64_t index_offset;
+    // 2 floats per brick
+    uint64_t min_max_offset;
+    uint64_t data_offset;
+    uint64_t data_size;
+  };
+
+  // Histogram of the normalized voxels, one z slice per task
+  static void ComputeHistogram (StructuredGridVolume* vol, ThreadPool* thread_pool, uint64_t* histogram, float* value_range)
+  {
+    PROFILE_SCOPE("VolumeContainer::ComputeHistogram");
+    const int B = VolumeContainer::HISTOGRAM_BINS;
+    int width = (int)vol->GetWidth(), height = (int)vol->GetHeight(), depth = (int)vol->GetDepth();
+
+    std::vector<uint64_t> slice_histograms((size_t)depth * B, 0);
+    std::vector<float> slice_ranges((size_t)depth * 2);
+    vol->DispatchVoxelAccess([&](auto view) {
+      thread_pool->ParallelFor(depth, [&](int z) {
+        typename decltype(view)::Sampler sampler(view);
+        std::vector<float> row(width);
+        uint64_t* hist = &slice_histograms[(size_t)z * B];
+        float vmin = std::numeric_limits<float>::max(), vmax = -std::numeric_limits<float>::max();
+        for (int y = 0; y < height; y++)
+        {
+          sampler.GetRowNormalized(y, z, row.data());
+          for (int x = 0; x < width; x++)
+          {
+            hist[std::min(std::max((int)(row[x] * (float)B), 0), B - 1)]++;
+            vmin = std::min(vmin, row[x]);
+            vmax = std::max(vmax, row[x]);
+          }
+        }
+        slice_ranges[(size_t)z * 2 + 0] = vmin;
+        slice_ranges[(size_t)z * 2 + 1] = vmax;
+      });
+    });
+
+    value_range[0] = std::numeric_limits<float>::max();
+    value_range[1] = -std::numeric_limits<float>::max();
+    for (int i = 0; i < B; i++)
+      histogram[i] = 0;
+    for (int z = 0; z < depth; z++)
+    {
+      for (int i = 0; i < B; i++)
+        histogram[i] += slice_histograms[(size_t)z * B + i];
+      value_range[0] = std::min(value_range[0], slice_ranges[(size_t)z * 2 + 0]);
+      value_range[1] = std::max(value_range[1], slice_ranges[(size_t)z * 2 + 1]);
+    }
+  }
+
+  bool VolumeContainer::Write (StructuredGridVolume* vol, std::string filename, const VolumeContainerSettings& settings,
+                               ThreadPool* thread_pool)
+  {
+    PROFILE_SCOPE("VolumeContainer::Write");
+    if (vol == nullptr || (vol->GetArrayData() == nullptr && !vol->IsPaged()))
+    {
+      printf("VolumeContainer: the volume has no data\n");
+      return false;
+    }
+    if (vol->GetDataStorageSize() != DataStorageSize::_8_BITS && vol->GetDataStorageSize() != DataStorageSize::_16_BITS)
+    {
+      printf("VolumeContainer: only 8 and 16 bit volumes can be written\n");
+      return false;
+    }
+    if (thread_pool == nullptr)
+      thread_pool = ThreadPool::GetDefault();
+
+    Header header;
+    memset(&header, 0, sizeof(Header));
+    memcpy(header.magic, VOLUME_CONTAINER_MAGIC, sizeof(VOLUME_CONTAINER_MAGIC));
+    header.version = VOLUME_CONTAINER_VERSION;
+    header.storage = (uint32_t)vol->GetDataStorageSize();
+    header.width = vol->GetWidth();
+    header.height = vol->GetHeight();
+    header.depth = vol->GetDepth();
+    header.brick_size = (uint32_t)settings.brick_size;
+    header.max_error = (uint32_t)std::max(settings.max_error, 0);
+    header.reduction = (uint32_t)settings.reduction;
+    header.scale[0] = vol->GetScaleX();
+    header.scale[1] = vol->GetScaleY();
+    header.scale[2] = vol->GetScaleZ();
+    ComputeHistogram(vol, thread_pool, header.histogram, header.value_range);
+
+    // Same temporary file approach of GradientCache::Write
+    std::string tmp_filename = filename + ".tmp";
+    FILE* fp = fopen(tmp_filename.c_str(), "wb");
+    if (fp == nullptr)
+    {
+      printf("VolumeContainer: could not write %s\n", filename.c_str());
+      return false;
+    }
+
+    // The header is written again after the chunks
+    uint64_t file_offset = sizeof(Header);
+    std::vector<Chunk> chunks;
+    bool written = fwrite(&header, sizeof(Header), 1, fp) == 1 &&
+                   WriteChunk(fp, &file_offset, CHUNK_TYPE::VOLUME, 0, vol, settings.max_error,
+                              settings.brick_size, thread_pool, &chunks);
+
+    if (written && settings.write_levels)
+    {
+      VolumePyramid pyramid;
+      if (pyramid.Build(vol, settings.reduction, thread_pool))
+      {
+        for (int l = 1; l < pyramid.GetNumberOfLevels() && written; l++)
+        {
+          if (pyramid.IsLevelAvailable(l))
+            written = WriteChunk(fp, &file_offset, CHUNK_TYPE::VOLUME, l, pyramid.GetLevel(l), settings.max_error,
+                                 settings.brick_size, thread_pool, &chunks);
+        }
+      }
+    }
+
+    if (written && settings.write_gradient)
+      written = WriteGradient(fp, &file_offset, vol, settings.brick_size, thread_pool, &chunks);
+
+    header.n_chunks = (uint32_t)chunks.size();
+    header.chunk_table_offset = file_offset;
+    written = written && fwrite(chunks.data(), sizeof(Chunk), chunks.size(), fp) == chunks.size() &&
+              fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(Header), 1, fp) == 1;
+    written = (fclose(fp) == 0) && written;
+
+    // The previous file is only replaced once the new one is complete
+    if (written)
+    {
+      std::remove(filename.c_str());
+      written = std::rename(tmp_filename.c_str(), filename.c_str()) == 0;
+    }
+    if (!written)
+    {
+      std::remove(tmp_filename.c_str());
+      printf("VolumeContainer: could not write %s\n", filename.c_str());
+      return false;
+    }
+
+    printf("VolumeContainer: saved %s (%zu chunks, %llu bytes)\n", filename.c_str(), chunks.size(),
+      (unsigned long long)(file_offset + chunks.size() * sizeof(Chunk)));
+    return true;
+  }
+
+  VolumeContainer::VolumeContainer ()
+    : m_resolution(0)
+    , m_scale(1.0)
+    , m_data_storage_size(DataStorageSize::UNKNOWN)
+    , m_brick_size(0)
+    , m_max_error(0)
+    , m_reduction(VolumePyramid::REDUCTION::AVERAGE)
+    , m_value_range(0.0f)
+  {
+  }
+
+  VolumeContainer::~VolumeContainer ()
+  {
+    Close();
+  }
+
+  bool VolumeContainer::Open (std::string filename)
+  {
+    PROFILE_SCOPE("VolumeContainer::Open");
+    Close();
+
+    if (!m_file.Open(filename, MappedFile::ACCESS_PATTERN::RANDOM))
+    {
+      printf("VolumeContainer: could not open %s\n", filename.c_str());
+      return false;
+    }
+
+    const unsigned char* data = static_cast<const unsigned char*>(m_file.GetData());
+    size_t file_size = m_file.GetSize();
+
+    Header header;
+    bool valid = file_size >= sizeof(Header);
+    if (valid)
+    {
+      memcpy(&header, data, sizeof(Header));
+      valid = memcmp(header.magic, VOLUME_CONTAINER_MAGIC, sizeof(VOLUME_CONTAINER_MAGIC)) == 0 &&
+              header.version == VOLUME_CONTAINER_VERSION &&
+              header.chunk_table_offset <= file_size &&
+              (uint64_t)header.n_chunks * sizeof(Chunk) <= file_size - header.chunk_table_offset;
+    }
+
+    if (valid)
+    {
+      m_chunks.resize(header.n_chunks);
+      memcpy(m_chunks.data(), data + header.chunk_table_offset, m_chunks.size() * sizeof(Chunk));
+
+      for (size_t i = 0; i < m_chunks.size() && valid; i++)
+      {
+        const Chunk& c = m_chunks[i];
+        uint64_t n_bricks = 0;
+        valid = (c.storage == (uint32_t)DataStorageSize::_8_BITS || c.storage == (uint32_t)DataStorageSize::_16_BITS) &&
+                c.brick_size >= 4 && c.brick_size <= 256 && (c.brick_size & (c.brick_size - 1)) == 0 &&
+                c.width > 0 && c.height > 0 && c.depth > 0;
+        if (valid)
+        {
+          n_bricks = (uint64_t)((c.width + c.brick_size - 1) / c.brick_size) * ((c.height + c.brick_size - 1) / c.brick_size)
+                   * ((c.depth + c.brick_size - 1) / c.brick_size);
+          valid = c.index_offset + (n_bricks + 1) * sizeof(uint64_t) <= file_size &&
+                  c.min_max_offset + n_bricks * 2 * sizeof(float) <= file_size &&
+                  c.data_offset <= file_size && c.data_size <= file_size - c.data_offset;
+        }
+        // ReadGradient decodes the gradient chunks into arrays of the header resolution
+        if (valid && (c.type == CHUNK_TYPE::GRADIENT_U || c.type == CHUNK_TYPE::GRADIENT_V))
+        {
+          valid = c.storage == (uint32_t)DataStorageSize::_16_BITS &&
+                  c.width == header.width && c.height == header.height && c.depth == header.depth;
+        }
+      }
+    }
+
+    if (!valid || FindChunk(CHUNK_TYPE::VOLUME, 0) < 0)
+    {
+      printf("VolumeContainer: %s is not a valid volume container\n", filename.c_str());
+      m_chunks.clear();
+      m_file.Close();
+      return false;
+    }
+
+    m_resolution = glm::ivec3(header.width, header.height, header.depth);
+    m_scale = glm::dvec3(header.scale[0], header.scale[1], header.scale[2]);
+    m_data_storage_size = (DataStorageSize)header.storage;
+    m_brick_size = (int)header.brick_size;
+    m_max_error = (int)header.max_error;
+    m_reduction = (VolumePyramid::REDUCTION)header.reduction;
+    m_value_range = glm::vec2(header.value_range[0], header.value_range[1]);
+    m_histogram.assign(header.histogram, header.histogram + HISTOGRAM_BINS);
+    return true;
+  }
+
+  void VolumeContainer::Close ()
+  {
+    m_file.Close();
+    m_chunks.clear();
+    m_histogram.clear();
+    m_resolution = glm::ivec3(0);
+    m_data_storage_size = DataStorageSize::UNKNOWN;
+  }
+
+  bool VolumeContainer::IsOpen ()
+  {
+    return m_file.IsOpen();
+  }
+
+  glm::ivec3 VolumeContainer::GetResolution () const
+  {
+    return m_resolution;
+  }
+
+  glm::dvec3 VolumeContainer::GetScale () const
+  {
+    return m_scale;
+  }
+
+  DataStorageSize VolumeContainer::GetDataStorageSize () const
+  {
+    return m_data_storage_size;
+  }
+
+  int VolumeContainer::GetBrickSize () const
+  {
+    return m_brick_size;
+  }
+
+  int VolumeContainer::GetMaxError () const
+  {
+    return m_max_error;
+  }
+
+  VolumePyramid::REDUCTION VolumeContainer::GetReduction () const
+  {
+    return m_reduction;
+  }
+
+  glm::vec2 VolumeContainer::GetValueRange () const
+  {
+    return m_value_range;
+  }
+
+  const std::vector<uint64_t>& VolumeContainer::GetHistogram () const
+  {
+    return m_histogram;
+  }
+
+  int VolumeContainer::GetNumberOfLevels () const
+  {
+    int n_levels = 0;
+    for (size_t i = 0; i < m_chunks.size(); i++)
+      if (m_chunks[i].type == CHUNK_TYPE::VOLUME)
+        n_levels = std::max(n_levels, (int)m_chunks[i].level + 1);
+    return n_levels;
+  }
+
+  bool VolumeContainer::IsLevelAvailable (int level) const
+  {
+    return FindChunk(CHUNK_TYPE::VOLUME, level) >= 0;
+  }
+
+  glm::ivec3 VolumeContainer::GetLevelResolution (int level) const
+  {
+    int chunk_id = FindChunk(CHUNK_TYPE::VOLUME, level);
+    if (chunk_id < 0) return glm::ivec3(0);
+    return glm::ivec3(m_chunks[chunk_id].width, m_chunks[chunk_id].height, m_chunks[chunk_id].depth);
+  }
+
+  StructuredGridVolume* VolumeContainer::ReadLevel (int level, ThreadPool* thread_pool)
+  {
+    PROFILE_SCOPE("VolumeContainer::ReadLevel");
+    int chunk_id = FindChunk(CHUNK_TYPE::VOLUME, level);
+    if (chunk_id < 0)
+    {
+      printf("VolumeContainer: level %d is not stored\n", level);
+      return nullptr;
+    }
+
+    const Chunk& c = m_chunks[chunk_id];
+    DataStorageSize dss = (DataStorageSize)c.storage;
+    size_t n_voxels = (size_t)c.width * c.height * c.depth;
+    unsigned char* data = new unsigned char[n_voxels * GetStorageSizeBytes(dss)];
+    if (!DecodeChunk(chunk_id, data, thread_pool))
+    {
+      delete[] data;
+      printf("VolumeContainer: could not decode level %d\n", level);
+      return nullptr;
+    }
+
+    StructuredGridVolume* vol = new StructuredGridVolume(m_file.GetFileName(), c.width, c.height, c.depth);
+    vol->SetScale(c.scale[0], c.scale[1], c.scale[2]);
+    vol->SetArrayData(data, dss);
+    return vol;
+  }
+
+  StructuredGridVolume* VolumeContainer::ReadLevelPaged (int level, size_t memory_budget)
+  {
+    int chunk_id = FindChunk(CHUNK_TYPE::VOLUME, level);
+    if (chunk_id < 0)
+    {
+      printf("VolumeContainer: level %d is not stored\n", level);
+      return nullptr;
+    }
+
+    std::unique_ptr<CompressedBricks> bricks(CreateBricks(chunk_id, true));
+    if (bricks == nullptr) return nullptr;
+
+    // The pager keeps the bricks, the volume keeps the pager
+    BrickPager* pager = new BrickPager();
+    if (!pager->Open(bricks.get(), memory_budget))
+    {
+      delete pager;
+      return nullptr;
+    }
+    bricks.release();
+
+    const Chunk& c = m_chunks[chunk_id];
+    StructuredGridVolume* vol = new StructuredGridVolume(m_file.GetFileName(), c.width, c.height, c.depth);
+    vol->SetScale(c.scale[0], c.scale[1], c.scale[2]);
+    vol->SetBrickPager(pager);
+    return vol;
+  }
+
+  bool VolumeContainer::HasGradient () const
+  {
+    return FindChunk(CHUNK_TYPE::GRADIENT_U, 0) >= 0 && FindChunk(CHUNK_TYPE::GRADIENT_V, 0) >= 0;
+  }
+
+  bool VolumeContainer::ReadGradient (float* xyz_output, ThreadPool* thread_pool)
+  {
+    PROFILE_SCOPE("VolumeContainer::ReadGradient");
+    if (!HasGradient()) return false;
+    if (thread_pool == nullptr)
+      thread_pool = ThreadPool::GetDefault();
+
+    size_t n_voxels = (size_t)m_resolution.x * m_resolution.y * m_resolution.z;
+    std::vector<uint16_t> u(n_voxels), v(n_voxels);
+    if (!DecodeChunk(FindChunk(CHUNK_TYPE::GRADIENT_U, 0), u.data(), thread_pool) ||
+        !DecodeChunk(FindChunk(CHUNK_TYPE::GRADIENT_V, 0), v.data(), thread_pool))
+    {
+      printf("VolumeContainer: could not decode the gradient\n");
+      return false;
+    }
+
+    size_t slice = (size_t)m_resolution.x * m_resolution.y;
+    thread_pool->ParallelFor(m_resolution.z, [&](int z) {
+      for (size_t i = (size_t)z * slice; i < (size_t)(z + 1) * slice; i++)
+      {
+        uint32_t code = (uint32_t)(uint16_t)(u[i] ^ VOLUME_CONTAINER_GRADIENT_BIAS)
+                      | ((uint32_t)(uint16_t)(v[i] ^ VOLUME_CONTAINER_GRADIENT_BIAS) << 16);
+        DecodeOctahedral16(code, xyz_output + i * 3);
+      }
+    });
+    return true;
+  }
+
+  /////////////////////
+  // Private Methods //
+  /////////////////////
+  bool VolumeContainer::WriteChunk (FILE* fp, uint64_t* file_offset, CHUNK_TYPE type, int level, StructuredGridVolume* vol,
+                                    int max_error, int brick_size, ThreadPool* thread_pool, std::vector<Chunk>* chunks)
+  {
+    CompressedBricks bricks;
+    if (!bricks.Build(vol, max_error, brick_size, thread_pool))
+      return false;
+
+    size_t n_bricks = (size_t)bricks.GetNumberOfBricks();
+
+    Chunk c;
+    memset(&c, 0, sizeof(Chunk));
+    c.type = (uint32_t)type;
+    c.level = (uint32_t)level;
+    c.storage = (uint32_t)bricks.GetDataStorageSize();
+    c.width = vol->GetWidth();
+    c.height = vol->GetHeight();
+    c.depth = vol->GetDepth();
+    c.brick_size = (uint32_t)bricks.GetBrickSize();
+    c.max_error = (uint32_t)bricks.GetMaxError();
+    c.scale[0] = vol->GetScaleX();
+    c.scale[1] = vol->GetScaleY();
+    c.scale[2] = vol->GetScaleZ();
+    c.index_offset = *file_offset;
+    c.min_max_offset = c.index_offset + (n_bricks + 1) * sizeof(uint64_t);
+    c.data_offset = c.min_max_offset + n_bricks * 2 * sizeof(float);
+    c.data_size = bricks.GetCompressedSizeBytes();
+
+    bool written = fwrite(bricks.m_offsets.data(), sizeof(uint64_t), n_bricks + 1, fp) == n_bricks + 1 &&
+                   fwrite(bricks.GetMinMaxData(), sizeof(float), n_bricks * 2, fp) == n_bricks * 2 &&
+                   fwrite(bricks.m_brick_data, 1, (size_t)c.data_size, fp) == (size_t)c.data_size;
+
+    *file_offset = c.data_offset + c.data_size;
+    chunks->push_back(c);
+    return written;
+  }
+
+  bool VolumeContainer::WriteGradient (FILE* fp, uint64_t* file_offset, StructuredGridVolume* vol, int brick_size,
+                                       ThreadPool* thread_pool, std::vector<Chunk>* chunks)
+  {
+    PROFILE_SCOPE("VolumeContainer::WriteGradient");
+    int width = (int)vol->GetWidth(), height = (int)vol->GetHeight(), depth = (int)vol->GetDepth();
+    size_t slice = (size_t)width * height;
+
+    unsigned short* u = new unsigned short[slice * depth];
+    unsigned short* v = new unsigned short[slice * depth];
+    {
+      GradientEngine gradient_engine(thread_pool);
+      std::vector<float> gradient = gradient_engine.ComputeFloat(vol);
+      if (gradient.empty())
+      {
+        delete[] u;
+        delete[] v;
+        printf("VolumeContainer: could not compute the gradient\n");
+        return false;
+      }
+
+      thread_pool->ParallelFor(depth, [&](int z) {
+        for (size_t i = (size_t)z * slice; i < (size_t)(z + 1) * slice; i++)
+        {
+          uint32_t code = EncodeOctahedral16(gradient[i * 3 + 0], gradient[i * 3 + 1], gradient[i * 3 + 2]);
+          u[i] = (unsigned short)((code & 0xFFFFu) ^ VOLUME_CONTAINER_GRADIENT_BIAS);
+          v[i] = (unsigned short)((code >> 16) ^ VOLUME_CONTAINER_GRADIENT_BIAS);
+        }
+      });
+    }
+
+    // The directions are kept lossless. Both volumes own their arrays
+    //  before the first write that can fail
+    StructuredGridVolume u_vol("gradient_u", width, height, depth);
+    u_vol.SetScale(vol->GetScaleX(), vol->GetScaleY(), vol->GetScaleZ());
+    u_vol.SetArrayData(u, DataStorageSize::_16_BITS);
+    StructuredGridVolume v_vol("gradient_v", width, height, depth);
+    v_vol.SetScale(vol->GetScaleX(), vol->GetScaleY(), vol->GetScaleZ());
+    v_vol.SetArrayData(v, DataStorageSize::_16_BITS);
+
+    if (!WriteChunk(fp, file_offset, CHUNK_TYPE::GRADIENT_U, 0, &u_vol, 0, brick_size, thread_pool, chunks))
+      return false;
+    return WriteChunk(fp, file_offset, CHUNK_TYPE::GRADIENT_V, 0, &v_vol, 0, brick_size, thread_pool, chunks);
+  }
+
+  int VolumeContainer::FindChunk (CHUNK_TYPE type, int level) const
+  {
+    for (size_t i = 0; i < m_chunks.size(); i++)
+      if (m_chunks[i].type == (uint32_t)type && m_chunks[i].level == (uint32_t)level)
+        return (int)i;
+    return -1;
+  }
+
+  CompressedBricks* VolumeContainer::CreateBricks (int chunk_id, bool own_mapping)
+  {
+    const Chunk& c = m_chunks[chunk_id];
+    const unsigned char* data = static_cast<const unsigned char*>(m_file.GetData());
+
+    CompressedBricks* bricks = new CompressedBricks();
+    bricks->m_vol_resolution = glm::ivec3(c.width, c.height, c.depth);
+    bricks->m_vol_scale = glm::dvec3(c.scale[0], c.scale[1], c.scale[2]);
+    bricks->m_data_storage_size = (DataStorageSize)c.storage;
+    bricks->m_max_error = (int)c.max_error;
+    bricks->m_brick_size = (int)c.brick_size;
+    bricks->m_grid_size = (bricks->m_vol_resolution + bricks->m_brick_size - 1) / bricks->m_brick_size;
+
+    size_t n_bricks = (size_t)bricks->GetNumberOfBricks();
+    bricks->m_offsets.resize(n_bricks + 1);
+    memcpy(bricks->m_offsets.data(), data + c.index_offset, (n_bricks + 1) * sizeof(uint64_t));
+    bricks->m_min_max.resize(n_bricks * 2);
+    memcpy(bricks->m_min_max.data(), data + c.min_max_offset, n_bricks * 2 * sizeof(float));
+
+    bool valid = bricks->m_offsets[n_bricks] <= c.data_size;
+    for (size_t i = 0; i < n_bricks && valid; i++)
+      valid = bricks->m_offsets[i] <= bricks->m_offsets[i + 1];
+    if (!valid)
+    {
+      printf("VolumeContainer: invalid brick index\n");
+      delete bricks;
+      return nullptr;
+    }
+
+    if (own_mapping)
+    {
+      MappedFile* mapped_file = new MappedFile();
+      if (!mapped_file->Open(m_file.GetFileName(), MappedFile::ACCESS_PATTERN::RANDOM))
+      {
+        printf("VolumeContainer: could not map %s\n", m_file.GetFileName().c_str());
+        delete mapped_file;
+        delete bricks;
+        return nullptr;
+      }
+      bricks->m_mapped_file = mapped_file;
+      data = static_cast<const unsigned char*>(mapped_file->GetData());
+    }
+    bricks->m_brick_data = data + c.data_offset;
+    return bricks;
+  }
+
+  bool VolumeContainer::DecodeChunk (int chunk_id, void* output, ThreadPool* thread_pool)
+  {
+    PROFILE_SCOPE("VolumeContainer::DecodeChunk");
+    if (thread_pool == nullptr)
+      thread_pool = ThreadPool::GetDefault();
+
+    CompressedBricks* bricks = CreateBricks(chunk_id, false);
+    if (bricks == nullptr) return false;
+
+    // Every brick is read once
+    const Chunk& c = m_chunks[chunk_id];
+    m_file.Advise(MappedFile::ACCESS_PATTERN::WILL_NEED, (size_t)c.data_offset, (size_t)c.data_size);
+
+    const int B = bricks->GetBrickSize();
+    const glm::ivec3 grid = bricks->GetGridSize();
+    const glm::ivec3 res = bricks->GetVolumeResolution();
+    const size_t voxel_bytes = GetStorageSizeBytes(bricks->GetDataStorageSize());
+    unsigned char* dst = static_cast<unsigned char*>(output);
+
+    // One row of bricks per task, the apron of each brick is dropped
+    std::atomic<bool> valid(true);
+    thread_pool->ParallelFor(grid.y * grid.z, [&](int row_id) {
+      int by = row_id % grid.y, bz = row_id / grid.y;
+      std::vector<unsigned char> brick(bricks->GetBrickSizeBytes());
+      for (int bx = 0; bx < grid.x; bx++)
+      {
+        if (!bricks->Decode(bx + row_id * grid.x, brick.data()))
+        {
+          valid = false;
+          continue;
+        }
+
+        int nx = std::min(B, res.x - bx * B), ny = std::min(B, res.y - by * B), nz = std::min(B, res.z - bz * B);
+        for (int z = 0; z < nz; z++)
+        {
+          for (int y = 0; y < ny; y++)
+          {
+            size_t src_id = ((size_t)y + (size_t)z * (B + 1)) * (B + 1);
+            size_t dst_id = (size_t)bx * B + ((size_t)by * B + y) * res.x + ((size_t)bz * B + z) * res.x * res.y;
+            memcpy(dst + dst_id * voxel_bytes, brick.data() + src_id * voxel_bytes, nx * voxel_bytes);
+          }
+        }
+      }
+    });
+
+    delete bricks;
+    return valid.load();
+  }
+}
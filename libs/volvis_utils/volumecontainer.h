@@ -0,0 +1,142 @@
+/**
+ * Native container (.vvol) of structured grid volumes.
+ *
+ * The file holds:
+ * . header: resolution, scale (StructuredGridVolume::SetScale), storage
+ *   type, normalized value range and a HISTOGRAM_BINS histogram of the
+ *   normalized voxel values
+ * . chunk table: one entry per set of vis::CompressedBricks, with its
+ *   resolution, scale and the offsets of the brick index, of the brick
+ *   min/max ranges and of the compressed bricks
+ * . chunks: level 0, the optional coarse levels of the vis::VolumePyramid
+ *   and an optional gradient channel (Sobel-Feldman direction of each
+ *   voxel, octahedral u and v as two 16 bit chunks, see octahedral.h)
+ *
+ * Write compresses the bricks of each chunk in parallel, then appends
+ *   them to the file, so only one chunk is kept in memory at a time.
+ *
+ * Open maps the file and reads only the header and the chunk table.
+ *   ReadLevel decodes every brick of a level in parallel into a new
+ *   volume, ReadLevelPaged decodes the bricks on demand into the cache of
+ *   a vis::BrickPager: the bricks stay in the mapped pages, so only the
+ *   bricks touched by the renderer are read from disk.
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_VOLUME_CONTAINER_H
+#define VOL_VIS_UTILS_VOLUME_CONTAINER_H
+
+#include <volvis_utils/structuredgridvolume.h>
+#include <volvis_utils/compressedbricks.h>
+#include <volvis_utils/volumepyramid.h>
+#include <volvis_utils/threadpool.h>
+#include <file_utils/mappedfile.h>
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace vis
+{
+  // Contents written by VolumeContainer::Write
+  struct VolumeContainerSettings
+  {
+    int brick_size = CompressedBricks::DEFAULT_BRICK_SIZE;
+    // Max error per voxel of the volume levels, 0 is lossless
+    int max_error = 0;
+    bool write_levels = true;
+    VolumePyramid::REDUCTION reduction = VolumePyramid::REDUCTION::AVERAGE;
+    // The whole gradient field is computed in memory
+    bool write_gradient = false;
+  };
+
+  class VolumeContainer
+  {
+  public:
+    static const int HISTOGRAM_BINS = 256;
+
+    // Write an 8 or 16 bit volume (in memory, mapped or paged)
+    static bool Write (StructuredGridVolume* vol, std::string filename, const VolumeContainerSettings& settings = VolumeContainerSettings(),
+                       ThreadPool* thread_pool = nullptr);
+
+    VolumeContainer ();
+    ~VolumeContainer ();
+
+    bool Open (std::string filename);
+    void Close ();
+    bool IsOpen ();
+
+    glm::ivec3 GetResolution () const;
+    glm::dvec3 GetScale () const;
+    DataStorageSize GetDataStorageSize () const;
+    int GetBrickSize () const;
+    int GetMaxError () const;
+    VolumePyramid::REDUCTION GetReduction () const;
+
+    // Normalized min and max voxel values
+    glm::vec2 GetValueRange () const;
+    // Number of voxels per bin of [0, 1]
+    const std::vector<uint64_t>& GetHistogram () const;
+
+    // Including level 0, some coarse levels may not be stored
+    int GetNumberOfLevels () const;
+    bool IsLevelAvailable (int level) const;
+    glm::ivec3 GetLevelResolution (int level) const;
+
+    // Decode the whole level into a new volume
+    StructuredGridVolume* ReadLevel (int level, ThreadPool* thread_pool = nullptr);
+    // New paged volume, the bricks are decoded on demand into a cache of
+    //  memory_budget bytes
+    StructuredGridVolume* ReadLevelPaged (int level, size_t memory_budget = BrickPager::DEFAULT_MEMORY_BUDGET);
+
+    bool HasGradient () const;
+    // 3 floats per voxel of level 0: unit vectors, (0, 0, 0) where the
+    //  gradient vanishes (same output of GradientCache::Entry::DecodeFloat)
+    bool ReadGradient (float* xyz_output, ThreadPool* thread_pool = nullptr);
+
+  protected:
+
+  private:
+    struct Header;
+    struct Chunk;
+
+    enum CHUNK_TYPE : unsigned int {
+      VOLUME     = 0,
+      GRADIENT_U = 1,
+      GRADIENT_V = 2,
+    };
+
+    // Compress vol and append it at file_offset
+    static bool WriteChunk (FILE* fp, uint64_t* file_offset, CHUNK_TYPE type, int level, StructuredGridVolume* vol,
+                            int max_error, int brick_size, ThreadPool* thread_pool, std::vector<Chunk>* chunks);
+    static bool WriteGradient (FILE* fp, uint64_t* file_offset, StructuredGridVolume* vol, int brick_size,
+                               ThreadPool* thread_pool, std::vector<Chunk>* chunks);
+
+    // -1 if the chunk is not stored
+    int FindChunk (CHUNK_TYPE type, int level) const;
+    // The bricks reference the pages of m_file, or of a new mapping owned
+    //  by the bricks if own_mapping is set
+    CompressedBricks* CreateBricks (int chunk_id, bool own_mapping);
+    // Decode every brick of the chunk into a width x height x depth array
+    bool DecodeChunk (int chunk_id, void* output, ThreadPool* thread_pool);
+
+    MappedFile m_file;
+
+    glm::ivec3 m_resolution;
+    glm::dvec3 m_scale;
+    DataStorageSize m_data_storage_size;
+    int m_brick_size;
+    int m_max_error;
+    VolumePyramid::REDUCTION m_reduction;
+    glm::vec2 m_value_range;
+    std::vector<uint64_t> m_histogram;
+
+    std::vector<Chunk> m_chunks;
+  };
+}
+
+#endif
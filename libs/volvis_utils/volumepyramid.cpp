@@ -0,0 +1,465 @@
+#include "volumepyramid.h"
+#include <file_utils/profiler.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+namespace vis
+{
+  static const char VOLUME_PYRAMID_MAGIC[8] = { 'V', 'V', 'P', 'Y', 'R', 'A', 'M', '\0' };
+  static const uint32_t VOLUME_PYRAMID_VERSION = 1;
+
+  // Levels after the coarsest one would not change the resolution anymore
+  static const int VOLUME_PYRAMID_MAX_LEVELS = 16;
+
+  // 64 bytes, followed by the voxels of the kept levels, finest first
+  struct VolumePyramid::Header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t reduction;
+    uint32_t storage;
+    uint32_t n_levels;
+    uint32_t first_level;
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    uint64_t content_hash;
+    uint64_t data_size;
+    uint32_t reserved_0;
+    uint32_t reserved_1;
+  };
+
+  template <typename T>
+  static T FromNormalized (float v)
+  {
+    if (std::is_integral<T>::value)
+      return (T)std::min(v / (float)VoxelTypeTraits<T>::NORMALIZATION + 0.5f, (float)(1.0 / VoxelTypeTraits<T>::NORMALIZATION));
+    return (T)v;
+  }
+
+  // Reduce the factor^3 blocks of src that cover the slice z of dst
+  template <typename View>
+  static void ReduceSlice (const View& src, typename View::Sampler& sampler, int factor,
+                           VolumePyramid::REDUCTION reduction, glm::ivec3 dst_resolution, int z,
+                           typename View::value_type* dst, std::vector<float>& row, std::vector<float>& acc)
+  {
+    typedef typename View::value_type T;
+
+    int z0 = z * factor, z1 = std::min(z0 + factor, src.depth);
+    for (int y = 0; y < dst_resolution.y; y++)
+    {
+      int y0 = y * factor, y1 = std::min(y0 + factor, src.height);
+      std::fill(acc.begin(), acc.end(), reduction == VolumePyramid::REDUCTION::MAXIMUM ? -FLT_MAX : 0.0f);
+
+      for (int sz = z0; sz < z1; sz++)
+      {
+        for (int sy = y0; sy < y1; sy++)
+        {
+          sampler.GetRowNormalized(sy, sz, row.data());
+          for (int x = 0; x < dst_resolution.x; x++)
+          {
+            int x0 = x * factor, x1 = std::min(x0 + factor, src.width);
+            float v = acc[x];
+            if (reduction == VolumePyramid::REDUCTION::MAXIMUM)
+              for (int sx = x0; sx < x1; sx++) v = std::max(v, row[sx]);
+            else
+              for (int sx = x0; sx < x1; sx++) v += row[sx];
+            acc[x] = v;
+          }
+        }
+      }
+
+      T* dst_row = dst + ((size_t)y + (size_t)z * dst_resolution.y) * dst_resolution.x;
+      for (int x = 0; x < dst_resolution.x; x++)
+      {
+        float v = acc[x];
+        if (reduction == VolumePyramid::REDUCTION::AVERAGE)
+        {
+          int x0 = x * factor, x1 = std::min(x0 + factor, src.width);
+          v /= (float)((x1 - x0) * (y1 - y0) * (z1 - z0));
+        }
+        dst_row[x] = FromNormalized<T>(v);
+      }
+    }
+  }
+
+  VolumePyramid::VolumePyramid ()
+    : m_source(nullptr)
+    , m_reduction(REDUCTION::AVERAGE)
+    , m_first_level(0)
+  {
+  }
+
+  VolumePyramid::~VolumePyramid ()
+  {
+    Clear();
+  }
+
+  bool VolumePyramid::Build (StructuredGridVolume* vol, REDUCTION reduction, ThreadPool* thread_pool,
+                             int min_resolution, size_t memory_budget)
+  {
+    PROFILE_SCOPE("VolumePyramid::Build");
+    if (!SetLevels(vol, reduction, min_resolution, memory_budget))
+      return false;
+
+    if (thread_pool == nullptr)
+      thread_pool = ThreadPool::GetDefault();
+
+    for (int l = m_first_level; l < GetNumberOfLevels(); l++)
+    {
+      // The first kept level is reduced from the source, the next ones from the previous level
+      StructuredGridVolume* src = (l == m_first_level) ? m_source : m_levels[l - 1];
+      int factor = (l == m_first_level) ? (1 << m_first_level) : 2;
+      glm::ivec3 res = m_level_resolution[l];
+
+      size_t n_voxels = (size_t)res.x * (size_t)res.y * (size_t)res.z;
+      void* data = nullptr;
+      src->DispatchVoxelAccess([&](auto view) {
+        typedef typename decltype(view)::value_type T;
+        T* dst = new T[n_voxels];
+        thread_pool->ParallelFor(res.z, [&](int z) {
+          typename decltype(view)::Sampler sampler(view);
+          std::vector<float> row((size_t)view.width);
+          std::vector<float> acc((size_t)res.x);
+          ReduceSlice(view, sampler, factor, reduction, res, z, dst, row, acc);
+        });
+        data = dst;
+      });
+
+      if (data == nullptr)
+      {
+        printf("VolumePyramid: could not read the voxels of level %d\n", l - 1);
+        Clear();
+        return false;
+      }
+      m_levels[l] = CreateLevel(l, data);
+    }
+
+    printf("VolumePyramid: built %d levels of [%d, %d, %d] (%s)\n", GetNumberOfLevels(),
+      vol->GetWidth(), vol->GetHeight(), vol->GetDepth(), reduction == REDUCTION::MAXIMUM ? "maximum" : "average");
+    return true;
+  }
+
+  bool VolumePyramid::Save (std::string filename)
+  {
+    PROFILE_SCOPE("VolumePyramid::Save");
+    if (!IsBuilt()) return false;
+
+    Header header;
+    memset(&header, 0, sizeof(Header));
+    memcpy(header.magic, VOLUME_PYRAMID_MAGIC, sizeof(VOLUME_PYRAMID_MAGIC));
+    header.version = VOLUME_PYRAMID_VERSION;
+    header.reduction = (uint32_t)m_reduction;
+    header.storage = (uint32_t)m_source->GetDataStorageSize();
+    header.n_levels = (uint32_t)GetNumberOfLevels();
+    header.first_level = (uint32_t)m_first_level;
+    header.width = m_source->GetWidth();
+    header.height = m_source->GetHeight();
+    header.depth = m_source->GetDepth();
+    header.content_hash = m_source->GetContentHash();
+
+    size_t voxel_bytes = GetStorageSizeBytes(m_source->GetDataStorageSize());
+    for (int l = m_first_level; l < GetNumberOfLevels(); l++)
+      header.data_size += (uint64_t)m_level_resolution[l].x * m_level_resolution[l].y * m_level_resolution[l].z * voxel_bytes;
+
+    // Same temporary file + rename of GradientCache::Write
+    std::string tmp_path = filename + ".tmp";
+    FILE* fp = fopen(tmp_path.c_str(), "wb");
+    if (fp == nullptr)
+    {
+      printf("VolumePyramid: could not write %s\n", filename.c_str());
+      return false;
+    }
+
+    bool written = fwrite(&header, sizeof(Header), 1, fp) == 1;
+    for (int l = m_first_level; written && l < GetNumberOfLevels(); l++)
+    {
+      size_t level_bytes = (size_t)m_level_resolution[l].x * m_level_resolution[l].y * m_level_resolution[l].z * voxel_bytes;
+      written = fwrite(m_levels[l]->GetArrayData(), 1, level_bytes, fp) == level_bytes;
+    }
+    written = (fclose(fp) == 0) && written;
+
+    std::remove(filename.c_str());
+    if (!written || std::rename(tmp_path.c_str(), filename.c_str()) != 0)
+    {
+      std::remove(tmp_path.c_str());
+      printf("VolumePyramid: could not write %s\n", filename.c_str());
+      return false;
+    }
+
+    printf("VolumePyramid: saved %s\n", filename.c_str());
+    return true;
+  }
+
+  bool VolumePyramid::Load (std::string filename, StructuredGridVolume* vol, REDUCTION reduction)
+  {
+    PROFILE_SCOPE("VolumePyramid::Load");
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (fp == nullptr) return false;
+
+    Header header;
+    if (fread(&header, sizeof(Header), 1, fp) != 1 ||
+        memcmp(header.magic, VOLUME_PYRAMID_MAGIC, sizeof(VOLUME_PYRAMID_MAGIC)) != 0 ||
+        header.version != VOLUME_PYRAMID_VERSION ||
+        header.reduction != (uint32_t)reduction ||
+        header.storage != (uint32_t)vol->GetDataStorageSize() ||
+        header.width != vol->GetWidth() || header.height != vol->GetHeight() || header.depth != vol->GetDepth() ||
+        header.content_hash != vol->GetContentHash())
+    {
+      printf("VolumePyramid: %s does not match the volume\n", filename.c_str());
+      fclose(fp);
+      return false;
+    }
+
+    Clear();
+    m_source = vol;
+    m_reduction = reduction;
+    m_first_level = (int)header.first_level;
+    for (int l = 0; l < (int)header.n_levels; l++)
+    {
+      glm::ivec3 res = glm::ivec3(header.width, header.height, header.depth);
+      for (int i = 0; i < l; i++) res = (res + 1) / 2;
+      m_level_resolution.push_back(res);
+      m_levels.push_back(l == 0 ? vol : nullptr);
+    }
+
+    size_t voxel_bytes = GetStorageSizeBytes(vol->GetDataStorageSize());
+    for (int l = m_first_level; l < GetNumberOfLevels(); l++)
+    {
+      size_t n_voxels = (size_t)m_level_resolution[l].x * m_level_resolution[l].y * m_level_resolution[l].z;
+      void* data = nullptr;
+      if (voxel_bytes == sizeof(unsigned char)) data = new unsigned char[n_voxels];
+      else if (voxel_bytes == sizeof(unsigned short)) data = new unsigned short[n_voxels];
+      else if (voxel_bytes == sizeof(float)) data = new float[n_voxels];
+      else data = new double[n_voxels];
+
+      // Owned by the level volume, also when the read fails
+      m_levels[l] = CreateLevel(l, data);
+      if (fread(data, voxel_bytes, n_voxels, fp) != n_voxels)
+      {
+        printf("VolumePyramid: %s is truncated\n", filename.c_str());
+        fclose(fp);
+        Clear();
+        return false;
+      }
+    }
+    fclose(fp);
+
+    printf("VolumePyramid: loaded %d levels from %s\n", GetNumberOfLevels(), filename.c_str());
+    return true;
+  }
+
+  bool VolumePyramid::LoadOrBuild (std::string filename, StructuredGridVolume* vol, REDUCTION reduction,
+                                   ThreadPool* thread_pool)
+  {
+    if (!filename.empty() && Load(filename, vol, reduction))
+      return true;
+
+    if (!Build(vol, reduction, thread_pool))
+      return false;
+
+    if (!filename.empty())
+      Save(filename);
+    return true;
+  }
+
+  void VolumePyramid::Clear ()
+  {
+    for (size_t l = 1; l < m_levels.size(); l++)
+      if (m_levels[l]) delete m_levels[l];
+    m_levels.clear();
+    m_level_resolution.clear();
+    m_source = nullptr;
+    m_first_level = 0;
+  }
+
+  bool VolumePyramid::IsBuilt () const
+  {
+    return m_source != nullptr;
+  }
+
+  VolumePyramid::REDUCTION VolumePyramid::GetReduction () const
+  {
+    return m_reduction;
+  }
+
+  int VolumePyramid::GetNumberOfLevels () const
+  {
+    return (int)m_levels.size();
+  }
+
+  StructuredGridVolume* VolumePyramid::GetLevel (int level)
+  {
+    if (level < 0 || level >= GetNumberOfLevels()) return nullptr;
+    return m_levels[level];
+  }
+
+  bool VolumePyramid::IsLevelAvailable (int level) const
+  {
+    return level == 0 || (level >= m_first_level && level < GetNumberOfLevels());
+  }
+
+  int VolumePyramid::GetCoarserAvailableLevel (int level) const
+  {
+    level = glm::clamp(level, 0, std::max(GetNumberOfLevels() - 1, 0));
+    if (IsLevelAvailable(level)) return level;
+    return m_first_level < GetNumberOfLevels() ? m_first_level : 0;
+  }
+
+  int VolumePyramid::GetFinerAvailableLevel (int level) const
+  {
+    level = glm::clamp(level, 0, std::max(GetNumberOfLevels() - 1, 0));
+    return IsLevelAvailable(level) ? level : 0;
+  }
+
+  float VolumePyramid::ComputeVoxelFootprint (StructuredGridVolume* vol, glm::vec3 eye,
+                                              float tan_fov_y, int screen_height)
+  {
+    glm::vec3 voxel_size = glm::vec3(vol->GetScale());
+    glm::vec3 half_extent = glm::vec3(vol->GetWidth(), vol->GetHeight(), vol->GetDepth()) * voxel_size * 0.5f;
+
+    // The volume is centered at the origin, as in the ray casters
+    float distance = glm::distance(eye, glm::clamp(eye, -half_extent, half_extent));
+    float voxel = std::max(voxel_size.x, std::max(voxel_size.y, voxel_size.z));
+    if (distance <= voxel) return FLT_MAX;
+
+    return voxel * (float)screen_height / (2.0f * distance * tan_fov_y);
+  }
+
+  int VolumePyramid::SelectLevel (float voxel_footprint, float lod_scale) const
+  {
+    if (!IsBuilt() || voxel_footprint >= lod_scale) return 0;
+    // Voxels of level l cover voxel_footprint * 2^l pixels
+    int level = (int)std::floor(std::log2(lod_scale / voxel_footprint));
+    return GetFinerAvailableLevel(level);
+  }
+
+  bool VolumePyramid::SetLevels (StructuredGridVolume* vol, REDUCTION reduction, int min_resolution, size_t memory_budget)
+  {
+    Clear();
+    if (vol == nullptr || (vol->GetArrayData() == nullptr && !vol->IsPaged()))
+      return false;
+
+    m_source = vol;
+    m_reduction = reduction;
+
+    glm::ivec3 res = glm::ivec3(vol->GetWidth(), vol->GetHeight(), vol->GetDepth());
+    m_level_resolution.push_back(res);
+    m_levels.push_back(vol);
+    while (std::max(res.x, std::max(res.y, res.z)) > std::max(min_resolution, 1) &&
+           GetNumberOfLevels() < VOLUME_PYRAMID_MAX_LEVELS)
+    {
+      res = (res + 1) / 2;
+      m_level_resolution.push_back(res);
+      m_levels.push_back(nullptr);
+    }
+
+    // Keep the coarsest levels that fit in the budget
+    size_t voxel_bytes = GetStorageSizeBytes(vol->GetDataStorageSize());
+    size_t total_bytes = 0;
+    m_first_level = GetNumberOfLevels();
+    for (int l = GetNumberOfLevels() - 1; l > 0; l--)
+    {
+      total_bytes += (size_t)m_level_resolution[l].x * m_level_resolution[l].y * m_level_resolution[l].z * voxel_bytes;
+      if (total_bytes > memory_budget) break;
+      m_first_level = l;
+    }
+    if (m_first_level > 1)
+      printf("VolumePyramid: levels 1 to %d do not fit in the memory budget\n", m_first_level - 1);
+
+    return true;
+  }
+
+  StructuredGridVolume* VolumePyramid::CreateLevel (int level, void* data)
+  {
+    glm::ivec3 res = m_level_resolution[level];
+    glm::dvec3 scale = m_source->GetScale() * glm::dvec3(m_level_resolution[0]) / glm::dvec3(res);
+
+    StructuredGridVolume* vol = new StructuredGridVolume(m_source->GetName() + "_lod" + std::to_string(level),
+                                                         res.x, res.y, res.z);
+    vol->SetScale(scale.x, scale.y, scale.z);
+    vol->SetArrayData(data, m_source->GetDataStorageSize());
+    return vol;
+  }
+
+  /////////////////////////////////
+  // PyramidLevelSelector        //
+  /////////////////////////////////
+  PyramidLevelSelector::PyramidLevelSelector ()
+    : m_interaction_budget_ms(50.0)
+  {
+    Reset();
+  }
+
+  PyramidLevelSelector::~PyramidLevelSelector ()
+  {
+  }
+
+  void PyramidLevelSelector::SetInteractionBudget (double budget_ms)
+  {
+    m_interaction_budget_ms = budget_ms;
+  }
+
+  double PyramidLevelSelector::GetInteractionBudget () const
+  {
+    return m_interaction_budget_ms;
+  }
+
+  int PyramidLevelSelector::Update (const VolumePyramid* pyramid, int target_level, bool interacting)
+  {
+    m_target_level = pyramid->GetFinerAvailableLevel(target_level);
+    if (interacting)
+      m_level = pyramid->GetCoarserAvailableLevel(m_target_level + m_interaction_offset);
+    else
+      // Frames coarser than the target are refined by the next Refine calls
+      m_level = std::max(m_level, m_target_level);
+    m_interacting = interacting;
+    return m_level;
+  }
+
+  bool PyramidLevelSelector::Refine (const VolumePyramid* pyramid)
+  {
+    if (m_interacting || m_level <= m_target_level)
+      return false;
+    m_level = pyramid->GetFinerAvailableLevel(m_level - 1);
+    return true;
+  }
+
+  void PyramidLevelSelector::FrameRendered (double ms)
+  {
+    if (!m_interacting) return;
+    if (ms > m_interaction_budget_ms && m_interaction_offset < VOLUME_PYRAMID_MAX_LEVELS)
+      m_interaction_offset++;
+    // Each finer level costs about 2x (twice the samples per ray)
+    else if (ms < m_interaction_budget_ms * 0.25 && m_interaction_offset > 0)
+      m_interaction_offset--;
+  }
+
+  int PyramidLevelSelector::GetLevel () const
+  {
+    return m_level;
+  }
+
+  int PyramidLevelSelector::GetTargetLevel () const
+  {
+    return m_target_level;
+  }
+
+  bool PyramidLevelSelector::IsRefining () const
+  {
+    return !m_interacting && m_level > m_target_level;
+  }
+
+  void PyramidLevelSelector::Reset ()
+  {
+    m_level = 0;
+    m_target_level = 0;
+    m_interaction_offset = 1;
+    m_interacting = false;
+  }
+}
@@ -0,0 +1,145 @@
+/**
+ * Multiresolution (mip) pyramid of a structured grid volume.
+ *
+ * Level 0 is the source volume, each next level halves the resolution
+ *   (rounded up) until the largest dimension reaches min_resolution.
+ *   Coarse levels keep the world extent of the source, so a level can
+ *   replace the source volume in a renderer without changing the camera.
+ * . AVERAGE: mean of the 2^l x 2^l x 2^l voxels of the source
+ * . MAXIMUM: max of the same voxels, preserves thin bright structures
+ *
+ * Levels are reduced from the finest level kept in memory, one z slice
+ *   per task of the thread pool. Paged source volumes are streamed
+ *   through their bricks. Levels larger than the memory budget are not
+ *   kept: renderers use the source volume instead.
+ *
+ * Save/Load persist the coarse levels in a .vpyr file, checked against
+ *   the content hash of the source volume.
+ *
+ * PyramidLevelSelector chooses the level of each frame for interactive
+ *   navigation: the level given by the screen-space voxel footprint when
+ *   the camera is still, coarser levels while it moves, and one level
+ *   finer per frame after it stops.
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_VOLUME_PYRAMID_H
+#define VOL_VIS_UTILS_VOLUME_PYRAMID_H
+
+#include <volvis_utils/structuredgridvolume.h>
+#include <volvis_utils/threadpool.h>
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+namespace vis
+{
+  class VolumePyramid
+  {
+  public:
+    enum REDUCTION : unsigned int {
+      AVERAGE = 0,
+      MAXIMUM = 1,
+    };
+
+    static const int DEFAULT_MIN_RESOLUTION = 16;
+    static const size_t DEFAULT_MEMORY_BUDGET = (size_t)2 << 30;
+
+    VolumePyramid ();
+    ~VolumePyramid ();
+
+    bool Build (StructuredGridVolume* vol, REDUCTION reduction = REDUCTION::AVERAGE,
+                ThreadPool* thread_pool = nullptr, int min_resolution = DEFAULT_MIN_RESOLUTION,
+                size_t memory_budget = DEFAULT_MEMORY_BUDGET);
+
+    bool Save (std::string filename);
+    // Fails if the file was not built from vol with the same reduction
+    bool Load (std::string filename, StructuredGridVolume* vol, REDUCTION reduction = REDUCTION::AVERAGE);
+    // An empty filename only builds the pyramid
+    bool LoadOrBuild (std::string filename, StructuredGridVolume* vol, REDUCTION reduction = REDUCTION::AVERAGE,
+                      ThreadPool* thread_pool = nullptr);
+
+    void Clear ();
+    bool IsBuilt () const;
+
+    REDUCTION GetReduction () const;
+
+    // Including the source volume (level 0)
+    int GetNumberOfLevels () const;
+    // nullptr if the level was not kept
+    StructuredGridVolume* GetLevel (int level);
+    bool IsLevelAvailable (int level) const;
+
+    // Nearest available level, coarser or finer than level
+    int GetCoarserAvailableLevel (int level) const;
+    int GetFinerAvailableLevel (int level) const;
+
+    // Size in pixels of a source voxel at the point of the volume nearest
+    //  to the eye, for a perspective camera looking at the volume center
+    static float ComputeVoxelFootprint (StructuredGridVolume* vol, glm::vec3 eye,
+                                        float tan_fov_y, int screen_height);
+
+    // Coarsest available level whose voxels cover at most lod_scale pixels
+    int SelectLevel (float voxel_footprint, float lod_scale = 1.0f) const;
+
+  protected:
+
+  private:
+    struct Header;
+
+    bool SetLevels (StructuredGridVolume* vol, REDUCTION reduction, int min_resolution, size_t memory_budget);
+    StructuredGridVolume* CreateLevel (int level, void* data);
+
+    StructuredGridVolume* m_source;
+    REDUCTION m_reduction;
+
+    std::vector<glm::ivec3> m_level_resolution;
+    // m_levels[0] is the (not owned) source volume
+    std::vector<StructuredGridVolume*> m_levels;
+    // Finest coarse level kept in memory
+    int m_first_level;
+  };
+
+  class PyramidLevelSelector
+  {
+  public:
+    PyramidLevelSelector ();
+    ~PyramidLevelSelector ();
+
+    // While the camera moves, the level gets coarser until the frames
+    //  take less than budget_ms (renderers that do not report the frame
+    //  time keep one level above the target)
+    void SetInteractionBudget (double budget_ms);
+    double GetInteractionBudget () const;
+
+    // Level of the next frame, target_level is given by the voxel footprint
+    int Update (const VolumePyramid* pyramid, int target_level, bool interacting);
+
+    // After a frame coarser than the target, moves one level finer and
+    //  returns true (the frame must be rendered again)
+    bool Refine (const VolumePyramid* pyramid);
+
+    // Time spent to render the last frame at GetLevel
+    void FrameRendered (double ms);
+
+    int GetLevel () const;
+    int GetTargetLevel () const;
+    bool IsRefining () const;
+
+    void Reset ();
+
+  protected:
+
+  private:
+    int m_level;
+    int m_target_level;
+    int m_interaction_offset;
+    bool m_interacting;
+    double m_interaction_budget_ms;
+  };
+}
+
+#endif
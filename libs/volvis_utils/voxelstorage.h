@@ -0,0 +1,185 @@
+/**
+ * Typed access to the voxels of structured grid volumes.
+ *
+ * StructuredGridVolume keeps its voxels as a void* + DataStorageSize.
+ * VoxelView<T> exposes the same memory as a typed span with its
+ *   strides, and VoxelTypeTraits<T> gives the storage type and the
+ *   normalization factor at compile time.
+ *
+ * Kernels are written as templates (or generic lambdas) over the
+ *   voxel type and the storage type is resolved once per operation
+ *   with StructuredGridVolume::DispatchVoxelView, instead of once
+ *   per voxel fetch:
+ *
+ *   vol->DispatchVoxelView([&](auto view) {
+ *     for (size_t i = 0; i < view.size; i++)
+ *       sum += view.GetNormalized(i);
+ *   });
+ *
+ * Leonardo Quatrin Campagnolo
+ * . campagnolo.lq@gmail.com
+**/
+#ifndef VOL_VIS_UTILS_VOXEL_STORAGE_H
+#define VOL_VIS_UTILS_VOXEL_STORAGE_H
+
+#include <cstddef>
+
+namespace vis
+{
+  enum DataStorageSize : unsigned int
+  {
+    UNKNOWN       = 0, // null data
+    _8_BITS       = 1, // unsigned char  [0 -   255]
+    _16_BITS      = 2, // unsigned short [0 - 65535]
+    _NORMALIZED_F = 3, // float [0.0f - 1.0f]
+    _NORMALIZED_D = 4, // double [0.0 - 1.0]
+  };
+
+  inline DataStorageSize GetStorageSizeType (size_t bytesize)
+  {
+    if (bytesize == sizeof(unsigned char))
+      return DataStorageSize::_8_BITS;
+    else if (bytesize == sizeof(unsigned short))
+      return DataStorageSize::_16_BITS;
+    else if (bytesize == sizeof(float))
+      return DataStorageSize::_NORMALIZED_F;
+    else if (bytesize == sizeof(double))
+      return DataStorageSize::_NORMALIZED_D;
+    return DataStorageSize::UNKNOWN;
+  }
+
+  inline size_t GetStorageSizeBytes (DataStorageSize dss)
+  {
+    if (dss == DataStorageSize::_8_BITS)
+      return sizeof(unsigned char);
+    else if (dss == DataStorageSize::_16_BITS)
+      return sizeof(unsigned short);
+    else if (dss == DataStorageSize::_NORMALIZED_F)
+      return sizeof(float);
+    else if (dss == DataStorageSize::_NORMALIZED_D)
+      return sizeof(double);
+    return 0;
+  }
+
+  // NORMALIZATION maps a stored value to [0, 1]
+  template <typename T> struct VoxelTypeTraits;
+
+  template <> struct VoxelTypeTraits<unsigned char>
+  {
+    static const DataStorageSize STORAGE = DataStorageSize::_8_BITS;
+    static constexpr double NORMALIZATION = 1.0 / 255.0;
+  };
+
+  template <> struct VoxelTypeTraits<unsigned short>
+  {
+    static const DataStorageSize STORAGE = DataStorageSize::_16_BITS;
+    static constexpr double NORMALIZATION = 1.0 / 65535.0;
+  };
+
+  template <> struct VoxelTypeTraits<float>
+  {
+    static const DataStorageSize STORAGE = DataStorageSize::_NORMALIZED_F;
+    static constexpr double NORMALIZATION = 1.0;
+  };
+
+  template <> struct VoxelTypeTraits<double>
+  {
+    static const DataStorageSize STORAGE = DataStorageSize::_NORMALIZED_D;
+    static constexpr double NORMALIZATION = 1.0;
+  };
+
+  // Read-only typed span over the voxels of a width x height x depth grid
+  //  . voxel (x, y, z) is at data[x + y * stride_y + z * stride_z]
+  template <typename T>
+  class VoxelView
+  {
+  public:
+    typedef T value_type;
+    typedef VoxelTypeTraits<T> traits;
+    // In-memory views are their own per-thread sampler (see vis::PagedVoxelView)
+    typedef VoxelView<T> Sampler;
+
+    VoxelView ()
+      : data(nullptr), width(0), height(0), depth(0), stride_y(0), stride_z(0), size(0)
+    {}
+
+    VoxelView (const T* vdata, int vwidth, int vheight, int vdepth)
+      : data(vdata), width(vwidth), height(vheight), depth(vdepth)
+      , stride_y((size_t)vwidth)
+      , stride_z((size_t)vwidth * (size_t)vheight)
+      , size((size_t)vwidth * (size_t)vheight * (size_t)vdepth)
+    {}
+
+    bool IsValid () const
+    {
+      return data != nullptr;
+    }
+
+    bool IsInside (int x, int y, int z) const
+    {
+      return x >= 0 && y >= 0 && z >= 0 && x < width && y < height && z < depth;
+    }
+
+    size_t Index (int x, int y, int z) const
+    {
+      return (size_t)x + (size_t)y * stride_y + (size_t)z * stride_z;
+    }
+
+    T Get (int x, int y, int z) const
+    {
+      return data[Index(x, y, z)];
+    }
+
+    float GetNormalized (size_t id) const
+    {
+      return (float)data[id] * (float)traits::NORMALIZATION;
+    }
+
+    float GetNormalized (int x, int y, int z) const
+    {
+      return GetNormalized(Index(x, y, z));
+    }
+
+    // Voxels outside the grid are 0, as the gradient compute shaders
+    float GetNormalizedOrZero (int x, int y, int z) const
+    {
+      return IsInside(x, y, z) ? GetNormalized(Index(x, y, z)) : 0.0f;
+    }
+
+    // The 8 voxels of the trilinear cell at (x, y, z), clamped to the grid
+    //  . voxel (x + i, y + j, z + k) goes to cell[(i + 2j + 4k) * cell_stride]
+    void GetCell (int x, int y, int z, float* cell, int cell_stride) const
+    {
+      size_t base = Index(x, y, z);
+      size_t ox = (x < width - 1) ? 1 : 0;
+      size_t oy = (y < height - 1) ? stride_y : 0;
+      size_t oz = (z < depth - 1) ? stride_z : 0;
+
+      cell[0 * cell_stride] = (float)data[base];
+      cell[1 * cell_stride] = (float)data[base + ox];
+      cell[2 * cell_stride] = (float)data[base + oy];
+      cell[3 * cell_stride] = (float)data[base + ox + oy];
+      cell[4 * cell_stride] = (float)data[base + oz];
+      cell[5 * cell_stride] = (float)data[base + ox + oz];
+      cell[6 * cell_stride] = (float)data[base + oy + oz];
+      cell[7 * cell_stride] = (float)data[base + ox + oy + oz];
+    }
+
+    // Normalized voxels of row (y, z), width values
+    void GetRowNormalized (int y, int z, float* dst) const
+    {
+      const T* src = data + Index(0, y, z);
+      const float norm = (float)traits::NORMALIZATION;
+      for (int x = 0; x < width; x++)
+        dst[x] = (float)src[x] * norm;
+    }
+
+    const T* data;
+    int width, height, depth;
+    size_t stride_y;
+    size_t stride_z;
+    size_t size;
+  };
+}
+
+#endif